@@ -26,8 +26,17 @@ common_drm_hwcomposer_cflags := \
 include $(CLEAR_VARS)
 
 LOCAL_SRC_FILES := \
+	frametimeline.cpp \
+	hwctrace.cpp \
+	latencystats.cpp \
+	taskqueueworker.cpp \
 	worker.cpp
 
+LOCAL_SHARED_LIBRARIES := \
+	libcutils \
+	liblog
+
+LOCAL_HEADER_LIBRARIES := libhardware_headers
 LOCAL_CFLAGS := $(common_drm_hwcomposer_cflags)
 
 LOCAL_MODULE := libdrmhwc_utils
@@ -38,24 +47,22 @@ include $(BUILD_STATIC_LIBRARY)
 # =====================
 # hwcomposer.drm.so
 # =====================
-include $(CLEAR_VARS)
-
-LOCAL_SHARED_LIBRARIES := \
+# The sources and flags are kept in drm_hwcomposer_* variables so that
+# tests/ can build the same HWC on top of the fake KMS device.
+drm_hwcomposer_shared_libs := \
 	libcutils \
-	libdrm \
 	libhardware \
 	liblog \
 	libsync \
 	libui \
 	libutils
 
-LOCAL_STATIC_LIBRARIES := libdrmhwc_utils
-
-LOCAL_C_INCLUDES := \
+drm_hwcomposer_c_includes := \
 	system/core/libsync
 
-LOCAL_SRC_FILES := \
+drm_hwcomposer_src_files := \
 	autolock.cpp \
+	bandwidthmodel.cpp \
 	resourcemanager.cpp \
 	drmdevice.cpp \
 	drmconnector.cpp \
@@ -65,36 +72,47 @@ LOCAL_SRC_FILES := \
 	drmencoder.cpp \
 	drmeventlistener.cpp \
 	drmhwctwo.cpp \
+	drmioctl.cpp \
 	drmmode.cpp \
 	drmplane.cpp \
 	drmproperty.cpp \
+	flightrecorder.cpp \
 	hwcutils.cpp \
 	platform.cpp \
 	platformdrmgeneric.cpp \
+	presenthistory.cpp \
+	synctimeline.cpp \
+	vsyncmodel.cpp \
 	vsyncworker.cpp
 
-LOCAL_CFLAGS := $(common_drm_hwcomposer_cflags)
-
-LOCAL_CPPFLAGS += \
+drm_hwcomposer_cppflags := \
 	-DHWC2_USE_CPP11 \
 	-DHWC2_INCLUDE_STRINGIFICATION
 
-
 ifeq ($(TARGET_PRODUCT),hikey960)
-LOCAL_CPPFLAGS += -DUSE_HISI_IMPORTER
-LOCAL_SRC_FILES += platformhisi.cpp
-LOCAL_C_INCLUDES += device/linaro/hikey/gralloc960/
+drm_hwcomposer_cppflags += -DUSE_HISI_IMPORTER
+drm_hwcomposer_src_files += platformhisi.cpp
+drm_hwcomposer_c_includes += device/linaro/hikey/gralloc960/
 else ifeq ($(TARGET_PRODUCT),hikey)
-LOCAL_CPPFLAGS += -DUSE_HISI_IMPORTER
-LOCAL_SRC_FILES += platformhisi.cpp
-LOCAL_C_INCLUDES += device/linaro/hikey/gralloc/
+drm_hwcomposer_cppflags += -DUSE_HISI_IMPORTER
+drm_hwcomposer_src_files += platformhisi.cpp
+drm_hwcomposer_c_includes += device/linaro/hikey/gralloc/
 else ifeq ($(strip $(BOARD_DRM_HWCOMPOSER_BUFFER_IMPORTER)),minigbm)
-LOCAL_SRC_FILES += platformminigbm.cpp
-LOCAL_C_INCLUDES += external/minigbm/cros_gralloc/
+drm_hwcomposer_src_files += platformminigbm.cpp
+drm_hwcomposer_c_includes += external/minigbm/cros_gralloc/
 else
-LOCAL_CPPFLAGS += -DUSE_DRM_GENERIC_IMPORTER
+drm_hwcomposer_cppflags += -DUSE_DRM_GENERIC_IMPORTER
 endif
 
+include $(CLEAR_VARS)
+
+LOCAL_SHARED_LIBRARIES := $(drm_hwcomposer_shared_libs) libdrm
+LOCAL_STATIC_LIBRARIES := libdrmhwc_utils
+LOCAL_C_INCLUDES := $(drm_hwcomposer_c_includes)
+LOCAL_SRC_FILES := $(drm_hwcomposer_src_files)
+LOCAL_CFLAGS := $(common_drm_hwcomposer_cflags)
+LOCAL_CPPFLAGS += $(drm_hwcomposer_cppflags)
+
 LOCAL_MODULE := hwcomposer.drm
 LOCAL_MODULE_TAGS := optional
 LOCAL_MODULE_RELATIVE_PATH := hw
@@ -40,6 +40,22 @@ int AutoLock::Lock() {
   return 0;
 }
 
+int AutoLock::TryLock() {
+  if (locked_) {
+    ALOGE("Invalid attempt to double lock AutoLock %s", name_);
+    return -EINVAL;
+  }
+  int ret = pthread_mutex_trylock(mutex_);
+  if (ret == EBUSY)
+    return -EBUSY;
+  if (ret) {
+    ALOGE("Failed to acquire %s lock %d", name_, ret);
+    return ret;
+  }
+  locked_ = true;
+  return 0;
+}
+
 int AutoLock::Unlock() {
   if (!locked_) {
     ALOGE("Invalid attempt to unlock unlocked AutoLock %s", name_);
@@ -32,6 +32,8 @@ class AutoLock {
   AutoLock &operator=(const AutoLock &rhs) = delete;
 
   int Lock();
+  // Returns -EBUSY without blocking if the mutex is held elsewhere
+  int TryLock();
   int Unlock();
 
  private:
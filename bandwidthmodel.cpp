@@ -0,0 +1,167 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#define LOG_TAG "hwc-bandwidth-model"
+
+#include "bandwidthmodel.h"
+#include "drmdisplaycomposition.h"
+#include "drmhwcomposer.h"
+
+#include <algorithm>
+
+#include <drm/drm_fourcc.h>
+
+namespace android {
+
+float BandwidthModel::BytesPerPixel(uint32_t format) {
+  switch (format) {
+    case DRM_FORMAT_C8:
+    case DRM_FORMAT_R8:
+      return 1;
+    case DRM_FORMAT_NV12:
+    case DRM_FORMAT_NV21:
+    case DRM_FORMAT_YUV420:
+    case DRM_FORMAT_YVU420:
+      return 1.5f;
+    case DRM_FORMAT_RGB565:
+    case DRM_FORMAT_BGR565:
+    case DRM_FORMAT_ARGB1555:
+    case DRM_FORMAT_XRGB1555:
+    case DRM_FORMAT_ARGB4444:
+    case DRM_FORMAT_XRGB4444:
+    case DRM_FORMAT_NV16:
+    case DRM_FORMAT_NV61:
+    case DRM_FORMAT_YUYV:
+    case DRM_FORMAT_YVYU:
+    case DRM_FORMAT_UYVY:
+    case DRM_FORMAT_VYUY:
+      return 2;
+    case DRM_FORMAT_RGB888:
+    case DRM_FORMAT_BGR888:
+    case DRM_FORMAT_YUV444:
+    case DRM_FORMAT_YVU444:
+      return 3;
+#ifdef DRM_FORMAT_ABGR16161616F
+    case DRM_FORMAT_ABGR16161616F:
+    case DRM_FORMAT_XBGR16161616F:
+      return 8;
+#endif
+    default:
+      return 4;
+  }
+}
+
+float BandwidthModel::CompressionRatio(uint64_t modifier) {
+  if (modifier == DRM_FORMAT_MOD_INVALID)
+    return 1;
+  // AFBC and Intel's CCS roughly halve typical UI content
+  if ((modifier >> 56) == DRM_FORMAT_MOD_VENDOR_ARM)
+    return 0.5f;
+#ifdef I915_FORMAT_MOD_Y_TILED_CCS
+  if (modifier == I915_FORMAT_MOD_Y_TILED_CCS ||
+      modifier == I915_FORMAT_MOD_Yf_TILED_CCS)
+    return 0.5f;
+#endif
+  return 1;
+}
+
+static bool IsRotated(const DrmHwcLayer &layer) {
+  return layer.transform &
+         (DrmHwcTransform::kRotate90 | DrmHwcTransform::kRotate270);
+}
+
+uint64_t BandwidthModel::ScanoutBytes(const DrmHwcLayer &layer) {
+  if (!layer.buffer)
+    return ScanoutBytes(DRM_FORMAT_ABGR8888, DRM_FORMAT_MOD_LINEAR,
+                        layer.source_crop, IsRotated(layer));
+  return ScanoutBytes(layer.buffer->format, layer.buffer->modifiers[0],
+                      layer.source_crop, IsRotated(layer));
+}
+
+uint64_t BandwidthModel::ScanoutBytes(uint32_t format, uint64_t modifier,
+                                      const hwc_frect_t &crop, bool rotated) {
+  double pixels = std::max(crop.right - crop.left, 0.0f) *
+                  std::max(crop.bottom - crop.top, 0.0f);
+  double bytes = pixels * BytesPerPixel(format) * CompressionRatio(modifier);
+  if (rotated && modifier == DRM_FORMAT_MOD_LINEAR)
+    bytes *= 2;
+  return bytes;
+}
+
+uint64_t BandwidthModel::ScanoutPixels(const DrmHwcLayer &layer) {
+  return ScanoutPixels(layer.source_crop, layer.display_frame,
+                       IsRotated(layer));
+}
+
+uint64_t BandwidthModel::ScanoutPixels(const hwc_frect_t &crop,
+                                       const hwc_rect_t &frame, bool rotated) {
+  double src_w = std::max(crop.right - crop.left, 0.0f);
+  double src_h = std::max(crop.bottom - crop.top, 0.0f);
+  if (rotated)
+    std::swap(src_w, src_h);
+  double dst_w = std::max(frame.right - frame.left, 0);
+  double dst_h = std::max(frame.bottom - frame.top, 0);
+  return std::max(src_w, dst_w) * std::max(src_h, dst_h);
+}
+
+uint64_t BandwidthModel::ClientReadBytes(uint32_t format,
+                                         const hwc_frect_t &crop) {
+  double pixels = std::max(crop.right - crop.left, 0.0f) *
+                  std::max(crop.bottom - crop.top, 0.0f);
+  return pixels * BytesPerPixel(format);
+}
+
+uint64_t BandwidthModel::ClientWriteBytes(uint32_t format,
+                                          const hwc_rect_t &frame) {
+  double pixels = (double)std::max(frame.right - frame.left, 0) *
+                  std::max(frame.bottom - frame.top, 0);
+  return pixels * BytesPerPixel(format);
+}
+
+void BandwidthModel::AddScanout(DrmDisplayComposition *composition,
+                                BandwidthEstimate *estimate) {
+  std::vector<DrmHwcLayer> &layers = composition->layers();
+  for (const DrmCompositionPlane &plane :
+       composition->composition_planes()) {
+    if (plane.type() != DrmCompositionPlane::Type::kLayer)
+      continue;
+    for (size_t i : plane.source_layers()) {
+      if (i >= layers.size())
+        continue;
+      estimate->scanout_bytes += ScanoutBytes(layers[i]);
+      estimate->scanout_pixels += ScanoutPixels(layers[i]);
+    }
+  }
+}
+
+void BandwidthModel::Dump(const BandwidthEstimate &estimate, float refresh_hz,
+                          std::ostringstream *out) {
+  if (!refresh_hz) {
+    *out << "scanout=" << estimate.scanout_bytes
+         << "B client_read=" << estimate.client_read_bytes
+         << "B client_write=" << estimate.client_write_bytes
+         << "B per frame, pixels=" << estimate.scanout_pixels;
+    return;
+  }
+  double scale = refresh_hz / 1e6;
+  *out << "scanout=" << estimate.scanout_bytes * scale
+       << "MB/s client_read=" << estimate.client_read_bytes * scale
+       << "MB/s client_write=" << estimate.client_write_bytes * scale
+       << "MB/s total=" << estimate.total_bytes() * scale
+       << "MB/s pixel_rate=" << estimate.scanout_pixels * scale << "MP/s";
+}
+}
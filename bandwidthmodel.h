@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef ANDROID_BANDWIDTH_MODEL_H_
+#define ANDROID_BANDWIDTH_MODEL_H_
+
+#include <stdint.h>
+
+#include <sstream>
+
+#include <hardware/hwcomposer.h>
+
+namespace android {
+
+class DrmDisplayComposition;
+struct DrmHwcLayer;
+
+// Memory traffic of one frame, in bytes per frame. Multiply by the refresh
+// rate for bandwidth.
+struct BandwidthEstimate {
+  // Fetched by the display engine for all planes, the client target included
+  uint64_t scanout_bytes = 0;
+  // Pixels going through the planes, scaled up by downscaling
+  uint64_t scanout_pixels = 0;
+  // Read by the GPU from the layers it composes into the client target
+  uint64_t client_read_bytes = 0;
+  // Written by the GPU to the client target
+  uint64_t client_write_bytes = 0;
+
+  uint64_t total_bytes() const {
+    return scanout_bytes + client_read_bytes + client_write_bytes;
+  }
+};
+
+// Rough cost model of scanning buffers out and composing them on the GPU,
+// shared by the HWC's reporting and the planner stages that use it as their
+// cost function. It doesn't know about caches, prefetch or line buffers:
+//
+//  - a plane fetches its whole source crop every frame, at the bytes per
+//    pixel of the format, and compressed modifiers divide that
+//  - 90 and 270 degree rotation of linear buffers reads across cache lines
+//    and costs twice as much, tiled and compressed buffers rotate for free
+//  - the scaler processes the larger of the source and the destination
+//    size in each direction, which is what bounds the pixel rate
+//  - the GPU reads the source crop of every client layer once and writes
+//    the client target once
+class BandwidthModel {
+ public:
+  // Average over the planes of the format, 4 for unknown formats
+  static float BytesPerPixel(uint32_t format);
+  // Fraction of the uncompressed size fetched for a buffer with modifier
+  static float CompressionRatio(uint64_t modifier);
+
+  // Bytes a plane fetches per frame to scan layer out
+  static uint64_t ScanoutBytes(const DrmHwcLayer &layer);
+  // rotated is a 90 or 270 degree rotation
+  static uint64_t ScanoutBytes(uint32_t format, uint64_t modifier,
+                               const hwc_frect_t &crop, bool rotated);
+  // Pixels per frame the plane of layer processes
+  static uint64_t ScanoutPixels(const DrmHwcLayer &layer);
+  static uint64_t ScanoutPixels(const hwc_frect_t &crop,
+                                const hwc_rect_t &frame, bool rotated);
+  // Bytes the GPU reads to compose crop of a buffer of format
+  static uint64_t ClientReadBytes(uint32_t format, const hwc_frect_t &crop);
+  // Bytes the GPU writes to frame of a client target of format
+  static uint64_t ClientWriteBytes(uint32_t format, const hwc_rect_t &frame);
+
+  // Adds the scanout cost of the planes of composition to estimate
+  static void AddScanout(DrmDisplayComposition *composition,
+                         BandwidthEstimate *estimate);
+  // Prints the estimate in MB/s, refresh_hz of 0 prints bytes per frame
+  static void Dump(const BandwidthEstimate &estimate, float refresh_hz,
+                   std::ostringstream *out);
+};
+}
+
+#endif  // ANDROID_BANDWIDTH_MODEL_H_
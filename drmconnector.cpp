@@ -38,6 +38,8 @@ DrmConnector::DrmConnector(DrmDevice *drm, drmModeConnectorPtr c,
       state_(c->connection),
       mm_width_(c->mmWidth),
       mm_height_(c->mmHeight),
+      boot_crtc_(current_encoder ? current_encoder->crtc() : NULL),
+      boot_mode_id_(0),
       possible_encoders_(possible_encoders) {
 }
 
@@ -113,7 +115,9 @@ bool DrmConnector::valid_type() const {
 int DrmConnector::UpdateModes() {
   int fd = drm_->fd();
 
-  drmModeConnectorPtr c = drmModeGetConnector(fd, id_);
+  drmModeConnectorPtr c = drm_->ioctls().Call(
+      DrmIoctlStats::kGetConnector, DrmIoctlStats::kProbe,
+      [&] { return drmModeGetConnector(fd, id_); });
   if (!c) {
     ALOGE("Failed to get connector %d", id_);
     return -ENODEV;
@@ -139,6 +143,20 @@ int DrmConnector::UpdateModes() {
     new_modes.push_back(m);
   }
   modes_.swap(new_modes);
+
+  // Adopt the mode of the CRTC the connector was already driven by if the
+  // pipe kept it, so the display can be taken over without a modeset
+  if (!active_mode_.id() && state_ == DRM_MODE_CONNECTED && boot_crtc_ &&
+      boot_crtc_->boot_mode_valid() && encoder_ &&
+      encoder_->crtc() == boot_crtc_) {
+    for (const DrmMode &mode : modes_) {
+      if (mode.SameTimings(boot_crtc_->boot_mode())) {
+        active_mode_ = mode;
+        boot_mode_id_ = mode.id();
+        break;
+      }
+    }
+  }
   return 0;
 }
 
@@ -148,6 +166,11 @@ const DrmMode &DrmConnector::active_mode() const {
 
 void DrmConnector::set_active_mode(const DrmMode &mode) {
   active_mode_ = mode;
+  boot_mode_id_ = 0;
+}
+
+uint32_t DrmConnector::boot_mode_id() const {
+  return boot_mode_id_;
 }
 
 const DrmProperty &DrmConnector::dpms_property() const {
@@ -56,6 +56,10 @@ class DrmConnector {
   }
   const DrmMode &active_mode() const;
   void set_active_mode(const DrmMode &mode);
+  // Id of the mode the connector was lit up with at probe time, which is also
+  // the active mode until a mode gets set. 0 if it was off or the mode isn't
+  // in modes().
+  uint32_t boot_mode_id() const;
 
   const DrmProperty &dpms_property() const;
   const DrmProperty &crtc_id_property() const;
@@ -90,6 +94,9 @@ class DrmConnector {
   DrmMode active_mode_;
   std::vector<DrmMode> modes_;
 
+  DrmCrtc *boot_crtc_;
+  uint32_t boot_mode_id_;
+
   DrmProperty dpms_property_;
   DrmProperty crtc_id_property_;
   DrmProperty writeback_pixel_formats_;
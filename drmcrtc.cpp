@@ -27,7 +27,12 @@
 namespace android {
 
 DrmCrtc::DrmCrtc(DrmDevice *drm, drmModeCrtcPtr c, unsigned pipe)
-    : drm_(drm), id_(c->crtc_id), pipe_(pipe), display_(-1), mode_(&c->mode) {
+    : drm_(drm),
+      id_(c->crtc_id),
+      pipe_(pipe),
+      display_(-1),
+      mode_(&c->mode),
+      mode_valid_(c->mode_valid) {
 }
 
 int DrmCrtc::Init() {
@@ -71,6 +76,14 @@ bool DrmCrtc::can_bind(int display) const {
   return display_ == -1 || display_ == display;
 }
 
+bool DrmCrtc::boot_mode_valid() const {
+  return mode_valid_;
+}
+
+const DrmMode &DrmCrtc::boot_mode() const {
+  return mode_;
+}
+
 const DrmProperty &DrmCrtc::active_property() const {
   return active_property_;
 }
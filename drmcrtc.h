@@ -43,6 +43,11 @@ class DrmCrtc {
 
   bool can_bind(int display) const;
 
+  // The mode the CRTC was scanning out when the device was probed, e.g. the
+  // one the bootloader set up for its splash screen
+  bool boot_mode_valid() const;
+  const DrmMode &boot_mode() const;
+
   const DrmProperty &active_property() const;
   const DrmProperty &mode_property() const;
   const DrmProperty &out_fence_ptr_property() const;
@@ -55,6 +60,7 @@ class DrmCrtc {
   int display_;
 
   DrmMode mode_;
+  bool mode_valid_;
 
   DrmProperty active_property_;
   DrmProperty mode_property_;
@@ -27,6 +27,8 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <stdint.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
 #include <xf86drm.h>
 #include <xf86drmMode.h>
 
@@ -40,40 +42,59 @@ DrmDevice::DrmDevice() : event_listener_(this) {
 
 DrmDevice::~DrmDevice() {
   event_listener_.Exit();
+  ClearPropertyCache();
 }
 
 std::tuple<int, int> DrmDevice::Init(const char *path, int num_displays) {
+  int ret = Probe(path);
+  if (ret)
+    return std::make_tuple(ret, 0);
+
+  int displays_added = AssignDisplays(num_displays);
+  ret = InitPipes();
+  if (ret)
+    return std::make_tuple(ret, 0);
+  return std::make_tuple(0, displays_added);
+}
+
+int DrmDevice::Probe(const char *path) {
   /* TODO: Use drmOpenControl here instead */
   fd_.Set(open(path, O_RDWR));
   if (fd() < 0) {
     ALOGE("Failed to open dri- %s", strerror(-errno));
-    return std::make_tuple(-ENODEV, 0);
+    return -ENODEV;
   }
 
-  int ret = drmSetClientCap(fd(), DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1);
+  struct stat st;
+  if (!fstat(fd(), &st) && S_ISCHR(st.st_mode))
+    node_minor_ = minor(st.st_rdev);
+
+  int ret = SetClientCap(DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1);
   if (ret) {
     ALOGE("Failed to set universal plane cap %d", ret);
-    return std::make_tuple(ret, 0);
+    return ret;
   }
 
-  ret = drmSetClientCap(fd(), DRM_CLIENT_CAP_ATOMIC, 1);
+  ret = SetClientCap(DRM_CLIENT_CAP_ATOMIC, 1);
   if (ret) {
     ALOGE("Failed to set atomic cap %d", ret);
-    return std::make_tuple(ret, 0);
+    return ret;
   }
 
 #ifdef DRM_CLIENT_CAP_WRITEBACK_CONNECTORS
-  ret = drmSetClientCap(fd(), DRM_CLIENT_CAP_WRITEBACK_CONNECTORS, 1);
+  ret = SetClientCap(DRM_CLIENT_CAP_WRITEBACK_CONNECTORS, 1);
   if (ret) {
     ALOGI("Failed to set writeback cap %d", ret);
     ret = 0;
   }
 #endif
 
-  drmModeResPtr res = drmModeGetResources(fd());
+  drmModeResPtr res = ioctls_.Call(DrmIoctlStats::kGetResources,
+                                   DrmIoctlStats::kProbe,
+                                   [&] { return drmModeGetResources(fd()); });
   if (!res) {
     ALOGE("Failed to get DrmDevice resources");
-    return std::make_tuple(-ENODEV, 0);
+    return -ENODEV;
   }
 
   min_resolution_ =
@@ -81,12 +102,12 @@ std::tuple<int, int> DrmDevice::Init(const char *path, int num_displays) {
   max_resolution_ =
       std::pair<uint32_t, uint32_t>(res->max_width, res->max_height);
 
-  // Assumes that the primary display will always be in the first
-  // drm_device opened.
-  bool found_primary = num_displays != 0;
-
   for (int i = 0; !ret && i < res->count_crtcs; ++i) {
-    drmModeCrtcPtr c = drmModeGetCrtc(fd(), res->crtcs[i]);
+    drmModeCrtcPtr c = ioctls_.Call(DrmIoctlStats::kGetCrtc,
+                                    DrmIoctlStats::kProbe, [&] {
+                                      return drmModeGetCrtc(fd(),
+                                                            res->crtcs[i]);
+                                    });
     if (!c) {
       ALOGE("Failed to get crtc %d", res->crtcs[i]);
       ret = -ENODEV;
@@ -106,7 +127,11 @@ std::tuple<int, int> DrmDevice::Init(const char *path, int num_displays) {
 
   std::vector<int> possible_clones;
   for (int i = 0; !ret && i < res->count_encoders; ++i) {
-    drmModeEncoderPtr e = drmModeGetEncoder(fd(), res->encoders[i]);
+    drmModeEncoderPtr e = ioctls_.Call(DrmIoctlStats::kGetEncoder,
+                                       DrmIoctlStats::kProbe, [&] {
+                                         return drmModeGetEncoder(
+                                             fd(), res->encoders[i]);
+                                       });
     if (!e) {
       ALOGE("Failed to get encoder %d", res->encoders[i]);
       ret = -ENODEV;
@@ -138,7 +163,11 @@ std::tuple<int, int> DrmDevice::Init(const char *path, int num_displays) {
   }
 
   for (int i = 0; !ret && i < res->count_connectors; ++i) {
-    drmModeConnectorPtr c = drmModeGetConnector(fd(), res->connectors[i]);
+    drmModeConnectorPtr c = ioctls_.Call(DrmIoctlStats::kGetConnector,
+                                         DrmIoctlStats::kProbe, [&] {
+                                           return drmModeGetConnector(
+                                               fd(), res->connectors[i]);
+                                         });
     if (!c) {
       ALOGE("Failed to get connector %d", res->connectors[i]);
       ret = -ENODEV;
@@ -173,6 +202,18 @@ std::tuple<int, int> DrmDevice::Init(const char *path, int num_displays) {
       connectors_.emplace_back(std::move(conn));
   }
 
+  if (res)
+    drmModeFreeResources(res);
+  ClearPropertyCache();
+  return ret;
+}
+
+int DrmDevice::AssignDisplays(int num_displays) {
+  int first_display = num_displays;
+  // Assumes that the primary display will always be in the first
+  // drm_device opened.
+  bool found_primary = num_displays != 0;
+
   // First look for primary amongst internal connectors
   for (auto &conn : connectors_) {
     if (conn->state() == DRM_MODE_CONNECTED && conn->internal() && !found_primary) {
@@ -184,38 +225,49 @@ std::tuple<int, int> DrmDevice::Init(const char *path, int num_displays) {
     }
   }
 
-  // Then pick first available as primary and for the others assign
-  // consecutive display_numbers.
+  // Then pick first available as primary
   for (auto &conn : connectors_) {
-    if (conn->external() || conn->internal()) {
-      if (conn->state() == DRM_MODE_CONNECTED && !found_primary) {
-        conn->set_display(num_displays);
-        displays_[num_displays] = num_displays;
-        found_primary = true;
-        ++num_displays;
-    //} else if (conn->display() < 0) {
-    //  conn->set_display(num_displays);
-    //  displays_[num_displays] = num_displays;
-    //  ++num_displays;
-      }
+    if ((conn->external() || conn->internal()) &&
+        conn->state() == DRM_MODE_CONNECTED && !found_primary) {
+      conn->set_display(num_displays);
+      displays_[num_displays] = num_displays;
+      found_primary = true;
+      ++num_displays;
+      break;
     }
   }
 
-  if (res)
-    drmModeFreeResources(res);
+  // and assign consecutive display numbers to the others, the disconnected
+  // ones too so that they are ready for hotplug
+  for (auto &conn : connectors_) {
+    if ((conn->external() || conn->internal()) && conn->display() < 0) {
+      conn->set_display(num_displays);
+      displays_[num_displays] = num_displays;
+      ++num_displays;
+    }
+  }
+  return num_displays - first_display;
+}
 
-  // Catch-all for the above loops
-  if (ret)
-    return std::make_tuple(ret, 0);
+int DrmDevice::InitPipes() {
+  if (pipes_initialized_)
+    return 0;
 
-  drmModePlaneResPtr plane_res = drmModeGetPlaneResources(fd());
+  int ret = 0;
+  drmModePlaneResPtr plane_res = ioctls_.Call(
+      DrmIoctlStats::kGetPlaneResources, DrmIoctlStats::kProbe,
+      [&] { return drmModeGetPlaneResources(fd()); });
   if (!plane_res) {
     ALOGE("Failed to get plane resources");
-    return std::make_tuple(-ENOENT, 0);
+    return -ENOENT;
   }
 
   for (uint32_t i = 0; i < plane_res->count_planes; ++i) {
-    drmModePlanePtr p = drmModeGetPlane(fd(), plane_res->planes[i]);
+    drmModePlanePtr p = ioctls_.Call(DrmIoctlStats::kGetPlane,
+                                     DrmIoctlStats::kProbe, [&] {
+                                       return drmModeGetPlane(
+                                           fd(), plane_res->planes[i]);
+                                     });
     if (!p) {
       ALOGE("Failed to get plane %d", plane_res->planes[i]);
       ret = -ENODEV;
@@ -236,25 +288,30 @@ std::tuple<int, int> DrmDevice::Init(const char *path, int num_displays) {
   }
   drmModeFreePlaneResources(plane_res);
   if (ret)
-    return std::make_tuple(ret, 0);
+    return ret;
 
   ret = event_listener_.Init();
   if (ret) {
     ALOGE("Can't initialize event listener %d", ret);
-    return std::make_tuple(ret, 0);
+    return ret;
   }
 
+  // Disconnected displays are routed once they get connected
   for (auto &conn : connectors_) {
+    if (conn->state() != DRM_MODE_CONNECTED)
+      continue;
     ret = CreateDisplayPipe(conn.get());
     if (ret) {
       ALOGE("Failed CreateDisplayPipe %d with %d", conn->id(), ret);
-      return std::make_tuple(ret, 0);
+      return ret;
     }
     if (!AttachWriteback(conn.get())) {
       ALOGI("Display %d has writeback attach to it", conn->display());
     }
   }
-  return std::make_tuple(ret, displays_.size());
+  ClearPropertyCache();
+  pipes_initialized_ = true;
+  return 0;
 }
 
 bool DrmDevice::HandlesDisplay(int display) const {
@@ -385,6 +442,17 @@ int DrmDevice::CreateDisplayPipe(DrmConnector *connector) {
   return -ENODEV;
 }
 
+void DrmDevice::ReleaseDisplayPipe(DrmConnector *connector) {
+  DrmCrtc *crtc = GetCrtcForDisplay(connector->display());
+  if (crtc)
+    crtc->set_display(-1);
+  // Attached again along with the CRTC the display gets on its next connect
+  DrmConnector *writeback = GetWritebackConnectorForDisplay(
+      connector->display());
+  if (writeback)
+    writeback->set_display(-1);
+}
+
 // Attach writeback connector to the CRTC linked to the display_conn
 int DrmDevice::AttachWriteback(DrmConnector *display_conn) {
   DrmCrtc *display_crtc = display_conn->encoder()->crtc();
@@ -413,6 +481,11 @@ int DrmDevice::AttachWriteback(DrmConnector *display_conn) {
   return -EINVAL;
 }
 
+int DrmDevice::SetClientCap(uint64_t capability, uint64_t value) {
+  return ioctls_.Call(DrmIoctlStats::kSetClientCap, DrmIoctlStats::kProbe,
+                      [&] { return drmSetClientCap(fd(), capability, value); });
+}
+
 int DrmDevice::CreatePropertyBlob(void *data, size_t length,
                                   uint32_t *blob_id) {
   struct drm_mode_create_blob create_blob;
@@ -420,7 +493,11 @@ int DrmDevice::CreatePropertyBlob(void *data, size_t length,
   create_blob.length = length;
   create_blob.data = (__u64)data;
 
-  int ret = drmIoctl(fd(), DRM_IOCTL_MODE_CREATEPROPBLOB, &create_blob);
+  int ret = ioctls_.Call(DrmIoctlStats::kCreatePropBlob,
+                         DrmIoctlStats::kBlobCreate, [&] {
+                           return drmIoctl(fd(), DRM_IOCTL_MODE_CREATEPROPBLOB,
+                                           &create_blob);
+                         });
   if (ret) {
     ALOGE("Failed to create mode property blob %d", ret);
     return ret;
@@ -436,7 +513,11 @@ int DrmDevice::DestroyPropertyBlob(uint32_t blob_id) {
   struct drm_mode_destroy_blob destroy_blob;
   memset(&destroy_blob, 0, sizeof(destroy_blob));
   destroy_blob.blob_id = (__u32)blob_id;
-  int ret = drmIoctl(fd(), DRM_IOCTL_MODE_DESTROYPROPBLOB, &destroy_blob);
+  int ret = ioctls_.Call(DrmIoctlStats::kDestroyPropBlob,
+                         DrmIoctlStats::kBlobDestroy, [&] {
+                           return drmIoctl(fd(), DRM_IOCTL_MODE_DESTROYPROPBLOB,
+                                           &destroy_blob);
+                         });
   if (ret) {
     ALOGE("Failed to destroy mode property blob %" PRIu32 "/%d", blob_id, ret);
     return ret;
@@ -448,28 +529,62 @@ DrmEventListener *DrmDevice::event_listener() {
   return &event_listener_;
 }
 
-int DrmDevice::GetProperty(uint32_t obj_id, uint32_t obj_type,
-                           const char *prop_name, DrmProperty *property) {
-  drmModeObjectPropertiesPtr props;
+const DrmDevice::ObjectProperties *DrmDevice::GetObjectProperties(
+    uint32_t obj_id, uint32_t obj_type) {
+  auto cached = object_properties_.find(obj_id);
+  if (cached != object_properties_.end())
+    return &cached->second;
 
-  props = drmModeObjectGetProperties(fd(), obj_id, obj_type);
+  drmModeObjectPropertiesPtr props;
+  props = ioctls_.Call(DrmIoctlStats::kObjGetProperties,
+                       DrmIoctlStats::kPropertyLookup, [&] {
+                         return drmModeObjectGetProperties(fd(), obj_id,
+                                                           obj_type);
+                       });
   if (!props) {
     ALOGE("Failed to get properties for %d/%x", obj_id, obj_type);
-    return -ENODEV;
+    return NULL;
   }
 
-  bool found = false;
-  for (int i = 0; !found && (size_t)i < props->count_props; ++i) {
-    drmModePropertyPtr p = drmModeGetProperty(fd(), props->props[i]);
-    if (!strcmp(p->name, prop_name)) {
-      property->Init(p, props->prop_values[i]);
-      found = true;
+  ObjectProperties &object = object_properties_[obj_id];
+  for (uint32_t i = 0; i < props->count_props; ++i) {
+    uint32_t prop_id = props->props[i];
+    drmModePropertyPtr &p = properties_[prop_id];
+    if (!p)
+      p = ioctls_.Call(DrmIoctlStats::kGetProperty,
+                       DrmIoctlStats::kPropertyLookup,
+                       [&] { return drmModeGetProperty(fd(), prop_id); });
+    if (!p) {
+      ALOGE("Failed to get property %d of %d/%x", prop_id, obj_id, obj_type);
+      properties_.erase(prop_id);
+      continue;
     }
-    drmModeFreeProperty(p);
+    object[p->name] = {prop_id, props->prop_values[i]};
   }
 
   drmModeFreeObjectProperties(props);
-  return found ? 0 : -ENOENT;
+  return &object;
+}
+
+int DrmDevice::GetProperty(uint32_t obj_id, uint32_t obj_type,
+                           const char *prop_name, DrmProperty *property) {
+  const ObjectProperties *object = GetObjectProperties(obj_id, obj_type);
+  if (!object)
+    return -ENODEV;
+
+  auto prop = object->find(prop_name);
+  if (prop == object->end())
+    return -ENOENT;
+
+  property->Init(properties_[prop->second.id], prop->second.value);
+  return 0;
+}
+
+void DrmDevice::ClearPropertyCache() {
+  for (auto &p : properties_)
+    drmModeFreeProperty(p.second);
+  properties_.clear();
+  object_properties_.clear();
 }
 
 int DrmDevice::GetPlaneProperty(const DrmPlane &plane, const char *prop_name,
@@ -488,4 +603,12 @@ int DrmDevice::GetConnectorProperty(const DrmConnector &connector,
   return GetProperty(connector.id(), DRM_MODE_OBJECT_CONNECTOR, prop_name,
                      property);
 }
+
+void DrmDevice::DumpStats(std::ostringstream *out) {
+  *out << "DRM device fd=" << fd() << " displays=";
+  for (auto &display : displays_)
+    *out << display.first << " ";
+  *out << "\n";
+  ioctls_.Dump(out);
+}
 }
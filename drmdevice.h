@@ -21,10 +21,15 @@
 #include "drmcrtc.h"
 #include "drmencoder.h"
 #include "drmeventlistener.h"
+#include "drmioctl.h"
 #include "drmplane.h"
 #include "platform.h"
 
 #include <stdint.h>
+#include <shared_mutex>
+#include <map>
+#include <sstream>
+#include <string>
 #include <tuple>
 
 namespace android {
@@ -34,11 +39,31 @@ class DrmDevice {
   DrmDevice();
   ~DrmDevice();
 
+  // Probe(), AssignDisplays() and InitPipes(), returns the number of
+  // displays added
   std::tuple<int, int> Init(const char *path, int num_displays);
 
+  // Opens path and enumerates its CRTCs, encoders and connectors. Devices
+  // may be probed concurrently.
+  int Probe(const char *path);
+  // Numbers the displays from num_displays on, disconnected ones included,
+  // returns how many were added
+  int AssignDisplays(int num_displays);
+  // Enumerates the planes, starts the event listener and routes the
+  // connected displays to CRTCs. Only the first call does anything, the plane
+  // and display accessors are only valid once it succeeded.
+  int InitPipes();
+  bool pipes_initialized() const {
+    return pipes_initialized_;
+  }
+
   int fd() const {
     return fd_.get();
   }
+  // Minor number of the device node, -1 if it isn't one
+  int node_minor() const {
+    return node_minor_;
+  }
 
   const std::vector<std::unique_ptr<DrmConnector>> &connectors() const {
     return connectors_;
@@ -77,16 +102,48 @@ class DrmDevice {
   int DestroyPropertyBlob(uint32_t blob_id);
   bool HandlesDisplay(int display) const;
 
+  // Routes the display of connector to an encoder and a CRTC, or frees its
+  // CRTC and writeback connector for other displays once it is disconnected
+  int CreateDisplayPipe(DrmConnector *connector);
+  void ReleaseDisplayPipe(DrmConnector *connector);
+  // Binds a free writeback connector to the CRTC of display_conn's pipe
+  int AttachWriteback(DrmConnector *display_conn);
+
+  // Arbitrates commits between the displays of this device. Modesetting
+  // commits can pull other CRTCs into their atomic state and take it
+  // exclusively, page flips only touch their own CRTC and take it shared so
+  // they never wait on each other.
+  std::shared_mutex &commit_lock() {
+    return commit_lock_;
+  }
+
+  // Every libdrm call on fd() goes through ioctls().Call()
+  DrmIoctlStats &ioctls() {
+    return ioctls_;
+  }
+  // Prints the ioctls made since the previous call and resets their counters
+  void DumpStats(std::ostringstream *out);
+
  private:
   int TryEncoderForDisplay(int display, DrmEncoder *enc);
+  // The properties of an object, by name
+  struct ObjectProperty {
+    uint32_t id;
+    uint64_t value;
+  };
+  typedef std::map<std::string, ObjectProperty> ObjectProperties;
+
+  int SetClientCap(uint64_t capability, uint64_t value);
   int GetProperty(uint32_t obj_id, uint32_t obj_type, const char *prop_name,
                   DrmProperty *property);
-
-  int CreateDisplayPipe(DrmConnector *connector);
-  int AttachWriteback(DrmConnector *display_conn);
+  const ObjectProperties *GetObjectProperties(uint32_t obj_id,
+                                              uint32_t obj_type);
+  void ClearPropertyCache();
 
   UniqueFd fd_;
+  int node_minor_ = -1;
   uint32_t mode_id_ = 0;
+  bool pipes_initialized_ = false;
 
   std::vector<std::unique_ptr<DrmConnector>> connectors_;
   std::vector<std::unique_ptr<DrmConnector>> writeback_connectors_;
@@ -98,6 +155,15 @@ class DrmDevice {
   std::pair<uint32_t, uint32_t> min_resolution_;
   std::pair<uint32_t, uint32_t> max_resolution_;
   std::map<int, int> displays_;
+  std::shared_mutex commit_lock_;
+  DrmIoctlStats ioctls_;
+
+  // Filled while probing and dropped once Init() is done, so that the
+  // objects' Init() only fetch each of their property lists once. Objects
+  // of a type share their property ids, each property is only described
+  // once as well.
+  std::map<uint32_t, ObjectProperties> object_properties_;
+  std::map<uint32_t, drmModePropertyPtr> properties_;
 };
 }
 
@@ -23,6 +23,7 @@
 #include "drmplane.h"
 #include "platform.h"
 
+#include <ctype.h>
 #include <stdlib.h>
 
 #include <algorithm>
@@ -76,10 +77,12 @@ int DrmDisplayComposition::SetDpmsMode(uint32_t dpms_mode) {
   return 0;
 }
 
-int DrmDisplayComposition::SetDisplayMode(const DrmMode &display_mode) {
+int DrmDisplayComposition::SetDisplayMode(const DrmMode &display_mode,
+                                          bool seamless) {
   if (!validate_composition_type(DRM_COMPOSITION_TYPE_MODESET))
     return -EINVAL;
   display_mode_ = display_mode;
+  seamless_mode_ = seamless;
   dpms_mode_ = DRM_MODE_DPMS_ON;
   type_ = DRM_COMPOSITION_TYPE_MODESET;
   return 0;
@@ -171,8 +174,14 @@ static void DumpBuffer(const DrmHwcBuffer &buffer, std::ostringstream *out) {
     return;
   }
 
-  *out << "buffer[w/h/format]=";
-  *out << buffer->width << "/" << buffer->height << "/" << buffer->format;
+  *out << "buffer[w/h/format/fb]=";
+  *out << buffer->width << "/" << buffer->height << "/";
+  // DRM formats are fourcc codes, print them as such when they are
+  for (int i = 0; i < 4; ++i) {
+    char c = (buffer->format >> (8 * i)) & 0xff;
+    *out << (isprint(c) ? c : '?');
+  }
+  *out << "/" << buffer->fb_id;
 }
 
 static void DumpTransform(uint32_t transform, std::ostringstream *out) {
@@ -248,10 +257,13 @@ void DrmDisplayComposition::Dump(std::ostringstream *out) const {
     case DRM_COMPOSITION_TYPE_MODESET:
       *out << " display_mode=" << display_mode_.h_display() << "x"
            << display_mode_.v_display();
+      if (seamless_mode_)
+        *out << " seamless";
       break;
     default:
       break;
   }
+  *out << "\n";
 
   *out << "    Layers: count=" << layers_.size() << "\n";
   for (size_t i = 0; i < layers_.size(); i++) {
@@ -259,6 +271,9 @@ void DrmDisplayComposition::Dump(std::ostringstream *out) const {
     *out << "      [" << i << "] ";
 
     DumpBuffer(layer.buffer, out);
+    *out << " frame=[" << layer.display_frame.left << ","
+         << layer.display_frame.top << "," << layer.display_frame.right << ","
+         << layer.display_frame.bottom << "]";
 
     if (layer.protected_usage())
       *out << " protected";
@@ -118,7 +118,9 @@ class DrmDisplayComposition {
   int AddPlaneComposition(DrmCompositionPlane plane);
   int AddPlaneDisable(DrmPlane *plane);
   int SetDpmsMode(uint32_t dpms_mode);
-  int SetDisplayMode(const DrmMode &display_mode);
+  // A seamless mode is already scanned out by the CRTC, e.g. since boot, and
+  // is taken over by the next frame without a modeset
+  int SetDisplayMode(const DrmMode &display_mode, bool seamless);
 
   int Plan(std::vector<DrmPlane *> *primary_planes,
            std::vector<DrmPlane *> *overlay_planes);
@@ -151,6 +153,10 @@ class DrmDisplayComposition {
     return display_mode_;
   }
 
+  bool seamless_mode() const {
+    return seamless_mode_;
+  }
+
   DrmCrtc *crtc() const {
     return crtc_;
   }
@@ -171,6 +177,15 @@ class DrmDisplayComposition {
     out_fence_.Set(out_fence);
   }
 
+  // Point on the compositor's release timeline signaled once this frame
+  // replaced the previous one on screen, 0 if nobody waits on it
+  uint32_t release_point() const {
+    return release_point_;
+  }
+  void set_release_point(uint32_t point) {
+    release_point_ = point;
+  }
+
   void Dump(std::ostringstream *out) const;
 
  private:
@@ -184,8 +199,10 @@ class DrmDisplayComposition {
   DrmCompositionType type_ = DRM_COMPOSITION_TYPE_EMPTY;
   uint32_t dpms_mode_ = DRM_MODE_DPMS_ON;
   DrmMode display_mode_;
+  bool seamless_mode_ = false;
 
   UniqueFd out_fence_ = -1;
+  uint32_t release_point_ = 0;
 
   bool geometry_changed_;
   std::vector<DrmHwcLayer> layers_;
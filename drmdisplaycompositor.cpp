@@ -23,9 +23,11 @@
 #include <sched.h>
 #include <stdlib.h>
 #include <time.h>
+#include <shared_mutex>
 #include <sstream>
 #include <vector>
 
+#include <cutils/properties.h>
 #include <log/log.h>
 #include <drm/drm_mode.h>
 #include <sync/sync.h>
@@ -40,6 +42,12 @@ static const uint32_t kWaitWritebackFence = 100;  // ms
 
 namespace android {
 
+static int64_t NowNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000 * 1000 * 1000 + ts.tv_nsec;
+}
+
 class CompositorVsyncCallback : public VsyncCallback {
  public:
   CompositorVsyncCallback(DrmDisplayCompositor *compositor)
@@ -54,6 +62,56 @@ class CompositorVsyncCallback : public VsyncCallback {
   DrmDisplayCompositor *compositor_;
 };
 
+// Handed to the kernel with every commit, tells the compositor when the frame
+// actually reached the display.
+class CompositorFlipHandler : public DrmEventHandler {
+ public:
+  CompositorFlipHandler(std::weak_ptr<PresentHistory> history,
+                        std::weak_ptr<FrameTimeline> frame_timeline,
+                        std::weak_ptr<SyncTimeline> release_timeline,
+                        uint32_t release_point, uint64_t frame_no,
+                        int64_t commit_ns, int64_t target_vsync_ns,
+                        int64_t vsync_period_ns)
+      : history_(history),
+        frame_timeline_(frame_timeline),
+        release_timeline_(release_timeline),
+        release_point_(release_point),
+        frame_no_(frame_no),
+        commit_ns_(commit_ns),
+        target_vsync_ns_(target_vsync_ns),
+        vsync_period_ns_(vsync_period_ns) {
+  }
+
+  void HandleEvent(uint64_t timestamp_us) override {
+    std::shared_ptr<FrameTimeline> frame_timeline = frame_timeline_.lock();
+    if (frame_timeline)
+      frame_timeline->Stamp(frame_no_, FrameTimeline::kFlip,
+                            timestamp_us * 1000);
+
+    // The previous frame's buffers aren't scanned out anymore
+    std::shared_ptr<SyncTimeline> release_timeline = release_timeline_.lock();
+    if (release_timeline)
+      release_timeline->SignalUpTo(release_point_);
+
+    std::shared_ptr<PresentHistory> history = history_.lock();
+    if (!history)
+      return;
+    history->RecordPresent(frame_no_, commit_ns_, target_vsync_ns_,
+                           timestamp_us * 1000, vsync_period_ns_);
+  }
+
+ private:
+  // weak since the compositor may be gone by the time the flip completes
+  std::weak_ptr<PresentHistory> history_;
+  std::weak_ptr<FrameTimeline> frame_timeline_;
+  std::weak_ptr<SyncTimeline> release_timeline_;
+  uint32_t release_point_;
+  uint64_t frame_no_;
+  int64_t commit_ns_;
+  int64_t target_vsync_ns_;
+  int64_t vsync_period_ns_;
+};
+
 DrmDisplayCompositor::DrmDisplayCompositor()
     : resource_manager_(NULL),
       display_(-1),
@@ -62,7 +120,24 @@ DrmDisplayCompositor::DrmDisplayCompositor()
       use_hw_overlays_(true),
       dump_frames_composited_(0),
       dump_last_timestamp_ns_(0),
+      dump_frames_tested_(0),
       flatten_countdown_(FLATTEN_COUNTDOWN_INIT),
+      frame_generation_(0),
+      flatten_generation_(0),
+      flattening_(false),
+      flatten_task_(0),
+      flatten_attempts_(0),
+      flatten_committed_(0),
+      flatten_aborted_(0),
+      flattened_ns_(0),
+      flattened_since_ns_(-1),
+      present_history_(std::make_shared<PresentHistory>()),
+      frame_timeline_(std::make_shared<FrameTimeline>()),
+      test_failures_(0),
+      last_flight_dump_ns_(-kFlightDumpIntervalNs),
+      release_timeline_(std::make_shared<SyncTimeline>()),
+      release_point_(0),
+      deferred_latches_(0),
       writeback_fence_(-1) {
   struct timespec ts;
   if (clock_gettime(CLOCK_MONOTONIC, &ts))
@@ -75,16 +150,18 @@ DrmDisplayCompositor::~DrmDisplayCompositor() {
     return;
 
   vsync_worker_.Exit();
+  resource_manager_->task_worker()->Cancel(flatten_task_);
   int ret = pthread_mutex_lock(&lock_);
   if (ret)
     ALOGE("Failed to acquire compositor lock %d", ret);
-  DrmDevice *drm = resource_manager_->GetDrmDevice(display_);
+  DrmDevice *drm = pipe_->device;
   if (mode_.blob_id)
     drm->DestroyPropertyBlob(mode_.blob_id);
   if (mode_.old_blob_id)
     drm->DestroyPropertyBlob(mode_.old_blob_id);
 
-  active_composition_.reset();
+  std::atomic_store(&active_composition_,
+                    std::shared_ptr<DrmDisplayComposition>());
 
   ret = pthread_mutex_unlock(&lock_);
   if (ret)
@@ -96,21 +173,33 @@ DrmDisplayCompositor::~DrmDisplayCompositor() {
 int DrmDisplayCompositor::Init(ResourceManager *resource_manager, int display) {
   resource_manager_ = resource_manager;
   display_ = display;
-  DrmDevice *drm = resource_manager_->GetDrmDevice(display);
-  if (!drm) {
-    ALOGE("Could not find drmdevice for display");
+  pipe_ = resource_manager_->GetPipe(display);
+  if (!pipe_) {
+    ALOGE("Could not find the pipe of display %d", display);
     return -EINVAL;
   }
+  DrmDevice *drm = pipe_->device;
   int ret = pthread_mutex_init(&lock_, NULL);
   if (ret) {
     ALOGE("Failed to initialize drm compositor lock %d\n", ret);
     return ret;
   }
   planner_ = Planner::CreateInstance(drm);
+  flatten_task_key_ = "flatten-" + std::to_string(display_);
+  // Without sw_sync layers don't get release fences, only the retire fence
+  release_timeline_->Init("drm_hwc_release");
+
+  char dir[PROPERTY_VALUE_MAX];
+  property_get("hwc.drm.flight_recorder_dir", dir, "/data/vendor/hwc");
+  flight_recorder_dir_ = dir;
 
-  vsync_worker_.Init(drm, display_);
   auto callback = std::make_shared<CompositorVsyncCallback>(this);
   vsync_worker_.RegisterCallback(callback);
+  ret = vsync_worker_.Init(drm, display_);
+  if (ret) {
+    ALOGE("Failed to subscribe to vsync for display %d %d", display_, ret);
+    return ret;
+  }
 
   initialized_ = true;
   return 0;
@@ -123,19 +212,9 @@ std::unique_ptr<DrmDisplayComposition> DrmDisplayCompositor::CreateComposition()
 
 std::unique_ptr<DrmDisplayComposition>
 DrmDisplayCompositor::CreateInitializedComposition() const {
-  DrmDevice *drm = resource_manager_->GetDrmDevice(display_);
-  DrmCrtc *crtc = drm->GetCrtcForDisplay(display_);
-  if (!crtc) {
-    ALOGE("Failed to find crtc for display = %d", display_);
-    return std::unique_ptr<DrmDisplayComposition>();
-  }
   std::unique_ptr<DrmDisplayComposition> comp = CreateComposition();
-  std::shared_ptr<Importer> importer = resource_manager_->GetImporter(display_);
-  if (!importer) {
-    ALOGE("Failed to find resources for display = %d", display_);
-    return std::unique_ptr<DrmDisplayComposition>();
-  }
-  int ret = comp->Init(drm, crtc, importer.get(), planner_.get(), 0);
+  int ret = comp->Init(pipe_->device, pipe_->crtc, pipe_->importer,
+                       planner_.get(), 0);
   if (ret) {
     ALOGE("Failed to init composition for display = %d", display_);
     return std::unique_ptr<DrmDisplayComposition>();
@@ -145,15 +224,7 @@ DrmDisplayCompositor::CreateInitializedComposition() const {
 
 std::tuple<uint32_t, uint32_t, int>
 DrmDisplayCompositor::GetActiveModeResolution() {
-  DrmDevice *drm = resource_manager_->GetDrmDevice(display_);
-  DrmConnector *connector = drm->GetConnectorForDisplay(display_);
-  if (connector == NULL) {
-    ALOGE("Failed to determine display mode: no connector for display %d",
-          display_);
-    return std::make_tuple(0, 0, -ENODEV);
-  }
-
-  const DrmMode &mode = connector->active_mode();
+  const DrmMode &mode = pipe_->connector->active_mode();
   return std::make_tuple(mode.h_display(), mode.v_display(), 0);
 }
 
@@ -179,8 +250,13 @@ int DrmDisplayCompositor::DisablePlanes(DrmDisplayComposition *display_comp) {
       return ret;
     }
   }
-  DrmDevice *drm = resource_manager_->GetDrmDevice(display_);
-  ret = drmModeAtomicCommit(drm->fd(), pset, 0, drm);
+  DrmDevice *drm = pipe_->device;
+  std::shared_lock<std::shared_mutex> flip_lock(drm->commit_lock());
+  ret = drm->ioctls().Call(DrmIoctlStats::kAtomic,
+                           DrmIoctlStats::kDisablePlanes, [&] {
+                             return drmModeAtomicCommit(drm->fd(), pset, 0,
+                                                        drm);
+                           });
   if (ret) {
     ALOGE("Failed to commit pset ret=%d\n", ret);
     drmModeAtomicFree(pset);
@@ -241,18 +317,16 @@ int DrmDisplayCompositor::CommitFrame(DrmDisplayComposition *display_comp,
   std::vector<DrmHwcLayer> &layers = display_comp->layers();
   std::vector<DrmCompositionPlane> &comp_planes =
       display_comp->composition_planes();
-  DrmDevice *drm = resource_manager_->GetDrmDevice(display_);
+  DrmDevice *drm = pipe_->device;
   uint64_t out_fences[drm->crtcs().size()];
+  DrmConnector *connector = pipe_->connector;
+  DrmCrtc *crtc = pipe_->crtc;
 
-  DrmConnector *connector = drm->GetConnectorForDisplay(display_);
-  if (!connector) {
-    ALOGE("Could not locate connector for display %d", display_);
-    return -ENODEV;
-  }
-  DrmCrtc *crtc = drm->GetCrtcForDisplay(display_);
-  if (!crtc) {
-    ALOGE("Could not locate crtc for display %d", display_);
-    return -ENODEV;
+  // mode_ can change under a test commit built outside the commit path
+  ModeState mode;
+  {
+    std::lock_guard<std::mutex> lk(mode_lock_);
+    mode = mode_;
   }
 
   drmModeAtomicReqPtr pset = drmModeAtomicAlloc();
@@ -261,6 +335,14 @@ int DrmDisplayCompositor::CommitFrame(DrmDisplayComposition *display_comp,
     return -ENOMEM;
   }
 
+  FlightRecord record;
+  record.Init(display_, display_comp, test_only);
+  auto add_property = [&](uint32_t object_id, uint32_t property_id,
+                          uint64_t value) {
+    record.AddProperty(object_id, property_id, value);
+    return drmModeAtomicAddProperty(pset, object_id, property_id, value);
+  };
+
   if (writeback_buffer != NULL) {
     if (writeback_conn == NULL) {
       ALOGE("Invalid arguments requested writeback without writeback conn");
@@ -274,8 +356,8 @@ int DrmDisplayCompositor::CommitFrame(DrmDisplayComposition *display_comp,
     }
   }
   if (crtc->out_fence_ptr_property().id() != 0) {
-    ret = drmModeAtomicAddProperty(pset, crtc->id(), crtc->out_fence_ptr_property().id(),
-                                   (uint64_t) &out_fences[crtc->pipe()]);
+    ret = add_property(crtc->id(), crtc->out_fence_ptr_property().id(),
+                       (uint64_t) &out_fences[crtc->pipe()]);
     if (ret < 0) {
       ALOGE("Failed to add OUT_FENCE_PTR property to pset: %d", ret);
       drmModeAtomicFree(pset);
@@ -283,21 +365,20 @@ int DrmDisplayCompositor::CommitFrame(DrmDisplayComposition *display_comp,
     }
   }
 
-  if (mode_.needs_modeset) {
-    ret = drmModeAtomicAddProperty(pset, crtc->id(), crtc->active_property().id(), 1);
+  if (mode.needs_modeset) {
+    ret = add_property(crtc->id(), crtc->active_property().id(), 1);
     if (ret < 0) {
       ALOGE("Failed to add crtc active to pset\n");
       drmModeAtomicFree(pset);
       return ret;
     }
 
-    ret = drmModeAtomicAddProperty(pset, crtc->id(), crtc->mode_property().id(),
-                                   mode_.blob_id) < 0 ||
-          drmModeAtomicAddProperty(pset, connector->id(),
-                                   connector->crtc_id_property().id(),
-                                   crtc->id()) < 0;
+    ret = add_property(crtc->id(), crtc->mode_property().id(),
+                       mode.blob_id) < 0 ||
+          add_property(connector->id(), connector->crtc_id_property().id(),
+                       crtc->id()) < 0;
     if (ret) {
-      ALOGE("Failed to add blob %d to pset", mode_.blob_id);
+      ALOGE("Failed to add blob %d to pset", mode.blob_id);
       drmModeAtomicFree(pset);
       return ret;
     }
@@ -353,13 +434,16 @@ int DrmDisplayCompositor::CommitFrame(DrmDisplayComposition *display_comp,
       else
         rotation |= DRM_MODE_ROTATE_0;
 
-      if (fence_fd >= 0) {
-        int prop_id = plane->in_fence_fd_property().id();
-        if (prop_id == 0) {
-                ALOGE("Failed to get IN_FENCE_FD property id");
-                break;
-        }
-        ret = drmModeAtomicAddProperty(pset, plane->id(), prop_id, fence_fd);
+      // Planes without IN_FENCE_FD had their fences waited for by
+      // WaitForAcquireFences() before a real commit
+      int prop_id = plane->in_fence_fd_property().id();
+      if (fence_fd >= 0 && prop_id == 0 && !test_only) {
+        ALOGE("Unwaited acquire fence for plane %d without IN_FENCE_FD",
+              plane->id());
+        ret = -EINVAL;
+        break;
+      } else if (fence_fd >= 0 && prop_id != 0) {
+        ret = add_property(plane->id(), prop_id, fence_fd);
         if (ret < 0) {
           ALOGE("Failed to add IN_FENCE_FD property to pset: %d", ret);
           break;
@@ -369,10 +453,8 @@ int DrmDisplayCompositor::CommitFrame(DrmDisplayComposition *display_comp,
 
     // Disable the plane if there's no framebuffer
     if (fb_id < 0) {
-      ret = drmModeAtomicAddProperty(pset, plane->id(),
-                                     plane->crtc_property().id(), 0) < 0 ||
-            drmModeAtomicAddProperty(pset, plane->id(),
-                                     plane->fb_property().id(), 0) < 0;
+      ret = add_property(plane->id(), plane->crtc_property().id(), 0) < 0 ||
+            add_property(plane->id(), plane->fb_property().id(), 0) < 0;
       if (ret) {
         ALOGE("Failed to add plane %d disable to pset", plane->id());
         break;
@@ -394,43 +476,33 @@ int DrmDisplayCompositor::CommitFrame(DrmDisplayComposition *display_comp,
       break;
     }
 
-    ret = drmModeAtomicAddProperty(pset, plane->id(),
-                                   plane->crtc_property().id(), crtc->id()) < 0;
-    ret |= drmModeAtomicAddProperty(pset, plane->id(),
-                                    plane->fb_property().id(), fb_id) < 0;
-    ret |= drmModeAtomicAddProperty(pset, plane->id(),
-                                    plane->crtc_x_property().id(),
-                                    display_frame.left) < 0;
-    ret |= drmModeAtomicAddProperty(pset, plane->id(),
-                                    plane->crtc_y_property().id(),
-                                    display_frame.top) < 0;
-    ret |= drmModeAtomicAddProperty(
-               pset, plane->id(), plane->crtc_w_property().id(),
-               display_frame.right - display_frame.left) < 0;
-    ret |= drmModeAtomicAddProperty(
-               pset, plane->id(), plane->crtc_h_property().id(),
-               display_frame.bottom - display_frame.top) < 0;
-    ret |= drmModeAtomicAddProperty(pset, plane->id(),
-                                    plane->src_x_property().id(),
-                                    (int)(source_crop.left) << 16) < 0;
-    ret |= drmModeAtomicAddProperty(pset, plane->id(),
-                                    plane->src_y_property().id(),
-                                    (int)(source_crop.top) << 16) < 0;
-    ret |= drmModeAtomicAddProperty(
-               pset, plane->id(), plane->src_w_property().id(),
-               (int)(source_crop.right - source_crop.left) << 16) < 0;
-    ret |= drmModeAtomicAddProperty(
-               pset, plane->id(), plane->src_h_property().id(),
-               (int)(source_crop.bottom - source_crop.top) << 16) < 0;
+    ret = add_property(plane->id(), plane->crtc_property().id(),
+                       crtc->id()) < 0;
+    ret |= add_property(plane->id(), plane->fb_property().id(), fb_id) < 0;
+    ret |= add_property(plane->id(), plane->crtc_x_property().id(),
+                        display_frame.left) < 0;
+    ret |= add_property(plane->id(), plane->crtc_y_property().id(),
+                        display_frame.top) < 0;
+    ret |= add_property(plane->id(), plane->crtc_w_property().id(),
+                        display_frame.right - display_frame.left) < 0;
+    ret |= add_property(plane->id(), plane->crtc_h_property().id(),
+                        display_frame.bottom - display_frame.top) < 0;
+    ret |= add_property(plane->id(), plane->src_x_property().id(),
+                        (int)(source_crop.left) << 16) < 0;
+    ret |= add_property(plane->id(), plane->src_y_property().id(),
+                        (int)(source_crop.top) << 16) < 0;
+    ret |= add_property(plane->id(), plane->src_w_property().id(),
+                        (int)(source_crop.right - source_crop.left) << 16) < 0;
+    ret |= add_property(plane->id(), plane->src_h_property().id(),
+                        (int)(source_crop.bottom - source_crop.top) << 16) < 0;
     if (ret) {
       ALOGE("Failed to add plane %d to set", plane->id());
       break;
     }
 
     if (plane->rotation_property().id()) {
-      ret = drmModeAtomicAddProperty(pset, plane->id(),
-                                     plane->rotation_property().id(),
-                                     rotation) < 0;
+      ret = add_property(plane->id(), plane->rotation_property().id(),
+                         rotation) < 0;
       if (ret) {
         ALOGE("Failed to add rotation property %d to plane %d",
               plane->rotation_property().id(), plane->id());
@@ -439,9 +511,7 @@ int DrmDisplayCompositor::CommitFrame(DrmDisplayComposition *display_comp,
     }
 
     if (plane->alpha_property().id()) {
-      ret = drmModeAtomicAddProperty(pset, plane->id(),
-                                     plane->alpha_property().id(),
-                                     alpha) < 0;
+      ret = add_property(plane->id(), plane->alpha_property().id(), alpha) < 0;
       if (ret) {
         ALOGE("Failed to add alpha property %d to plane %d",
               plane->alpha_property().id(), plane->id());
@@ -451,22 +521,71 @@ int DrmDisplayCompositor::CommitFrame(DrmDisplayComposition *display_comp,
   }
 
   if (!ret) {
-    uint32_t flags = DRM_MODE_ATOMIC_ALLOW_MODESET;
-    if (test_only)
+    // Only let the kernel modeset when we asked for one, so that a plain page
+    // flip never pulls other CRTCs into its commit. Routing a writeback
+    // connector is a modeset as well.
+    bool allow_modeset = mode.needs_modeset || writeback_buffer != NULL;
+    uint32_t flags = allow_modeset ? DRM_MODE_ATOMIC_ALLOW_MODESET : 0;
+    CompositorFlipHandler *flip_handler = NULL;
+    if (test_only) {
       flags |= DRM_MODE_ATOMIC_TEST_ONLY;
+    } else {
+      struct timespec ts;
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      int64_t commit_ns = ts.tv_sec * 1000 * 1000 * 1000 + ts.tv_nsec;
+      flip_handler = new CompositorFlipHandler(
+          present_history_, frame_timeline_, release_timeline_,
+          display_comp->release_point(),
+          display_comp->frame_no(), commit_ns,
+          vsync_worker_.GetNextVsyncNs(commit_ns),
+          vsync_worker_.GetVsyncPeriodNs());
+      flags |= DRM_MODE_PAGE_FLIP_EVENT;
+    }
 
-    ret = drmModeAtomicCommit(drm->fd(), pset, flags, drm);
+    std::unique_lock<std::shared_mutex> modeset_lock(drm->commit_lock(),
+                                                     std::defer_lock);
+    std::shared_lock<std::shared_mutex> flip_lock(drm->commit_lock(),
+                                                  std::defer_lock);
+    if (!test_only && allow_modeset)
+      modeset_lock.lock();
+    else if (!test_only)
+      flip_lock.lock();
+
+    DrmIoctlStats::Caller caller = DrmIoctlStats::kCommit;
+    if (test_only) {
+      caller = DrmIoctlStats::kTestCommit;
+      ++dump_frames_tested_;
+    } else if (allow_modeset) {
+      caller = DrmIoctlStats::kModesetCommit;
+    }
+    record.flags = flags;
+    record.ioctl_start_ns = NowNs();
+    // The event listener deletes the flip handler once the flip completes
+    ret = drm->ioctls().Call(DrmIoctlStats::kAtomic, caller, [&] {
+      return drmModeAtomicCommit(drm->fd(), pset, flags, flip_handler);
+    });
+    record.ioctl_end_ns = NowNs();
     if (ret) {
       if (!test_only)
         ALOGE("Failed to commit pset ret=%d\n", ret);
+      RecordCommit(&record, ret);
+      delete flip_handler;
       drmModeAtomicFree(pset);
       return ret;
     }
   }
+  RecordCommit(&record, ret);
   if (pset)
     drmModeAtomicFree(pset);
 
-  if (!test_only && mode_.needs_modeset) {
+  if (!test_only && mode.seamless) {
+    std::lock_guard<std::mutex> lk(mode_lock_);
+    connector->set_active_mode(mode_.mode);
+    mode_.seamless = false;
+  }
+
+  if (!test_only && mode.needs_modeset) {
+    std::lock_guard<std::mutex> lk(mode_lock_);
     ret = drm->DestroyPropertyBlob(mode_.old_blob_id);
     if (ret) {
       ALOGE("Failed to destroy old mode property blob %" PRIu32 "/%d",
@@ -485,6 +604,7 @@ int DrmDisplayCompositor::CommitFrame(DrmDisplayComposition *display_comp,
     mode_.old_blob_id = mode_.blob_id;
     mode_.blob_id = 0;
     mode_.needs_modeset = false;
+    drm->event_listener()->ResetDisplay(display_);
   }
 
   if (crtc->out_fence_ptr_property().id()) {
@@ -495,16 +615,16 @@ int DrmDisplayCompositor::CommitFrame(DrmDisplayComposition *display_comp,
 }
 
 int DrmDisplayCompositor::ApplyDpms(DrmDisplayComposition *display_comp) {
-  DrmDevice *drm = resource_manager_->GetDrmDevice(display_);
-  DrmConnector *conn = drm->GetConnectorForDisplay(display_);
-  if (!conn) {
-    ALOGE("Failed to get DrmConnector for display %d", display_);
-    return -ENODEV;
-  }
+  DrmDevice *drm = pipe_->device;
+  DrmConnector *conn = pipe_->connector;
 
   const DrmProperty &prop = conn->dpms_property();
-  int ret = drmModeConnectorSetProperty(drm->fd(), conn->id(), prop.id(),
-                                        display_comp->dpms_mode());
+  int ret = drm->ioctls().Call(DrmIoctlStats::kConnectorSetProperty,
+                               DrmIoctlStats::kDpms, [&] {
+                                 return drmModeConnectorSetProperty(
+                                     drm->fd(), conn->id(), prop.id(),
+                                     display_comp->dpms_mode());
+                               });
   if (ret) {
     ALOGE("Failed to set DPMS property for connector %d", conn->id());
     return ret;
@@ -519,7 +639,7 @@ std::tuple<int, uint32_t> DrmDisplayCompositor::CreateModeBlob(
   mode.ToDrmModeModeInfo(&drm_mode);
 
   uint32_t id = 0;
-  DrmDevice *drm = resource_manager_->GetDrmDevice(display_);
+  DrmDevice *drm = pipe_->device;
   int ret = drm->CreatePropertyBlob(&drm_mode, sizeof(struct drm_mode_modeinfo),
                                     &id);
   if (ret) {
@@ -531,30 +651,47 @@ std::tuple<int, uint32_t> DrmDisplayCompositor::CreateModeBlob(
 }
 
 void DrmDisplayCompositor::ClearDisplay() {
-  if (!active_composition_)
+  std::shared_ptr<DrmDisplayComposition> active =
+      std::atomic_load(&active_composition_);
+  if (!active)
     return;
 
-  if (DisablePlanes(active_composition_.get()))
+  if (DisablePlanes(active.get()))
     return;
 
-  active_composition_.reset(NULL);
+  std::atomic_store(&active_composition_,
+                    std::shared_ptr<DrmDisplayComposition>());
   vsync_worker_.VSyncControl(false);
 }
 
 void DrmDisplayCompositor::ApplyFrame(
     std::unique_ptr<DrmDisplayComposition> composition, int status,
-    bool writeback) {
+    bool writeback, int *out_fence) {
   AutoLock lock(&lock_, __func__);
-  if (lock.Lock())
-    return;
+  if (writeback) {
+    // A commit in flight means a new frame, don't make it wait on us
+    if (lock.TryLock()) {
+      ALOGV("Abort playing back scene, commit in progress");
+      ++flatten_aborted_;
+      return;
+    }
+  } else {
+    if (lock.Lock())
+      return;
+    flatten_countdown_ = FLATTEN_COUNTDOWN_INIT;
+  }
   int ret = status;
 
   if (!ret) {
-    if (writeback && !CountdownExpired()) {
+    if (writeback && (!CountdownExpired() ||
+                      flatten_generation_ != frame_generation_)) {
       ALOGE("Abort playing back scene");
+      ++flatten_aborted_;
       return;
     }
     ret = CommitFrame(composition.get(), false);
+    if (ret && !writeback && FallBackToModeset())
+      ret = CommitFrame(composition.get(), false);
   }
 
   if (ret) {
@@ -562,18 +699,41 @@ void DrmDisplayCompositor::ApplyFrame(
     // Disable the hw used by the last active composition. This allows us to
     // signal the release fences from that composition to avoid hanging.
     ClearDisplay();
+    release_timeline_->SignalUpTo(composition->release_point());
     return;
   }
-  ++dump_frames_composited_;
 
-  active_composition_.swap(composition);
+  if (out_fence)
+    *out_fence = composition->take_out_fence();
+  if (!writeback)
+    frame_timeline_->Stamp(composition->frame_no(), FrameTimeline::kCommit);
 
-  flatten_countdown_ = FLATTEN_COUNTDOWN_INIT;
+  // Keep the previous composition alive until we've dropped the lock, freeing
+  // its buffers goes back to the kernel.
+  std::shared_ptr<DrmDisplayComposition> previous = std::atomic_exchange(
+      &active_composition_,
+      std::shared_ptr<DrmDisplayComposition>(std::move(composition)));
+  if (!writeback)
+    ++frame_generation_;
+
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  int64_t now_ns = ts.tv_sec * 1000 * 1000 * 1000 + ts.tv_nsec;
+  if (writeback) {
+    ++flatten_committed_;
+    flattened_since_ns_ = now_ns;
+  } else if (flattened_since_ns_ >= 0) {
+    flattened_ns_ += now_ns - flattened_since_ns_;
+    flattened_since_ns_ = -1;
+  }
+  lock.Unlock();
+
+  ++dump_frames_composited_;
   vsync_worker_.VSyncControl(!writeback);
 }
 
 int DrmDisplayCompositor::ApplyComposition(
-    std::unique_ptr<DrmDisplayComposition> composition) {
+    std::unique_ptr<DrmDisplayComposition> composition, int *out_fence) {
   int ret = 0;
   switch (composition->type()) {
     case DRM_COMPOSITION_TYPE_FRAME:
@@ -581,25 +741,48 @@ int DrmDisplayCompositor::ApplyComposition(
         // Send the composition to the kernel to ensure we can commit it. This
         // is just a test, it won't actually commit the frame.
         ret = CommitFrame(composition.get(), true);
+        if (ret && FallBackToModeset())
+          ret = CommitFrame(composition.get(), true);
         if (ret) {
           ALOGE("Commit test failed for display %d, FIXME", display_);
+          // The previous frame stays on screen, and with it the buffers the
+          // release fences of this frame wait for. The next frame to flip
+          // signals its point and with it this one, as does DPMS off.
           return ret;
         }
+        frame_timeline_->Stamp(composition->frame_no(),
+                               FrameTimeline::kTestCommit);
       }
 
-      ApplyFrame(std::move(composition), ret);
+      ret = WaitForAcquireFences(composition.get());
+      ApplyFrame(std::move(composition), ret, false, out_fence);
       break;
     case DRM_COMPOSITION_TYPE_DPMS:
       active_ = (composition->dpms_mode() == DRM_MODE_DPMS_ON);
       ret = ApplyDpms(composition.get());
       if (ret)
         ALOGE("Failed to apply dpms for display %d", display_);
+      else if (active_)
+        pipe_->device->event_listener()->ResetDisplay(display_);
+      // No frame may follow to signal the points of buffers still held back,
+      // including the one deferred latches wait on. Nothing is scanned out
+      // anymore, so release them all now.
+      if (!active_)
+        release_timeline_->SignalUpTo(release_point_ + 1);
       return ret;
-    case DRM_COMPOSITION_TYPE_MODESET:
+    case DRM_COMPOSITION_TYPE_MODESET: {
+      std::lock_guard<std::mutex> lk(mode_lock_);
       mode_.mode = composition->display_mode();
+      // The CRTC is already lit with this mode, leave ACTIVE, MODE_ID and the
+      // routing as they are so the next frame is a plain page flip. The
+      // active mode is only updated once that frame is committed.
+      if (composition->seamless_mode() && !mode_.needs_modeset) {
+        mode_.seamless = true;
+        return 0;
+      }
+      mode_.seamless = false;
       if (mode_.blob_id)
-        resource_manager_->GetDrmDevice(display_)
-            ->DestroyPropertyBlob(mode_.blob_id);
+        pipe_->device->DestroyPropertyBlob(mode_.blob_id);
       std::tie(ret, mode_.blob_id) = CreateModeBlob(mode_.mode);
       if (ret) {
         ALOGE("Failed to create mode blob for display %d", display_);
@@ -607,6 +790,7 @@ int DrmDisplayCompositor::ApplyComposition(
       }
       mode_.needs_modeset = true;
       return 0;
+    }
     default:
       ALOGE("Unknown composition type %d", composition->type());
       return -EINVAL;
@@ -615,22 +799,152 @@ int DrmDisplayCompositor::ApplyComposition(
   return ret;
 }
 
+bool DrmDisplayCompositor::FallBackToModeset() {
+  std::lock_guard<std::mutex> lk(mode_lock_);
+  if (!mode_.seamless)
+    return false;
+  mode_.seamless = false;
+
+  ALOGW("Seamless mode rejected on display %d, falling back to a modeset",
+        display_);
+  int ret;
+  if (mode_.blob_id)
+    pipe_->device->DestroyPropertyBlob(mode_.blob_id);
+  std::tie(ret, mode_.blob_id) = CreateModeBlob(mode_.mode);
+  if (ret) {
+    ALOGE("Failed to create mode blob for display %d", display_);
+    return false;
+  }
+  mode_.needs_modeset = true;
+  return true;
+}
+
+int DrmDisplayCompositor::WaitForAcquireFences(
+    DrmDisplayComposition *display_comp) {
+  ATRACE_CALL();
+
+  std::vector<DrmHwcLayer> &layers = display_comp->layers();
+  std::vector<DrmHwcLayer *> waited_layers;
+  UniqueFd merged_fence;
+  for (DrmCompositionPlane &comp_plane : display_comp->composition_planes()) {
+    if (comp_plane.type() != DrmCompositionPlane::Type::kLayer ||
+        comp_plane.plane()->in_fence_fd_property().id() != 0)
+      continue;
+
+    for (size_t source_layer : comp_plane.source_layers()) {
+      if (source_layer >= layers.size())
+        continue;
+      DrmHwcLayer &layer = layers[source_layer];
+      int fence = layer.acquire_fence.get();
+      if (fence < 0)
+        continue;
+
+      if (merged_fence.get() < 0)
+        merged_fence.Set(dup(fence));
+      else
+        merged_fence.Set(sync_merge("hwc_acquire", merged_fence.get(), fence));
+      if (merged_fence.get() < 0) {
+        int ret = -errno;
+        ALOGE("Failed to merge acquire fences %d", ret);
+        return ret;
+      }
+      waited_layers.push_back(&layer);
+    }
+  }
+  if (merged_fence.get() < 0)
+    return 0;
+
+  int ret = 0;
+  for (int i = 0; i < kAcquireWaitTries; ++i) {
+    ret = sync_wait(merged_fence.get(), kAcquireWaitTimeoutMs);
+    if (!ret || errno != ETIME)
+      break;
+    ALOGW("Acquire fences of frame %" PRIu64 " pending for %d ms",
+          display_comp->frame_no(), (i + 1) * kAcquireWaitTimeoutMs);
+  }
+  if (ret) {
+    ALOGE("Failed to wait for acquire fences of frame %" PRIu64 " %d",
+          display_comp->frame_no(), -errno);
+    // The frame never gets to CommitFrame(), file it here
+    FlightRecord record;
+    record.Init(display_, display_comp, false);
+    record.result = -ETIMEDOUT;
+    flight_recorder_.Add(record);
+    DumpFlightRecorder("fence_timeout");
+    return -ETIMEDOUT;
+  }
+
+  for (DrmHwcLayer *layer : waited_layers)
+    layer->acquire_fence.Close();
+  return 0;
+}
+
+void DrmDisplayCompositor::RecordCommit(FlightRecord *record, int ret) {
+  record->result = ret;
+  flight_recorder_.Add(*record);
+
+  if (!record->test_only) {
+    if (ret)
+      DumpFlightRecorder("commit_failed");
+    return;
+  }
+  if (!ret) {
+    test_failures_ = 0;
+    return;
+  }
+  // Once per streak of failures
+  if (++test_failures_ == kFlightDumpTestFailures)
+    DumpFlightRecorder("test_failed");
+}
+
+void DrmDisplayCompositor::DumpFlightRecorder(const char *reason) {
+  if (flight_recorder_dir_.empty())
+    return;
+  int64_t now = NowNs();
+  int64_t last = last_flight_dump_ns_;
+  if (now - last < kFlightDumpIntervalNs ||
+      !last_flight_dump_ns_.compare_exchange_strong(last, now))
+    return;
+
+  // Take the records now, the ones leading up to the failure are about to
+  // be overwritten
+  std::string data;
+  flight_recorder_.Serialize(display_, reason, &data);
+  std::string path = flight_recorder_dir_ + "/hwc-flight-" +
+                     std::to_string(display_) + "-" + reason + ".bin";
+  ALOGE("Dumping the flight recorder of display %d to %s", display_,
+        path.c_str());
+  resource_manager_->task_worker()->Post(
+      [path, data] { FlightRecorder::WriteFile(path, data); });
+}
+
 int DrmDisplayCompositor::TestComposition(DrmDisplayComposition *composition) {
   return CommitFrame(composition, true);
 }
 
+int DrmDisplayCompositor::CreateReleaseFence(
+    DrmDisplayComposition *composition) {
+  composition->set_release_point(++release_point_);
+  return release_timeline_->CreateFence(release_point_);
+}
+
+int DrmDisplayCompositor::CreateNextReleaseFence() {
+  return release_timeline_->CreateFence(release_point_ + 1);
+}
+
 // Flatten a scene on the display by using a writeback connector
 // and returns the composition result as a DrmHwcLayer.
 int DrmDisplayCompositor::FlattenOnDisplay(
     std::unique_ptr<DrmDisplayComposition> &src, DrmConnector *writeback_conn,
     DrmMode &src_mode, DrmHwcLayer *writeback_layer) {
   int ret = 0;
-  DrmDevice *drm = resource_manager_->GetDrmDevice(display_);
+  DrmDevice *drm = pipe_->device;
   ret = writeback_conn->UpdateModes();
   if (ret) {
     ALOGE("Failed to update modes %d", ret);
     return ret;
   }
+  std::unique_lock<std::mutex> mode_lk(mode_lock_);
   for (const DrmMode &mode : writeback_conn->modes()) {
     if (mode.h_display() == src_mode.h_display() &&
         mode.v_display() == src_mode.v_display()) {
@@ -650,12 +964,9 @@ int DrmDisplayCompositor::FlattenOnDisplay(
     ALOGE("Failed to find similar mode");
     return -EINVAL;
   }
+  mode_lk.unlock();
 
-  DrmCrtc *crtc = drm->GetCrtcForDisplay(display_);
-  if (!crtc) {
-    ALOGE("Failed to find crtc for display %d", display_);
-    return -EINVAL;
-  }
+  DrmCrtc *crtc = pipe_->crtc;
   // TODO what happens if planes could go to both CRTCs, I don't think it's
   // handled anywhere
   std::vector<DrmPlane *> primary_planes;
@@ -685,25 +996,24 @@ int DrmDisplayCompositor::FlattenOnDisplay(
     i = overlay_planes.erase(i);
   }
 
-  AutoLock lock(&lock_, __func__);
-  ret = lock.Lock();
-  if (ret)
-    return ret;
   DrmFramebuffer *writeback_fb = &framebuffers_[framebuffer_index_];
   framebuffer_index_ = (framebuffer_index_ + 1) % DRM_DISPLAY_BUFFERS;
-  if (!writeback_fb->Allocate(mode_.mode.h_display(), mode_.mode.v_display())) {
+  if (!writeback_fb->Allocate(src_mode.h_display(), src_mode.v_display())) {
     ALOGE("Failed to allocate writeback buffer");
     return -ENOMEM;
   }
   DrmHwcBuffer *writeback_buffer = &writeback_layer->buffer;
   writeback_layer->sf_handle = writeback_fb->buffer()->handle;
-  ret = writeback_layer->ImportBuffer(
-      resource_manager_->GetImporter(display_).get());
+  ret = writeback_layer->ImportBuffer(pipe_->importer);
   if (ret) {
     ALOGE("Failed to import writeback buffer");
     return ret;
   }
 
+  AutoLock lock(&lock_, __func__);
+  ret = lock.Lock();
+  if (ret)
+    return ret;
   ret = CommitFrame(src.get(), true, writeback_conn, writeback_buffer);
   if (ret) {
     ALOGE("Atomic check failed");
@@ -714,6 +1024,7 @@ int DrmDisplayCompositor::FlattenOnDisplay(
     ALOGE("Atomic commit failed");
     return ret;
   }
+  lock.Unlock();
 
   ret = sync_wait(writeback_fence_, kWaitWritebackFence);
   writeback_layer->acquire_fence.Set(writeback_fence_);
@@ -736,20 +1047,26 @@ int DrmDisplayCompositor::FlattenSerial(DrmConnector *writeback_conn) {
   if (!writeback_comp)
     return -EINVAL;
 
-  AutoLock lock(&lock_, __func__);
-  int ret = lock.Lock();
-  if (ret)
-    return ret;
-  if (!CountdownExpired() || active_composition_->layers().size() < 2) {
+  flatten_generation_ = frame_generation_;
+  std::shared_ptr<DrmDisplayComposition> active =
+      std::atomic_load(&active_composition_);
+  if (!CountdownExpired() || !active || active->layers().size() < 2) {
     ALOGV("Flattening is not needed");
     return -EALREADY;
   }
 
+  // mode_ is written on the commit worker
+  DrmMode mode;
+  {
+    std::lock_guard<std::mutex> lk(mode_lock_);
+    mode = mode_.mode;
+  }
+
   DrmFramebuffer *writeback_fb = &framebuffers_[framebuffer_index_];
   framebuffer_index_ = (framebuffer_index_ + 1) % DRM_DISPLAY_BUFFERS;
-  lock.Unlock();
+  int ret;
 
-  if (!writeback_fb->Allocate(mode_.mode.h_display(), mode_.mode.v_display())) {
+  if (!writeback_fb->Allocate(mode.h_display(), mode.v_display())) {
     ALOGE("Failed to allocate writeback buffer");
     return -ENOMEM;
   }
@@ -757,12 +1074,11 @@ int DrmDisplayCompositor::FlattenSerial(DrmConnector *writeback_conn) {
 
   DrmHwcLayer &writeback_layer = writeback_comp->layers().back();
   writeback_layer.sf_handle = writeback_fb->buffer()->handle;
-  writeback_layer.source_crop = {0, 0, (float)mode_.mode.h_display(),
-                                 (float)mode_.mode.v_display()};
-  writeback_layer.display_frame = {0, 0, (int)mode_.mode.h_display(),
-                                   (int)mode_.mode.v_display()};
-  ret = writeback_layer.ImportBuffer(
-      resource_manager_->GetImporter(display_).get());
+  writeback_layer.source_crop = {0, 0, (float)mode.h_display(),
+                                 (float)mode.v_display()};
+  writeback_layer.display_frame = {0, 0, (int)mode.h_display(),
+                                   (int)mode.v_display()};
+  ret = writeback_layer.ImportBuffer(pipe_->importer);
   if (ret || writeback_comp->layers().size() != 1) {
     ALOGE("Failed to import writeback buffer");
     return ret;
@@ -773,23 +1089,38 @@ int DrmDisplayCompositor::FlattenSerial(DrmConnector *writeback_conn) {
     ALOGE("Failed to allocate property set");
     return -ENOMEM;
   }
-  DrmDevice *drm = resource_manager_->GetDrmDevice(display_);
-  DrmCrtc *crtc = drm->GetCrtcForDisplay(display_);
-  if (!crtc) {
-    ALOGE("Failed to find crtc for display %d", display_);
-    return -EINVAL;
-  }
+  DrmDevice *drm = pipe_->device;
+  DrmCrtc *crtc = pipe_->crtc;
   ret = SetupWritebackCommit(pset, crtc->id(), writeback_conn,
                              &writeback_layer.buffer);
   if (ret < 0) {
     ALOGE("Failed to Setup Writeback Commit");
+    drmModeAtomicFree(pset);
     return ret;
   }
-  ret = drmModeAtomicCommit(drm->fd(), pset, 0, drm);
+  AutoLock lock(&lock_, __func__);
+  ret = lock.TryLock();
+  if (ret) {
+    ALOGV("Abort flattening, commit in progress");
+    drmModeAtomicFree(pset);
+    return ret;
+  }
+  {
+    // Routes the writeback connector, which mustn't race other CRTCs' commits
+    std::unique_lock<std::shared_mutex> modeset_lock(drm->commit_lock());
+    ret = drm->ioctls().Call(DrmIoctlStats::kAtomic, DrmIoctlStats::kWriteback,
+                             [&] {
+                               return drmModeAtomicCommit(drm->fd(), pset, 0,
+                                                          drm);
+                             });
+  }
+  drmModeAtomicFree(pset);
   if (ret) {
     ALOGE("Failed to enable writeback %d", ret);
     return ret;
   }
+  lock.Unlock();
+
   ret = sync_wait(writeback_fence_, kWaitWritebackFence);
   writeback_layer.acquire_fence.Set(writeback_fence_);
   writeback_fence_ = -1;
@@ -800,13 +1131,11 @@ int DrmDisplayCompositor::FlattenSerial(DrmConnector *writeback_conn) {
 
   DrmCompositionPlane squashed_comp(DrmCompositionPlane::Type::kLayer, NULL,
                                     crtc);
-  for (auto &drmplane : drm->planes()) {
-    if (!drmplane->GetCrtcSupported(*crtc))
-      continue;
+  for (DrmPlane *drmplane : pipe_->planes) {
     if (!squashed_comp.plane() && drmplane->type() == DRM_PLANE_TYPE_PRIMARY)
-      squashed_comp.set_plane(drmplane.get());
+      squashed_comp.set_plane(drmplane);
     else
-      writeback_comp->AddPlaneDisable(drmplane.get());
+      writeback_comp->AddPlaneDisable(drmplane);
   }
   squashed_comp.source_layers().push_back(0);
   ret = writeback_comp->AddPlaneComposition(std::move(squashed_comp));
@@ -844,18 +1173,24 @@ int DrmDisplayCompositor::FlattenConcurrent(DrmConnector *writeback_conn) {
 
   if (!copy_comp || !writeback_comp)
     return -EINVAL;
-  AutoLock lock(&lock_, __func__);
-  ret = lock.Lock();
-  if (ret)
-    return ret;
-  if (!CountdownExpired() || active_composition_->layers().size() < 2) {
+  flatten_generation_ = frame_generation_;
+  std::shared_ptr<DrmDisplayComposition> active =
+      std::atomic_load(&active_composition_);
+  if (!CountdownExpired() || !active || active->layers().size() < 2) {
     ALOGV("Flattening is not needed");
     return -EALREADY;
   }
-  DrmCrtc *crtc = active_composition_->crtc();
+  DrmCrtc *crtc = active->crtc();
+
+  // mode_ is written on the commit worker
+  DrmMode mode;
+  {
+    std::lock_guard<std::mutex> lk(mode_lock_);
+    mode = mode_.mode;
+  }
 
   std::vector<DrmHwcLayer> copy_layers;
-  for (DrmHwcLayer &src_layer : active_composition_->layers()) {
+  for (DrmHwcLayer &src_layer : active->layers()) {
     DrmHwcLayer copy;
     ret = copy.InitFromDrmHwcLayer(
         &src_layer,
@@ -872,10 +1207,9 @@ int DrmDisplayCompositor::FlattenConcurrent(DrmConnector *writeback_conn) {
     return ret;
   }
 
-  lock.Unlock();
   DrmHwcLayer writeback_layer;
   ret = drmdisplaycompositor.FlattenOnDisplay(copy_comp, writeback_conn,
-                                              mode_.mode, &writeback_layer);
+                                              mode, &writeback_layer);
   if (ret) {
     ALOGE("Failed to flatten on display ret = %d", ret);
     return ret;
@@ -883,23 +1217,21 @@ int DrmDisplayCompositor::FlattenConcurrent(DrmConnector *writeback_conn) {
 
   DrmCompositionPlane squashed_comp(DrmCompositionPlane::Type::kLayer, NULL,
                                     crtc);
-  for (auto &drmplane : resource_manager_->GetDrmDevice(display_)->planes()) {
-    if (!drmplane->GetCrtcSupported(*crtc))
-      continue;
+  for (DrmPlane *drmplane : pipe_->planes) {
     if (drmplane->type() == DRM_PLANE_TYPE_PRIMARY)
-      squashed_comp.set_plane(drmplane.get());
+      squashed_comp.set_plane(drmplane);
     else
-      writeback_comp->AddPlaneDisable(drmplane.get());
+      writeback_comp->AddPlaneDisable(drmplane);
   }
   writeback_comp->layers().emplace_back();
   DrmHwcLayer &next_layer = writeback_comp->layers().back();
   next_layer.sf_handle = writeback_layer.get_usable_handle();
   next_layer.blending = DrmHwcBlending::kPreMult;
-  next_layer.source_crop = {0, 0, (float)mode_.mode.h_display(),
-                            (float)mode_.mode.v_display()};
-  next_layer.display_frame = {0, 0, (int)mode_.mode.h_display(),
-                              (int)mode_.mode.v_display()};
-  ret = next_layer.ImportBuffer(resource_manager_->GetImporter(display_).get());
+  next_layer.source_crop = {0, 0, (float)mode.h_display(),
+                            (float)mode.v_display()};
+  next_layer.display_frame = {0, 0, (int)mode.h_display(),
+                              (int)mode.v_display()};
+  ret = next_layer.ImportBuffer(pipe_->importer);
   if (ret) {
     ALOGE("Failed to import framebuffer for display %d", ret);
     return ret;
@@ -917,18 +1249,25 @@ int DrmDisplayCompositor::FlattenConcurrent(DrmConnector *writeback_conn) {
 int DrmDisplayCompositor::FlattenActiveComposition() {
   DrmConnector *writeback_conn =
       resource_manager_->AvailableWritebackConnector(display_);
-  if (!active_composition_ || !writeback_conn) {
+  if (!std::atomic_load(&active_composition_) || !writeback_conn) {
     ALOGV("No writeback connector available");
     return -EINVAL;
   }
 
+  bool idle = false;
+  if (!flattening_.compare_exchange_strong(idle, true))
+    return -EALREADY;
+  ++flatten_attempts_;
+
+  int ret;
   if (writeback_conn->display() != display_) {
-    return FlattenConcurrent(writeback_conn);
+    ret = FlattenConcurrent(writeback_conn);
   } else {
-    return FlattenSerial(writeback_conn);
+    ret = FlattenSerial(writeback_conn);
   }
 
-  return 0;
+  flattening_ = false;
+  return ret;
 }
 
 bool DrmDisplayCompositor::CountdownExpired() const {
@@ -936,44 +1275,49 @@ bool DrmDisplayCompositor::CountdownExpired() const {
 }
 
 void DrmDisplayCompositor::Vsync(int display, int64_t timestamp) {
-  AutoLock lock(&lock_, __func__);
-  if (lock.Lock())
+  if (--flatten_countdown_ > 0)
     return;
-  flatten_countdown_--;
-  if (!CountdownExpired())
-    return;
-  lock.Unlock();
-  int ret = FlattenActiveComposition();
-  ALOGV("scene flattening triggered for display %d at timestamp %" PRIu64
-        " result = %d \n",
-        display, timestamp, ret);
+
+  // Flattening waits on the writeback fence, keep it off the event loop. Only
+  // one request is ever queued however many vsyncs go by.
+  flatten_task_ = resource_manager_->task_worker()->PostCoalesced(
+      flatten_task_key_, TaskQueueWorker::Now(), [this, display, timestamp] {
+        int ret = FlattenActiveComposition();
+        ALOGV("scene flattening triggered for display %d at timestamp %" PRIu64
+              " result = %d \n",
+              display, timestamp, ret);
+      });
 }
 
 void DrmDisplayCompositor::Dump(std::ostringstream *out) const {
-  int ret = pthread_mutex_lock(&lock_);
-  if (ret)
-    return;
-
-  uint64_t num_frames = dump_frames_composited_;
-  dump_frames_composited_ = 0;
-
   struct timespec ts;
-  ret = clock_gettime(CLOCK_MONOTONIC, &ts);
-  if (ret) {
-    pthread_mutex_unlock(&lock_);
+  int ret = clock_gettime(CLOCK_MONOTONIC, &ts);
+  if (ret)
     return;
-  }
 
+  uint64_t num_frames = dump_frames_composited_.exchange(0);
   uint64_t cur_ts = ts.tv_sec * 1000 * 1000 * 1000 + ts.tv_nsec;
-  uint64_t num_ms = (cur_ts - dump_last_timestamp_ns_) / (1000 * 1000);
+  uint64_t last_ts = dump_last_timestamp_ns_.exchange(cur_ts);
+  uint64_t num_ms = (cur_ts - last_ts) / (1000 * 1000);
   float fps = num_ms ? (num_frames * 1000.0f) / (num_ms) : 0.0f;
 
   *out << "--DrmDisplayCompositor[" << display_
        << "]: num_frames=" << num_frames << " num_ms=" << num_ms
-       << " fps=" << fps << "\n";
-
-  dump_last_timestamp_ns_ = cur_ts;
-
-  pthread_mutex_unlock(&lock_);
+       << " fps=" << fps
+       << " vsync_period_ns=" << vsync_worker_.GetVsyncPeriodNs()
+       << " tested_frames=" << dump_frames_tested_.exchange(0)
+       << " deferred_latches=" << deferred_latches_ << "\n";
+  *out << "    flatten: attempts=" << flatten_attempts_
+       << " committed=" << flatten_committed_
+       << " aborted=" << flatten_aborted_
+       << " flattened_ms=" << flattened_ns_ / (1000 * 1000) << "\n";
+  present_history_->Dump(out);
+  frame_timeline_->Dump(out);
+  flight_recorder_.Dump(out);
+
+  std::shared_ptr<DrmDisplayComposition> active =
+      std::atomic_load(&active_composition_);
+  if (active)
+    active->Dump(out);
 }
 }
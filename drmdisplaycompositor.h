@@ -20,11 +20,17 @@
 #include "drmhwcomposer.h"
 #include "drmdisplaycomposition.h"
 #include "drmframebuffer.h"
+#include "flightrecorder.h"
+#include "frametimeline.h"
+#include "presenthistory.h"
 #include "resourcemanager.h"
+#include "synctimeline.h"
 #include "vsyncworker.h"
 
 #include <pthread.h>
+#include <atomic>
 #include <memory>
+#include <mutex>
 #include <sstream>
 #include <tuple>
 
@@ -50,17 +56,42 @@ class DrmDisplayCompositor {
 
   std::unique_ptr<DrmDisplayComposition> CreateComposition() const;
   std::unique_ptr<DrmDisplayComposition> CreateInitializedComposition() const;
-  int ApplyComposition(std::unique_ptr<DrmDisplayComposition> composition);
+  // If out_fence is given, it receives the out fence of a committed frame
+  int ApplyComposition(std::unique_ptr<DrmDisplayComposition> composition,
+                       int *out_fence = NULL);
   int TestComposition(DrmDisplayComposition *composition);
+  // Gives composition the next point on the release timeline and returns a
+  // fence for it, which signals once composition's frame is on screen and the
+  // buffers of the frame before it are free again. Returns -1 if there's no
+  // release timeline.
+  int CreateReleaseFence(DrmDisplayComposition *composition);
+  // Fence for the point of the composition after the last one given out
+  int CreateNextReleaseFence();
+  bool release_fences_supported() const {
+    return release_timeline_->valid();
+  }
+  // Layers of a frame which kept their previous buffer, for the dump
+  void CountDeferredLatches(uint32_t count) {
+    deferred_latches_ += count;
+  }
   int Composite();
   void Dump(std::ostringstream *out) const;
   void Vsync(int display, int64_t timestamp);
 
   std::tuple<uint32_t, uint32_t, int> GetActiveModeResolution();
 
+  const PresentHistory &present_history() const {
+    return *present_history_;
+  }
+  FrameTimeline *frame_timeline() {
+    return frame_timeline_.get();
+  }
+
  private:
   struct ModeState {
     bool needs_modeset = false;
+    // mode is taken over from the bootloader, until a commit goes through
+    bool seamless = false;
     DrmMode mode;
     uint32_t blob_id = 0;
     uint32_t old_blob_id = 0;
@@ -72,6 +103,10 @@ class DrmDisplayCompositor {
   // kAcquireWaitTries times, logging a warning in between.
   static const int kAcquireWaitTries = 5;
   static const int kAcquireWaitTimeoutMs = 100;
+  // Consecutive failed test commits which get the flight recorder dumped
+  static const int kFlightDumpTestFailures = 8;
+  // Failures tend to come in storms, dump at most once per interval
+  static const int64_t kFlightDumpIntervalNs = 10ll * 1000 * 1000 * 1000;
 
   int CommitFrame(DrmDisplayComposition *display_comp, bool test_only,
                   DrmConnector *writeback_conn = NULL,
@@ -79,12 +114,21 @@ class DrmDisplayCompositor {
   int SetupWritebackCommit(drmModeAtomicReqPtr pset, uint32_t crtc_id,
                            DrmConnector *writeback_conn,
                            DrmHwcBuffer *writeback_buffer);
+  // Waits in userspace for the acquire fences of layers on planes that can't
+  // take an IN_FENCE_FD, and drops them from the composition once signaled.
+  // Runs on the commit path, never on the caller of ApplyComposition().
+  int WaitForAcquireFences(DrmDisplayComposition *display_comp);
+  // Files the outcome of a commit with the flight recorder, and has it dumped
+  // if that's a failure worth looking into
+  void RecordCommit(FlightRecord *record, int ret);
+  // Writes the flight recorder to flight_recorder_dir_ from the task worker
+  void DumpFlightRecorder(const char *reason);
   int ApplyDpms(DrmDisplayComposition *display_comp);
   int DisablePlanes(DrmDisplayComposition *display_comp);
 
   void ClearDisplay();
   void ApplyFrame(std::unique_ptr<DrmDisplayComposition> composition,
-                  int status, bool writeback = false);
+                  int status, bool writeback = false, int *out_fence = NULL);
   int FlattenActiveComposition();
   int FlattenSerial(DrmConnector *writeback_conn);
   int FlattenConcurrent(DrmConnector *writeback_conn);
@@ -95,31 +139,74 @@ class DrmDisplayCompositor {
   bool CountdownExpired() const;
 
   std::tuple<int, uint32_t> CreateModeBlob(const DrmMode &mode);
+  // Turns a seamless mode the kernel rejected into a full modeset, returns
+  // whether there was one to retry the commit with
+  bool FallBackToModeset();
 
   ResourceManager *resource_manager_;
   int display_;
+  // Resolved by Init(), the frame path goes through it only
+  DrmDisplayPipe *pipe_ = NULL;
 
-  std::unique_ptr<DrmDisplayComposition> active_composition_;
+  // Only ever accessed through std::atomic_load/atomic_store, readers take a
+  // reference and never need lock_.
+  std::shared_ptr<DrmDisplayComposition> active_composition_;
 
   bool initialized_;
   bool active_;
   bool use_hw_overlays_;
 
+  // Written on the commit path only, mode_lock_ lets test commits built on
+  // other threads take a consistent snapshot.
   ModeState mode_;
+  std::mutex mode_lock_;
 
   int framebuffer_index_;
   DrmFramebuffer framebuffers_[DRM_DISPLAY_BUFFERS];
 
-  // mutable since we need to acquire in Dump()
-  mutable pthread_mutex_t lock_;
+  // Serializes this display's commits to the kernel, mode_ is guarded by
+  // mode_lock_ instead. Only held around the commit itself, never while
+  // waiting on a fence.
+  pthread_mutex_t lock_;
 
   // State tracking progress since our last Dump(). These are mutable since
   // we need to reset them on every Dump() call.
-  mutable uint64_t dump_frames_composited_;
-  mutable uint64_t dump_last_timestamp_ns_;
+  alignas(64) mutable std::atomic<uint64_t> dump_frames_composited_;
+  alignas(64) mutable std::atomic<uint64_t> dump_last_timestamp_ns_;
+  mutable std::atomic<uint64_t> dump_frames_tested_;
   VSyncWorker vsync_worker_;
-  int64_t flatten_countdown_;
+  // Decremented on the event loop every vsync, reset by the present path
+  alignas(64) std::atomic<int64_t> flatten_countdown_;
+  // Bumped every time a new frame from SurfaceFlinger is committed, a flatten
+  // result is thrown away if this changed since it sampled the scene.
+  alignas(64) std::atomic<uint64_t> frame_generation_;
+  uint64_t flatten_generation_;
+  std::atomic<bool> flattening_;
+  // Flattening runs on the resource manager's task worker
+  std::string flatten_task_key_;
+  std::atomic<uint64_t> flatten_task_;
+  // Lifetime flattening counters. A flattened scene stays up until the next
+  // frame from SurfaceFlinger, the time it was up is what flattening bought.
+  std::atomic<uint64_t> flatten_attempts_;
+  std::atomic<uint64_t> flatten_committed_;
+  std::atomic<uint64_t> flatten_aborted_;
+  std::atomic<uint64_t> flattened_ns_;
+  // Under lock_, -1 unless the active composition is a flattened one
+  int64_t flattened_since_ns_;
   std::unique_ptr<Planner> planner_;
+  // Shared with the page flip handlers of in-flight commits
+  std::shared_ptr<PresentHistory> present_history_;
+  std::shared_ptr<FrameTimeline> frame_timeline_;
+  FlightRecorder flight_recorder_;
+  // hwc.drm.flight_recorder_dir, dumps are disabled when empty
+  std::string flight_recorder_dir_;
+  std::atomic<int> test_failures_;
+  std::atomic<int64_t> last_flight_dump_ns_;
+  std::shared_ptr<SyncTimeline> release_timeline_;
+  // Last point handed out on release_timeline_. Only written on the present
+  // path before queueing a composition, so the commit worker may read it.
+  uint32_t release_point_;
+  std::atomic<uint64_t> deferred_latches_;
   int writeback_fence_;
 };
 }
@@ -19,11 +19,17 @@
 #include "drmdevice.h"
 #include "drmeventlistener.h"
 
-#include <assert.h>
 #include <errno.h>
 #include <linux/netlink.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <time.h>
 
+#include <cutils/properties.h>
 #include <log/log.h>
 #include <hardware/hardware.h>
 #include <hardware/hwcomposer.h>
@@ -31,12 +37,97 @@
 
 namespace android {
 
+static const int kMaxEpollEvents = 16;
+static const int64_t kOneSecondNs = 1 * 1000 * 1000 * 1000;
+
+// Number of consecutive hardware vblanks the model has to agree with before
+// the vblank interrupt is turned off in favour of predicted vsyncs.
+static const int kResyncVblanks = 8;
+// Number of predicted vsyncs after which we go back to hardware vblanks to
+// check the model is still in sync.
+static const int kMaxPredictedVsyncs = 120;
+// Predictions older than this are not trusted when vsync is re-enabled.
+static const int64_t kMaxPredictionAgeNs = kOneSecondNs;
+
+static int EpollAdd(int epoll_fd, int fd, uint32_t events) {
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = events;
+  ev.data.fd = fd;
+  if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev))
+    return -errno;
+  return 0;
+}
+
+static int64_t MonotonicNowNs() {
+  struct timespec ts;
+  if (clock_gettime(CLOCK_MONOTONIC, &ts))
+    return -1;
+  return (int64_t)ts.tv_sec * kOneSecondNs + (int64_t)ts.tv_nsec;
+}
+
+/*
+ * Returns the timestamp of the next vsync in phase with last_timestamp.
+ * For example:
+ *  last_timestamp = 137
+ *  frame_ns = 50
+ *  current = 683
+ *
+ *  ret = (50 * ((683 - 137)/50 + 1)) + 137
+ *  ret = 687
+ *
+ *  Thus, we must sleep until timestamp 687 to maintain phase with the last
+ *  timestamp.
+ */
+static int64_t GetPhasedVSync(int64_t frame_ns, int64_t current,
+                              int64_t last_timestamp) {
+  if (last_timestamp < 0)
+    return current + frame_ns;
+
+  return frame_ns * ((current - last_timestamp) / frame_ns + 1) +
+         last_timestamp;
+}
+
+static int64_t NominalPeriodNs(DrmDevice *drm, int display) {
+  float refresh = 60.0f;  // Default to 60Hz refresh rate
+  DrmConnector *conn = drm->GetConnectorForDisplay(display);
+  if (conn && conn->active_mode().v_refresh() != 0.0f)
+    refresh = conn->active_mode().v_refresh();
+  else
+    ALOGW("Vsync active with conn=%p refresh=%f\n", conn,
+          conn ? conn->active_mode().v_refresh() : 0.0f);
+  return kOneSecondNs / refresh;
+}
+
 DrmEventListener::DrmEventListener(DrmDevice *drm)
     : Worker("drm-event-listener", HAL_PRIORITY_URGENT_DISPLAY), drm_(drm) {
 }
 
+DrmEventListener::~DrmEventListener() {
+  // Exit() must run while we are still a DrmEventListener, otherwise the base
+  // destructor can't kick the loop out of epoll_wait.
+  Exit();
+}
+
 int DrmEventListener::Init() {
-  uevent_fd_.Set(socket(PF_NETLINK, SOCK_DGRAM, NETLINK_KOBJECT_UEVENT));
+  char prediction_prop[PROPERTY_VALUE_MAX];
+  property_get("hwc.drm.vsync_prediction", prediction_prop, "1");
+  vsync_prediction_ = atoi(prediction_prop);
+
+  epoll_fd_.Set(epoll_create1(EPOLL_CLOEXEC));
+  if (epoll_fd_.get() < 0) {
+    ALOGE("Failed to create epoll fd %d", -errno);
+    return -errno;
+  }
+
+  wake_fd_.Set(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC));
+  if (wake_fd_.get() < 0) {
+    ALOGE("Failed to create wake eventfd %d", -errno);
+    return -errno;
+  }
+
+  uevent_fd_.Set(socket(PF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                        NETLINK_KOBJECT_UEVENT));
   if (uevent_fd_.get() < 0) {
     ALOGE("Failed to open uevent socket %d", uevent_fd_.get());
     return uevent_fd_.get();
@@ -54,19 +145,309 @@ int DrmEventListener::Init() {
     return -errno;
   }
 
-  FD_ZERO(&fds_);
-  FD_SET(drm_->fd(), &fds_);
-  FD_SET(uevent_fd_.get(), &fds_);
-  max_fd_ = std::max(drm_->fd(), uevent_fd_.get());
+  for (int fd : {wake_fd_.get(), drm_->fd(), uevent_fd_.get()}) {
+    ret = EpollAdd(epoll_fd_.get(), fd, EPOLLIN);
+    if (ret) {
+      ALOGE("Failed to add fd %d to epoll %d", fd, ret);
+      return ret;
+    }
+  }
 
   return InitWorker();
 }
 
-void DrmEventListener::RegisterHotplugHandler(DrmEventHandler *handler) {
-  assert(!hotplug_handler_);
+void DrmEventListener::Signal() {
+  uint64_t one = 1;
+  if (wake_fd_.get() >= 0 && write(wake_fd_.get(), &one, sizeof(one)) < 0)
+    ALOGE("Failed to wake event listener %d", -errno);
+  Worker::Signal();
+}
+
+void DrmEventListener::RegisterHotplugHandler(HotplugHandler handler) {
+  std::lock_guard<std::mutex> lk(mutex_);
   hotplug_handler_ = handler;
 }
 
+int DrmEventListener::AddFdLocked(int fd, uint32_t events, FdHandler handler) {
+  if (fd_handlers_.count(fd))
+    return -EEXIST;
+
+  int ret = EpollAdd(epoll_fd_.get(), fd, events);
+  if (ret) {
+    ALOGE("Failed to add fd %d to epoll %d", fd, ret);
+    return ret;
+  }
+  fd_handlers_[fd] = std::move(handler);
+  return 0;
+}
+
+int DrmEventListener::RegisterFdHandler(int fd, uint32_t events,
+                                        FdHandler handler) {
+  std::lock_guard<std::mutex> lk(mutex_);
+  return AddFdLocked(fd, events, std::move(handler));
+}
+
+void DrmEventListener::UnregisterFdHandler(int fd) {
+  {
+    std::lock_guard<std::mutex> lk(mutex_);
+    if (!fd_handlers_.erase(fd))
+      return;
+    epoll_ctl(epoll_fd_.get(), EPOLL_CTL_DEL, fd, NULL);
+  }
+  // Wait out a handler which may be running right now
+  std::lock_guard<std::recursive_mutex> lk(dispatch_lock_);
+}
+
+DrmEventListener::VblankState *DrmEventListener::GetVblankStateLocked(
+    int display) {
+  VblankState &state = vblank_[display];
+  if (!state.listener) {
+    state.listener = this;
+    state.display = display;
+  }
+  return &state;
+}
+
+int DrmEventListener::RegisterVblankHandler(int display,
+                                            DrmVblankHandler *handler) {
+  std::lock_guard<std::mutex> lk(mutex_);
+  VblankState *state = GetVblankStateLocked(display);
+  state->handlers.push_back(handler);
+  if (!handler->vblank_enabled())
+    return 0;
+  return QueueVblankLocked(state);
+}
+
+void DrmEventListener::UnregisterVblankHandler(int display,
+                                               DrmVblankHandler *handler) {
+  {
+    std::lock_guard<std::mutex> lk(mutex_);
+    auto state = vblank_.find(display);
+    if (state == vblank_.end())
+      return;
+    std::vector<DrmVblankHandler *> &handlers = state->second.handlers;
+    handlers.erase(std::remove(handlers.begin(), handlers.end(), handler),
+                   handlers.end());
+  }
+  std::lock_guard<std::recursive_mutex> lk(dispatch_lock_);
+}
+
+void DrmEventListener::RequestVblank(int display) {
+  std::lock_guard<std::mutex> lk(mutex_);
+  auto state = vblank_.find(display);
+  if (state == vblank_.end())
+    return;
+
+  VblankState *vblank = &state->second;
+  if (vblank->predicting && !vblank->pending &&
+      MonotonicNowNs() - vblank->last_timestamp_ns > kMaxPredictionAgeNs) {
+    vblank->predicting = false;
+    vblank->hw_samples = 0;
+  }
+  QueueVblankLocked(vblank);
+}
+
+void DrmEventListener::ResetDisplay(int display) {
+  std::lock_guard<std::mutex> lk(mutex_);
+  auto state = vblank_.find(display);
+  if (state == vblank_.end())
+    return;
+
+  VblankState *vblank = &state->second;
+  vblank->crtc = NULL;
+  // The CRTC may deliver vblank events now
+  vblank->synthetic = false;
+  vblank->predicting = false;
+  vblank->hw_samples = 0;
+  vblank->predicted_vsyncs = 0;
+  vblank->model.Reset();
+}
+
+int64_t DrmEventListener::GetVsyncPeriodNs(int display) {
+  std::lock_guard<std::mutex> lk(mutex_);
+  VblankState *state = GetVblankStateLocked(display);
+  state->model.SetNominalPeriod(NominalPeriodNs(drm_, display));
+  return state->model.period();
+}
+
+int64_t DrmEventListener::GetNextVsyncNs(int display, int64_t timestamp_ns) {
+  std::lock_guard<std::mutex> lk(mutex_);
+  VblankState *state = GetVblankStateLocked(display);
+  if (state->model.confident())
+    return state->model.PredictNext(timestamp_ns);
+  if (state->last_timestamp_ns < 0)
+    return -1;
+  return GetPhasedVSync(state->model.nominal_period(), timestamp_ns,
+                        state->last_timestamp_ns);
+}
+
+int DrmEventListener::QueueVblankLocked(VblankState *state) {
+  if (state->pending)
+    return 0;
+  if (state->synthetic || state->predicting)
+    return QueueSyntheticVblankLocked(state);
+
+  if (!state->crtc)
+    state->crtc = drm_->GetCrtcForDisplay(state->display);
+  DrmCrtc *crtc = state->crtc;
+  if (!crtc) {
+    ALOGE("Failed to get crtc for display %d", state->display);
+    return -ENODEV;
+  }
+
+  int ret = -EINVAL;
+  if (queue_sequence_supported_) {
+    // errno is taken inside the call, tracing may clobber it
+    ret = drm_->ioctls().Call(DrmIoctlStats::kCrtcQueueSequence,
+                              DrmIoctlStats::kVblank, [&] {
+                                return drmCrtcQueueSequence(
+                                           drm_->fd(), crtc->id(),
+                                           DRM_CRTC_SEQUENCE_RELATIVE, 1, NULL,
+                                           (uint64_t)(uintptr_t)state)
+                                           ? -errno
+                                           : 0;
+                              });
+    // Kernels without CRTC_QUEUE_SEQUENCE, fall back to vblank events. A CRTC
+    // which is off fails with -EINVAL, that only concerns this display.
+    if (ret == -ENOTTY || ret == -EOPNOTSUPP)
+      queue_sequence_supported_ = false;
+  }
+
+  if (ret && !queue_sequence_supported_) {
+    uint32_t high_crtc = (crtc->pipe() << DRM_VBLANK_HIGH_CRTC_SHIFT);
+
+    drmVBlank vblank;
+    memset(&vblank, 0, sizeof(vblank));
+    vblank.request.type =
+        (drmVBlankSeqType)(DRM_VBLANK_RELATIVE | DRM_VBLANK_EVENT |
+                           (high_crtc & DRM_VBLANK_HIGH_CRTC_MASK));
+    vblank.request.sequence = 1;
+    vblank.request.signal = (unsigned long)state;
+    ret = drm_->ioctls().Call(DrmIoctlStats::kWaitVblank,
+                              DrmIoctlStats::kVblank, [&] {
+                                return drmWaitVBlank(drm_->fd(), &vblank)
+                                           ? -errno
+                                           : 0;
+                              });
+  }
+
+  if (ret) {
+    ALOGW("No vblank events for display %d (%d), using synthetic vsync",
+          state->display, ret);
+    state->synthetic = true;
+    return QueueSyntheticVblankLocked(state);
+  }
+
+  state->pending = true;
+  return 0;
+}
+
+int DrmEventListener::QueueSyntheticVblankLocked(VblankState *state) {
+  int display = state->display;
+  int ret;
+  if (state->timer_fd.get() < 0) {
+    state->timer_fd.Set(
+        timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC));
+    if (state->timer_fd.get() < 0) {
+      ALOGE("Failed to create vsync timer %d", -errno);
+      return -errno;
+    }
+
+    int timer_fd = state->timer_fd.get();
+    ret = AddFdLocked(timer_fd, EPOLLIN, [this, display,
+                                          timer_fd](uint32_t /* events */) {
+      uint64_t expirations;
+      if (read(timer_fd, &expirations, sizeof(expirations)) < 0)
+        return;
+
+      int64_t timestamp;
+      {
+        std::lock_guard<std::mutex> lk(mutex_);
+        timestamp = vblank_[display].synthetic_deadline_ns;
+      }
+      DispatchVblank(display, timestamp, false);
+    });
+    if (ret) {
+      state->timer_fd.Close();
+      return ret;
+    }
+  }
+
+  state->model.SetNominalPeriod(NominalPeriodNs(drm_, display));
+
+  int64_t now = MonotonicNowNs();
+  int64_t deadline;
+  if (state->model.confident())
+    deadline = state->model.PredictNext(now);
+  else
+    deadline = GetPhasedVSync(state->model.nominal_period(), now,
+                              state->last_timestamp_ns);
+
+  struct itimerspec its;
+  memset(&its, 0, sizeof(its));
+  its.it_value.tv_sec = deadline / kOneSecondNs;
+  its.it_value.tv_nsec = deadline % kOneSecondNs;
+  ret = timerfd_settime(state->timer_fd.get(), TFD_TIMER_ABSTIME, &its, NULL);
+  if (ret) {
+    ALOGE("Failed to arm vsync timer %d", -errno);
+    return -errno;
+  }
+
+  state->synthetic_deadline_ns = deadline;
+  state->pending = true;
+  return 0;
+}
+
+void DrmEventListener::UpdateModelLocked(VblankState *state,
+                                         int64_t timestamp_ns, bool hardware) {
+  if (!hardware) {
+    // Back to hardware vblanks every so often to check for drift
+    if (state->predicting && ++state->predicted_vsyncs >= kMaxPredictedVsyncs) {
+      state->predicting = false;
+      state->hw_samples = 0;
+    }
+    return;
+  }
+
+  state->model.SetNominalPeriod(NominalPeriodNs(drm_, state->display));
+  state->model.AddSample(timestamp_ns);
+  if (!state->model.confident()) {
+    state->hw_samples = 0;
+    return;
+  }
+
+  if (vsync_prediction_ && ++state->hw_samples >= kResyncVblanks) {
+    state->predicting = true;
+    state->predicted_vsyncs = 0;
+  }
+}
+
+void DrmEventListener::DispatchVblank(int display, int64_t timestamp_ns,
+                                      bool hardware) {
+  std::vector<DrmVblankHandler *> handlers;
+  {
+    std::lock_guard<std::mutex> lk(mutex_);
+    VblankState &state = vblank_[display];
+    state.pending = false;
+    state.last_timestamp_ns = timestamp_ns;
+    UpdateModelLocked(&state, timestamp_ns, hardware);
+    handlers = state.handlers;
+  }
+
+  for (DrmVblankHandler *handler : handlers)
+    if (handler->vblank_enabled())
+      handler->HandleVblank(timestamp_ns);
+
+  std::lock_guard<std::mutex> lk(mutex_);
+  VblankState &state = vblank_[display];
+  for (DrmVblankHandler *handler : state.handlers) {
+    if (handler->vblank_enabled()) {
+      QueueVblankLocked(&state);
+      break;
+    }
+  }
+}
+
 void DrmEventListener::FlipHandler(int /* fd */, unsigned int /* sequence */,
                                    unsigned int tv_sec, unsigned int tv_usec,
                                    void *user_data) {
@@ -78,61 +459,126 @@ void DrmEventListener::FlipHandler(int /* fd */, unsigned int /* sequence */,
   delete handler;
 }
 
+void DrmEventListener::VblankHandler(int /* fd */, unsigned int /* sequence */,
+                                     unsigned int tv_sec, unsigned int tv_usec,
+                                     void *user_data) {
+  VblankState *state = (VblankState *)user_data;
+  if (!state)
+    return;
+
+  state->listener->DispatchVblank(state->display,
+                                  (int64_t)tv_sec * kOneSecondNs +
+                                      (int64_t)tv_usec * 1000,
+                                  true);
+}
+
+void DrmEventListener::SequenceHandler(int /* fd */, uint64_t /* sequence */,
+                                       uint64_t ns, uint64_t user_data) {
+  VblankState *state = (VblankState *)(uintptr_t)user_data;
+  if (!state)
+    return;
+
+  state->listener->DispatchVblank(state->display, (int64_t)ns, true);
+}
+
+void DrmEventListener::DrmHandler() {
+  drmEventContext event_context = {
+      .version = 4,
+      .vblank_handler = DrmEventListener::VblankHandler,
+      .page_flip_handler = DrmEventListener::FlipHandler,
+      .page_flip_handler2 = NULL,
+      .sequence_handler = DrmEventListener::SequenceHandler};
+  drm_->ioctls().Call(DrmIoctlStats::kReadEvents, DrmIoctlStats::kEvents, [&] {
+    return drmHandleEvent(drm_->fd(), &event_context);
+  });
+}
+
+bool DrmEventListener::ParseHotplugUEvent(const char *msg, size_t len,
+                                          DrmHotplugEvent *event) {
+  bool drm_event = false, hotplug_event = false;
+  *event = DrmHotplugEvent();
+  // NUL separated, "<action>@<devpath>" followed by KEY=value pairs
+  for (size_t i = 0; i < len;) {
+    const char *field = msg + i;
+    size_t field_len = strnlen(field, len - i);
+    if (!strcmp(field, "DEVTYPE=drm_minor"))
+      drm_event = true;
+    else if (!strcmp(field, "HOTPLUG=1"))
+      hotplug_event = true;
+    else if (!strncmp(field, "MINOR=", 6))
+      event->minor = atoi(field + 6);
+    else if (!strncmp(field, "CONNECTOR=", 10))
+      event->connector_id = strtoul(field + 10, NULL, 10);
+
+    i += field_len + 1;
+  }
+  return drm_event && hotplug_event;
+}
+
 void DrmEventListener::UEventHandler() {
-  char buffer[1024];
+  // The kernel's UEVENT_BUFFER_SIZE, plus room for a terminating NUL
+  char buffer[2048 + 1];
   int ret;
 
-  struct timespec ts;
-  uint64_t timestamp = 0;
-  ret = clock_gettime(CLOCK_MONOTONIC, &ts);
-  if (!ret)
-    timestamp = ts.tv_sec * 1000 * 1000 * 1000 + ts.tv_nsec;
-  else
-    ALOGE("Failed to get monotonic clock on hotplug %d", ret);
-
   while (true) {
-    ret = read(uevent_fd_.get(), &buffer, sizeof(buffer));
+    ret = read(uevent_fd_.get(), &buffer, sizeof(buffer) - 1);
     if (ret == 0) {
       return;
     } else if (ret < 0) {
-      ALOGE("Got error reading uevent %d", ret);
+      if (errno != EAGAIN && errno != EINTR)
+        ALOGE("Got error reading uevent %d", -errno);
       return;
     }
+    buffer[ret] = '\0';
 
-    if (!hotplug_handler_)
+    DrmHotplugEvent event;
+    if (!ParseHotplugUEvent(buffer, ret, &event))
       continue;
 
-    bool drm_event = false, hotplug_event = false;
-    for (int i = 0; i < ret;) {
-      char *event = buffer + i;
-      if (strcmp(event, "DEVTYPE=drm_minor"))
-        drm_event = true;
-      else if (strcmp(event, "HOTPLUG=1"))
-        hotplug_event = true;
-
-      i += strlen(event) + 1;
+    HotplugHandler handler;
+    {
+      std::lock_guard<std::mutex> lk(mutex_);
+      handler = hotplug_handler_;
     }
-
-    if (drm_event && hotplug_event)
-      hotplug_handler_->HandleEvent(timestamp);
+    if (handler)
+      handler(event);
   }
 }
 
 void DrmEventListener::Routine() {
+  struct epoll_event events[kMaxEpollEvents];
   int ret;
   do {
-    ret = select(max_fd_ + 1, &fds_, NULL, NULL, NULL);
+    ret = epoll_wait(epoll_fd_.get(), events, kMaxEpollEvents, -1);
   } while (ret == -1 && errno == EINTR);
 
-  if (FD_ISSET(drm_->fd(), &fds_)) {
-    drmEventContext event_context = {
-        .version = 2,
-        .vblank_handler = NULL,
-        .page_flip_handler = DrmEventListener::FlipHandler};
-    drmHandleEvent(drm_->fd(), &event_context);
+  if (ret < 0) {
+    ALOGE("epoll_wait failed %d", -errno);
+    return;
   }
 
-  if (FD_ISSET(uevent_fd_.get(), &fds_))
-    UEventHandler();
+  std::lock_guard<std::recursive_mutex> lk(dispatch_lock_);
+  for (int i = 0; i < ret; ++i) {
+    int fd = events[i].data.fd;
+    if (fd == wake_fd_.get()) {
+      uint64_t count;
+      if (read(fd, &count, sizeof(count)) < 0)
+        ALOGE("Failed to read wake eventfd %d", -errno);
+    } else if (fd == drm_->fd()) {
+      DrmHandler();
+    } else if (fd == uevent_fd_.get()) {
+      UEventHandler();
+    } else {
+      FdHandler handler;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = fd_handlers_.find(fd);
+        if (it != fd_handlers_.end())
+          handler = it->second;
+      }
+      if (handler)
+        handler(events[i].events);
+    }
+  }
 }
 }
@@ -18,10 +18,17 @@
 #define ANDROID_DRM_EVENT_LISTENER_H_
 
 #include "autofd.h"
+#include "vsyncmodel.h"
 #include "worker.h"
 
+#include <functional>
+#include <map>
+#include <mutex>
+#include <vector>
+
 namespace android {
 
+class DrmCrtc;
 class DrmDevice;
 
 class DrmEventHandler {
@@ -34,31 +41,132 @@ class DrmEventHandler {
   virtual void HandleEvent(uint64_t timestamp_us) = 0;
 };
 
+// A connector hotplug uevent of a DRM device
+struct DrmHotplugEvent {
+  // Of the device the event is for, -1 if the uevent didn't say
+  int minor = -1;
+  // Newer kernels name the connector that changed, 0 if they didn't
+  uint32_t connector_id = 0;
+};
+
+// Subscriber for the vblanks of a single display. Any number of handlers may
+// be registered for the same display; the listener keeps one vblank request
+// queued with the kernel as long as at least one of them is enabled.
+class DrmVblankHandler {
+ public:
+  virtual ~DrmVblankHandler() {
+  }
+
+  // Called from the event loop, without the listener lock held.
+  virtual void HandleVblank(int64_t timestamp_ns) = 0;
+  virtual bool vblank_enabled() = 0;
+};
+
+// One epoll based event loop per DrmDevice. It services page flip and vblank
+// events from the drm fd, uevents, and any other fd (fences, timers) handed
+// to it through RegisterFdHandler().
 class DrmEventListener : public Worker {
  public:
+  typedef std::function<void(uint32_t events)> FdHandler;
+  typedef std::function<void(const DrmHotplugEvent &event)> HotplugHandler;
+
   DrmEventListener(DrmDevice *drm);
-  virtual ~DrmEventListener() {
-  }
+  ~DrmEventListener() override;
 
   int Init();
+  void Signal() override;
+
+  // Called from the event loop for the hotplug uevents of every DRM device,
+  // the uevent socket isn't specific to ours. NULL unregisters it.
+  void RegisterHotplugHandler(HotplugHandler handler);
+  // Returns false if msg, a uevent of len bytes, isn't a DRM hotplug
+  static bool ParseHotplugUEvent(const char *msg, size_t len,
+                                 DrmHotplugEvent *event);
+
+  // Watches fd for the given epoll events until it is unregistered. The fd is
+  // not owned by the listener and must stay open while it is registered.
+  int RegisterFdHandler(int fd, uint32_t events, FdHandler handler);
+  // Once this returns, the handler for fd is not running and won't run again.
+  void UnregisterFdHandler(int fd);
+
+  int RegisterVblankHandler(int display, DrmVblankHandler *handler);
+  void UnregisterVblankHandler(int display, DrmVblankHandler *handler);
+  // Queues a vblank event for display unless one is already pending.
+  void RequestVblank(int display);
+  // Drops the CRTC and vsync timing cached for display and tries its vblank
+  // events again, after a hotplug routed it to another CRTC or none, or a
+  // modeset lit its CRTC
+  void ResetDisplay(int display);
 
-  void RegisterHotplugHandler(DrmEventHandler *handler);
+  // Vsync period of display as measured from its vblank timestamps, or the
+  // nominal period of the active mode while there aren't enough of them.
+  int64_t GetVsyncPeriodNs(int display);
+  // Predicted timestamp of the first vsync after timestamp_ns, or -1 if
+  // display hasn't produced any vblank yet.
+  int64_t GetNextVsyncNs(int display, int64_t timestamp_ns);
 
   static void FlipHandler(int fd, unsigned int sequence, unsigned int tv_sec,
                           unsigned int tv_usec, void *user_data);
 
  protected:
-  virtual void Routine();
+  void Routine() override;
 
  private:
+  // Entries are never erased, their address is passed to the kernel as the
+  // user_data of queued vblank events.
+  struct VblankState {
+    DrmEventListener *listener = NULL;
+    int display = -1;
+    // Looked up on the first vblank request
+    DrmCrtc *crtc = NULL;
+    std::vector<DrmVblankHandler *> handlers;
+    bool pending = false;
+    // No usable vblank events until the next ResetDisplay(), vsync is driven
+    // by timer_fd
+    bool synthetic = false;
+    // The model is trusted and vblank events are off, vsync is driven by
+    // timer_fd until the next resync
+    bool predicting = false;
+    int hw_samples = 0;
+    int predicted_vsyncs = 0;
+    int64_t last_timestamp_ns = -1;
+    int64_t synthetic_deadline_ns = -1;
+    UniqueFd timer_fd;
+    VSyncModel model;
+  };
+
+  static void VblankHandler(int fd, unsigned int sequence, unsigned int tv_sec,
+                            unsigned int tv_usec, void *user_data);
+  static void SequenceHandler(int fd, uint64_t sequence, uint64_t ns,
+                              uint64_t user_data);
+
+  int AddFdLocked(int fd, uint32_t events, FdHandler handler);
+  VblankState *GetVblankStateLocked(int display);
+  int QueueVblankLocked(VblankState *state);
+  int QueueSyntheticVblankLocked(VblankState *state);
+  void UpdateModelLocked(VblankState *state, int64_t timestamp_ns,
+                         bool hardware);
+  void DispatchVblank(int display, int64_t timestamp_ns, bool hardware);
+  void DrmHandler();
   void UEventHandler();
 
-  fd_set fds_;
+  UniqueFd epoll_fd_;
+  UniqueFd wake_fd_;
   UniqueFd uevent_fd_;
-  int max_fd_ = -1;
 
   DrmDevice *drm_;
-  DrmEventHandler *hotplug_handler_ = NULL;
+
+  // Guarded by the worker lock
+  HotplugHandler hotplug_handler_;
+  std::map<int, FdHandler> fd_handlers_;
+  std::map<int, VblankState> vblank_;
+  bool queue_sequence_supported_ = true;
+  bool vsync_prediction_ = true;
+
+  // Held by the event loop while it runs handlers, so that unregistering can
+  // wait for a running handler to finish. Recursive since handlers are allowed
+  // to unregister themselves.
+  std::recursive_mutex dispatch_lock_;
 };
 }
 
@@ -20,19 +20,53 @@
 #include "drmdisplaycomposition.h"
 #include "drmhwcomposer.h"
 #include "drmhwctwo.h"
+#include "flightrecorder.h"
 #include "platform.h"
 #include "vsyncworker.h"
 
+#include <errno.h>
+#include <fcntl.h>
 #include <inttypes.h>
+#include <time.h>
+#include <unistd.h>
 #include <string>
 
 #include <log/log.h>
 #include <cutils/properties.h>
+#include <drm/drm_fourcc.h>
 #include <hardware/hardware.h>
 #include <hardware/hwcomposer2.h>
+#include <sync/sync.h>
+#include <utils/Trace.h>
 
 namespace android {
 
+// How long before a vsync an acquire fence has to signal for the flip to
+// still make it
+static const int64_t kLatchMarginNs = 2 * 1000 * 1000;
+
+static int64_t NowNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000 * 1000 * 1000 + ts.tv_nsec;
+}
+
+// Returns when fd signaled on CLOCK_MONOTONIC, or -1 if it hasn't yet
+static int64_t FenceSignalTimeNs(int fd) {
+  struct sync_file_info *info = sync_file_info(fd);
+  if (!info)
+    return -1;
+
+  int64_t signaled_ns = -1;
+  if (info->status == 1) {
+    struct sync_fence_info *fences = sync_get_fence_info(info);
+    for (uint32_t i = 0; i < info->num_fences; ++i)
+      signaled_ns = std::max(signaled_ns, (int64_t)fences[i].timestamp_ns);
+  }
+  sync_file_info_free(info);
+  return signaled_ns;
+}
+
 class DrmVsyncCallback : public VsyncCallback {
  public:
   DrmVsyncCallback(hwc2_callback_data_t data, hwc2_function_pointer_t hook)
@@ -57,6 +91,12 @@ DrmHwcTwo::DrmHwcTwo() {
   getFunction = HookDevGetFunction;
 }
 
+DrmHwcTwo::~DrmHwcTwo() {
+  // Hotplugs run on the resource manager's task worker, stop them before the
+  // displays go away
+  resource_manager_.RegisterHotplugHandler(NULL);
+}
+
 HWC2::Error DrmHwcTwo::Init() {
   int ret = resource_manager_.Init();
   if (ret) {
@@ -64,32 +104,40 @@ HWC2::Error DrmHwcTwo::Init() {
     return HWC2::Error::NoResources;
   }
 
-  DrmDevice *drm = resource_manager_.GetDrmDevice(HWC_DISPLAY_PRIMARY);
+  std::lock_guard<std::mutex> lock(hotplug_lock_);
+  HWC2::Error err = AddDisplay(HWC_DISPLAY_PRIMARY);
+  if (err != HWC2::Error::None)
+    return err;
   std::shared_ptr<Importer> importer =
       resource_manager_.GetImporter(HWC_DISPLAY_PRIMARY);
-  if (!drm || !importer) {
-    ALOGE("Failed to get a valid drmresource and importer");
-    return HWC2::Error::NoResources;
-  }
-
-  displays_.emplace(
-      std::piecewise_construct, std::forward_as_tuple(HWC_DISPLAY_PRIMARY),
-      std::forward_as_tuple(&resource_manager_, drm, importer,
-                            HWC_DISPLAY_PRIMARY, HWC2::DisplayType::Physical));
 
-  DrmCrtc *crtc = drm->GetCrtcForDisplay(static_cast<int>(HWC_DISPLAY_PRIMARY));
-  if (!crtc) {
-    ALOGE("Failed to get crtc for display %d",
-          static_cast<int>(HWC_DISPLAY_PRIMARY));
-    return HWC2::Error::BadDisplay;
+  // The other displays that are already connected, the rest is hotplugged
+  for (int display = 1; display < resource_manager_.num_displays(); ++display) {
+    DrmDevice *drm = resource_manager_.GetDrmDevice(display);
+    DrmConnector *conn = drm->GetConnectorForDisplay(display);
+    if (conn && conn->state() == DRM_MODE_CONNECTED)
+      AddDisplay(display);
   }
-
-  std::vector<DrmPlane *> display_planes;
-  for (auto &plane : drm->planes()) {
-    if (plane->GetCrtcSupported(*crtc))
-      display_planes.push_back(plane.get());
-  }
-  displays_.at(HWC_DISPLAY_PRIMARY).Init(&display_planes);
+  resource_manager_.RegisterHotplugHandler(
+      [this](int display) { HandleHotplug(display); });
+
+  // hwc.drm.trace_file: where to record the HWC2 calls, see hwctrace.h
+  char trace_file[PROPERTY_VALUE_MAX];
+  property_get("hwc.drm.trace_file", trace_file, "");
+  if (trace_file[0])
+    trace_.Open(trace_file, resource_manager_.task_worker(),
+                [importer](buffer_handle_t handle, HwcTraceBuffer *info) {
+                  hwc_drm_bo_t bo;
+                  int ret = importer->GetBufferInfo(handle, &bo);
+                  if (ret)
+                    return ret;
+                  info->width = bo.width;
+                  info->height = bo.height;
+                  info->format = bo.format;
+                  info->stride = bo.pitches[0];
+                  info->usage = bo.usage;
+                  return 0;
+                });
   return HWC2::Error::None;
 }
 
@@ -115,9 +163,146 @@ HWC2::Error DrmHwcTwo::DestroyVirtualDisplay(hwc2_display_t display) {
   return unsupported(__func__, display);
 }
 
+HWC2::Error DrmHwcTwo::AddDisplay(hwc2_display_t handle) {
+  int display_id = static_cast<int>(handle);
+  DrmDisplayPipe *pipe = resource_manager_.ConnectDisplay(display_id);
+  std::shared_ptr<Importer> importer =
+      resource_manager_.GetImporter(display_id);
+  if (!pipe || !importer) {
+    ALOGE("Failed to get a valid drmresource and importer for display %d",
+          display_id);
+    return HWC2::Error::NoResources;
+  }
+
+  std::unique_ptr<HwcDisplay> display = std::make_unique<HwcDisplay>(
+      &resource_manager_, pipe->device, importer, handle,
+      HWC2::DisplayType::Physical);
+  std::vector<DrmPlane *> display_planes(pipe->planes);
+  HWC2::Error err = display->Init(&display_planes);
+  // The primary display is kept regardless, SurfaceFlinger can't do without
+  if (err != HWC2::Error::None && handle != HWC_DISPLAY_PRIMARY) {
+    ALOGE("Failed to initialize display %d %d", display_id, err);
+    display.reset();
+    resource_manager_.DisconnectDisplay(display_id);
+    return err;
+  }
+
+  for (std::pair<const HWC2::Callback, HwcCallback> &callback : callbacks_) {
+    if (callback.first == HWC2::Callback::Vsync)
+      display->RegisterVsyncCallback(callback.second.data,
+                                     callback.second.func);
+    else if (callback.first == HWC2::Callback::Refresh)
+      display->RegisterRefreshCallback(callback.second.data,
+                                       callback.second.func);
+  }
+
+  std::unique_lock<std::shared_mutex> lock(displays_lock_);
+  displays_[handle] = std::move(display);
+  return HWC2::Error::None;
+}
+
+bool DrmHwcTwo::RemoveDisplay(hwc2_display_t handle) {
+  std::unique_ptr<HwcDisplay> display;
+  {
+    // Waits for the hooks still using it
+    std::unique_lock<std::shared_mutex> lock(displays_lock_);
+    auto it = displays_.find(handle);
+    if (it == displays_.end())
+      return false;
+    display = std::move(it->second);
+    displays_.erase(it);
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(display->lock());
+    display->SetPowerMode(static_cast<int32_t>(HWC2::PowerMode::Off));
+  }
+  display.reset();
+  resource_manager_.DisconnectDisplay(static_cast<int>(handle));
+  return true;
+}
+
+void DrmHwcTwo::HandleHotplug(int display) {
+  DrmDevice *drm = resource_manager_.GetDrmDevice(display);
+  DrmConnector *connector = NULL;
+  if (drm)
+    connector = drm->GetConnectorForDisplay(display);
+  if (!connector)
+    return;
+  hwc2_display_t handle = display;
+
+  std::lock_guard<std::mutex> lock(hotplug_lock_);
+  bool exists = false;
+  int ret;
+  {
+    // The hooks of a live display reprobe its connector as well
+    std::shared_lock<std::shared_mutex> displays_lock(displays_lock_);
+    HwcDisplay *hwc_display = GetDisplay(handle);
+    std::unique_lock<std::mutex> display_lock;
+    if (hwc_display) {
+      exists = true;
+      display_lock = std::unique_lock<std::mutex>(hwc_display->lock());
+    }
+    ret = connector->UpdateModes();
+  }
+  if (ret) {
+    ALOGE("Failed to reprobe display %d %d", display, ret);
+    return;
+  }
+
+  // The primary display stays around while it is disconnected
+  bool connected = connector->state() == DRM_MODE_CONNECTED;
+  if (connected == exists || handle == HWC_DISPLAY_PRIMARY)
+    return;
+
+  ALOGI("Display %d %s", display, connected ? "connected" : "disconnected");
+  if (connected && AddDisplay(handle) != HWC2::Error::None)
+    return;
+  if (!connected)
+    RemoveDisplay(handle);
+
+  auto callback = callbacks_.find(HWC2::Callback::Hotplug);
+  if (callback == callbacks_.end())
+    return;
+  auto hotplug = reinterpret_cast<HWC2_PFN_HOTPLUG>(callback->second.func);
+  hotplug(callback->second.data, handle,
+          static_cast<int32_t>(connected ? HWC2::Connection::Connected
+                                         : HWC2::Connection::Disconnected));
+}
+
 void DrmHwcTwo::Dump(uint32_t *size, char *buffer) {
-  // TODO: Implement dump
-  unsupported(__func__, size, buffer);
+  supported(__func__);
+  if (buffer) {
+    // SurfaceFlinger asks for the size first, then for the contents
+    size_t copied = std::min<size_t>(*size, dump_string_.size());
+    memcpy(buffer, dump_string_.data(), copied);
+    *size = copied;
+    dump_string_.clear();
+    return;
+  }
+
+  // hwc.drm.timeline_dir: where to write the binary FrameTimeline snapshots
+  char timeline_dir[PROPERTY_VALUE_MAX];
+  property_get("hwc.drm.timeline_dir", timeline_dir, "");
+
+  std::ostringstream out;
+  out << "-- drm_hwcomposer --\n";
+  std::shared_lock<std::shared_mutex> displays_lock(displays_lock_);
+  for (std::pair<const hwc2_display_t, std::unique_ptr<HwcDisplay>> &d :
+       displays_) {
+    std::lock_guard<std::mutex> lock(d.second->lock());
+    d.second->Dump(&out);
+    if (timeline_dir[0]) {
+      std::string path;
+      d.second->WriteTimelineSnapshot(timeline_dir, &path);
+      out << "  timeline snapshot: " << path << "\n";
+    }
+  }
+  displays_lock.unlock();
+  resource_manager_.DumpStats(&out);
+
+  dump_string_ = out.str();
+  *size = dump_string_.size();
 }
 
 uint32_t DrmHwcTwo::GetMaxVirtualDisplayCount() {
@@ -131,19 +316,34 @@ HWC2::Error DrmHwcTwo::RegisterCallback(int32_t descriptor,
                                         hwc2_function_pointer_t function) {
   supported(__func__);
   auto callback = static_cast<HWC2::Callback>(descriptor);
+  std::lock_guard<std::mutex> lock(hotplug_lock_);
   callbacks_.emplace(callback, HwcCallback(data, function));
 
+  std::shared_lock<std::shared_mutex> displays_lock(displays_lock_);
   switch (callback) {
     case HWC2::Callback::Hotplug: {
+      std::vector<hwc2_display_t> connected;
+      for (std::pair<const hwc2_display_t, std::unique_ptr<HwcDisplay>> &d :
+           displays_)
+        connected.push_back(d.first);
+      // SurfaceFlinger may call back into us right away
+      displays_lock.unlock();
       auto hotplug = reinterpret_cast<HWC2_PFN_HOTPLUG>(function);
-      hotplug(data, HWC_DISPLAY_PRIMARY,
-              static_cast<int32_t>(HWC2::Connection::Connected));
+      for (hwc2_display_t display : connected)
+        hotplug(data, display,
+                static_cast<int32_t>(HWC2::Connection::Connected));
       break;
     }
     case HWC2::Callback::Vsync: {
-      for (std::pair<const hwc2_display_t, DrmHwcTwo::HwcDisplay> &d :
+      for (std::pair<const hwc2_display_t, std::unique_ptr<HwcDisplay>> &d :
            displays_)
-        d.second.RegisterVsyncCallback(data, function);
+        d.second->RegisterVsyncCallback(data, function);
+      break;
+    }
+    case HWC2::Callback::Refresh: {
+      for (std::pair<const hwc2_display_t, std::unique_ptr<HwcDisplay>> &d :
+           displays_)
+        d.second->RegisterRefreshCallback(data, function);
       break;
     }
     default:
@@ -152,6 +352,19 @@ HWC2::Error DrmHwcTwo::RegisterCallback(int32_t descriptor,
   return HWC2::Error::None;
 }
 
+// name.<display> if set, name otherwise, 0 if neither is
+static uint64_t GetDisplayProperty(const char *name, int display) {
+  char value[PROPERTY_VALUE_MAX];
+  std::string display_name = std::string(name) + "." + std::to_string(display);
+  if (property_get(display_name.c_str(), value, "") <= 0)
+    property_get(name, value, "0");
+  return strtoull(value, NULL, 0);
+}
+
+static std::string CommitWorkerName(hwc2_display_t handle) {
+  return "hwc-commit-" + std::to_string(handle);
+}
+
 DrmHwcTwo::HwcDisplay::HwcDisplay(ResourceManager *resource_manager,
                                   DrmDevice *drm,
                                   std::shared_ptr<Importer> importer,
@@ -160,7 +373,11 @@ DrmHwcTwo::HwcDisplay::HwcDisplay(ResourceManager *resource_manager,
       drm_(drm),
       importer_(importer),
       handle_(handle),
-      type_(type) {
+      type_(type),
+      scanout_counter_("HWC scanout " + std::to_string(handle)),
+      client_counter_("HWC client " + std::to_string(handle)),
+      commit_worker_(CommitWorkerName(handle).c_str(),
+                     HAL_PRIORITY_URGENT_DISPLAY) {
   supported(__func__);
 }
 
@@ -173,7 +390,13 @@ HWC2::Error DrmHwcTwo::HwcDisplay::Init(std::vector<DrmPlane *> *planes) {
   }
 
   int display = static_cast<int>(handle_);
-  int ret = compositor_.Init(resource_manager_, display);
+  int ret = commit_worker_.Init();
+  if (ret) {
+    ALOGE("Failed to start commit worker for display %d (%d)", display, ret);
+    return HWC2::Error::NoResources;
+  }
+
+  ret = compositor_.Init(resource_manager_, display);
   if (ret) {
     ALOGE("Failed display compositor init for display %d (%d)", display, ret);
     return HWC2::Error::NoResources;
@@ -184,6 +407,19 @@ HWC2::Error DrmHwcTwo::HwcDisplay::Init(std::vector<DrmPlane *> *planes) {
   char use_overlay_planes_prop[PROPERTY_VALUE_MAX];
   property_get("hwc.drm.use_overlay_planes", use_overlay_planes_prop, "1");
   bool use_overlay_planes = atoi(use_overlay_planes_prop);
+  char defer_unsignaled_prop[PROPERTY_VALUE_MAX];
+  property_get("hwc.drm.defer_unsignaled", defer_unsignaled_prop, "0");
+  defer_unsignaled_ = atoi(defer_unsignaled_prop);
+  char ioctl_frame_stats_prop[PROPERTY_VALUE_MAX];
+  property_get("hwc.drm.ioctl_frame_stats", ioctl_frame_stats_prop, "0");
+  ioctl_frame_stats_ = atoi(ioctl_frame_stats_prop);
+  char seamless_boot_prop[PROPERTY_VALUE_MAX];
+  property_get("hwc.drm.seamless_boot", seamless_boot_prop, "1");
+  seamless_boot_ = atoi(seamless_boot_prop);
+  scanout_budget_mbps_ =
+      GetDisplayProperty("hwc.drm.scanout_budget_mbps", display);
+  pixel_rate_budget_mpps_ =
+      GetDisplayProperty("hwc.drm.pixel_rate_budget_mpps", display);
   for (auto &plane : *planes) {
     if (plane->type() == DRM_PLANE_TYPE_PRIMARY)
       primary_planes_.push_back(plane);
@@ -191,17 +427,13 @@ HWC2::Error DrmHwcTwo::HwcDisplay::Init(std::vector<DrmPlane *> *planes) {
       overlay_planes_.push_back(plane);
   }
 
-  crtc_ = drm_->GetCrtcForDisplay(display);
-  if (!crtc_) {
-    ALOGE("Failed to get crtc for display %d", display);
-    return HWC2::Error::BadDisplay;
-  }
-
-  connector_ = drm_->GetConnectorForDisplay(display);
-  if (!connector_) {
-    ALOGE("Failed to get connector for display %d", display);
+  DrmDisplayPipe *pipe = resource_manager_->GetPipe(display);
+  if (!pipe) {
+    ALOGE("Failed to get the pipe of display %d", display);
     return HWC2::Error::BadDisplay;
   }
+  crtc_ = pipe->crtc;
+  connector_ = pipe->connector;
 
   // Fetch the number of modes from the display
   uint32_t num_configs;
@@ -216,6 +448,10 @@ HWC2::Error DrmHwcTwo::HwcDisplay::Init(std::vector<DrmPlane *> *planes) {
   err = GetDisplayConfigs(&num_configs, &default_config);
   if (err != HWC2::Error::None)
     return err;
+  // Unless the display is still lit with the mode the bootloader set, then
+  // keep that one and take over its splash screen without blanking it
+  if (seamless_boot_ && connector_->boot_mode_id())
+    default_config = connector_->boot_mode_id();
 
   ret = vsync_worker_.Init(drm_, display);
   if (ret) {
@@ -234,6 +470,27 @@ HWC2::Error DrmHwcTwo::HwcDisplay::RegisterVsyncCallback(
   return HWC2::Error::None;
 }
 
+HWC2::Error DrmHwcTwo::HwcDisplay::RegisterRefreshCallback(
+    hwc2_callback_data_t data, hwc2_function_pointer_t func) {
+  supported(__func__);
+  std::lock_guard<std::mutex> lock(lock_);
+  refresh_data_ = data;
+  refresh_hook_ = reinterpret_cast<HWC2_PFN_REFRESH>(func);
+  return HWC2::Error::None;
+}
+
+void DrmHwcTwo::HwcDisplay::RequestRefresh() {
+  if (!refresh_hook_)
+    return;
+
+  // SurfaceFlinger may call right back into us, so don't call it from a hook
+  hwc2_callback_data_t data = refresh_data_;
+  HWC2_PFN_REFRESH hook = refresh_hook_;
+  hwc2_display_t display = handle_;
+  resource_manager_->task_worker()->Post(
+      [data, hook, display] { hook(data, display); });
+}
+
 HWC2::Error DrmHwcTwo::HwcDisplay::AcceptDisplayChanges() {
   supported(__func__);
   for (std::pair<const hwc2_layer_t, DrmHwcTwo::HwcLayer> &l : layers_)
@@ -341,7 +598,8 @@ HWC2::Error DrmHwcTwo::HwcDisplay::GetDisplayAttribute(hwc2_config_t config,
       *value = mode->v_display();
       break;
     case HWC2::Attribute::VsyncPeriod:
-      // in nanoseconds
+      // in nanoseconds, nominal since SurfaceFlinger takes the attributes of
+      // a config as fixed. The measured period is in the dump.
       *value = 1000 * 1000 * 1000 / mode->v_refresh();
       break;
     case HWC2::Attribute::DpiX:
@@ -466,15 +724,61 @@ void DrmHwcTwo::HwcDisplay::AddFenceToRetireFence(int fd) {
   if (fd < 0)
     return;
 
-  if (next_retire_fence_.get() >= 0) {
-    int old_fence = next_retire_fence_.get();
-    next_retire_fence_.Set(sync_merge("dc_retire", old_fence, fd));
+  if (retire_fence_.get() >= 0) {
+    int old_fence = retire_fence_.get();
+    retire_fence_.Set(sync_merge("dc_retire", old_fence, fd));
   } else {
-    next_retire_fence_.Set(dup(fd));
+    retire_fence_.Set(dup(fd));
+  }
+}
+
+int DrmHwcTwo::HwcDisplay::WaitForCommit() {
+  if (!pending_commit_)
+    return 0;
+
+  commit_worker_.Wait(pending_commit_);
+  pending_commit_ = 0;
+  if (ioctl_frame_stats_) {
+    last_frame_ioctls_ = commit_ioctls_;
+    if (commit_ioctls_.total_ns() > worst_frame_ioctls_.total_ns())
+      worst_frame_ioctls_ = commit_ioctls_;
   }
+  AddFenceToRetireFence(commit_out_fence_.get());
+  commit_out_fence_.Close();
+  return commit_status_;
+}
+
+void DrmHwcTwo::HwcDisplay::QueueCommit(
+    std::unique_ptr<DrmDisplayComposition> composition) {
+  // Commits stay in order, and the blocking commit of a slow display only
+  // ever holds up its own worker
+  int ret = WaitForCommit();
+  if (ret)
+    ALOGE("Previous commit failed on display %" PRIu64 " ret=%d", handle_, ret);
+
+  queued_composition_ = std::move(composition);
+  commit_ioctls_ = frame_ioctls_;
+  frame_ioctls_ = DrmIoctlFrame();
+  pending_commit_ = commit_worker_.Post([this] {
+    DrmIoctlFrameScope ioctl_scope(ioctl_frame_stats_ ? &commit_ioctls_
+                                                      : NULL);
+    int out_fence = -1;
+    int64_t start_ns = NowNs();
+    commit_status_ = compositor_.ApplyComposition(
+        std::move(queued_composition_), &out_fence);
+    commit_latency_.AddSample(NowNs() - start_ns);
+    commit_out_fence_.Set(out_fence);
+  });
+}
+
+int DrmHwcTwo::HwcDisplay::CommitAndWait(
+    std::unique_ptr<DrmDisplayComposition> composition) {
+  QueueCommit(std::move(composition));
+  return WaitForCommit();
 }
 
 HWC2::Error DrmHwcTwo::HwcDisplay::CreateComposition(bool test) {
+  ATRACE_CALL();
   std::vector<DrmCompositionDisplayLayersMap> layers_map;
   layers_map.emplace_back();
   DrmCompositionDisplayLayersMap &map = layers_map.back();
@@ -512,10 +816,30 @@ HWC2::Error DrmHwcTwo::HwcDisplay::CreateComposition(bool test) {
   if (z_map.empty())
     return HWC2::Error::BadLayer;
 
+  // Latching unsignaled buffers late holds their old buffer on screen past
+  // this frame, that needs release fences for the frame after it
+  int64_t now = NowNs();
+  int64_t latch_deadline_ns = -1;
+  if (!test && defer_unsignaled_ && compositor_.release_fences_supported()) {
+    int64_t next_vsync_ns = vsync_worker_.GetNextVsyncNs(now);
+    if (next_vsync_ns >= 0)
+      latch_deadline_ns = next_vsync_ns - kLatchMarginNs;
+  }
+  std::vector<DrmHwcTwo::HwcLayer *> deferred_layers;
+
   // now that they're ordered by z, add them to the composition
   for (std::pair<const uint32_t, DrmHwcTwo::HwcLayer *> &l : z_map) {
+    // The client target has no release fence to keep its old buffer alive
+    bool defer = false;
+    if (latch_deadline_ns >= 0 && l.second != &client_layer_) {
+      l.second->TrackAcquireFence(now);
+      defer = l.second->ShouldDeferLatch(now, latch_deadline_ns);
+      if (defer)
+        deferred_layers.push_back(l.second);
+    }
+
     DrmHwcLayer layer;
-    l.second->PopulateDrmLayer(&layer);
+    l.second->PopulateDrmLayer(&layer, test, defer);
     int ret = layer.ImportBuffer(importer_.get());
     if (ret) {
       ALOGE("Failed to import layer, ret=%d", ret);
@@ -523,6 +847,8 @@ HWC2::Error DrmHwcTwo::HwcDisplay::CreateComposition(bool test) {
     }
     map.layers.emplace_back(std::move(layer));
   }
+  if (!test)
+    compositor_.frame_timeline()->Stamp(frame_no_, FrameTimeline::kImport);
 
   std::unique_ptr<DrmDisplayComposition> composition =
       compositor_.CreateComposition();
@@ -542,6 +868,8 @@ HWC2::Error DrmHwcTwo::HwcDisplay::CreateComposition(bool test) {
     ALOGE("Failed to plan the composition ret=%d", ret);
     return HWC2::Error::BadConfig;
   }
+  if (!test)
+    compositor_.frame_timeline()->Stamp(frame_no_, FrameTimeline::kPlan);
 
   // Disable the planes we're not using
   for (auto i = primary_planes.begin(); i != primary_planes.end();) {
@@ -553,22 +881,41 @@ HWC2::Error DrmHwcTwo::HwcDisplay::CreateComposition(bool test) {
     i = overlay_planes.erase(i);
   }
 
-  if (test) {
-    ret = compositor_.TestComposition(composition.get());
-  } else {
-    AddFenceToRetireFence(composition->take_out_fence());
-    ret = compositor_.ApplyComposition(std::move(composition));
+  if (!test) {
+    EstimateBandwidth(composition.get());
+    UniqueFd release_fence(compositor_.CreateReleaseFence(composition.get()));
+    UniqueFd next_release_fence;
+    if (!deferred_layers.empty()) {
+      next_release_fence.Set(compositor_.CreateNextReleaseFence());
+      compositor_.CountDeferredLatches(deferred_layers.size());
+    }
+    QueueCommit(std::move(composition));
+
+    for (std::pair<const hwc2_layer_t, DrmHwcTwo::HwcLayer> &l : layers_) {
+      bool deferred = std::find(deferred_layers.begin(), deferred_layers.end(),
+                                &l.second) != deferred_layers.end();
+      l.second.PresentedWithReleaseFence(release_fence.get(),
+                                         next_release_fence.get(), deferred);
+    }
+    // Get the deferred buffers on screen with the next frame
+    if (!deferred_layers.empty())
+      RequestRefresh();
+    return HWC2::Error::None;
   }
-  if (ret) {
-    if (!test)
-      ALOGE("Failed to apply the frame composition ret=%d", ret);
+
+  ret = compositor_.TestComposition(composition.get());
+  if (ret)
     return HWC2::Error::BadParameter;
-  }
   return HWC2::Error::None;
 }
 
 HWC2::Error DrmHwcTwo::HwcDisplay::PresentDisplay(int32_t *retire_fence) {
   supported(__func__);
+  ATRACE_CALL();
+  DrmIoctlFrameScope ioctl_scope(ioctl_frame_stats_ ? &frame_ioctls_ : NULL);
+  int64_t start_ns = NowNs();
+  compositor_.frame_timeline()->Stamp(frame_no_, FrameTimeline::kPresent,
+                                      start_ns);
   HWC2::Error ret;
 
   ret = CreateComposition(false);
@@ -580,12 +927,13 @@ HWC2::Error DrmHwcTwo::HwcDisplay::PresentDisplay(int32_t *retire_fence) {
   if (ret != HWC2::Error::None)
     return ret;
 
-  // The retire fence returned here is for the last frame, so return it and
-  // promote the next retire fence
+  // The retire fence returned here is for the last frame, whose commit has
+  // been waited for before queueing this one
   *retire_fence = retire_fence_.Release();
-  retire_fence_ = std::move(next_retire_fence_);
 
   ++frame_no_;
+  frame_started_ = false;
+  present_latency_.AddSample(NowNs() - start_ns);
   return HWC2::Error::None;
 }
 
@@ -602,8 +950,9 @@ HWC2::Error DrmHwcTwo::HwcDisplay::SetActiveConfig(hwc2_config_t config) {
   std::unique_ptr<DrmDisplayComposition> composition =
       compositor_.CreateComposition();
   composition->Init(drm_, crtc_, importer_.get(), planner_.get(), frame_no_);
-  int ret = composition->SetDisplayMode(*mode);
-  ret = compositor_.ApplyComposition(std::move(composition));
+  bool seamless = seamless_boot_ && connector_->boot_mode_id() == config;
+  int ret = composition->SetDisplayMode(*mode, seamless);
+  ret = CommitAndWait(std::move(composition));
   if (ret) {
     ALOGE("Failed to queue dpms composition on %d", ret);
     return HWC2::Error::BadConfig;
@@ -683,7 +1032,7 @@ HWC2::Error DrmHwcTwo::HwcDisplay::SetPowerMode(int32_t mode_in) {
       compositor_.CreateComposition();
   composition->Init(drm_, crtc_, importer_.get(), planner_.get(), frame_no_);
   composition->SetDpmsMode(dpms_value);
-  int ret = compositor_.ApplyComposition(std::move(composition));
+  int ret = CommitAndWait(std::move(composition));
   if (ret) {
     ALOGE("Failed to apply the dpms composition ret=%d", ret);
     return HWC2::Error::BadParameter;
@@ -700,6 +1049,9 @@ HWC2::Error DrmHwcTwo::HwcDisplay::SetVsyncEnabled(int32_t enabled) {
 HWC2::Error DrmHwcTwo::HwcDisplay::ValidateDisplay(uint32_t *num_types,
                                                    uint32_t *num_requests) {
   supported(__func__);
+  ATRACE_CALL();
+  DrmIoctlFrameScope ioctl_scope(ioctl_frame_stats_ ? &frame_ioctls_ : NULL);
+  int64_t start_ns = NowNs();
   *num_types = 0;
   *num_requests = 0;
   size_t avail_planes = primary_planes_.size() + overlay_planes_.size();
@@ -727,18 +1079,76 @@ HWC2::Error DrmHwcTwo::HwcDisplay::ValidateDisplay(uint32_t *num_types,
   if (avail_planes < layers_.size())
     avail_planes--;
 
+  // Scanout budget of the CRTC for one frame
+  bool budgeted = scanout_budget_mbps_ || pixel_rate_budget_mpps_;
+  float refresh_hz = connector_->active_mode().v_refresh();
+  if (refresh_hz <= 0)
+    refresh_hz = 60;
+  uint64_t budget_bytes = UINT64_MAX;
+  uint64_t budget_pixels = UINT64_MAX;
+  if (scanout_budget_mbps_)
+    budget_bytes = scanout_budget_mbps_ * 1000000 / refresh_hz;
+  if (pixel_rate_budget_mpps_)
+    budget_pixels = pixel_rate_budget_mpps_ * 1000000 / refresh_hz;
+  size_t planned_layers =
+      comp_failed ? 0 : std::min(z_map.size(), avail_planes);
+
+  struct DeviceLayer {
+    DrmHwcTwo::HwcLayer *layer;
+    uint64_t bytes;
+    uint64_t pixels;
+  };
+  std::vector<DeviceLayer> device_layers;
+  uint64_t used_bytes = 0, used_pixels = 0;
+  bool over_budget = false;
   for (std::pair<const uint32_t, DrmHwcTwo::HwcLayer *> &l : z_map) {
-    if (comp_failed || !avail_planes--)
+    if (comp_failed || !avail_planes)
       break;
-    l.second->set_validated_type(HWC2::Composition::Device);
+    DeviceLayer device = {l.second, 0, 0};
+    if (budgeted)
+      l.second->GetScanoutCost(importer_.get(), &device.bytes,
+                               &device.pixels);
+    if (used_bytes + device.bytes > budget_bytes ||
+        used_pixels + device.pixels > budget_pixels) {
+      over_budget = true;
+      break;
+    }
+    used_bytes += device.bytes;
+    used_pixels += device.pixels;
+    device_layers.push_back(device);
+    avail_planes--;
+  }
+
+  // The client target is scanned out as well, make room for it by giving
+  // the GPU the topmost device layers, which keeps the device layers below
+  // the client ones. There's always a plane left for it.
+  if (budgeted && device_layers.size() < layers_.size()) {
+    uint64_t target_bytes, target_pixels;
+    client_layer_.GetScanoutCost(importer_.get(), &target_bytes,
+                                 &target_pixels);
+    while (!device_layers.empty() &&
+           (used_bytes + target_bytes > budget_bytes ||
+            used_pixels + target_pixels > budget_pixels)) {
+      used_bytes -= device_layers.back().bytes;
+      used_pixels -= device_layers.back().pixels;
+      device_layers.pop_back();
+      over_budget = true;
+    }
   }
+  if (over_budget)
+    over_budget_layers_ += planned_layers - device_layers.size();
+  for (DeviceLayer &device : device_layers)
+    device.layer->set_validated_type(HWC2::Composition::Device);
 
+  uint32_t num_device = 0;
   for (std::pair<const hwc2_layer_t, DrmHwcTwo::HwcLayer> &l : layers_) {
     DrmHwcTwo::HwcLayer &layer = l.second;
     switch (layer.sf_type()) {
       case HWC2::Composition::Device:
-        if (layer.validated_type() == HWC2::Composition::Device)
+        if (layer.validated_type() == HWC2::Composition::Device) {
+          ++num_device;
           break;
+        }
       // fall thru
       case HWC2::Composition::SolidColor:
       case HWC2::Composition::Cursor:
@@ -749,9 +1159,121 @@ HWC2::Error DrmHwcTwo::HwcDisplay::ValidateDisplay(uint32_t *num_types,
         break;
     }
   }
+  RecordSplit(num_device, layers_.size() - num_device);
+  int64_t end_ns = NowNs();
+  validate_latency_.AddSample(end_ns - start_ns);
+  compositor_.frame_timeline()->Stamp(frame_no_, FrameTimeline::kValidate,
+                                      end_ns);
   return *num_types ? HWC2::Error::HasChanges : HWC2::Error::None;
 }
 
+void DrmHwcTwo::HwcDisplay::RecordSplit(uint32_t device_layers,
+                                        uint32_t client_layers) {
+  split_history_[next_split_] = {device_layers, client_layers};
+  next_split_ = (next_split_ + 1) % kSplitHistorySize;
+  validated_frames_++;
+  if (!client_layers)
+    all_device_frames_++;
+  else if (!device_layers)
+    all_client_frames_++;
+}
+
+uint32_t DrmHwcTwo::HwcDisplay::BufferFormat(buffer_handle_t buffer) {
+  hwc_drm_bo_t bo;
+  if (buffer && !importer_->GetBufferInfo(buffer, &bo))
+    return bo.format;
+  return DRM_FORMAT_ABGR8888;
+}
+
+void DrmHwcTwo::HwcDisplay::EstimateBandwidth(
+    DrmDisplayComposition *composition) {
+  BandwidthEstimate estimate;
+  BandwidthModel::AddScanout(composition, &estimate);
+
+  bool use_client_layer = false;
+  for (std::pair<const hwc2_layer_t, DrmHwcTwo::HwcLayer> &l : layers_) {
+    if (l.second.validated_type() != HWC2::Composition::Client)
+      continue;
+    use_client_layer = true;
+    estimate.client_read_bytes += BandwidthModel::ClientReadBytes(
+        BufferFormat(l.second.buffer()), l.second.source_crop());
+  }
+  if (use_client_layer)
+    estimate.client_write_bytes = BandwidthModel::ClientWriteBytes(
+        BufferFormat(client_layer_.buffer()), client_layer_.display_frame());
+  bandwidth_ = estimate;
+
+  if (ATRACE_ENABLED()) {
+    float refresh_hz = connector_->active_mode().v_refresh();
+    ATRACE_INT64(scanout_counter_.c_str(),
+                 estimate.scanout_bytes * refresh_hz);
+    ATRACE_INT64(client_counter_.c_str(),
+                 (estimate.client_read_bytes + estimate.client_write_bytes) *
+                     refresh_hz);
+  }
+}
+
+void DrmHwcTwo::HwcDisplay::Dump(std::ostringstream *out) {
+  *out << "- Display " << handle_ << ": type=" << to_string(type_)
+       << " connector=" << (connector_ ? connector_->id() : 0)
+       << " crtc=" << (crtc_ ? crtc_->id() : 0) << " frames=" << frame_no_
+       << " layers=" << layers_.size() << "\n";
+  *out << "  vsync period: measured=" << vsync_worker_.GetVsyncPeriodNs()
+       << "ns\n";
+
+  *out << "  validated=" << validated_frames_
+       << " all_device=" << all_device_frames_
+       << " all_client=" << all_client_frames_ << " mixed="
+       << validated_frames_ - all_device_frames_ - all_client_frames_
+       << "\n  recent device/client:";
+  size_t splits = std::min<uint64_t>(validated_frames_, kSplitHistorySize);
+  for (size_t i = splits; i > 0; --i) {
+    const CompositionSplit &split =
+        split_history_[(next_split_ + kSplitHistorySize - i) %
+                       kSplitHistorySize];
+    *out << " " << split.device << "/" << split.client;
+  }
+  *out << "\n  bandwidth: ";
+  BandwidthModel::Dump(bandwidth_,
+                       connector_ ? connector_->active_mode().v_refresh() : 0,
+                       out);
+  *out << "\n  budget: scanout=" << scanout_budget_mbps_
+       << "MB/s pixel_rate=" << pixel_rate_budget_mpps_
+       << "MP/s (0 is unlimited) over_budget_layers=" << over_budget_layers_
+       << "\n";
+  if (ioctl_frame_stats_) {
+    *out << "  ioctls last frame: ";
+    last_frame_ioctls_.Dump(out);
+    *out << "\n  ioctls worst frame: ";
+    worst_frame_ioctls_.Dump(out);
+    *out << "\n";
+  }
+
+  validate_latency_.Dump("  validate", out);
+  present_latency_.Dump("  present", out);
+  commit_latency_.Dump("  commit", out);
+  compositor_.Dump(out);
+}
+
+void DrmHwcTwo::HwcDisplay::WriteTimelineSnapshot(const char *dir,
+                                                  std::string *path) {
+  std::string snapshot;
+  compositor_.frame_timeline()->AppendSnapshot(&snapshot);
+
+  // Don't hold up validate and present on the file system
+  *path = std::string(dir) + "/hwc-timeline-" + std::to_string(handle_) +
+          ".bin";
+  resource_manager_->task_worker()->Post(
+      [file = *path, snapshot] { FlightRecorder::WriteFile(file, snapshot); });
+}
+
+void DrmHwcTwo::HwcDisplay::LayerUpdated() {
+  if (frame_started_)
+    return;
+  compositor_.frame_timeline()->Stamp(frame_no_, FrameTimeline::kSetLayer);
+  frame_started_ = true;
+}
+
 HWC2::Error DrmHwcTwo::HwcLayer::SetCursorPosition(int32_t x, int32_t y) {
   supported(__func__);
   cursor_x_ = x;
@@ -848,7 +1370,75 @@ HWC2::Error DrmHwcTwo::HwcLayer::SetLayerZOrder(uint32_t order) {
   return HWC2::Error::None;
 }
 
-void DrmHwcTwo::HwcLayer::PopulateDrmLayer(DrmHwcLayer *layer) {
+void DrmHwcTwo::HwcLayer::PresentedWithReleaseFence(int release_fence,
+                                                    int next_release_fence,
+                                                    bool latch_deferred) {
+  bool buffer_changed = buffer_changed_;
+  buffer_changed_ = false;
+  latch_deferred_ = latch_deferred;
+  if (latch_deferred) {
+    // The buffer shown so far stays up until the next frame replaces it
+    release_fence_.Set(dup(next_release_fence));
+    return;
+  }
+
+  // Only a buffer we scanned out and which got replaced needs to wait for the
+  // new frame, anything else is free right away
+  if (scanned_out_ && buffer_changed && release_fence >= 0)
+    release_fence_.Set(dup(release_fence));
+  else
+    release_fence_.Close();
+
+  scanned_out_ = validated_type_ == HWC2::Composition::Device;
+}
+
+void DrmHwcTwo::HwcLayer::TrackAcquireFence(int64_t now_ns) {
+  if (tracked_fence_.get() >= 0) {
+    int64_t signaled_ns = FenceSignalTimeNs(tracked_fence_.get());
+    if (signaled_ns < 0)
+      return;
+    acquire_latency_ns_ = std::max(signaled_ns - tracked_since_ns_, (int64_t)0);
+    tracked_fence_.Close();
+  }
+
+  if (buffer_changed_ && acquire_fence_.get() >= 0) {
+    tracked_fence_.Set(dup(acquire_fence_.get()));
+    tracked_since_ns_ = now_ns;
+  }
+}
+
+bool DrmHwcTwo::HwcLayer::ShouldDeferLatch(int64_t now_ns,
+                                           int64_t deadline_ns) const {
+  // Never hold back the same buffer twice, nor without learning how late
+  // this producer usually is
+  if (latch_deferred_ || !buffer_changed_ || !scanned_out_ ||
+      !latched_buffer_ || acquire_fence_.get() < 0 || acquire_latency_ns_ < 0)
+    return false;
+
+  if (sync_wait(acquire_fence_.get(), 0) == 0)
+    return false;
+  return now_ns + acquire_latency_ns_ > deadline_ns;
+}
+
+void DrmHwcTwo::HwcLayer::GetScanoutCost(Importer *importer, uint64_t *bytes,
+                                          uint64_t *pixels) {
+  uint32_t format = DRM_FORMAT_ABGR8888;
+  uint64_t modifier = DRM_FORMAT_MOD_LINEAR;
+  hwc_drm_bo_t bo;
+  if (buffer_ && !importer->GetBufferInfo(buffer_, &bo)) {
+    format = bo.format;
+    modifier = bo.modifiers[0];
+  }
+  // Both 90 and 270 degrees, flipped or not, have the ROT_90 bit
+  bool rotated = static_cast<int32_t>(transform_) & HWC_TRANSFORM_ROT_90;
+  *bytes = BandwidthModel::ScanoutBytes(format, modifier, source_crop_,
+                                        rotated);
+  *pixels = BandwidthModel::ScanoutPixels(source_crop_, display_frame_,
+                                          rotated);
+}
+
+void DrmHwcTwo::HwcLayer::PopulateDrmLayer(DrmHwcLayer *layer, bool test,
+                                           bool latch_deferred) {
   supported(__func__);
   switch (blending_) {
     case HWC2::BlendMode::None:
@@ -866,14 +1456,24 @@ void DrmHwcTwo::HwcLayer::PopulateDrmLayer(DrmHwcLayer *layer) {
       break;
   }
 
-  OutputFd release_fence = release_fence_output();
-
-  layer->sf_handle = buffer_;
-  layer->acquire_fence = acquire_fence_.Release();
-  layer->release_fence = std::move(release_fence);
+  if (latch_deferred) {
+    // Already signaled, buffer_ keeps its fence for the next frame
+    layer->sf_handle = latched_buffer_;
+    layer->SetSourceCrop(latched_source_crop_);
+  } else if (test) {
+    layer->sf_handle = buffer_;
+    if (acquire_fence_.get() >= 0)
+      layer->acquire_fence.Set(dup(acquire_fence_.get()));
+    layer->SetSourceCrop(source_crop_);
+  } else {
+    layer->sf_handle = buffer_;
+    layer->acquire_fence = acquire_fence_.Release();
+    layer->SetSourceCrop(source_crop_);
+    latched_buffer_ = buffer_;
+    latched_source_crop_ = source_crop_;
+  }
   layer->SetDisplayFrame(display_frame_);
   layer->alpha = static_cast<uint16_t>(65535.0f * alpha_ + 0.5f);
-  layer->SetSourceCrop(source_crop_);
   layer->SetTransform(static_cast<int32_t>(transform_));
 }
 
@@ -900,186 +1500,233 @@ hwc2_function_pointer_t DrmHwcTwo::HookDevGetFunction(
     // Device functions
     case HWC2::FunctionDescriptor::CreateVirtualDisplay:
       return ToHook<HWC2_PFN_CREATE_VIRTUAL_DISPLAY>(
-          DeviceHook<int32_t, decltype(&DrmHwcTwo::CreateVirtualDisplay),
+          DeviceHook<HWC2::FunctionDescriptor::CreateVirtualDisplay, int32_t,
+                     decltype(&DrmHwcTwo::CreateVirtualDisplay),
                      &DrmHwcTwo::CreateVirtualDisplay, uint32_t, uint32_t,
-                     int32_t*, hwc2_display_t *>);
+                     int32_t *, hwc2_display_t *>);
     case HWC2::FunctionDescriptor::DestroyVirtualDisplay:
       return ToHook<HWC2_PFN_DESTROY_VIRTUAL_DISPLAY>(
-          DeviceHook<int32_t, decltype(&DrmHwcTwo::DestroyVirtualDisplay),
+          DeviceHook<HWC2::FunctionDescriptor::DestroyVirtualDisplay, int32_t,
+                     decltype(&DrmHwcTwo::DestroyVirtualDisplay),
                      &DrmHwcTwo::DestroyVirtualDisplay, hwc2_display_t>);
     case HWC2::FunctionDescriptor::Dump:
       return ToHook<HWC2_PFN_DUMP>(
-          DeviceHook<void, decltype(&DrmHwcTwo::Dump), &DrmHwcTwo::Dump,
-                     uint32_t *, char *>);
+          DeviceHook<HWC2::FunctionDescriptor::Dump, void,
+                     decltype(&DrmHwcTwo::Dump), &DrmHwcTwo::Dump, uint32_t *,
+                     char *>);
     case HWC2::FunctionDescriptor::GetMaxVirtualDisplayCount:
       return ToHook<HWC2_PFN_GET_MAX_VIRTUAL_DISPLAY_COUNT>(
-          DeviceHook<uint32_t, decltype(&DrmHwcTwo::GetMaxVirtualDisplayCount),
+          DeviceHook<HWC2::FunctionDescriptor::GetMaxVirtualDisplayCount,
+                     uint32_t, decltype(&DrmHwcTwo::GetMaxVirtualDisplayCount),
                      &DrmHwcTwo::GetMaxVirtualDisplayCount>);
     case HWC2::FunctionDescriptor::RegisterCallback:
       return ToHook<HWC2_PFN_REGISTER_CALLBACK>(
-          DeviceHook<int32_t, decltype(&DrmHwcTwo::RegisterCallback),
+          DeviceHook<HWC2::FunctionDescriptor::RegisterCallback, int32_t,
+                     decltype(&DrmHwcTwo::RegisterCallback),
                      &DrmHwcTwo::RegisterCallback, int32_t,
                      hwc2_callback_data_t, hwc2_function_pointer_t>);
 
     // Display functions
     case HWC2::FunctionDescriptor::AcceptDisplayChanges:
       return ToHook<HWC2_PFN_ACCEPT_DISPLAY_CHANGES>(
-          DisplayHook<decltype(&HwcDisplay::AcceptDisplayChanges),
+          DisplayHook<HWC2::FunctionDescriptor::AcceptDisplayChanges,
+                      decltype(&HwcDisplay::AcceptDisplayChanges),
                       &HwcDisplay::AcceptDisplayChanges>);
     case HWC2::FunctionDescriptor::CreateLayer:
       return ToHook<HWC2_PFN_CREATE_LAYER>(
-          DisplayHook<decltype(&HwcDisplay::CreateLayer),
+          DisplayHook<HWC2::FunctionDescriptor::CreateLayer,
+                      decltype(&HwcDisplay::CreateLayer),
                       &HwcDisplay::CreateLayer, hwc2_layer_t *>);
     case HWC2::FunctionDescriptor::DestroyLayer:
       return ToHook<HWC2_PFN_DESTROY_LAYER>(
-          DisplayHook<decltype(&HwcDisplay::DestroyLayer),
+          DisplayHook<HWC2::FunctionDescriptor::DestroyLayer,
+                      decltype(&HwcDisplay::DestroyLayer),
                       &HwcDisplay::DestroyLayer, hwc2_layer_t>);
     case HWC2::FunctionDescriptor::GetActiveConfig:
       return ToHook<HWC2_PFN_GET_ACTIVE_CONFIG>(
-          DisplayHook<decltype(&HwcDisplay::GetActiveConfig),
+          DisplayHook<HWC2::FunctionDescriptor::GetActiveConfig,
+                      decltype(&HwcDisplay::GetActiveConfig),
                       &HwcDisplay::GetActiveConfig, hwc2_config_t *>);
     case HWC2::FunctionDescriptor::GetChangedCompositionTypes:
       return ToHook<HWC2_PFN_GET_CHANGED_COMPOSITION_TYPES>(
-          DisplayHook<decltype(&HwcDisplay::GetChangedCompositionTypes),
+          DisplayHook<HWC2::FunctionDescriptor::GetChangedCompositionTypes,
+                      decltype(&HwcDisplay::GetChangedCompositionTypes),
                       &HwcDisplay::GetChangedCompositionTypes, uint32_t *,
                       hwc2_layer_t *, int32_t *>);
     case HWC2::FunctionDescriptor::GetClientTargetSupport:
       return ToHook<HWC2_PFN_GET_CLIENT_TARGET_SUPPORT>(
-          DisplayHook<decltype(&HwcDisplay::GetClientTargetSupport),
+          DisplayHook<HWC2::FunctionDescriptor::GetClientTargetSupport,
+                      decltype(&HwcDisplay::GetClientTargetSupport),
                       &HwcDisplay::GetClientTargetSupport, uint32_t, uint32_t,
                       int32_t, int32_t>);
     case HWC2::FunctionDescriptor::GetColorModes:
       return ToHook<HWC2_PFN_GET_COLOR_MODES>(
-          DisplayHook<decltype(&HwcDisplay::GetColorModes),
+          DisplayHook<HWC2::FunctionDescriptor::GetColorModes,
+                      decltype(&HwcDisplay::GetColorModes),
                       &HwcDisplay::GetColorModes, uint32_t *, int32_t *>);
     case HWC2::FunctionDescriptor::GetDisplayAttribute:
-      return ToHook<HWC2_PFN_GET_DISPLAY_ATTRIBUTE>(DisplayHook<
-          decltype(&HwcDisplay::GetDisplayAttribute),
-          &HwcDisplay::GetDisplayAttribute, hwc2_config_t, int32_t, int32_t *>);
+      return ToHook<HWC2_PFN_GET_DISPLAY_ATTRIBUTE>(
+          DisplayHook<HWC2::FunctionDescriptor::GetDisplayAttribute,
+                      decltype(&HwcDisplay::GetDisplayAttribute),
+                      &HwcDisplay::GetDisplayAttribute, hwc2_config_t, int32_t,
+                      int32_t *>);
     case HWC2::FunctionDescriptor::GetDisplayConfigs:
-      return ToHook<HWC2_PFN_GET_DISPLAY_CONFIGS>(DisplayHook<
-          decltype(&HwcDisplay::GetDisplayConfigs),
-          &HwcDisplay::GetDisplayConfigs, uint32_t *, hwc2_config_t *>);
+      return ToHook<HWC2_PFN_GET_DISPLAY_CONFIGS>(
+          DisplayHook<HWC2::FunctionDescriptor::GetDisplayConfigs,
+                      decltype(&HwcDisplay::GetDisplayConfigs),
+                      &HwcDisplay::GetDisplayConfigs, uint32_t *,
+                      hwc2_config_t *>);
     case HWC2::FunctionDescriptor::GetDisplayName:
       return ToHook<HWC2_PFN_GET_DISPLAY_NAME>(
-          DisplayHook<decltype(&HwcDisplay::GetDisplayName),
+          DisplayHook<HWC2::FunctionDescriptor::GetDisplayName,
+                      decltype(&HwcDisplay::GetDisplayName),
                       &HwcDisplay::GetDisplayName, uint32_t *, char *>);
     case HWC2::FunctionDescriptor::GetDisplayRequests:
       return ToHook<HWC2_PFN_GET_DISPLAY_REQUESTS>(
-          DisplayHook<decltype(&HwcDisplay::GetDisplayRequests),
+          DisplayHook<HWC2::FunctionDescriptor::GetDisplayRequests,
+                      decltype(&HwcDisplay::GetDisplayRequests),
                       &HwcDisplay::GetDisplayRequests, int32_t *, uint32_t *,
                       hwc2_layer_t *, int32_t *>);
     case HWC2::FunctionDescriptor::GetDisplayType:
       return ToHook<HWC2_PFN_GET_DISPLAY_TYPE>(
-          DisplayHook<decltype(&HwcDisplay::GetDisplayType),
+          DisplayHook<HWC2::FunctionDescriptor::GetDisplayType,
+                      decltype(&HwcDisplay::GetDisplayType),
                       &HwcDisplay::GetDisplayType, int32_t *>);
     case HWC2::FunctionDescriptor::GetDozeSupport:
       return ToHook<HWC2_PFN_GET_DOZE_SUPPORT>(
-          DisplayHook<decltype(&HwcDisplay::GetDozeSupport),
+          DisplayHook<HWC2::FunctionDescriptor::GetDozeSupport,
+                      decltype(&HwcDisplay::GetDozeSupport),
                       &HwcDisplay::GetDozeSupport, int32_t *>);
     case HWC2::FunctionDescriptor::GetHdrCapabilities:
       return ToHook<HWC2_PFN_GET_HDR_CAPABILITIES>(
-          DisplayHook<decltype(&HwcDisplay::GetHdrCapabilities),
+          DisplayHook<HWC2::FunctionDescriptor::GetHdrCapabilities,
+                      decltype(&HwcDisplay::GetHdrCapabilities),
                       &HwcDisplay::GetHdrCapabilities, uint32_t *, int32_t *,
                       float *, float *, float *>);
     case HWC2::FunctionDescriptor::GetReleaseFences:
       return ToHook<HWC2_PFN_GET_RELEASE_FENCES>(
-          DisplayHook<decltype(&HwcDisplay::GetReleaseFences),
+          DisplayHook<HWC2::FunctionDescriptor::GetReleaseFences,
+                      decltype(&HwcDisplay::GetReleaseFences),
                       &HwcDisplay::GetReleaseFences, uint32_t *, hwc2_layer_t *,
                       int32_t *>);
     case HWC2::FunctionDescriptor::PresentDisplay:
       return ToHook<HWC2_PFN_PRESENT_DISPLAY>(
-          DisplayHook<decltype(&HwcDisplay::PresentDisplay),
+          DisplayHook<HWC2::FunctionDescriptor::PresentDisplay,
+                      decltype(&HwcDisplay::PresentDisplay),
                       &HwcDisplay::PresentDisplay, int32_t *>);
     case HWC2::FunctionDescriptor::SetActiveConfig:
       return ToHook<HWC2_PFN_SET_ACTIVE_CONFIG>(
-          DisplayHook<decltype(&HwcDisplay::SetActiveConfig),
+          DisplayHook<HWC2::FunctionDescriptor::SetActiveConfig,
+                      decltype(&HwcDisplay::SetActiveConfig),
                       &HwcDisplay::SetActiveConfig, hwc2_config_t>);
     case HWC2::FunctionDescriptor::SetClientTarget:
-      return ToHook<HWC2_PFN_SET_CLIENT_TARGET>(DisplayHook<
-          decltype(&HwcDisplay::SetClientTarget), &HwcDisplay::SetClientTarget,
-          buffer_handle_t, int32_t, int32_t, hwc_region_t>);
+      return ToHook<HWC2_PFN_SET_CLIENT_TARGET>(
+          DisplayHook<HWC2::FunctionDescriptor::SetClientTarget,
+                      decltype(&HwcDisplay::SetClientTarget),
+                      &HwcDisplay::SetClientTarget, buffer_handle_t, int32_t,
+                      int32_t, hwc_region_t>);
     case HWC2::FunctionDescriptor::SetColorMode:
       return ToHook<HWC2_PFN_SET_COLOR_MODE>(
-          DisplayHook<decltype(&HwcDisplay::SetColorMode),
+          DisplayHook<HWC2::FunctionDescriptor::SetColorMode,
+                      decltype(&HwcDisplay::SetColorMode),
                       &HwcDisplay::SetColorMode, int32_t>);
     case HWC2::FunctionDescriptor::SetColorTransform:
       return ToHook<HWC2_PFN_SET_COLOR_TRANSFORM>(
-          DisplayHook<decltype(&HwcDisplay::SetColorTransform),
+          DisplayHook<HWC2::FunctionDescriptor::SetColorTransform,
+                      decltype(&HwcDisplay::SetColorTransform),
                       &HwcDisplay::SetColorTransform, const float *, int32_t>);
     case HWC2::FunctionDescriptor::SetOutputBuffer:
       return ToHook<HWC2_PFN_SET_OUTPUT_BUFFER>(
-          DisplayHook<decltype(&HwcDisplay::SetOutputBuffer),
+          DisplayHook<HWC2::FunctionDescriptor::SetOutputBuffer,
+                      decltype(&HwcDisplay::SetOutputBuffer),
                       &HwcDisplay::SetOutputBuffer, buffer_handle_t, int32_t>);
     case HWC2::FunctionDescriptor::SetPowerMode:
       return ToHook<HWC2_PFN_SET_POWER_MODE>(
-          DisplayHook<decltype(&HwcDisplay::SetPowerMode),
+          DisplayHook<HWC2::FunctionDescriptor::SetPowerMode,
+                      decltype(&HwcDisplay::SetPowerMode),
                       &HwcDisplay::SetPowerMode, int32_t>);
     case HWC2::FunctionDescriptor::SetVsyncEnabled:
       return ToHook<HWC2_PFN_SET_VSYNC_ENABLED>(
-          DisplayHook<decltype(&HwcDisplay::SetVsyncEnabled),
+          DisplayHook<HWC2::FunctionDescriptor::SetVsyncEnabled,
+                      decltype(&HwcDisplay::SetVsyncEnabled),
                       &HwcDisplay::SetVsyncEnabled, int32_t>);
     case HWC2::FunctionDescriptor::ValidateDisplay:
       return ToHook<HWC2_PFN_VALIDATE_DISPLAY>(
-          DisplayHook<decltype(&HwcDisplay::ValidateDisplay),
+          DisplayHook<HWC2::FunctionDescriptor::ValidateDisplay,
+                      decltype(&HwcDisplay::ValidateDisplay),
                       &HwcDisplay::ValidateDisplay, uint32_t *, uint32_t *>);
 
     // Layer functions
     case HWC2::FunctionDescriptor::SetCursorPosition:
       return ToHook<HWC2_PFN_SET_CURSOR_POSITION>(
-          LayerHook<decltype(&HwcLayer::SetCursorPosition),
+          LayerHook<HWC2::FunctionDescriptor::SetCursorPosition,
+                    decltype(&HwcLayer::SetCursorPosition),
                     &HwcLayer::SetCursorPosition, int32_t, int32_t>);
     case HWC2::FunctionDescriptor::SetLayerBlendMode:
       return ToHook<HWC2_PFN_SET_LAYER_BLEND_MODE>(
-          LayerHook<decltype(&HwcLayer::SetLayerBlendMode),
+          LayerHook<HWC2::FunctionDescriptor::SetLayerBlendMode,
+                    decltype(&HwcLayer::SetLayerBlendMode),
                     &HwcLayer::SetLayerBlendMode, int32_t>);
     case HWC2::FunctionDescriptor::SetLayerBuffer:
       return ToHook<HWC2_PFN_SET_LAYER_BUFFER>(
-          LayerHook<decltype(&HwcLayer::SetLayerBuffer),
+          LayerHook<HWC2::FunctionDescriptor::SetLayerBuffer,
+                    decltype(&HwcLayer::SetLayerBuffer),
                     &HwcLayer::SetLayerBuffer, buffer_handle_t, int32_t>);
     case HWC2::FunctionDescriptor::SetLayerColor:
       return ToHook<HWC2_PFN_SET_LAYER_COLOR>(
-          LayerHook<decltype(&HwcLayer::SetLayerColor),
+          LayerHook<HWC2::FunctionDescriptor::SetLayerColor,
+                    decltype(&HwcLayer::SetLayerColor),
                     &HwcLayer::SetLayerColor, hwc_color_t>);
     case HWC2::FunctionDescriptor::SetLayerCompositionType:
       return ToHook<HWC2_PFN_SET_LAYER_COMPOSITION_TYPE>(
-          LayerHook<decltype(&HwcLayer::SetLayerCompositionType),
+          LayerHook<HWC2::FunctionDescriptor::SetLayerCompositionType,
+                    decltype(&HwcLayer::SetLayerCompositionType),
                     &HwcLayer::SetLayerCompositionType, int32_t>);
     case HWC2::FunctionDescriptor::SetLayerDataspace:
       return ToHook<HWC2_PFN_SET_LAYER_DATASPACE>(
-          LayerHook<decltype(&HwcLayer::SetLayerDataspace),
+          LayerHook<HWC2::FunctionDescriptor::SetLayerDataspace,
+                    decltype(&HwcLayer::SetLayerDataspace),
                     &HwcLayer::SetLayerDataspace, int32_t>);
     case HWC2::FunctionDescriptor::SetLayerDisplayFrame:
       return ToHook<HWC2_PFN_SET_LAYER_DISPLAY_FRAME>(
-          LayerHook<decltype(&HwcLayer::SetLayerDisplayFrame),
+          LayerHook<HWC2::FunctionDescriptor::SetLayerDisplayFrame,
+                    decltype(&HwcLayer::SetLayerDisplayFrame),
                     &HwcLayer::SetLayerDisplayFrame, hwc_rect_t>);
     case HWC2::FunctionDescriptor::SetLayerPlaneAlpha:
       return ToHook<HWC2_PFN_SET_LAYER_PLANE_ALPHA>(
-          LayerHook<decltype(&HwcLayer::SetLayerPlaneAlpha),
+          LayerHook<HWC2::FunctionDescriptor::SetLayerPlaneAlpha,
+                    decltype(&HwcLayer::SetLayerPlaneAlpha),
                     &HwcLayer::SetLayerPlaneAlpha, float>);
     case HWC2::FunctionDescriptor::SetLayerSidebandStream:
-      return ToHook<HWC2_PFN_SET_LAYER_SIDEBAND_STREAM>(LayerHook<
-          decltype(&HwcLayer::SetLayerSidebandStream),
-          &HwcLayer::SetLayerSidebandStream, const native_handle_t *>);
+      return ToHook<HWC2_PFN_SET_LAYER_SIDEBAND_STREAM>(
+          LayerHook<HWC2::FunctionDescriptor::SetLayerSidebandStream,
+                    decltype(&HwcLayer::SetLayerSidebandStream),
+                    &HwcLayer::SetLayerSidebandStream,
+                    const native_handle_t *>);
     case HWC2::FunctionDescriptor::SetLayerSourceCrop:
       return ToHook<HWC2_PFN_SET_LAYER_SOURCE_CROP>(
-          LayerHook<decltype(&HwcLayer::SetLayerSourceCrop),
+          LayerHook<HWC2::FunctionDescriptor::SetLayerSourceCrop,
+                    decltype(&HwcLayer::SetLayerSourceCrop),
                     &HwcLayer::SetLayerSourceCrop, hwc_frect_t>);
     case HWC2::FunctionDescriptor::SetLayerSurfaceDamage:
       return ToHook<HWC2_PFN_SET_LAYER_SURFACE_DAMAGE>(
-          LayerHook<decltype(&HwcLayer::SetLayerSurfaceDamage),
+          LayerHook<HWC2::FunctionDescriptor::SetLayerSurfaceDamage,
+                    decltype(&HwcLayer::SetLayerSurfaceDamage),
                     &HwcLayer::SetLayerSurfaceDamage, hwc_region_t>);
     case HWC2::FunctionDescriptor::SetLayerTransform:
       return ToHook<HWC2_PFN_SET_LAYER_TRANSFORM>(
-          LayerHook<decltype(&HwcLayer::SetLayerTransform),
+          LayerHook<HWC2::FunctionDescriptor::SetLayerTransform,
+                    decltype(&HwcLayer::SetLayerTransform),
                     &HwcLayer::SetLayerTransform, int32_t>);
     case HWC2::FunctionDescriptor::SetLayerVisibleRegion:
       return ToHook<HWC2_PFN_SET_LAYER_VISIBLE_REGION>(
-          LayerHook<decltype(&HwcLayer::SetLayerVisibleRegion),
+          LayerHook<HWC2::FunctionDescriptor::SetLayerVisibleRegion,
+                    decltype(&HwcLayer::SetLayerVisibleRegion),
                     &HwcLayer::SetLayerVisibleRegion, hwc_region_t>);
     case HWC2::FunctionDescriptor::SetLayerZOrder:
       return ToHook<HWC2_PFN_SET_LAYER_Z_ORDER>(
-          LayerHook<decltype(&HwcLayer::SetLayerZOrder),
+          LayerHook<HWC2::FunctionDescriptor::SetLayerZOrder,
+                    decltype(&HwcLayer::SetLayerZOrder),
                     &HwcLayer::SetLayerZOrder, uint32_t>);
     case HWC2::FunctionDescriptor::Invalid:
     default:
@@ -14,15 +14,24 @@
  * limitations under the License.
  */
 
+#include "bandwidthmodel.h"
 #include "drmdisplaycompositor.h"
 #include "drmhwcomposer.h"
+#include "drmioctl.h"
+#include "hwctrace.h"
+#include "latencystats.h"
 #include "platform.h"
 #include "resourcemanager.h"
+#include "taskqueueworker.h"
 #include "vsyncworker.h"
 
 #include <hardware/hwcomposer2.h>
 
 #include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <sstream>
 
 namespace android {
 
@@ -32,6 +41,7 @@ class DrmHwcTwo : public hwc2_device_t {
                          struct hw_device_t **dev);
 
   DrmHwcTwo();
+  ~DrmHwcTwo();
 
   HWC2::Error Init();
 
@@ -57,11 +67,18 @@ class DrmHwcTwo : public hwc2_device_t {
     uint32_t z_order() const {
       return z_order_;
     }
+    const hwc_rect_t &display_frame() const {
+      return display_frame_;
+    }
+    const hwc_frect_t &source_crop() const {
+      return source_crop_;
+    }
 
     buffer_handle_t buffer() {
       return buffer_;
     }
     void set_buffer(buffer_handle_t buffer) {
+      buffer_changed_ |= buffer != buffer_;
       buffer_ = buffer;
     }
 
@@ -72,21 +89,30 @@ class DrmHwcTwo : public hwc2_device_t {
       acquire_fence_.Set(dup(acquire_fence));
     }
 
-    int release_fence() {
-      return release_fence_.get();
-    }
     int take_release_fence() {
       return release_fence_.Release();
     }
-    void manage_release_fence() {
-      release_fence_.Set(release_fence_raw_);
-      release_fence_raw_ = -1;
-    }
-    OutputFd release_fence_output() {
-      return OutputFd(&release_fence_raw_);
-    }
-
-    void PopulateDrmLayer(DrmHwcLayer *layer);
+    // Called once per presented frame, fence signals when the buffer shown
+    // before this frame isn't scanned out anymore. next_release_fence is
+    // handed out instead if the latch of the new buffer was deferred.
+    void PresentedWithReleaseFence(int release_fence, int next_release_fence,
+                                   bool latch_deferred);
+
+    // Latch-unsignaled support. Learns how long the producer of this layer
+    // takes to signal its acquire fences, and predicts whether the pending
+    // one signals before deadline_ns.
+    void TrackAcquireFence(int64_t now_ns);
+    bool ShouldDeferLatch(int64_t now_ns, int64_t deadline_ns) const;
+
+    // What scanning this layer out would cost per frame, see BandwidthModel
+    void GetScanoutCost(Importer *importer, uint64_t *bytes,
+                        uint64_t *pixels);
+
+    // For a test composition the acquire fence is only borrowed. With
+    // latch_deferred the last latched buffer is used instead of the new one,
+    // which keeps its acquire fence for the next frame.
+    void PopulateDrmLayer(DrmHwcLayer *layer, bool test = false,
+                          bool latch_deferred = false);
 
     // Layer hooks
     HWC2::Error SetCursorPosition(int32_t x, int32_t y);
@@ -111,10 +137,22 @@ class DrmHwcTwo : public hwc2_device_t {
     HWC2::Composition validated_type_ = HWC2::Composition::Invalid;
 
     HWC2::BlendMode blending_ = HWC2::BlendMode::None;
-    buffer_handle_t buffer_;
+    buffer_handle_t buffer_ = NULL;
+    // A new buffer was set since the last presented frame
+    bool buffer_changed_ = false;
+    // The buffer was on a plane in the last presented frame
+    bool scanned_out_ = false;
     UniqueFd acquire_fence_;
-    int release_fence_raw_ = -1;
     UniqueFd release_fence_;
+    // What the last presented frame actually latched
+    buffer_handle_t latched_buffer_ = NULL;
+    hwc_frect_t latched_source_crop_;
+    // The last frame deferred buffer_, so the next one has to take it
+    bool latch_deferred_ = false;
+    // Acquire fence being timed, and when we got it
+    UniqueFd tracked_fence_;
+    int64_t tracked_since_ns_ = -1;
+    int64_t acquire_latency_ns_ = -1;
     hwc_rect_t display_frame_;
     float alpha_ = 1.0f;
     hwc_frect_t source_crop_;
@@ -143,6 +181,8 @@ class DrmHwcTwo : public hwc2_device_t {
 
     HWC2::Error RegisterVsyncCallback(hwc2_callback_data_t data,
                                       hwc2_function_pointer_t func);
+    HWC2::Error RegisterRefreshCallback(hwc2_callback_data_t data,
+                                        hwc2_function_pointer_t func);
 
     // HWC Hooks
     HWC2::Error AcceptDisplayChanges();
@@ -185,9 +225,35 @@ class DrmHwcTwo : public hwc2_device_t {
       return layers_.at(layer);
     }
 
+    // Held across every hook into this display, displays never share it
+    std::mutex &lock() {
+      return lock_;
+    }
+
+    // Performance report for dumpsys, caller holds lock()
+    void Dump(std::ostringstream *out);
+    // Takes a FrameTimeline snapshot of this display and writes it to a file
+    // in dir on the task worker
+    void WriteTimelineSnapshot(const char *dir, std::string *path);
+    // Called on every layer hook, stamps the start of a frame
+    void LayerUpdated();
+
    private:
     HWC2::Error CreateComposition(bool test);
     void AddFenceToRetireFence(int fd);
+    // Hands composition to the commit worker, after waiting for the commit
+    // queued before it
+    void QueueCommit(std::unique_ptr<DrmDisplayComposition> composition);
+    // Waits for the last queued commit and returns its status. Its out fence
+    // is folded into the retire fence.
+    int WaitForCommit();
+    int CommitAndWait(std::unique_ptr<DrmDisplayComposition> composition);
+    void RequestRefresh();
+    void RecordSplit(uint32_t device_layers, uint32_t client_layers);
+    // Bandwidth of the composition about to be queued and of composing its
+    // client layers, for dumpsys and the trace counters
+    void EstimateBandwidth(DrmDisplayComposition *composition);
+    uint32_t BufferFormat(buffer_handle_t buffer);
 
     ResourceManager *resource_manager_;
     DrmDevice *drm_;
@@ -207,10 +273,73 @@ class DrmHwcTwo : public hwc2_device_t {
     std::map<hwc2_layer_t, HwcLayer> layers_;
     HwcLayer client_layer_;
     UniqueFd retire_fence_;
-    UniqueFd next_retire_fence_;
     int32_t color_mode_;
 
     uint32_t frame_no_ = 0;
+    // A layer of frame_no_ has been updated already
+    bool frame_started_ = false;
+
+    // How validate split the layers between the planes and the client, over
+    // the last kSplitHistorySize frames and in total
+    struct CompositionSplit {
+      uint32_t device = 0;
+      uint32_t client = 0;
+    };
+    static const size_t kSplitHistorySize = 16;
+    CompositionSplit split_history_[kSplitHistorySize];
+    size_t next_split_ = 0;
+    uint64_t validated_frames_ = 0;
+    uint64_t all_device_frames_ = 0;
+    uint64_t all_client_frames_ = 0;
+
+    BandwidthEstimate bandwidth_;
+    // hwc.drm.scanout_budget_mbps and hwc.drm.pixel_rate_budget_mpps, 0 if
+    // unlimited. ValidateDisplay() leaves layers to the client rather than
+    // have the CRTC fetch more than that.
+    uint64_t scanout_budget_mbps_ = 0;
+    uint64_t pixel_rate_budget_mpps_ = 0;
+    uint64_t over_budget_layers_ = 0;
+    // Trace counter names, bytes per second
+    std::string scanout_counter_;
+    std::string client_counter_;
+
+    LatencyStats validate_latency_;
+    LatencyStats present_latency_;
+    // Time spent in ApplyComposition() on the commit worker
+    LatencyStats commit_latency_;
+
+    // hwc.drm.ioctl_frame_stats: add up the DRM calls of every frame, from
+    // its validate to its commit. frame_ioctls_ collects those of the HWC
+    // thread, the commit worker owns commit_ioctls_ like queued_composition_.
+    bool ioctl_frame_stats_ = false;
+    DrmIoctlFrame frame_ioctls_;
+    DrmIoctlFrame commit_ioctls_;
+    DrmIoctlFrame last_frame_ioctls_;
+    DrmIoctlFrame worst_frame_ioctls_;
+
+    // hwc.drm.defer_unsignaled: device layers whose acquire fence is
+    // predicted to miss the next vsync keep their previous buffer for a frame
+    bool defer_unsignaled_ = false;
+
+    // hwc.drm.seamless_boot: if the display is still lit with a mode of the
+    // bootloader, set it as the first config and show the first frame with a
+    // plain page flip instead of a modeset, see DrmConnector::boot_mode_id()
+    bool seamless_boot_ = true;
+
+    hwc2_callback_data_t refresh_data_ = NULL;
+    HWC2_PFN_REFRESH refresh_hook_ = NULL;
+
+    // At most one commit is queued at a time. The commit worker owns
+    // queued_composition_, commit_status_ and commit_out_fence_ until
+    // WaitForCommit() returns.
+    std::unique_ptr<DrmDisplayComposition> queued_composition_;
+    int commit_status_ = 0;
+    UniqueFd commit_out_fence_;
+    TaskQueueWorker::TaskId pending_commit_ = 0;
+    // Declared last so that it's stopped before anything its tasks touch
+    TaskQueueWorker commit_worker_;
+
+    std::mutex lock_;
   };
 
   static DrmHwcTwo *toDrmHwcTwo(hwc2_device_t *dev) {
@@ -223,27 +352,50 @@ class DrmHwcTwo : public hwc2_device_t {
     return reinterpret_cast<hwc2_function_pointer_t>(function);
   }
 
-  template <typename T, typename HookType, HookType func, typename... Args>
+  // The hooks record their call to trace_ when hwc.drm.trace_file is set
+  template <HWC2::FunctionDescriptor function, typename T, typename HookType,
+            HookType func, typename... Args>
   static T DeviceHook(hwc2_device_t *dev, Args... args) {
     DrmHwcTwo *hwc = toDrmHwcTwo(dev);
+    if (hwc->trace_.enabled())
+      hwc->trace_.Record(static_cast<int32_t>(function), 0, 0, 0, args...);
     return static_cast<T>(((*hwc).*func)(std::forward<Args>(args)...));
   }
 
-  template <typename HookType, HookType func, typename... Args>
+  template <HWC2::FunctionDescriptor function, typename HookType,
+            HookType func, typename... Args>
   static int32_t DisplayHook(hwc2_device_t *dev, hwc2_display_t display_handle,
                              Args... args) {
     DrmHwcTwo *hwc = toDrmHwcTwo(dev);
-    HwcDisplay &display = hwc->displays_.at(display_handle);
-    return static_cast<int32_t>((display.*func)(std::forward<Args>(args)...));
+    std::shared_lock<std::shared_mutex> displays_lock(hwc->displays_lock_);
+    HwcDisplay *display = hwc->GetDisplay(display_handle);
+    if (!display)
+      return static_cast<int32_t>(HWC2::Error::BadDisplay);
+    std::lock_guard<std::mutex> lock(display->lock());
+    int32_t ret = static_cast<int32_t>((display->*func)(args...));
+    if (hwc->trace_.enabled())
+      hwc->trace_.Record(static_cast<int32_t>(function), display_handle, 0,
+                         ret, args...);
+    return ret;
   }
 
-  template <typename HookType, HookType func, typename... Args>
+  template <HWC2::FunctionDescriptor function, typename HookType,
+            HookType func, typename... Args>
   static int32_t LayerHook(hwc2_device_t *dev, hwc2_display_t display_handle,
                            hwc2_layer_t layer_handle, Args... args) {
     DrmHwcTwo *hwc = toDrmHwcTwo(dev);
-    HwcDisplay &display = hwc->displays_.at(display_handle);
-    HwcLayer &layer = display.get_layer(layer_handle);
-    return static_cast<int32_t>((layer.*func)(std::forward<Args>(args)...));
+    std::shared_lock<std::shared_mutex> displays_lock(hwc->displays_lock_);
+    HwcDisplay *display = hwc->GetDisplay(display_handle);
+    if (!display)
+      return static_cast<int32_t>(HWC2::Error::BadDisplay);
+    std::lock_guard<std::mutex> lock(display->lock());
+    HwcLayer &layer = display->get_layer(layer_handle);
+    display->LayerUpdated();
+    int32_t ret = static_cast<int32_t>((layer.*func)(args...));
+    if (hwc->trace_.enabled())
+      hwc->trace_.Record(static_cast<int32_t>(function), display_handle,
+                         layer_handle, ret, args...);
+    return ret;
   }
 
   // hwc2_device_t hooks
@@ -263,8 +415,28 @@ class DrmHwcTwo : public hwc2_device_t {
   HWC2::Error RegisterCallback(int32_t descriptor, hwc2_callback_data_t data,
                                hwc2_function_pointer_t function);
 
+  // Physical displays come and go with their connector, see
+  // ResourceManager::RegisterHotplugHandler(). The caller of AddDisplay() and
+  // RemoveDisplay() holds hotplug_lock_.
+  HWC2::Error AddDisplay(hwc2_display_t handle);
+  bool RemoveDisplay(hwc2_display_t handle);
+  void HandleHotplug(int display);
+  // Caller holds displays_lock_
+  HwcDisplay *GetDisplay(hwc2_display_t handle) {
+    auto display = displays_.find(handle);
+    return display != displays_.end() ? display->second.get() : NULL;
+  }
+
   ResourceManager resource_manager_;
-  std::map<hwc2_display_t, HwcDisplay> displays_;
+  // Hooks hold displays_lock_ shared for as long as they use their display,
+  // hotplug takes it exclusively to add or remove one
+  std::shared_mutex displays_lock_;
+  std::map<hwc2_display_t, std::unique_ptr<HwcDisplay>> displays_;
+  // Orders hotplugs against each other and against callback registration
+  std::mutex hotplug_lock_;
   std::map<HWC2::Callback, HwcCallback> callbacks_;
+  // Report built by the sizing call to Dump() and copied out by the next one
+  std::string dump_string_;
+  HwcTraceWriter trace_;
 };
 }
@@ -0,0 +1,160 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define ATRACE_TAG ATRACE_TAG_GRAPHICS
+#define LOG_TAG "hwc-drm-ioctl"
+
+#include "drmioctl.h"
+
+#include <time.h>
+
+#include <string>
+
+#include <utils/Trace.h>
+
+namespace android {
+
+static const char *const kTypeNames[DrmIoctlStats::kNumTypes] = {
+    "SET_CLIENT_CAP", "GETRESOURCES",          "GETCRTC",
+    "GETENCODER",     "GETCONNECTOR",          "GETPLANERESOURCES",
+    "GETPLANE",       "OBJ_GETPROPERTIES",     "GETPROPERTY",
+    "CREATEPROPBLOB", "DESTROYPROPBLOB",       "PRIME_FD_TO_HANDLE",
+    "ADDFB2",         "RMFB",                  "GEM_CLOSE",
+    "ATOMIC",         "CONNECTOR_SETPROPERTY", "CRTC_QUEUE_SEQUENCE",
+    "WAIT_VBLANK",    "READ_EVENTS"};
+
+static const char *const kCallerNames[DrmIoctlStats::kNumCallers] = {
+    "probe",       "property_lookup", "blob_create", "blob_destroy",
+    "import",      "release",         "test_commit", "commit",
+    "modeset",     "disable_planes",  "writeback",   "dpms",
+    "vblank",      "events"};
+
+// The calls of this thread are added to it as well when set
+static thread_local DrmIoctlFrame *current_frame = NULL;
+
+static int64_t NowNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000 * 1000 * 1000 + ts.tv_nsec;
+}
+
+// ATRACE wants names which outlive the section
+static const char *TraceName(DrmIoctlStats::Type type,
+                             DrmIoctlStats::Caller caller) {
+  static const std::string *names = [] {
+    std::string *table =
+        new std::string[DrmIoctlStats::kNumTypes * DrmIoctlStats::kNumCallers];
+    for (int t = 0; t < DrmIoctlStats::kNumTypes; ++t)
+      for (int c = 0; c < DrmIoctlStats::kNumCallers; ++c)
+        table[t * DrmIoctlStats::kNumCallers + c] =
+            std::string("drm ") + kTypeNames[t] + " " + kCallerNames[c];
+    return table;
+  }();
+  return names[type * DrmIoctlStats::kNumCallers + caller].c_str();
+}
+
+const char *DrmIoctlStats::TypeName(Type type) {
+  return kTypeNames[type];
+}
+
+const char *DrmIoctlStats::CallerName(Caller caller) {
+  return kCallerNames[caller];
+}
+
+void DrmIoctlStats::Counter::Add(int64_t ns) {
+  count.fetch_add(1, std::memory_order_relaxed);
+  total_ns.fetch_add(ns, std::memory_order_relaxed);
+
+  int64_t max = max_ns.load(std::memory_order_relaxed);
+  while (ns > max &&
+         !max_ns.compare_exchange_weak(max, ns, std::memory_order_relaxed))
+    ;
+}
+
+void DrmIoctlStats::Counter::Dump(const char *name, std::ostringstream *out) {
+  uint64_t n = count.exchange(0, std::memory_order_relaxed);
+  uint64_t total = total_ns.exchange(0, std::memory_order_relaxed);
+  int64_t max = max_ns.exchange(0, std::memory_order_relaxed);
+  if (!n)
+    return;
+  *out << "    " << name << ": n=" << n << " total=" << total / 1000
+       << "us mean=" << total / n / 1000 << "us max=" << max / 1000 << "us\n";
+}
+
+int64_t DrmIoctlStats::Begin(Type type, Caller caller) {
+  ATRACE_BEGIN(TraceName(type, caller));
+  return NowNs();
+}
+
+void DrmIoctlStats::End(Type type, Caller caller, int64_t start_ns) {
+  int64_t ns = NowNs() - start_ns;
+  ATRACE_END();
+
+  types_[type].Add(ns);
+  callers_[caller].Add(ns);
+  if (current_frame) {
+    current_frame->count[caller]++;
+    current_frame->ns[caller] += ns;
+  }
+}
+
+void DrmIoctlStats::Dump(std::ostringstream *out) {
+  *out << "  ioctls since last dump, per type:\n";
+  for (int t = 0; t < kNumTypes; ++t)
+    types_[t].Dump(kTypeNames[t], out);
+  *out << "  per caller:\n";
+  for (int c = 0; c < kNumCallers; ++c)
+    callers_[c].Dump(kCallerNames[c], out);
+}
+
+uint32_t DrmIoctlFrame::total_count() const {
+  uint32_t total = 0;
+  for (uint32_t n : count)
+    total += n;
+  return total;
+}
+
+int64_t DrmIoctlFrame::total_ns() const {
+  int64_t total = 0;
+  for (int64_t n : ns)
+    total += n;
+  return total;
+}
+
+void DrmIoctlFrame::Add(const DrmIoctlFrame &other) {
+  for (int c = 0; c < DrmIoctlStats::kNumCallers; ++c) {
+    count[c] += other.count[c];
+    ns[c] += other.ns[c];
+  }
+}
+
+void DrmIoctlFrame::Dump(std::ostringstream *out) const {
+  *out << "n=" << total_count() << " total=" << total_ns() / 1000 << "us";
+  for (int c = 0; c < DrmIoctlStats::kNumCallers; ++c)
+    if (count[c])
+      *out << " " << kCallerNames[c] << "=" << count[c] << "/"
+           << ns[c] / 1000 << "us";
+}
+
+DrmIoctlFrameScope::DrmIoctlFrameScope(DrmIoctlFrame *frame)
+    : previous_(current_frame) {
+  current_frame = frame;
+}
+
+DrmIoctlFrameScope::~DrmIoctlFrameScope() {
+  current_frame = previous_;
+}
+}
@@ -0,0 +1,142 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_DRM_IOCTL_H_
+#define ANDROID_DRM_IOCTL_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <sstream>
+
+namespace android {
+
+struct DrmIoctlFrame;
+
+// Accounting of the libdrm calls of a DrmDevice. DrmDevice, the importers, the
+// compositors and the event listener issue them all through Call(), which
+// counts them along with their cumulative and max latency, both per type of
+// call and per caller, and wraps them in ATRACE sections named
+// "drm <type> <caller>".
+class DrmIoctlStats {
+ public:
+  // libdrm calls, named after the ioctl they issue
+  enum Type {
+    kSetClientCap,
+    kGetResources,
+    kGetCrtc,
+    kGetEncoder,
+    kGetConnector,
+    kGetPlaneResources,
+    kGetPlane,
+    kObjGetProperties,
+    kGetProperty,
+    kCreatePropBlob,
+    kDestroyPropBlob,
+    kPrimeFdToHandle,
+    kAddFb2,
+    kRmFb,
+    kGemClose,
+    kAtomic,
+    kConnectorSetProperty,
+    kCrtcQueueSequence,
+    kWaitVblank,
+    kReadEvents,
+    kNumTypes
+  };
+
+  // What the call was made for
+  enum Caller {
+    kProbe,
+    kPropertyLookup,
+    kBlobCreate,
+    kBlobDestroy,
+    kImport,
+    kRelease,
+    kTestCommit,
+    kCommit,
+    kModesetCommit,
+    kDisablePlanes,
+    kWriteback,
+    kDpms,
+    kVblank,
+    kEvents,
+    kNumCallers
+  };
+
+  DrmIoctlStats() = default;
+  DrmIoctlStats(const DrmIoctlStats &) = delete;
+  DrmIoctlStats &operator=(const DrmIoctlStats &) = delete;
+
+  // Returns call(), which makes the libdrm call
+  template <typename F>
+  auto Call(Type type, Caller caller, F call) -> decltype(call()) {
+    int64_t start_ns = Begin(type, caller);
+    auto ret = call();
+    End(type, caller, start_ns);
+    return ret;
+  }
+
+  // Prints the counters accumulated since the previous call and resets them
+  void Dump(std::ostringstream *out);
+
+  static const char *TypeName(Type type);
+  static const char *CallerName(Caller caller);
+
+ private:
+  struct Counter {
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> total_ns{0};
+    std::atomic<int64_t> max_ns{0};
+
+    void Add(int64_t ns);
+    void Dump(const char *name, std::ostringstream *out);
+  };
+
+  int64_t Begin(Type type, Caller caller);
+  void End(Type type, Caller caller, int64_t start_ns);
+
+  Counter types_[kNumTypes];
+  Counter callers_[kNumCallers];
+};
+
+// The calls made for one frame, per caller. While a DrmIoctlFrameScope is
+// alive, the calls of its thread are added to its frame as well.
+struct DrmIoctlFrame {
+  uint32_t count[DrmIoctlStats::kNumCallers] = {};
+  int64_t ns[DrmIoctlStats::kNumCallers] = {};
+
+  uint32_t total_count() const;
+  int64_t total_ns() const;
+  void Add(const DrmIoctlFrame &other);
+  // Prints "n=... total=...us" and the callers with any call
+  void Dump(std::ostringstream *out) const;
+};
+
+class DrmIoctlFrameScope {
+ public:
+  // A NULL frame doesn't attribute the calls to any frame
+  explicit DrmIoctlFrameScope(DrmIoctlFrame *frame);
+  ~DrmIoctlFrameScope();
+  DrmIoctlFrameScope(const DrmIoctlFrameScope &) = delete;
+  DrmIoctlFrameScope &operator=(const DrmIoctlFrameScope &) = delete;
+
+ private:
+  DrmIoctlFrame *previous_;
+};
+}
+
+#endif  // ANDROID_DRM_IOCTL_H_
@@ -51,6 +51,15 @@ bool DrmMode::operator==(const drmModeModeInfo &m) const {
          v_scan_ == m.vscan && flags_ == m.flags && type_ == m.type;
 }
 
+bool DrmMode::SameTimings(const DrmMode &m) const {
+  return clock_ == m.clock_ && h_display_ == m.h_display_ &&
+         h_sync_start_ == m.h_sync_start_ && h_sync_end_ == m.h_sync_end_ &&
+         h_total_ == m.h_total_ && h_skew_ == m.h_skew_ &&
+         v_display_ == m.v_display_ && v_sync_start_ == m.v_sync_start_ &&
+         v_sync_end_ == m.v_sync_end_ && v_total_ == m.v_total_ &&
+         v_scan_ == m.v_scan_ && flags_ == m.flags_;
+}
+
 void DrmMode::ToDrmModeModeInfo(drm_mode_modeinfo *m) const {
   m->clock = clock_;
   m->hdisplay = h_display_;
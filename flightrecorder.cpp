@@ -0,0 +1,157 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "hwc-flight-recorder"
+
+#include "flightrecorder.h"
+#include "autofd.h"
+#include "drmdisplaycomposition.h"
+#include "drmplane.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+
+#include <log/log.h>
+
+namespace android {
+
+void FlightRecord::Init(int display_id,
+                        DrmDisplayComposition *composition,
+                        bool test_only_commit) {
+  memset(this, 0, sizeof(*this));
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  start_ns = ts.tv_sec * 1000 * 1000 * 1000 + ts.tv_nsec;
+  ioctl_start_ns = -1;
+  ioctl_end_ns = -1;
+  frame_no = composition->frame_no();
+  display = display_id;
+  test_only = test_only_commit;
+
+  for (const DrmHwcLayer &layer : composition->layers()) {
+    if (num_layers == kMaxLayers) {
+      dropped++;
+      continue;
+    }
+    Layer &l = layers[num_layers++];
+    if (layer.buffer) {
+      l.fb_id = layer.buffer->fb_id;
+      l.format = layer.buffer->format;
+      l.width = layer.buffer->width;
+      l.height = layer.buffer->height;
+    }
+    l.display_frame[0] = layer.display_frame.left;
+    l.display_frame[1] = layer.display_frame.top;
+    l.display_frame[2] = layer.display_frame.right;
+    l.display_frame[3] = layer.display_frame.bottom;
+    l.source_crop[0] = layer.source_crop.left;
+    l.source_crop[1] = layer.source_crop.top;
+    l.source_crop[2] = layer.source_crop.right;
+    l.source_crop[3] = layer.source_crop.bottom;
+    l.transform = layer.transform;
+    l.alpha = layer.alpha;
+    l.blending = static_cast<uint8_t>(layer.blending);
+    l.has_acquire_fence = layer.acquire_fence.get() >= 0;
+  }
+
+  for (const DrmCompositionPlane &comp_plane :
+       composition->composition_planes()) {
+    if (num_planes == kMaxPlanes) {
+      dropped++;
+      continue;
+    }
+    Plane &p = planes[num_planes++];
+    p.plane_id = comp_plane.plane() ? comp_plane.plane()->id() : 0;
+    p.type = static_cast<uint32_t>(comp_plane.type());
+    p.source_layer = comp_plane.source_layers().empty()
+                         ? -1
+                         : comp_plane.source_layers().front();
+  }
+}
+
+void FlightRecord::AddProperty(uint32_t object_id, uint32_t property_id,
+                               uint64_t value) {
+  if (num_properties == kMaxProperties) {
+    dropped++;
+    return;
+  }
+  properties[num_properties++] = {object_id, property_id, value};
+}
+
+void FlightRecorder::Add(const FlightRecord &record) {
+  std::lock_guard<std::mutex> lk(mutex_);
+  records_[next_record_] = record;
+  next_record_ = (next_record_ + 1) % kNumRecords;
+  total_records_++;
+  if (record.result)
+    failed_records_++;
+}
+
+void FlightRecorder::Serialize(int display, const char *reason,
+                               std::string *out) const {
+  std::lock_guard<std::mutex> lk(mutex_);
+  Header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, "HWCF", sizeof(header.magic));
+  header.version = kVersion;
+  header.record_size = sizeof(FlightRecord);
+  header.num_records = std::min<uint64_t>(total_records_, kNumRecords);
+  header.display = display;
+  strncpy(header.reason, reason, sizeof(header.reason) - 1);
+  out->append(reinterpret_cast<const char *>(&header), sizeof(header));
+
+  for (size_t i = header.num_records; i > 0; --i) {
+    const FlightRecord &record =
+        records_[(next_record_ + kNumRecords - i) % kNumRecords];
+    out->append(reinterpret_cast<const char *>(&record), sizeof(record));
+  }
+}
+
+void FlightRecorder::Dump(std::ostringstream *out) const {
+  std::lock_guard<std::mutex> lk(mutex_);
+  *out << "    flight recorder: commits=" << total_records_
+       << " failed=" << failed_records_ << "\n";
+}
+
+int FlightRecorder::WriteFile(const std::string &path,
+                              const std::string &data) {
+  UniqueFd fd(open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                   0644));
+  if (fd.get() < 0) {
+    int ret = -errno;
+    ALOGE("Failed to open %s ret=%d", path.c_str(), ret);
+    return ret;
+  }
+
+  size_t written = 0;
+  while (written < data.size()) {
+    ssize_t ret = write(fd.get(), data.data() + written, data.size() - written);
+    if (ret < 0 && errno == EINTR)
+      continue;
+    if (ret < 0) {
+      ret = -errno;
+      ALOGE("Failed to write %s ret=%zd", path.c_str(), ret);
+      return ret;
+    }
+    written += ret;
+  }
+  return 0;
+}
+}
@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_FLIGHT_RECORDER_H_
+#define ANDROID_FLIGHT_RECORDER_H_
+
+#include <stdint.h>
+
+#include <mutex>
+#include <sstream>
+#include <string>
+
+namespace android {
+
+class DrmDisplayComposition;
+
+// Fixed size image of one atomic commit, test or real: what was asked of the
+// kernel and what it answered. Plain data, so a dump is just the records
+// back to back.
+struct FlightRecord {
+  static const size_t kMaxLayers = 16;
+  static const size_t kMaxPlanes = 16;
+  static const size_t kMaxProperties = 160;
+
+  struct Layer {
+    uint32_t fb_id;
+    uint32_t format;
+    uint32_t width;
+    uint32_t height;
+    int32_t display_frame[4];  // left, top, right, bottom
+    float source_crop[4];
+    uint32_t transform;
+    uint16_t alpha;
+    uint8_t blending;
+    uint8_t has_acquire_fence;
+  };
+
+  struct Plane {
+    uint32_t plane_id;
+    uint32_t type;          // DrmCompositionPlane::Type
+    int32_t source_layer;   // -1 for none
+  };
+
+  struct Property {
+    uint32_t object_id;
+    uint32_t property_id;
+    uint64_t value;
+  };
+
+  uint64_t frame_no;
+  // CLOCK_MONOTONIC, the ioctl ones are -1 if it was never issued
+  int64_t start_ns;
+  int64_t ioctl_start_ns;
+  int64_t ioctl_end_ns;
+  int32_t display;
+  // 0, or the error from building the request or from the ioctl
+  int32_t result;
+  uint32_t flags;  // DRM_MODE_ATOMIC_* flags passed to the ioctl
+  uint32_t test_only;
+  uint32_t num_layers;
+  uint32_t num_planes;
+  uint32_t num_properties;
+  // Layers, planes and properties which didn't fit
+  uint32_t dropped;
+  Layer layers[kMaxLayers];
+  Plane planes[kMaxPlanes];
+  Property properties[kMaxProperties];
+
+  void Init(int display, DrmDisplayComposition *composition,
+            bool test_only_commit);
+  void AddProperty(uint32_t object_id, uint32_t property_id, uint64_t value);
+};
+
+// Keeps the last kNumRecords commits of a display so that a failure can be
+// dumped along with what led up to it.
+class FlightRecorder {
+ public:
+  static const size_t kNumRecords = 32;
+  static const uint32_t kVersion = 1;
+
+  struct Header {
+    char magic[4];  // "HWCF"
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t num_records;
+    int32_t display;
+    char reason[28];
+  };
+
+  void Add(const FlightRecord &record);
+
+  // A Header followed by the records, oldest first
+  void Serialize(int display, const char *reason, std::string *out) const;
+  void Dump(std::ostringstream *out) const;
+
+  static int WriteFile(const std::string &path, const std::string &data);
+
+ private:
+  mutable std::mutex mutex_;
+  FlightRecord records_[kNumRecords];
+  size_t next_record_ = 0;
+  uint64_t total_records_ = 0;
+  uint64_t failed_records_ = 0;
+};
+}
+
+#endif  // ANDROID_FLIGHT_RECORDER_H_
@@ -0,0 +1,146 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "hwc-frame-timeline"
+
+#include "frametimeline.h"
+
+#include <string.h>
+#include <time.h>
+
+namespace android {
+
+FrameTimeline::FrameTimeline() : last_flipped_(0), flipped_(false) {
+  for (FrameRecord &record : ring_) {
+    record.frame_no.store(0, std::memory_order_relaxed);
+    for (std::atomic<int64_t> &stamp : record.stamps)
+      stamp.store(-1, std::memory_order_relaxed);
+  }
+}
+
+const char *FrameTimeline::StageName(Stage stage) {
+  switch (stage) {
+    case kSetLayer:
+      return "set_layer";
+    case kValidate:
+      return "validate";
+    case kPresent:
+      return "present";
+    case kImport:
+      return "import";
+    case kPlan:
+      return "plan";
+    case kTestCommit:
+      return "test_commit";
+    case kCommit:
+      return "commit";
+    case kFlip:
+      return "flip";
+    case kRelease:
+      return "release";
+    default:
+      return "<invalid>";
+  }
+}
+
+void FrameTimeline::Stamp(uint64_t frame_no, Stage stage) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  Stamp(frame_no, stage, ts.tv_sec * 1000 * 1000 * 1000 + ts.tv_nsec);
+}
+
+void FrameTimeline::Stamp(uint64_t frame_no, Stage stage,
+                          int64_t timestamp_ns) {
+  // Frames flip in order, anything else is a recommit of what's on screen
+  // already, e.g. a flattened scene
+  if (stage == kFlip && flipped_ && frame_no <= last_flipped_)
+    return;
+
+  FrameRecord &record = ring_[frame_no % kRingSize];
+  uint64_t slot_frame = record.frame_no.load(std::memory_order_acquire);
+  if (slot_frame > frame_no)
+    return;  // Overwritten by a newer frame already
+  if (slot_frame < frame_no) {
+    for (std::atomic<int64_t> &stamp : record.stamps)
+      stamp.store(-1, std::memory_order_relaxed);
+    record.frame_no.store(frame_no, std::memory_order_release);
+  }
+  record.stamps[stage].store(timestamp_ns, std::memory_order_relaxed);
+
+  for (int prev = stage - 1; prev >= 0; --prev) {
+    int64_t prev_ns = record.stamps[prev].load(std::memory_order_relaxed);
+    if (prev_ns >= 0 && prev_ns <= timestamp_ns) {
+      stage_latency_[stage].AddSample(timestamp_ns - prev_ns);
+      break;
+    }
+  }
+
+  if (stage != kFlip)
+    return;
+  for (int first = 0; first < kFlip; ++first) {
+    int64_t first_ns = record.stamps[first].load(std::memory_order_relaxed);
+    if (first_ns >= 0 && first_ns <= timestamp_ns) {
+      frame_latency_.AddSample(timestamp_ns - first_ns);
+      break;
+    }
+  }
+  // Scanning out this frame releases the buffers of the one before it
+  if (flipped_.exchange(true))
+    Stamp(last_flipped_, kRelease, timestamp_ns);
+  last_flipped_ = frame_no;
+}
+
+int64_t FrameTimeline::GetStamp(uint64_t frame_no, Stage stage) const {
+  const FrameRecord &record = ring_[frame_no % kRingSize];
+  if (record.frame_no.load(std::memory_order_acquire) != frame_no)
+    return -1;
+  return record.stamps[stage].load(std::memory_order_relaxed);
+}
+
+void FrameTimeline::Dump(std::ostringstream *out) const {
+  *out << "    stage latencies:\n";
+  for (int stage = 0; stage < kNumStages; ++stage) {
+    std::string name = "      ";
+    name += StageName(static_cast<Stage>(stage));
+    stage_latency_[stage].Dump(name.c_str(), out);
+  }
+  frame_latency_.Dump("      first_stage_to_flip", out);
+}
+
+void FrameTimeline::AppendSnapshot(std::string *out) const {
+  SnapshotHeader header;
+  memcpy(header.magic, "HWCT", sizeof(header.magic));
+  header.version = kSnapshotVersion;
+  header.num_stages = kNumStages;
+  header.num_buckets = LatencyStats::kNumBuckets;
+  header.ring_size = kRingSize;
+  header.reserved = 0;
+  out->append(reinterpret_cast<const char *>(&header), sizeof(header));
+
+  for (const LatencyStats &stats : stage_latency_)
+    stats.AppendSnapshot(out);
+  frame_latency_.AppendSnapshot(out);
+
+  auto append = [out](uint64_t value) {
+    out->append(reinterpret_cast<const char *>(&value), sizeof(value));
+  };
+  for (const FrameRecord &record : ring_) {
+    append(record.frame_no.load(std::memory_order_acquire));
+    for (const std::atomic<int64_t> &stamp : record.stamps)
+      append(stamp.load(std::memory_order_relaxed));
+  }
+}
+}
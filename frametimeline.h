@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_FRAME_TIMELINE_H_
+#define ANDROID_FRAME_TIMELINE_H_
+
+#include "latencystats.h"
+
+#include <stdint.h>
+
+#include <atomic>
+#include <sstream>
+#include <string>
+
+namespace android {
+
+// CLOCK_MONOTONIC timestamps of every stage a frame goes through on its way
+// to the glass, for the last kRingSize frames of a display, and a histogram
+// per stage of the time it took since the stage before it.
+//
+// Stamping is cheap enough to stay on: no locks and no allocation. A frame's
+// slot is claimed by the first stage stamped for it, which is always the
+// SurfaceFlinger thread; the later stages run one after the other on the
+// commit worker and the event loop.
+class FrameTimeline {
+ public:
+  enum Stage {
+    kSetLayer,    // First layer update of the frame
+    kValidate,    // ValidateDisplay() done
+    kPresent,     // PresentDisplay() called
+    kImport,      // Buffers imported
+    kPlan,        // Layers assigned to planes
+    kTestCommit,  // TEST_ONLY commit done
+    kCommit,      // Commit handed to the kernel
+    kFlip,        // Page flip event
+    kRelease,     // Next frame flipped, the buffers are released
+    kNumStages
+  };
+  static const size_t kRingSize = 64;
+
+  FrameTimeline();
+  FrameTimeline(const FrameTimeline &) = delete;
+  FrameTimeline &operator=(const FrameTimeline &) = delete;
+
+  void Stamp(uint64_t frame_no, Stage stage, int64_t timestamp_ns);
+  void Stamp(uint64_t frame_no, Stage stage);
+
+  // Timestamp of stage for frame_no, -1 if it wasn't stamped or the frame
+  // isn't in the ring (anymore)
+  int64_t GetStamp(uint64_t frame_no, Stage stage) const;
+  const LatencyStats &stage_latency(Stage stage) const {
+    return stage_latency_[stage];
+  }
+
+  void Dump(std::ostringstream *out) const;
+  // Appends a SnapshotHeader, the stage and frame histograms (see
+  // LatencyStats::AppendSnapshot) and the ring slots, each as a native
+  // endian 64 bit frame number followed by its kNumStages timestamps.
+  void AppendSnapshot(std::string *out) const;
+
+  struct SnapshotHeader {
+    char magic[4];  // "HWCT"
+    uint32_t version;
+    uint32_t num_stages;
+    uint32_t num_buckets;
+    uint32_t ring_size;
+    uint32_t reserved;
+  };
+  static const uint32_t kSnapshotVersion = 1;
+
+  static const char *StageName(Stage stage);
+
+ private:
+  struct FrameRecord {
+    std::atomic<uint64_t> frame_no;
+    std::atomic<int64_t> stamps[kNumStages];
+  };
+
+  FrameRecord ring_[kRingSize];
+  // Time from the previous stamped stage of the same frame
+  LatencyStats stage_latency_[kNumStages];
+  // Time from the first stage to the flip
+  LatencyStats frame_latency_;
+  // Only written by the event loop
+  std::atomic<uint64_t> last_flipped_;
+  std::atomic<bool> flipped_;
+};
+}
+
+#endif  // ANDROID_FRAME_TIMELINE_H_
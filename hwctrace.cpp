@@ -0,0 +1,223 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#define LOG_TAG "hwc-trace"
+
+#include "hwctrace.h"
+#include "taskqueueworker.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <unistd.h>
+
+#include <log/log.h>
+
+namespace android {
+
+static int WriteAll(int fd, const std::string &data) {
+  size_t written = 0;
+  while (written < data.size()) {
+    ssize_t ret = write(fd, data.data() + written, data.size() - written);
+    if (ret < 0 && errno == EINTR)
+      continue;
+    if (ret < 0)
+      return -errno;
+    written += ret;
+  }
+  return 0;
+}
+
+HwcTraceWriter::~HwcTraceWriter() {
+  if (!fd_)
+    return;
+  std::lock_guard<std::mutex> lock(mutex_);
+  // Queued behind the earlier flushes, so the tail lands last
+  if (!buffer_.empty())
+    worker_->Wait(worker_->Post([this] {
+      if (WriteAll(fd_->get(), buffer_))
+        ALOGE("Failed to write the end of the trace");
+    }));
+}
+
+int HwcTraceWriter::Open(const char *path, TaskQueueWorker *worker,
+                         Describer describe) {
+  UniqueFd fd(open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644));
+  if (fd.get() < 0) {
+    int ret = -errno;
+    ALOGE("Failed to open trace %s ret=%d", path, ret);
+    return ret;
+  }
+
+  HwcTraceHeader header;
+  memcpy(header.magic, "HWCR", sizeof(header.magic));
+  header.version = kHwcTraceVersion;
+  buffer_.reserve(kFlushBytes * 2);
+  PutRaw(header);
+
+  fd_ = std::make_shared<UniqueFd>(fd.Release());
+  worker_ = worker;
+  describe_ = describe;
+  start_ns_ = last_flush_ns_ = TaskQueueWorker::Now();
+  ALOGI("Recording HWC2 calls to %s", path);
+  return 0;
+}
+
+void HwcTraceWriter::Define(buffer_handle_t buffer) {
+  if (!buffer)
+    return;
+
+  HwcTraceBuffer info;
+  memset(&info, 0, sizeof(info));
+  bool valid = !describe_(buffer, &info);
+  auto it = buffers_.find(buffer);
+  // Handles get reused once freed, so compare with what was seen last
+  if (it != buffers_.end() && it->second.valid == valid &&
+      (!valid || (it->second.info.width == info.width &&
+                  it->second.info.height == info.height &&
+                  it->second.info.format == info.format &&
+                  it->second.info.stride == info.stride &&
+                  it->second.info.usage == info.usage)))
+    return;
+
+  info.id = next_buffer_id_++;
+  buffers_[buffer] = KnownBuffer{info, valid};
+  size_t start = BeginLocked(kBufferFunction, 0, 0, 0);
+  PutRaw(info);
+  EndLocked(start);
+}
+
+void HwcTraceWriter::Put(hwc_region_t region) {
+  PutRaw<uint32_t>(region.rects ? region.numRects : 0);
+  for (size_t i = 0; region.rects && i < region.numRects; ++i)
+    PutRaw(region.rects[i]);
+}
+
+void HwcTraceWriter::Put(buffer_handle_t buffer) {
+  auto it = buffers_.find(buffer);
+  PutRaw<uint32_t>(it != buffers_.end() ? it->second.info.id : 0);
+}
+
+void HwcTraceWriter::Put(const float *matrix) {
+  PutRaw<uint8_t>(matrix != NULL);
+  if (matrix)
+    buffer_.append(reinterpret_cast<const char *>(matrix), 16 * sizeof(float));
+}
+
+size_t HwcTraceWriter::BeginLocked(int32_t function, uint64_t display,
+                                   uint64_t layer, int32_t error) {
+  HwcTraceRecord record;
+  record.size = 0;
+  record.function = function;
+  record.timestamp_ns = TaskQueueWorker::Now() - start_ns_;
+  record.display = display;
+  record.layer = layer;
+  record.error = error;
+  record.reserved = 0;
+
+  size_t start = buffer_.size();
+  PutRaw(record);
+  return start;
+}
+
+void HwcTraceWriter::EndLocked(size_t start) {
+  uint32_t size = buffer_.size() - start;
+  memcpy(&buffer_[start] + offsetof(HwcTraceRecord, size), &size,
+         sizeof(size));
+
+  int64_t now = TaskQueueWorker::Now();
+  if (buffer_.size() >= kFlushBytes || now - last_flush_ns_ >= kFlushIntervalNs)
+    FlushLocked(now);
+}
+
+void HwcTraceWriter::FlushLocked(int64_t now) {
+  last_flush_ns_ = now;
+  written_ += buffer_.size();
+  if (written_ >= kMaxBytes) {
+    ALOGW("Trace reached %zu bytes, not recording anymore", written_);
+    full_ = true;
+  }
+
+  std::shared_ptr<std::string> data = std::make_shared<std::string>();
+  data->reserve(kFlushBytes * 2);
+  data->swap(buffer_);
+  std::shared_ptr<UniqueFd> fd = fd_;
+  worker_->Post([fd, data] {
+    int ret = WriteAll(fd->get(), *data);
+    if (ret)
+      ALOGE("Failed to write trace ret=%d", ret);
+  });
+}
+
+int HwcTraceReader::Open(const char *path) {
+  UniqueFd fd(open(path, O_RDONLY | O_CLOEXEC));
+  if (fd.get() < 0) {
+    int ret = -errno;
+    ALOGE("Failed to open trace %s ret=%d", path, ret);
+    return ret;
+  }
+
+  char chunk[64 * 1024];
+  ssize_t len;
+  while ((len = read(fd.get(), chunk, sizeof(chunk))) != 0) {
+    if (len < 0 && errno == EINTR)
+      continue;
+    if (len < 0)
+      return -errno;
+    data_.append(chunk, len);
+  }
+
+  HwcTraceHeader header;
+  if (data_.size() < sizeof(header))
+    return -EINVAL;
+  memcpy(&header, data_.data(), sizeof(header));
+  if (memcmp(header.magic, "HWCR", sizeof(header.magic)) ||
+      header.version != kHwcTraceVersion) {
+    ALOGE("%s isn't a version %u trace", path, kHwcTraceVersion);
+    return -EINVAL;
+  }
+  pos_ = end_ = sizeof(header);
+  return 0;
+}
+
+bool HwcTraceReader::Next(HwcTraceRecord *record) {
+  if (end_ + sizeof(*record) > data_.size())
+    return false;
+  memcpy(record, data_.data() + end_, sizeof(*record));
+  if (record->size < sizeof(*record) || end_ + record->size > data_.size())
+    return false;
+
+  pos_ = end_ + sizeof(*record);
+  end_ += record->size;
+  error_ = false;
+  return true;
+}
+
+void HwcTraceReader::GetRegion(std::vector<hwc_rect_t> *rects) {
+  uint32_t count = Get<uint32_t>();
+  rects->clear();
+  for (uint32_t i = 0; i < count && !error_; ++i)
+    rects->push_back(Get<hwc_rect_t>());
+}
+
+bool HwcTraceReader::GetMatrix(float matrix[16]) {
+  bool present = Get<uint8_t>();
+  for (size_t i = 0; present && i < 16; ++i)
+    matrix[i] = Get<float>();
+  return present;
+}
+}
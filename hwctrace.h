@@ -0,0 +1,238 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef ANDROID_HWC_TRACE_H_
+#define ANDROID_HWC_TRACE_H_
+
+#include "autofd.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <hardware/hwcomposer2.h>
+
+namespace android {
+
+class TaskQueueWorker;
+
+// Binary trace of the HWC2 calls SurfaceFlinger makes, to reproduce its
+// layer stacks offline with hwc-drm-replay. The file is a HwcTraceHeader
+// followed by records, all native endian. A record is a HwcTraceRecord
+// followed by the arguments of the hook, in order, encoded by type:
+//
+//   integers, floats, rects and colors  as is
+//   hwc_region_t                        uint32_t count, then the rects
+//   buffer_handle_t                     uint32_t id of a buffer record, or 0
+//   const float * (color transform)     uint8_t present, then 16 floats
+//   output pointers                     uint8_t present, then the value the
+//                                       hook left in the first element
+//   other pointers                      uint8_t present
+//
+// Buffers get an id the first time they are seen, with a kBufferFunction
+// record holding a HwcTraceBuffer just before the call that uses them.
+// Pixels and fences aren't recorded.
+struct HwcTraceHeader {
+  char magic[4];  // "HWCR"
+  uint32_t version;
+};
+
+struct HwcTraceRecord {
+  uint32_t size;  // of the whole record, this header included
+  int32_t function;  // HWC2::FunctionDescriptor or kBufferFunction
+  // CLOCK_MONOTONIC, relative to the start of the trace
+  int64_t timestamp_ns;
+  uint64_t display;
+  uint64_t layer;
+  // What the hook returned. Device functions are recorded before they run
+  // and have 0, display and layer functions are recorded after.
+  int32_t error;
+  uint32_t reserved;
+};
+
+struct HwcTraceBuffer {
+  uint32_t id;
+  uint32_t width;
+  uint32_t height;
+  uint32_t format;  // DRM_FORMAT_*
+  uint32_t stride;
+  uint32_t reserved;
+  uint64_t usage;
+};
+
+static const uint32_t kHwcTraceVersion = 1;
+static const int32_t kBufferFunction = -1;
+
+class HwcTraceWriter {
+ public:
+  // Fills in everything but the id, returns an error if it can't
+  typedef std::function<int(buffer_handle_t, HwcTraceBuffer *)> Describer;
+
+  static const size_t kFlushBytes = 64 * 1024;
+  static const int64_t kFlushIntervalNs = 1000000000;
+  static const size_t kMaxBytes = 256 * 1024 * 1024;
+
+  ~HwcTraceWriter();
+
+  // Writes go through worker, which must outlive the writer
+  int Open(const char *path, TaskQueueWorker *worker, Describer describe);
+  // Only changed by Open(), before any hook runs
+  bool enabled() const {
+    return fd_ != nullptr;
+  }
+
+  template <typename... Args>
+  void Record(int32_t function, uint64_t display, uint64_t layer,
+              int32_t error, Args... args) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (full_)
+      return;
+    int defined[] = {0, (Define(args), 0)...};
+    size_t start = BeginLocked(function, display, layer, error);
+    int put[] = {0, (Put(args), 0)...};
+    EndLocked(start);
+    (void)defined;
+    (void)put;
+  }
+
+ private:
+  template <typename T>
+  void PutRaw(const T &value) {
+    buffer_.append(reinterpret_cast<const char *>(&value), sizeof(value));
+  }
+
+  template <typename T>
+  void Define(T /*arg*/) {
+  }
+  void Define(buffer_handle_t buffer);
+
+  void Put(int32_t value) {
+    PutRaw(value);
+  }
+  void Put(uint32_t value) {
+    PutRaw(value);
+  }
+  void Put(uint64_t value) {
+    PutRaw(value);
+  }
+  void Put(float value) {
+    PutRaw(value);
+  }
+  void Put(hwc_rect_t rect) {
+    PutRaw(rect);
+  }
+  void Put(hwc_frect_t rect) {
+    PutRaw(rect);
+  }
+  void Put(hwc_color_t color) {
+    PutRaw(color);
+  }
+  void Put(hwc_region_t region);
+  void Put(buffer_handle_t buffer);
+  void Put(const float *matrix);
+  void Put(char *string) {
+    PutRaw<uint8_t>(string != NULL);
+  }
+  void Put(void *data) {
+    PutRaw<uint8_t>(data != NULL);
+  }
+  void Put(hwc2_function_pointer_t function) {
+    PutRaw<uint8_t>(function != NULL);
+  }
+  template <typename T>
+  void Put(T *output) {
+    PutRaw<uint8_t>(output != NULL);
+    if (output)
+      PutRaw(*output);
+  }
+
+  size_t BeginLocked(int32_t function, uint64_t display, uint64_t layer,
+                     int32_t error);
+  void EndLocked(size_t start);
+  void FlushLocked(int64_t now);
+
+  std::shared_ptr<UniqueFd> fd_;
+  TaskQueueWorker *worker_ = NULL;
+  Describer describe_;
+
+  std::mutex mutex_;
+  std::string buffer_;
+  int64_t start_ns_ = 0;
+  int64_t last_flush_ns_ = 0;
+  size_t written_ = 0;
+  bool full_ = false;
+  uint32_t next_buffer_id_ = 1;
+  struct KnownBuffer {
+    HwcTraceBuffer info;
+    bool valid;
+  };
+  std::map<buffer_handle_t, KnownBuffer> buffers_;
+};
+
+// Reads a whole trace back, for replaying it
+class HwcTraceReader {
+ public:
+  int Open(const char *path);
+
+  // Moves to the next record, false at the end of the trace or if the
+  // record is truncated
+  bool Next(HwcTraceRecord *record);
+
+  // Arguments of the current record, in the order they were written. Reads
+  // past the end of the record return zeroes and set error().
+  template <typename T>
+  T Get() {
+    T value;
+    memset(&value, 0, sizeof(value));
+    if (pos_ + sizeof(value) > end_) {
+      error_ = true;
+      return value;
+    }
+    memcpy(&value, data_.data() + pos_, sizeof(value));
+    pos_ += sizeof(value);
+    return value;
+  }
+  void GetRegion(std::vector<hwc_rect_t> *rects);
+  // Returns whether the pointer was non-NULL, and the recorded value if any
+  template <typename T>
+  bool GetOutput(T *value) {
+    bool present = Get<uint8_t>();
+    if (present)
+      *value = Get<T>();
+    return present;
+  }
+  bool GetMatrix(float matrix[16]);
+
+  bool error() const {
+    return error_;
+  }
+
+ private:
+  std::string data_;
+  size_t pos_ = 0;
+  size_t end_ = 0;
+  bool error_ = false;
+};
+}
+
+#endif  // ANDROID_HWC_TRACE_H_
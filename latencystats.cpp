@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "hwc-latency-stats"
+
+#include "latencystats.h"
+
+#include <algorithm>
+
+namespace android {
+
+// Needed once one is bound to a reference, as gtest's ASSERT_* do
+const int LatencyStats::kSubBucketBits;
+const size_t LatencyStats::kSubBuckets;
+const int LatencyStats::kMaxValueBits;
+const size_t LatencyStats::kNumBuckets;
+
+LatencyStats::LatencyStats() : count_(0), sum_ns_(0), max_ns_(0) {
+  for (std::atomic<uint64_t> &bucket : buckets_)
+    bucket.store(0, std::memory_order_relaxed);
+}
+
+size_t LatencyStats::BucketIndex(int64_t value_ns) {
+  if (value_ns < (int64_t)(2 * kSubBuckets))
+    return value_ns < 0 ? 0 : value_ns;
+  if (value_ns >= (1ll << kMaxValueBits))
+    return kNumBuckets - 1;
+
+  // value_ns >> shift lands in [kSubBuckets, 2 * kSubBuckets)
+  int shift = 63 - __builtin_clzll(value_ns) - kSubBucketBits;
+  return shift * kSubBuckets + (value_ns >> shift);
+}
+
+int64_t LatencyStats::BucketHighestValue(size_t index) {
+  if (index < 2 * kSubBuckets)
+    return index;
+  int shift = index / kSubBuckets - 1;
+  int64_t mantissa = index - shift * kSubBuckets;
+  return ((mantissa + 1) << shift) - 1;
+}
+
+void LatencyStats::AddSample(int64_t latency_ns) {
+  buckets_[BucketIndex(latency_ns)].fetch_add(1, std::memory_order_relaxed);
+  count_.fetch_add(1, std::memory_order_relaxed);
+  sum_ns_.fetch_add(std::max<int64_t>(latency_ns, 0),
+                    std::memory_order_relaxed);
+
+  int64_t max = max_ns_.load(std::memory_order_relaxed);
+  while (latency_ns > max &&
+         !max_ns_.compare_exchange_weak(max, latency_ns,
+                                        std::memory_order_relaxed))
+    ;
+}
+
+uint64_t LatencyStats::total_samples() const {
+  return count_.load(std::memory_order_relaxed);
+}
+
+int64_t LatencyStats::Percentile(unsigned p) const {
+  // Work on a copy, samples added meanwhile would skew the ranks
+  uint64_t counts[kNumBuckets];
+  uint64_t total = 0;
+  for (size_t i = 0; i < kNumBuckets; ++i) {
+    counts[i] = buckets_[i].load(std::memory_order_relaxed);
+    total += counts[i];
+  }
+  if (!total)
+    return -1;
+
+  // Nearest rank, so p100 is the max and p0 the min
+  uint64_t rank = std::max<uint64_t>((std::min(p, 100u) * total + 99) / 100, 1);
+  uint64_t seen = 0;
+  for (size_t i = 0; i < kNumBuckets; ++i) {
+    seen += counts[i];
+    if (seen >= rank)
+      return std::min(BucketHighestValue(i),
+                      max_ns_.load(std::memory_order_relaxed));
+  }
+  return max_ns_.load(std::memory_order_relaxed);
+}
+
+void LatencyStats::Dump(const char *name, std::ostringstream *out) const {
+  uint64_t count = total_samples();
+  *out << name << ": n=" << count;
+  if (!count) {
+    *out << "\n";
+    return;
+  }
+  *out << " mean=" << sum_ns_.load(std::memory_order_relaxed) / count / 1000
+       << "us p50=" << Percentile(50) / 1000
+       << "us p90=" << Percentile(90) / 1000
+       << "us p99=" << Percentile(99) / 1000
+       << "us max=" << max_ns_.load(std::memory_order_relaxed) / 1000
+       << "us\n";
+}
+
+void LatencyStats::AppendSnapshot(std::string *out) const {
+  auto append = [out](uint64_t value) {
+    out->append(reinterpret_cast<const char *>(&value), sizeof(value));
+  };
+  append(count_.load(std::memory_order_relaxed));
+  append(sum_ns_.load(std::memory_order_relaxed));
+  append(max_ns_.load(std::memory_order_relaxed));
+  for (const std::atomic<uint64_t> &bucket : buckets_)
+    append(bucket.load(std::memory_order_relaxed));
+}
+}
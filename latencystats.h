@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_LATENCY_STATS_H_
+#define ANDROID_LATENCY_STATS_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <sstream>
+#include <string>
+
+namespace android {
+
+// Log-bucket latency histogram in the style of HdrHistogram: every power of
+// two is split into kSubBuckets linear buckets, so any value is reported
+// within 1/kSubBuckets of itself. Samples are counted with relaxed atomics,
+// never lock and never allocate, and may be added from any thread.
+class LatencyStats {
+ public:
+  static const int kSubBucketBits = 4;
+  static const size_t kSubBuckets = 1 << kSubBucketBits;
+  // Values of 2^kMaxValueBits ns (~68s) and up land in the last bucket
+  static const int kMaxValueBits = 36;
+  static const size_t kNumBuckets =
+      (kMaxValueBits - kSubBucketBits + 1) * kSubBuckets;
+
+  LatencyStats();
+  LatencyStats(const LatencyStats &) = delete;
+  LatencyStats &operator=(const LatencyStats &) = delete;
+
+  void AddSample(int64_t latency_ns);
+
+  // Percentile p (0-100) of all samples, rounded up to the highest value of
+  // its bucket, or -1 if there are none
+  int64_t Percentile(unsigned p) const;
+  uint64_t total_samples() const;
+
+  // Prints "name: n=... mean=... p50=... p90=... p99=... max=..." in
+  // microseconds
+  void Dump(const char *name, std::ostringstream *out) const;
+  // Appends the sample count, sum, max and the kNumBuckets bucket counts as
+  // native endian 64 bit integers
+  void AppendSnapshot(std::string *out) const;
+
+  static size_t BucketIndex(int64_t value_ns);
+  static int64_t BucketHighestValue(size_t index);
+
+ private:
+  std::atomic<uint64_t> buckets_[kNumBuckets];
+  std::atomic<uint64_t> count_;
+  std::atomic<uint64_t> sum_ns_;
+  std::atomic<int64_t> max_ns_;
+};
+}
+
+#endif  // ANDROID_LATENCY_STATS_H_
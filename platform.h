@@ -20,6 +20,8 @@
 #include "drmdisplaycomposition.h"
 #include "drmhwcomposer.h"
 
+#include <errno.h>
+
 #include <hardware/hardware.h>
 #include <hardware/hwcomposer.h>
 
@@ -44,6 +46,12 @@ class Importer {
   //       implementation is responsible for ensuring thread safety.
   virtual int ImportBuffer(buffer_handle_t handle, hwc_drm_bo_t *bo) = 0;
 
+  // Fills in the size, format, usage and pitches of bo like ImportBuffer()
+  // would, without importing anything. Used to describe buffers in traces.
+  virtual int GetBufferInfo(buffer_handle_t /*handle*/, hwc_drm_bo_t * /*bo*/) {
+    return -ENOTSUP;
+  }
+
   // Releases the buffer object (ie: does the inverse of ImportBuffer)
   //
   // Note: This can be called from a different thread than ImportBuffer. The
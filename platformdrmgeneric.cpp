@@ -89,7 +89,12 @@ int DrmGenericImporter::ImportBuffer(buffer_handle_t handle, hwc_drm_bo_t *bo) {
     return -EINVAL;
 
   uint32_t gem_handle;
-  int ret = drmPrimeFDToHandle(drm_->fd(), gr_handle->prime_fd, &gem_handle);
+  int ret = drm_->ioctls().Call(DrmIoctlStats::kPrimeFdToHandle,
+                                DrmIoctlStats::kImport, [&] {
+                                  return drmPrimeFDToHandle(drm_->fd(),
+                                                            gr_handle->prime_fd,
+                                                            &gem_handle);
+                                });
   if (ret) {
     ALOGE("failed to import prime fd %d ret=%d", gr_handle->prime_fd, ret);
     return ret;
@@ -103,9 +108,17 @@ int DrmGenericImporter::ImportBuffer(buffer_handle_t handle, hwc_drm_bo_t *bo) {
   bo->pitches[0] = gr_handle->stride;
   bo->gem_handles[0] = gem_handle;
   bo->offsets[0] = 0;
-
-  ret = drmModeAddFB2(drm_->fd(), bo->width, bo->height, bo->format,
-                      bo->gem_handles, bo->pitches, bo->offsets, &bo->fb_id, 0);
+  bo->modifiers[0] = gr_handle->modifier;
+
+  // bo->modifiers only feeds the bandwidth model, not every driver takes
+  // DRM_MODE_FB_MODIFIERS
+  ret = drm_->ioctls().Call(DrmIoctlStats::kAddFb2, DrmIoctlStats::kImport,
+                            [&] {
+                              return drmModeAddFB2(drm_->fd(), bo->width,
+                                                   bo->height, bo->format,
+                                                   bo->gem_handles, bo->pitches,
+                                                   bo->offsets, &bo->fb_id, 0);
+                            });
   if (ret) {
     ALOGE("could not create drm fb %d", ret);
     return ret;
@@ -114,10 +127,28 @@ int DrmGenericImporter::ImportBuffer(buffer_handle_t handle, hwc_drm_bo_t *bo) {
   return ret;
 }
 
+int DrmGenericImporter::GetBufferInfo(buffer_handle_t handle,
+                                      hwc_drm_bo_t *bo) {
+  gralloc_handle_t *gr_handle = gralloc_handle(handle);
+  if (!gr_handle)
+    return -EINVAL;
+
+  memset(bo, 0, sizeof(hwc_drm_bo_t));
+  bo->width = gr_handle->width;
+  bo->height = gr_handle->height;
+  bo->format = ConvertHalFormatToDrm(gr_handle->format);
+  bo->usage = gr_handle->usage;
+  bo->pitches[0] = gr_handle->stride;
+  bo->modifiers[0] = gr_handle->modifier;
+  return 0;
+}
+
 int DrmGenericImporter::ReleaseBuffer(hwc_drm_bo_t *bo) {
-  if (bo->fb_id)
-    if (drmModeRmFB(drm_->fd(), bo->fb_id))
+  if (bo->fb_id) {
+    if (drm_->ioctls().Call(DrmIoctlStats::kRmFb, DrmIoctlStats::kRelease,
+                            [&] { return drmModeRmFB(drm_->fd(), bo->fb_id); }))
       ALOGE("Failed to rm fb");
+  }
 
   struct drm_gem_close gem_close;
   memset(&gem_close, 0, sizeof(gem_close));
@@ -127,7 +158,12 @@ int DrmGenericImporter::ReleaseBuffer(hwc_drm_bo_t *bo) {
       continue;
 
     gem_close.handle = bo->gem_handles[i];
-    int ret = drmIoctl(drm_->fd(), DRM_IOCTL_GEM_CLOSE, &gem_close);
+    int ret = drm_->ioctls().Call(DrmIoctlStats::kGemClose,
+                                  DrmIoctlStats::kRelease, [&] {
+                                    return drmIoctl(drm_->fd(),
+                                                    DRM_IOCTL_GEM_CLOSE,
+                                                    &gem_close);
+                                  });
     if (ret) {
       ALOGE("Failed to close gem handle %d %d", i, ret);
     } else {
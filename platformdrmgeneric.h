@@ -32,6 +32,7 @@ class DrmGenericImporter : public Importer {
   int Init();
 
   int ImportBuffer(buffer_handle_t handle, hwc_drm_bo_t *bo) override;
+  int GetBufferInfo(buffer_handle_t handle, hwc_drm_bo_t *bo) override;
   int ReleaseBuffer(hwc_drm_bo_t *bo) override;
 
   uint32_t ConvertHalFormatToDrm(uint32_t hal_format);
@@ -78,7 +78,12 @@ int HisiImporter::ImportBuffer(buffer_handle_t handle, hwc_drm_bo_t *bo) {
     return -EINVAL;
 
   uint32_t gem_handle;
-  int ret = drmPrimeFDToHandle(drm_->fd(), hnd->share_fd, &gem_handle);
+  int ret = drm_->ioctls().Call(DrmIoctlStats::kPrimeFdToHandle,
+                                DrmIoctlStats::kImport, [&] {
+                                  return drmPrimeFDToHandle(drm_->fd(),
+                                                            hnd->share_fd,
+                                                            &gem_handle);
+                                });
   if (ret) {
     ALOGE("failed to import prime fd %d ret=%d", hnd->share_fd, ret);
     return ret;
@@ -123,8 +128,13 @@ int HisiImporter::ImportBuffer(buffer_handle_t handle, hwc_drm_bo_t *bo) {
       break;
   }
 
-  ret = drmModeAddFB2(drm_->fd(), bo->width, bo->height, bo->format,
-                      bo->gem_handles, bo->pitches, bo->offsets, &bo->fb_id, 0);
+  ret = drm_->ioctls().Call(DrmIoctlStats::kAddFb2, DrmIoctlStats::kImport,
+                            [&] {
+                              return drmModeAddFB2(drm_->fd(), bo->width,
+                                                   bo->height, bo->format,
+                                                   bo->gem_handles, bo->pitches,
+                                                   bo->offsets, &bo->fb_id, 0);
+                            });
   if (ret) {
     ALOGE("could not create drm fb %d", ret);
     return ret;
@@ -133,6 +143,25 @@ int HisiImporter::ImportBuffer(buffer_handle_t handle, hwc_drm_bo_t *bo) {
   return ret;
 }
 
+int HisiImporter::GetBufferInfo(buffer_handle_t handle, hwc_drm_bo_t *bo) {
+  private_handle_t const *hnd =
+      reinterpret_cast<private_handle_t const *>(handle);
+  if (!hnd)
+    return -EINVAL;
+
+  int32_t fmt = ConvertHalFormatToDrm(hnd->req_format);
+  if (fmt < 0)
+    return fmt;
+
+  memset(bo, 0, sizeof(hwc_drm_bo_t));
+  bo->width = hnd->width;
+  bo->height = hnd->height;
+  bo->format = fmt;
+  bo->usage = hnd->usage;
+  bo->pitches[0] = hnd->byte_stride;
+  return 0;
+}
+
 std::unique_ptr<Planner> Planner::CreateInstance(DrmDevice *) {
   std::unique_ptr<Planner> planner(new Planner);
   planner->AddStage<PlanStageGreedy>();
@@ -35,6 +35,7 @@ class HisiImporter : public DrmGenericImporter {
   int Init();
 
   int ImportBuffer(buffer_handle_t handle, hwc_drm_bo_t *bo) override;
+  int GetBufferInfo(buffer_handle_t handle, hwc_drm_bo_t *bo) override;
 
  private:
   DrmDevice *drm_;
@@ -72,7 +72,12 @@ int DrmMinigbmImporter::ImportBuffer(buffer_handle_t handle, hwc_drm_bo_t *bo) {
     return -EINVAL;
 
   uint32_t gem_handle;
-  int ret = drmPrimeFDToHandle(drm_->fd(), gr_handle->fds[0], &gem_handle);
+  int ret = drm_->ioctls().Call(DrmIoctlStats::kPrimeFdToHandle,
+                                DrmIoctlStats::kImport, [&] {
+                                  return drmPrimeFDToHandle(drm_->fd(),
+                                                            gr_handle->fds[0],
+                                                            &gem_handle);
+                                });
   if (ret) {
     ALOGE("failed to import prime fd %d ret=%d", gr_handle->fds[0], ret);
     return ret;
@@ -87,8 +92,13 @@ int DrmMinigbmImporter::ImportBuffer(buffer_handle_t handle, hwc_drm_bo_t *bo) {
   bo->offsets[0] = gr_handle->offsets[0];
   bo->gem_handles[0] = gem_handle;
 
-  ret = drmModeAddFB2(drm_->fd(), bo->width, bo->height, bo->format,
-                      bo->gem_handles, bo->pitches, bo->offsets, &bo->fb_id, 0);
+  ret = drm_->ioctls().Call(DrmIoctlStats::kAddFb2, DrmIoctlStats::kImport,
+                            [&] {
+                              return drmModeAddFB2(drm_->fd(), bo->width,
+                                                   bo->height, bo->format,
+                                                   bo->gem_handles, bo->pitches,
+                                                   bo->offsets, &bo->fb_id, 0);
+                            });
   if (ret) {
     ALOGE("could not create drm fb %d", ret);
     return ret;
@@ -97,6 +107,22 @@ int DrmMinigbmImporter::ImportBuffer(buffer_handle_t handle, hwc_drm_bo_t *bo) {
   return ret;
 }
 
+int DrmMinigbmImporter::GetBufferInfo(buffer_handle_t handle,
+                                      hwc_drm_bo_t *bo) {
+  cros_gralloc_handle *gr_handle = (cros_gralloc_handle *)handle;
+  if (!gr_handle)
+    return -EINVAL;
+
+  memset(bo, 0, sizeof(hwc_drm_bo_t));
+  bo->width = gr_handle->width;
+  bo->height = gr_handle->height;
+  bo->format = gr_handle->format;
+  bo->usage = gr_handle->usage;
+  bo->pitches[0] = gr_handle->strides[0];
+  bo->offsets[0] = gr_handle->offsets[0];
+  return 0;
+}
+
 std::unique_ptr<Planner> Planner::CreateInstance(DrmResources *) {
   std::unique_ptr<Planner> planner(new Planner);
   planner->AddStage<PlanStageGreedy>();
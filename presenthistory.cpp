@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#define LOG_TAG "hwc-present-history"
+
+#include "presenthistory.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+
+#include <log/log.h>
+
+namespace android {
+
+// Number of most recent records printed by Dump()
+static const size_t kDumpRecords = 8;
+
+void PresentHistory::RecordPresent(uint64_t frame_no, int64_t commit_ns,
+                                   int64_t target_vsync_ns, int64_t present_ns,
+                                   int64_t vsync_period_ns) {
+  PresentRecord record;
+  record.frame_no = frame_no;
+  record.commit_ns = commit_ns;
+  record.present_ns = present_ns;
+  record.target_vsync_ns = target_vsync_ns;
+
+  // Anything more than half a period past the target is a later vblank
+  if (target_vsync_ns >= 0 && vsync_period_ns > 0 &&
+      present_ns > target_vsync_ns + vsync_period_ns / 2)
+    record.missed_vblanks =
+        (present_ns - target_vsync_ns + vsync_period_ns / 2) / vsync_period_ns;
+
+  std::lock_guard<std::mutex> lk(mutex_);
+  presented_frames_++;
+  if (record.missed_vblanks) {
+    late_frames_++;
+    missed_vblanks_ += record.missed_vblanks;
+    ALOGV("Frame %" PRIu64 " missed %u vblanks", frame_no,
+          record.missed_vblanks);
+  }
+
+  if (last_present_ns_ >= 0) {
+    int64_t interval = present_ns - last_present_ns_;
+    if (last_interval_ns_ >= 0 && vsync_period_ns > 0 &&
+        llabs(interval - last_interval_ns_) > vsync_period_ns / 2)
+      janky_frames_++;
+    last_interval_ns_ = interval;
+  }
+  last_present_ns_ = present_ns;
+
+  records_[next_record_] = record;
+  next_record_ = (next_record_ + 1) % kHistorySize;
+}
+
+bool PresentHistory::GetRecord(uint64_t frame_no,
+                               PresentRecord *record) const {
+  std::lock_guard<std::mutex> lk(mutex_);
+  for (const PresentRecord &r : records_) {
+    if (r.present_ns >= 0 && r.frame_no == frame_no) {
+      *record = r;
+      return true;
+    }
+  }
+  return false;
+}
+
+void PresentHistory::Dump(std::ostringstream *out) const {
+  std::lock_guard<std::mutex> lk(mutex_);
+  *out << "    presented=" << presented_frames_ << " late=" << late_frames_
+       << " missed_vblanks=" << missed_vblanks_ << " janky=" << janky_frames_
+       << "\n";
+
+  for (size_t i = kDumpRecords; i > 0; --i) {
+    const PresentRecord &r =
+        records_[(next_record_ + kHistorySize - i) % kHistorySize];
+    if (r.present_ns < 0)
+      continue;
+    *out << "    frame=" << r.frame_no
+         << " commit_to_present_us=" << (r.present_ns - r.commit_ns) / 1000
+         << " missed=" << r.missed_vblanks << "\n";
+  }
+}
+}
@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef ANDROID_PRESENT_HISTORY_H_
+#define ANDROID_PRESENT_HISTORY_H_
+
+#include <stdint.h>
+
+#include <mutex>
+#include <sstream>
+
+namespace android {
+
+struct PresentRecord {
+  uint64_t frame_no = 0;
+  // CLOCK_MONOTONIC timestamps of the commit and of the page flip event
+  int64_t commit_ns = -1;
+  int64_t present_ns = -1;
+  // Vsync the frame was meant to hit, -1 if it wasn't known at commit time
+  int64_t target_vsync_ns = -1;
+  uint32_t missed_vblanks = 0;
+};
+
+// Ring buffer of recent page flip timestamps for a display, with running
+// counters of frames which reached the glass late. Records are added from the
+// event loop and read from Dump(), hence the lock.
+class PresentHistory {
+ public:
+  static const size_t kHistorySize = 128;
+
+  void RecordPresent(uint64_t frame_no, int64_t commit_ns,
+                     int64_t target_vsync_ns, int64_t present_ns,
+                     int64_t vsync_period_ns);
+
+  // Returns false if frame_no isn't in the history (anymore)
+  bool GetRecord(uint64_t frame_no, PresentRecord *record) const;
+
+  void Dump(std::ostringstream *out) const;
+
+ private:
+  mutable std::mutex mutex_;
+
+  PresentRecord records_[kHistorySize];
+  size_t next_record_ = 0;
+
+  uint64_t presented_frames_ = 0;
+  // Frames which missed the vsync they were committed for
+  uint64_t late_frames_ = 0;
+  uint64_t missed_vblanks_ = 0;
+  // Frames shown for a different number of vsyncs than the one before them
+  uint64_t janky_frames_ = 0;
+  int64_t last_present_ns_ = -1;
+  int64_t last_interval_ns_ = -1;
+};
+}
+
+#endif  // ANDROID_PRESENT_HISTORY_H_
@@ -19,32 +19,77 @@
 #include "resourcemanager.h"
 
 #include <cutils/properties.h>
+#include <hardware/hardware.h>
 #include <log/log.h>
+#include <unistd.h>
 #include <sstream>
 #include <string>
+#include <thread>
 
 namespace android {
 
-ResourceManager::ResourceManager() : num_displays_(0), gralloc_(NULL) {
+// Connectors tend to bounce a few times while a cable is plugged in, with a
+// uevent each time. Reprobe once things have settled.
+static const int64_t kHotplugDebounceNs = 200 * 1000 * 1000;
+static const char kHotplugTaskKey[] = "hotplug";
+
+ResourceManager::ResourceManager()
+    : num_displays_(0),
+      gralloc_(NULL),
+      task_worker_("hwc-deferred", HAL_PRIORITY_URGENT_DISPLAY) {
 }
 
 int ResourceManager::Init() {
+  int ret = task_worker_.Init();
+  if (ret) {
+    ALOGE("Failed to start deferred task worker %d", ret);
+    return ret;
+  }
+
   char path_pattern[PROPERTY_VALUE_MAX];
   // Could be a valid path or it can have at the end of it the wildcard %
-  // which means that it will try open all devices until an error is met.
+  // which means that it will try all the devices until one is missing.
   int path_len = property_get("hwc.drm.device", path_pattern, "/dev/dri/card0");
-  int ret = 0;
+  std::vector<std::string> paths;
   if (path_pattern[path_len - 1] != '%') {
-    ret = AddDrmDevice(std::string(path_pattern));
+    paths.emplace_back(path_pattern);
   } else {
     path_pattern[path_len - 1] = '\0';
-    for (int idx = 0; !ret; ++idx) {
-      std::ostringstream path;
-      path << path_pattern << idx;
-      ret = AddDrmDevice(path.str());
+    for (int idx = 0;; ++idx) {
+      std::string path = std::string(path_pattern) + std::to_string(idx);
+      if (access(path.c_str(), F_OK))
+        break;
+      paths.push_back(path);
     }
   }
 
+  // Probing is mostly spent waiting on the kernel, do all the devices at once
+  std::vector<std::unique_ptr<DrmDevice>> drms;
+  std::vector<int> probe_ret(paths.size(), 0);
+  std::vector<std::thread> probes;
+  for (size_t i = 0; i < paths.size(); ++i)
+    drms.emplace_back(std::make_unique<DrmDevice>());
+  for (size_t i = 1; i < paths.size(); ++i)
+    probes.emplace_back([&drms, &paths, &probe_ret, i] {
+      probe_ret[i] = drms[i]->Probe(paths[i].c_str());
+    });
+  if (!paths.empty())
+    probe_ret[0] = drms[0]->Probe(paths[0].c_str());
+  for (std::thread &probe : probes)
+    probe.join();
+
+  // Displays are numbered in device order
+  for (size_t i = 0; i < drms.size(); ++i) {
+    ret = probe_ret[i];
+    if (ret) {
+      ALOGE("Failed to probe %s %d", paths[i].c_str(), ret);
+      continue;
+    }
+    ret = AddDrmDevice(std::move(drms[i]));
+    if (ret)
+      ALOGE("Failed to add %s %d", paths[i].c_str(), ret);
+  }
+
   if (!num_displays_) {
     ALOGE("Failed to initialize any displays");
     return ret ? -EINVAL : ret;
@@ -54,22 +99,190 @@ int ResourceManager::Init() {
                        (const hw_module_t **)&gralloc_);
 }
 
-int ResourceManager::AddDrmDevice(std::string path) {
-  std::unique_ptr<DrmDevice> drm = std::make_unique<DrmDevice>();
-  int displays_added, ret;
-  std::tie(ret, displays_added) = drm->Init(path.c_str(), num_displays_);
-  if (ret)
+int ResourceManager::AddDrmDevice(std::unique_ptr<DrmDevice> drm) {
+  int displays_added = drm->AssignDisplays(num_displays_);
+  // The device of the primary display is always set up
+  bool connected = displays_added && !num_displays_;
+  for (auto &conn : drm->connectors())
+    connected |= conn->display() >= 0 && conn->state() == DRM_MODE_CONNECTED;
+  drms_.push_back(std::move(drm));
+  importers_.emplace_back();
+  // The planes of a device without any connected display are only enumerated
+  // once one of its displays is connected, so it doesn't hold up the first
+  // frame
+  if (connected) {
+    int ret = ActivateDevice(drms_.back().get());
+    if (ret) {
+      drms_.pop_back();
+      importers_.pop_back();
+      return ret;
+    }
+  }
+  num_displays_ += displays_added;
+  return 0;
+}
+
+int ResourceManager::ActivateDevice(DrmDevice *drm) {
+  std::lock_guard<std::mutex> lock(devices_lock_);
+  size_t index = 0;
+  while (index < drms_.size() && drms_[index].get() != drm)
+    ++index;
+  if (index == drms_.size())
+    return -ENODEV;
+  if (importers_[index])
+    return 0;
+
+  int ret = drm->InitPipes();
+  if (ret) {
+    ALOGE("Failed to set up the pipes of device fd=%d %d", drm->fd(), ret);
     return ret;
+  }
+
   std::shared_ptr<Importer> importer;
-  importer.reset(Importer::CreateInstance(drm.get()));
+  importer.reset(Importer::CreateInstance(drm));
   if (!importer) {
     ALOGE("Failed to create importer instance");
     return -ENODEV;
   }
-  importers_.push_back(importer);
-  drms_.push_back(std::move(drm));
-  num_displays_ += displays_added;
-  return ret;
+  importers_[index] = importer;
+  for (auto &conn : drm->connectors())
+    UpdatePipeLocked(drm, conn.get(), importer.get());
+  return 0;
+}
+
+void ResourceManager::UpdatePipeLocked(DrmDevice *drm, DrmConnector *conn,
+                                       Importer *importer) {
+  int display = conn->display();
+  if (display < 0 || !drm->HandlesDisplay(display))
+    return;
+
+  std::unique_ptr<DrmDisplayPipe> &pipe = pipes_[display];
+  if (!pipe)
+    pipe = std::make_unique<DrmDisplayPipe>();
+  pipe->display = display;
+  pipe->device = drm;
+  pipe->crtc = drm->GetCrtcForDisplay(display);
+  pipe->connector = conn;
+  pipe->importer = importer;
+  pipe->planes.clear();
+  if (!pipe->crtc)
+    return;
+  for (auto &plane : drm->planes())
+    if (plane->GetCrtcSupported(*pipe->crtc))
+      pipe->planes.push_back(plane.get());
+}
+
+DrmDisplayPipe *ResourceManager::ConnectDisplay(int display) {
+  DrmDevice *drm = GetDrmDevice(display);
+  if (!drm)
+    return NULL;
+  int ret = ActivateDevice(drm);
+  if (ret)
+    return NULL;
+
+  std::lock_guard<std::mutex> lock(devices_lock_);
+  DrmConnector *conn = drm->GetConnectorForDisplay(display);
+  if (!drm->GetCrtcForDisplay(display)) {
+    ret = drm->CreateDisplayPipe(conn);
+    if (ret || !drm->GetCrtcForDisplay(display)) {
+      ALOGE("Failed to find a CRTC for display %d %d", display, ret);
+      return NULL;
+    }
+    if (!drm->AttachWriteback(conn))
+      ALOGI("Display %d has writeback attach to it", display);
+  }
+
+  size_t index = 0;
+  while (drms_[index].get() != drm)
+    ++index;
+  UpdatePipeLocked(drm, conn, importers_[index].get());
+  drm->event_listener()->ResetDisplay(display);
+  return pipes_[display].get();
+}
+
+void ResourceManager::DisconnectDisplay(int display) {
+  std::lock_guard<std::mutex> lock(devices_lock_);
+  auto pipe = pipes_.find(display);
+  if (pipe == pipes_.end() || !pipe->second->crtc)
+    return;
+
+  DrmDevice *drm = pipe->second->device;
+  drm->ReleaseDisplayPipe(pipe->second->connector);
+  pipe->second->crtc = NULL;
+  pipe->second->planes.clear();
+  drm->event_listener()->ResetDisplay(display);
+}
+
+void ResourceManager::RegisterHotplugHandler(HotplugHandler handler) {
+  {
+    std::lock_guard<std::mutex> lock(hotplug_lock_);
+    hotplug_handler_ = handler;
+    hotplug_events_.clear();
+  }
+  // Any listener gets the uevents of every device, the primary one's is
+  // always running
+  DrmDevice *drm = GetDrmDevice(0);
+  if (!handler) {
+    if (drm)
+      drm->event_listener()->RegisterHotplugHandler(NULL);
+    // Returns true as long as it cancelled a pending run, and waits for the
+    // running one otherwise
+    while (task_worker_.Cancel(kHotplugTaskKey))
+      ;
+    return;
+  }
+  if (!drm)
+    return;
+  drm->event_listener()->RegisterHotplugHandler(
+      [this](const DrmHotplugEvent &event) {
+        std::lock_guard<std::mutex> lock(hotplug_lock_);
+        if (!hotplug_handler_)
+          return;
+        hotplug_events_.push_back(event);
+        task_worker_.PostCoalesced(kHotplugTaskKey,
+                                   TaskQueueWorker::Now() + kHotplugDebounceNs,
+                                   [this] { HandleHotplugEvents(); });
+      });
+}
+
+void ResourceManager::HandleHotplugEvents() {
+  HotplugHandler handler;
+  std::vector<DrmHotplugEvent> events;
+  {
+    std::lock_guard<std::mutex> lock(hotplug_lock_);
+    handler = hotplug_handler_;
+    events.swap(hotplug_events_);
+  }
+  if (!handler)
+    return;
+
+  // Only the connectors the kernel named, all of them on older kernels
+  std::vector<int> displays;
+  for (auto &drm : drms_) {
+    for (auto &conn : drm->connectors()) {
+      if (conn->display() < 0)
+        continue;
+      for (const DrmHotplugEvent &event : events) {
+        if (event.minor >= 0 && drm->node_minor() >= 0 &&
+            event.minor != drm->node_minor())
+          continue;
+        if (event.connector_id && event.connector_id != conn->id())
+          continue;
+        displays.push_back(conn->display());
+        break;
+      }
+    }
+  }
+  for (int display : displays)
+    handler(display);
+}
+
+DrmDisplayPipe *ResourceManager::GetPipe(int display) {
+  std::lock_guard<std::mutex> lock(devices_lock_);
+  auto pipe = pipes_.find(display);
+  if (pipe == pipes_.end() || !pipe->second->crtc)
+    return NULL;
+  return pipe->second.get();
 }
 
 DrmConnector *ResourceManager::AvailableWritebackConnector(int display) {
@@ -81,7 +294,7 @@ DrmConnector *ResourceManager::AvailableWritebackConnector(int display) {
       return writeback_conn;
   }
   for (auto &drm : drms_) {
-    if (drm.get() == drm_device)
+    if (drm.get() == drm_device || !drm->pipes_initialized())
       continue;
     writeback_conn = drm->AvailableWritebackConnector(display);
     if (writeback_conn)
@@ -90,6 +303,10 @@ DrmConnector *ResourceManager::AvailableWritebackConnector(int display) {
   return writeback_conn;
 }
 
+int ResourceManager::num_displays() const {
+  return num_displays_;
+}
+
 DrmDevice *ResourceManager::GetDrmDevice(int display) {
   for (auto &drm : drms_) {
     if (drm->HandlesDisplay(display))
@@ -99,6 +316,7 @@ DrmDevice *ResourceManager::GetDrmDevice(int display) {
 }
 
 std::shared_ptr<Importer> ResourceManager::GetImporter(int display) {
+  std::lock_guard<std::mutex> lock(devices_lock_);
   for (unsigned int i = 0; i < drms_.size(); i++) {
     if (drms_[i]->HandlesDisplay(display))
       return importers_[i];
@@ -109,4 +327,9 @@ std::shared_ptr<Importer> ResourceManager::GetImporter(int display) {
 const gralloc_module_t *ResourceManager::gralloc() {
   return gralloc_;
 }
+
+void ResourceManager::DumpStats(std::ostringstream *out) {
+  for (auto &drm : drms_)
+    drm->DumpStats(out);
+}
 }
@@ -19,11 +19,29 @@
 
 #include "drmdevice.h"
 #include "platform.h"
+#include "taskqueueworker.h"
 
 #include <string.h>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <sstream>
 
 namespace android {
 
+// Everything a display is driven through, resolved once when its device is
+// activated so that the frame path doesn't look any of it up
+struct DrmDisplayPipe {
+  int display;
+  DrmDevice *device;
+  DrmCrtc *crtc;
+  DrmConnector *connector;
+  // Owned by the resource manager
+  Importer *importer;
+  // The planes which can be used on crtc
+  std::vector<DrmPlane *> planes;
+};
+
 class ResourceManager {
  public:
   ResourceManager();
@@ -34,14 +52,54 @@ class ResourceManager {
   std::shared_ptr<Importer> GetImporter(int display);
   const gralloc_module_t *gralloc();
   DrmConnector *AvailableWritebackConnector(int display);
+  // NULL until the display's device is activated. The pipe lives as long as
+  // the resource manager, keep it rather than looking it up for every frame.
+  DrmDisplayPipe *GetPipe(int display);
+  // Enumerates the planes of a device that had no connected display at
+  // Init() and creates its importer, see DrmDevice::InitPipes()
+  int ActivateDevice(DrmDevice *drm);
+  // Displays are numbered 0 to num_displays() - 1, connected or not
+  int num_displays() const;
+
+  // Routes a connected display to a CRTC, activating its device first if
+  // needed, and returns its pipe
+  DrmDisplayPipe *ConnectDisplay(int display);
+  // Frees the CRTC of a disconnected display, GetPipe() is NULL afterwards.
+  // Nothing may use the pipe anymore.
+  void DisconnectDisplay(int display);
+
+  // Called on the task worker with each display whose connector might have
+  // changed, a moment after the kernel's hotplug uevents settled. Reprobing
+  // the connector is up to the handler. NULL unregisters it and waits for a
+  // running call to return.
+  typedef std::function<void(int display)> HotplugHandler;
+  void RegisterHotplugHandler(HotplugHandler handler);
+  // Per device counters, see DrmDevice::DumpStats()
+  void DumpStats(std::ostringstream *out);
+  // Shared thread for deferred and timed work that shouldn't run on the event
+  // loops or on SurfaceFlinger's threads
+  TaskQueueWorker *task_worker() {
+    return &task_worker_;
+  }
 
  private:
-  int AddDrmDevice(std::string path);
+  int AddDrmDevice(std::unique_ptr<DrmDevice> drm);
+  void UpdatePipeLocked(DrmDevice *drm, DrmConnector *conn,
+                        Importer *importer);
+  void HandleHotplugEvents();
 
   int num_displays_;
   std::vector<std::unique_ptr<DrmDevice>> drms_;
+  // NULL until the device is activated
   std::vector<std::shared_ptr<Importer>> importers_;
+  std::map<int, std::unique_ptr<DrmDisplayPipe>> pipes_;
+  std::mutex devices_lock_;
   const gralloc_module_t *gralloc_;
+  std::mutex hotplug_lock_;
+  HotplugHandler hotplug_handler_;
+  std::vector<DrmHotplugEvent> hotplug_events_;
+  // Last so queued tasks are gone before the devices they might use
+  TaskQueueWorker task_worker_;
 };
 }
 
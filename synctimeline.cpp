@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#define LOG_TAG "hwc-sync-timeline"
+
+#include "synctimeline.h"
+
+#include <errno.h>
+
+#include <log/log.h>
+#include <sw_sync.h>
+
+namespace android {
+
+int SyncTimeline::Init(const char *name) {
+  std::lock_guard<std::mutex> lk(mutex_);
+  name_ = name;
+  timeline_fd_.Set(sw_sync_timeline_create());
+  if (timeline_fd_.get() < 0) {
+    int ret = -errno;
+    ALOGW("Failed to create %s timeline %d", name, ret);
+    return ret;
+  }
+  return 0;
+}
+
+bool SyncTimeline::valid() {
+  std::lock_guard<std::mutex> lk(mutex_);
+  return timeline_fd_.get() >= 0;
+}
+
+int SyncTimeline::CreateFence(uint32_t point) {
+  std::lock_guard<std::mutex> lk(mutex_);
+  if (timeline_fd_.get() < 0 || point <= signaled_)
+    return -1;
+
+  int fd = sw_sync_fence_create(timeline_fd_.get(), name_.c_str(), point);
+  if (fd < 0)
+    ALOGE("Failed to create %s fence %u %d", name_.c_str(), point, -errno);
+  return fd;
+}
+
+void SyncTimeline::SignalUpTo(uint32_t point) {
+  std::lock_guard<std::mutex> lk(mutex_);
+  if (timeline_fd_.get() < 0 || point <= signaled_)
+    return;
+
+  int ret = sw_sync_timeline_inc(timeline_fd_.get(), point - signaled_);
+  if (ret) {
+    ALOGE("Failed to signal %s timeline to %u %d", name_.c_str(), point,
+          -errno);
+    return;
+  }
+  signaled_ = point;
+}
+}
@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef ANDROID_SYNC_TIMELINE_H_
+#define ANDROID_SYNC_TIMELINE_H_
+
+#include "autofd.h"
+
+#include <stdint.h>
+
+#include <mutex>
+#include <string>
+
+namespace android {
+
+// sw_sync timeline handing out fences for points which are signaled from
+// userspace. Used for release fences which must exist before the commit that
+// eventually signals them has run. Closing the timeline signals every fence
+// still pending on it.
+class SyncTimeline {
+ public:
+  // Returns -errno if sw_sync is not available, CreateFence() then always
+  // returns -1.
+  int Init(const char *name);
+
+  bool valid();
+
+  // Returns a fence signaled once the timeline reaches point, or -1
+  int CreateFence(uint32_t point);
+  // Signals every fence up to and including point
+  void SignalUpTo(uint32_t point);
+
+ private:
+  std::mutex mutex_;
+  UniqueFd timeline_fd_;
+  std::string name_;
+  uint32_t signaled_ = 0;
+};
+}
+
+#endif  // ANDROID_SYNC_TIMELINE_H_
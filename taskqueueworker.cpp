@@ -0,0 +1,245 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#define LOG_TAG "hwc-drm-task-queue"
+
+#include "taskqueueworker.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <log/log.h>
+
+namespace android {
+
+static const int64_t kOneSecondNs = 1 * 1000 * 1000 * 1000;
+
+TaskQueueWorker::TaskQueueWorker(const char *name, int priority)
+    : Worker(name, priority) {
+}
+
+TaskQueueWorker::~TaskQueueWorker() {
+  // Exit() must run while we can still kick the thread out of poll()
+  Exit();
+}
+
+int64_t TaskQueueWorker::Now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * kOneSecondNs + ts.tv_nsec;
+}
+
+int TaskQueueWorker::Init() {
+  timer_fd_.Set(timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC));
+  if (timer_fd_.get() < 0) {
+    ALOGE("Failed to create timerfd %d", -errno);
+    return -errno;
+  }
+
+  event_fd_.Set(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC));
+  if (event_fd_.get() < 0) {
+    ALOGE("Failed to create eventfd %d", -errno);
+    return -errno;
+  }
+
+  return InitWorker();
+}
+
+void TaskQueueWorker::Signal() {
+  uint64_t one = 1;
+  if (event_fd_.get() >= 0 && write(event_fd_.get(), &one, sizeof(one)) < 0)
+    ALOGE("Failed to kick task queue %d", -errno);
+  Worker::Signal();
+}
+
+TaskQueueWorker::TaskId TaskQueueWorker::Post(Task task) {
+  return PostAt(Now(), std::move(task));
+}
+
+TaskQueueWorker::TaskId TaskQueueWorker::PostDelayed(int64_t delay_ns,
+                                                     Task task) {
+  return PostAt(Now() + delay_ns, std::move(task));
+}
+
+TaskQueueWorker::TaskId TaskQueueWorker::PostAt(int64_t deadline_ns,
+                                                Task task) {
+  TaskId id;
+  {
+    std::lock_guard<std::mutex> lk(mutex_);
+    id = PostLocked(deadline_ns, std::string(), std::move(task));
+  }
+  Signal();
+  return id;
+}
+
+TaskQueueWorker::TaskId TaskQueueWorker::PostCoalesced(const std::string &key,
+                                                       int64_t deadline_ns,
+                                                       Task task) {
+  TaskId id;
+  {
+    std::lock_guard<std::mutex> lk(mutex_);
+    auto pending = keys_.find(key);
+    if (pending != keys_.end()) {
+      TaskId old_id = pending->second;
+      tasks_.erase(TaskOrder(deadlines_[old_id], old_id));
+      deadlines_.erase(old_id);
+      keys_.erase(pending);
+      task_done_.notify_all();
+    }
+    id = PostLocked(deadline_ns, key, std::move(task));
+  }
+  Signal();
+  return id;
+}
+
+TaskQueueWorker::TaskId TaskQueueWorker::PostLocked(int64_t deadline_ns,
+                                                    const std::string &key,
+                                                    Task task) {
+  TaskId id = next_id_++;
+  tasks_[TaskOrder(deadline_ns, id)] = PendingTask{std::move(task), key};
+  deadlines_[id] = deadline_ns;
+  if (!key.empty())
+    keys_[key] = id;
+  return id;
+}
+
+bool TaskQueueWorker::CancelLocked(TaskId id, std::unique_lock<std::mutex> *lk) {
+  auto deadline = deadlines_.find(id);
+  if (deadline != deadlines_.end()) {
+    auto task = tasks_.find(TaskOrder(deadline->second, id));
+    if (!task->second.key.empty())
+      keys_.erase(task->second.key);
+    tasks_.erase(task);
+    deadlines_.erase(deadline);
+    task_done_.notify_all();
+    return true;
+  }
+
+  // Wait for it to finish, unless that's us
+  if (std::this_thread::get_id() != thread_id_)
+    task_done_.wait(*lk, [this, id] { return running_ != id; });
+  return false;
+}
+
+bool TaskQueueWorker::Cancel(TaskId id) {
+  if (!id)
+    return false;
+  std::unique_lock<std::mutex> lk(mutex_);
+  return CancelLocked(id, &lk);
+}
+
+bool TaskQueueWorker::Cancel(const std::string &key) {
+  std::unique_lock<std::mutex> lk(mutex_);
+  auto pending = keys_.find(key);
+  if (pending != keys_.end())
+    return CancelLocked(pending->second, &lk);
+
+  // Not pending, but it may be running
+  if (running_ && running_key_ == key)
+    CancelLocked(running_, &lk);
+  return false;
+}
+
+void TaskQueueWorker::Wait(TaskId id) {
+  if (!id)
+    return;
+  std::unique_lock<std::mutex> lk(mutex_);
+  task_done_.wait(lk, [this, id] {
+    return running_ != id && deadlines_.find(id) == deadlines_.end();
+  });
+}
+
+size_t TaskQueueWorker::pending_tasks() {
+  std::lock_guard<std::mutex> lk(mutex_);
+  return tasks_.size();
+}
+
+int TaskQueueWorker::ArmTimerLocked() {
+  int64_t deadline = tasks_.empty() ? 0 : tasks_.begin()->first.first;
+  if (deadline == armed_deadline_ns_)
+    return 0;
+
+  // A zeroed it_value disarms the timer
+  struct itimerspec its;
+  memset(&its, 0, sizeof(its));
+  its.it_value.tv_sec = deadline / kOneSecondNs;
+  its.it_value.tv_nsec = deadline % kOneSecondNs;
+  if (timerfd_settime(timer_fd_.get(), TFD_TIMER_ABSTIME, &its, NULL)) {
+    ALOGE("Failed to arm task timer %d", -errno);
+    return -errno;
+  }
+  armed_deadline_ns_ = deadline;
+  return 0;
+}
+
+void TaskQueueWorker::Routine() {
+  std::unique_lock<std::mutex> lk(mutex_);
+  thread_id_ = std::this_thread::get_id();
+  if (should_exit())
+    return;
+
+  if (!tasks_.empty() && tasks_.begin()->first.first <= Now()) {
+    auto next = tasks_.begin();
+    TaskId id = next->first.second;
+    Task task = std::move(next->second.task);
+    if (!next->second.key.empty())
+      keys_.erase(next->second.key);
+    running_key_ = std::move(next->second.key);
+    deadlines_.erase(id);
+    tasks_.erase(next);
+
+    running_ = id;
+    lk.unlock();
+    task();
+    lk.lock();
+    running_ = 0;
+    running_key_.clear();
+    task_done_.notify_all();
+    return;
+  }
+
+  ArmTimerLocked();
+  lk.unlock();
+
+  struct pollfd fds[2];
+  fds[0].fd = timer_fd_.get();
+  fds[0].events = POLLIN;
+  fds[1].fd = event_fd_.get();
+  fds[1].events = POLLIN;
+  int ret = poll(fds, 2, -1);
+  if (ret < 0 && errno != EINTR) {
+    ALOGE("Failed to poll task queue %d", -errno);
+    return;
+  }
+
+  uint64_t count;
+  if ((fds[0].revents & POLLIN) &&
+      read(timer_fd_.get(), &count, sizeof(count)) > 0) {
+    lk.lock();
+    armed_deadline_ns_ = -1;
+    lk.unlock();
+  }
+  if ((fds[1].revents & POLLIN) &&
+      read(event_fd_.get(), &count, sizeof(count)) < 0)
+    ALOGE("Failed to read task queue eventfd %d", -errno);
+}
+}
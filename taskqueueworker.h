@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef ANDROID_TASK_QUEUE_WORKER_H_
+#define ANDROID_TASK_QUEUE_WORKER_H_
+
+#include "autofd.h"
+#include "worker.h"
+
+#include <stdint.h>
+
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <string>
+#include <thread>
+
+namespace android {
+
+// Worker running closures, either as soon as possible or at a deadline on
+// CLOCK_MONOTONIC. The thread sleeps on a timerfd armed for the earliest
+// deadline and an eventfd kicked whenever the queue changes. Tasks run one at
+// a time, in deadline order, without the worker lock held.
+class TaskQueueWorker : public Worker {
+ public:
+  typedef std::function<void()> Task;
+  typedef uint64_t TaskId;
+
+  TaskQueueWorker(const char *name, int priority);
+  ~TaskQueueWorker() override;
+
+  int Init();
+  void Signal() override;
+
+  TaskId Post(Task task);
+  TaskId PostAt(int64_t deadline_ns, Task task);
+  TaskId PostDelayed(int64_t delay_ns, Task task);
+  // Replaces the pending task posted with the same key, if any, so repeated
+  // requests for the same job collapse into a single run.
+  TaskId PostCoalesced(const std::string &key, int64_t deadline_ns, Task task);
+
+  // Returns true if the task was still pending. Unless called from a task,
+  // the task is not running anymore once this returns.
+  bool Cancel(TaskId id);
+  bool Cancel(const std::string &key);
+
+  // Blocks until the task has run or was cancelled. Must not be called from
+  // a task, nor for a task that won't run because the worker exited.
+  void Wait(TaskId id);
+
+  size_t pending_tasks();
+
+  static int64_t Now();
+
+ protected:
+  void Routine() override;
+
+ private:
+  struct PendingTask {
+    Task task;
+    std::string key;
+  };
+  // Ordered by deadline, then by posting order
+  typedef std::pair<int64_t, TaskId> TaskOrder;
+
+  TaskId PostLocked(int64_t deadline_ns, const std::string &key, Task task);
+  bool CancelLocked(TaskId id, std::unique_lock<std::mutex> *lk);
+  int ArmTimerLocked();
+
+  UniqueFd timer_fd_;
+  UniqueFd event_fd_;
+
+  // Guarded by the worker lock
+  TaskId next_id_ = 1;
+  std::map<TaskOrder, PendingTask> tasks_;
+  std::map<TaskId, int64_t> deadlines_;
+  std::map<std::string, TaskId> keys_;
+  TaskId running_ = 0;
+  std::string running_key_;
+  std::thread::id thread_id_;
+  int64_t armed_deadline_ns_ = -1;
+
+  std::condition_variable task_done_;
+};
+}
+
+#endif  // ANDROID_TASK_QUEUE_WORKER_H_
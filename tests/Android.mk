@@ -3,13 +3,138 @@ LOCAL_PATH := $(call my-dir)
 include $(CLEAR_VARS)
 
 LOCAL_SRC_FILES := \
+	bandwidthmodel_test.cpp \
+	drmeventlistener_test.cpp \
+	drmioctl_test.cpp \
+	frametimeline_test.cpp \
+	hwctrace_test.cpp \
+	latencystats_test.cpp \
+	taskqueue_test.cpp \
+	vsyncmodel_test.cpp \
 	worker_test.cpp
 
 LOCAL_MODULE := hwc-drm-tests
 LOCAL_VENDOR_MODULE := true
 LOCAL_HEADER_LIBRARIES := libhardware_headers
 LOCAL_STATIC_LIBRARIES := libdrmhwc_utils
-LOCAL_SHARED_LIBRARIES := hwcomposer.drm
+LOCAL_SHARED_LIBRARIES := hwcomposer.drm libcutils liblog
 LOCAL_C_INCLUDES := external/drm_hwcomposer
 
 include $(BUILD_NATIVE_TEST)
+
+# =====================
+# libdrmhwc_fakekms.a
+# =====================
+# Links in place of libdrm, so only the libdrm headers are used
+fakekms_c_includes := \
+	external/drm_hwcomposer \
+	external/libdrm \
+	external/libdrm/include/drm \
+	system/core/libsync
+
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := fakekms.cpp
+LOCAL_SHARED_LIBRARIES := libcutils liblog libsync
+LOCAL_C_INCLUDES := $(fakekms_c_includes)
+LOCAL_CFLAGS := $(common_drm_hwcomposer_cflags)
+LOCAL_MODULE := libdrmhwc_fakekms
+LOCAL_VENDOR_MODULE := true
+
+include $(BUILD_STATIC_LIBRARY)
+
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := fakekms_test.cpp
+LOCAL_MODULE := hwc-drm-fakekms-tests
+LOCAL_VENDOR_MODULE := true
+LOCAL_STATIC_LIBRARIES := libdrmhwc_fakekms
+LOCAL_SHARED_LIBRARIES := libcutils liblog libsync
+LOCAL_C_INCLUDES := $(fakekms_c_includes)
+
+include $(BUILD_NATIVE_TEST)
+
+# =====================
+# hwcomposer.fakekms.so
+# =====================
+# The unmodified HWC on the fake KMS device, for running and benchmarking
+# without display hardware. Select it with ro.hardware.hwcomposer=fakekms and
+# point hwc.drm.device at a writable device description, see fakekms.desc.
+include $(CLEAR_VARS)
+
+LOCAL_SHARED_LIBRARIES := $(drm_hwcomposer_shared_libs)
+LOCAL_STATIC_LIBRARIES := libdrmhwc_utils libdrmhwc_fakekms
+LOCAL_C_INCLUDES := $(drm_hwcomposer_c_includes) $(fakekms_c_includes)
+LOCAL_SRC_FILES := $(addprefix ../,$(drm_hwcomposer_src_files))
+LOCAL_CFLAGS := $(common_drm_hwcomposer_cflags)
+LOCAL_CPPFLAGS += $(drm_hwcomposer_cppflags)
+
+LOCAL_MODULE := hwcomposer.fakekms
+LOCAL_MODULE_TAGS := optional
+LOCAL_MODULE_RELATIVE_PATH := hw
+LOCAL_MODULE_CLASS := SHARED_LIBRARIES
+LOCAL_MODULE_SUFFIX := $(TARGET_SHLIB_SUFFIX)
+LOCAL_VENDOR_MODULE := true
+
+include $(BUILD_SHARED_LIBRARY)
+
+# =====================
+# hwc-drm-benchmark
+# =====================
+# Frame benchmark of the HWC on the fake KMS device, see hwc_benchmark.cpp
+include $(CLEAR_VARS)
+
+LOCAL_SHARED_LIBRARIES := $(drm_hwcomposer_shared_libs)
+LOCAL_STATIC_LIBRARIES := libdrmhwc_utils libdrmhwc_fakekms
+LOCAL_C_INCLUDES := $(drm_hwcomposer_c_includes) $(fakekms_c_includes)
+LOCAL_SRC_FILES := \
+	hwc_benchmark.cpp \
+	$(addprefix ../,$(drm_hwcomposer_src_files))
+LOCAL_CFLAGS := $(common_drm_hwcomposer_cflags)
+LOCAL_CPPFLAGS += $(drm_hwcomposer_cppflags)
+
+LOCAL_MODULE := hwc-drm-benchmark
+LOCAL_MODULE_TAGS := optional
+LOCAL_VENDOR_MODULE := true
+
+include $(BUILD_EXECUTABLE)
+
+# =====================
+# hwc-drm-replay
+# =====================
+# Replays a trace recorded with hwc.drm.trace_file, see hwc_replay.cpp
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := hwc_replay.cpp
+LOCAL_SHARED_LIBRARIES := libcutils libhardware liblog libui libutils
+LOCAL_STATIC_LIBRARIES := libdrmhwc_utils
+LOCAL_C_INCLUDES := external/drm_hwcomposer external/libdrm/include/drm
+LOCAL_CFLAGS := $(common_drm_hwcomposer_cflags)
+
+LOCAL_MODULE := hwc-drm-replay
+LOCAL_MODULE_TAGS := optional
+LOCAL_VENDOR_MODULE := true
+
+include $(BUILD_EXECUTABLE)
+
+# =====================
+# hwc-drm-planner-benchmark
+# =====================
+# Planner stages on the plane inventory of a fake KMS device, see
+# planner_benchmark.cpp
+include $(CLEAR_VARS)
+
+LOCAL_SHARED_LIBRARIES := $(drm_hwcomposer_shared_libs)
+LOCAL_STATIC_LIBRARIES := libdrmhwc_utils libdrmhwc_fakekms
+LOCAL_C_INCLUDES := $(drm_hwcomposer_c_includes) $(fakekms_c_includes)
+LOCAL_SRC_FILES := \
+	planner_benchmark.cpp \
+	$(addprefix ../,$(drm_hwcomposer_src_files))
+LOCAL_CFLAGS := $(common_drm_hwcomposer_cflags)
+LOCAL_CPPFLAGS += $(drm_hwcomposer_cppflags)
+
+LOCAL_MODULE := hwc-drm-planner-benchmark
+LOCAL_MODULE_TAGS := optional
+LOCAL_VENDOR_MODULE := true
+
+include $(BUILD_EXECUTABLE)
@@ -0,0 +1,47 @@
+#include <gtest/gtest.h>
+
+#include <drm/drm_fourcc.h>
+
+#include "bandwidthmodel.h"
+
+using android::BandwidthModel;
+
+TEST(BandwidthModelTest, scanout_bytes) {
+  ASSERT_EQ(1920u * 1080 * 4,
+            BandwidthModel::ScanoutBytes(DRM_FORMAT_ABGR8888,
+                                         DRM_FORMAT_MOD_LINEAR,
+                                         {0, 0, 1920, 1080}, false));
+  ASSERT_EQ(1920u * 1080 * 3 / 2,
+            BandwidthModel::ScanoutBytes(DRM_FORMAT_NV12, DRM_FORMAT_MOD_LINEAR,
+                                         {0, 0, 1920, 1080}, false));
+  ASSERT_EQ(1920u * 1080 * 2,
+            BandwidthModel::ScanoutBytes(DRM_FORMAT_ABGR8888,
+                                         DRM_FORMAT_MOD_ARM_AFBC(1),
+                                         {0, 0, 1920, 1080}, false));
+
+  // Rotating a linear buffer costs twice as much
+  ASSERT_EQ(1080u * 1920 * 2 * 2,
+            BandwidthModel::ScanoutBytes(DRM_FORMAT_RGB565,
+                                         DRM_FORMAT_MOD_LINEAR,
+                                         {0, 0, 1080, 1920}, true));
+}
+
+TEST(BandwidthModelTest, scanout_pixels_grow_with_downscaling) {
+  ASSERT_EQ(1920u * 1080, BandwidthModel::ScanoutPixels({0, 0, 1920, 1080},
+                                                        {0, 0, 960, 540},
+                                                        false));
+  ASSERT_EQ(1920u * 1080, BandwidthModel::ScanoutPixels({0, 0, 640, 360},
+                                                        {0, 0, 1920, 1080},
+                                                        false));
+  // The source is rotated before it is compared with the destination
+  ASSERT_EQ(1920u * 1080, BandwidthModel::ScanoutPixels({0, 0, 1080, 1920},
+                                                        {0, 0, 1920, 1080},
+                                                        true));
+}
+
+TEST(BandwidthModelTest, client_composition) {
+  ASSERT_EQ(100u * 50 * 4, BandwidthModel::ClientReadBytes(
+                               DRM_FORMAT_ABGR8888, {10, 10, 110, 60}));
+  ASSERT_EQ(1080u * 1920 * 4, BandwidthModel::ClientWriteBytes(
+                                  DRM_FORMAT_ABGR8888, {0, 0, 1080, 1920}));
+}
@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef ANDROID_BENCH_METRIC_H_
+#define ANDROID_BENCH_METRIC_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <algorithm>
+
+#include "latencystats.h"
+
+namespace android {
+
+static inline int64_t BenchNow(clockid_t clock) {
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// A histogram plus the exact mean and maximum, printed as a JSON member
+struct BenchMetric {
+  LatencyStats stats;
+  uint64_t sum = 0;
+  int64_t max = 0;
+
+  void Add(int64_t value) {
+    stats.AddSample(value);
+    sum += value;
+    max = std::max(max, value);
+  }
+
+  void Print(FILE *out, const char *indent, const char *name,
+             bool last) const {
+    uint64_t n = stats.total_samples();
+    fprintf(out,
+            "%s\"%s\": {\"mean\": %.1f, \"p50\": %lld, \"p90\": %lld, "
+            "\"p99\": %lld, \"max\": %lld}%s\n",
+            indent, name, n ? (double)sum / n : 0.0,
+            (long long)std::max<int64_t>(stats.Percentile(50), 0),
+            (long long)std::max<int64_t>(stats.Percentile(90), 0),
+            (long long)std::max<int64_t>(stats.Percentile(99), 0),
+            (long long)max, last ? "" : ",");
+  }
+};
+}
+
+#endif  // ANDROID_BENCH_METRIC_H_
@@ -0,0 +1,51 @@
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include "drmeventlistener.h"
+
+using android::DrmEventListener;
+using android::DrmHotplugEvent;
+
+static bool Parse(const std::string &msg, DrmHotplugEvent *event) {
+  return DrmEventListener::ParseHotplugUEvent(msg.data(), msg.size(), event);
+}
+
+TEST(DrmEventListenerTest, parses_hotplug_uevents) {
+  static const char kUEvent[] =
+      "change@/devices/platform/display/drm/card1\0ACTION=change\0"
+      "DEVPATH=/devices/platform/display/drm/card1\0SUBSYSTEM=drm\0"
+      "HOTPLUG=1\0CONNECTOR=77\0DEVNAME=dri/card1\0DEVTYPE=drm_minor\0"
+      "SEQNUM=2043\0MAJOR=226\0MINOR=1";
+  DrmHotplugEvent event;
+  ASSERT_TRUE(Parse(std::string(kUEvent, sizeof(kUEvent)), &event));
+  ASSERT_EQ(1, event.minor);
+  ASSERT_EQ(77u, event.connector_id);
+
+  // Older kernels don't name the connector
+  static const char kOldUEvent[] =
+      "change@/devices/platform/display/drm/card0\0ACTION=change\0"
+      "HOTPLUG=1\0DEVTYPE=drm_minor\0MINOR=0";
+  ASSERT_TRUE(Parse(std::string(kOldUEvent, sizeof(kOldUEvent)), &event));
+  ASSERT_EQ(0, event.minor);
+  ASSERT_EQ(0u, event.connector_id);
+}
+
+TEST(DrmEventListenerTest, ignores_other_uevents) {
+  static const char kConnectorUEvent[] =
+      "add@/devices/platform/display/drm/card0/card0-HDMI-A-1\0ACTION=add\0"
+      "SUBSYSTEM=drm\0DEVTYPE=drm_connector";
+  static const char kPowerUEvent[] =
+      "change@/devices/platform/battery\0ACTION=change\0"
+      "SUBSYSTEM=power_supply\0POWER_SUPPLY_ONLINE=1";
+  static const char kLeaseUEvent[] =
+      "change@/devices/platform/display/drm/card0\0ACTION=change\0"
+      "LEASE=1\0DEVTYPE=drm_minor\0MINOR=0";
+  DrmHotplugEvent event;
+  ASSERT_FALSE(Parse(
+      std::string(kConnectorUEvent, sizeof(kConnectorUEvent)), &event));
+  ASSERT_FALSE(
+      Parse(std::string(kPowerUEvent, sizeof(kPowerUEvent)), &event));
+  ASSERT_FALSE(
+      Parse(std::string(kLeaseUEvent, sizeof(kLeaseUEvent)), &event));
+}
@@ -0,0 +1,60 @@
+#include <gtest/gtest.h>
+
+#include "drmioctl.h"
+
+using android::DrmIoctlFrame;
+using android::DrmIoctlFrameScope;
+using android::DrmIoctlStats;
+
+TEST(DrmIoctlStatsTest, counts_per_type_and_caller) {
+  DrmIoctlStats stats;
+  int calls = 0;
+  ASSERT_EQ(7, stats.Call(DrmIoctlStats::kAtomic, DrmIoctlStats::kTestCommit,
+                          [&] { return ++calls, 7; }));
+  stats.Call(DrmIoctlStats::kAtomic, DrmIoctlStats::kCommit,
+             [&] { return ++calls; });
+  stats.Call(DrmIoctlStats::kAddFb2, DrmIoctlStats::kImport,
+             [&] { return ++calls; });
+  ASSERT_EQ(3, calls);
+
+  std::ostringstream out;
+  stats.Dump(&out);
+  std::string dump = out.str();
+  ASSERT_NE(std::string::npos, dump.find("ATOMIC: n=2 "));
+  ASSERT_NE(std::string::npos, dump.find("ADDFB2: n=1 "));
+  ASSERT_NE(std::string::npos, dump.find("test_commit: n=1 "));
+  ASSERT_NE(std::string::npos, dump.find("import: n=1 "));
+  ASSERT_EQ(std::string::npos, dump.find("RMFB"));
+
+  // Dumping resets the counters
+  std::ostringstream again;
+  stats.Dump(&again);
+  ASSERT_EQ(std::string::npos, again.str().find("ATOMIC"));
+}
+
+TEST(DrmIoctlStatsTest, attributes_calls_to_frame_in_scope) {
+  DrmIoctlStats stats;
+  DrmIoctlFrame frame;
+  DrmIoctlFrame inner;
+  {
+    DrmIoctlFrameScope scope(&frame);
+    stats.Call(DrmIoctlStats::kPrimeFdToHandle, DrmIoctlStats::kImport,
+               [] { return 0; });
+    {
+      DrmIoctlFrameScope nested(&inner);
+      stats.Call(DrmIoctlStats::kAtomic, DrmIoctlStats::kCommit,
+                 [] { return 0; });
+    }
+    stats.Call(DrmIoctlStats::kAddFb2, DrmIoctlStats::kImport,
+               [] { return 0; });
+  }
+  stats.Call(DrmIoctlStats::kRmFb, DrmIoctlStats::kRelease, [] { return 0; });
+
+  ASSERT_EQ(2u, frame.count[DrmIoctlStats::kImport]);
+  ASSERT_EQ(2u, frame.total_count());
+  ASSERT_EQ(1u, inner.count[DrmIoctlStats::kCommit]);
+  ASSERT_EQ(1u, inner.total_count());
+
+  frame.Add(inner);
+  ASSERT_EQ(3u, frame.total_count());
+}
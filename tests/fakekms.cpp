@@ -0,0 +1,2027 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "hwc-fakekms"
+
+#include "fakekms.h"
+#include "autofd.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <drm/drm_fourcc.h>
+#include <log/log.h>
+#include <sw_sync.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+struct _drmModeAtomicReq {
+  struct Item {
+    uint32_t object_id;
+    uint32_t property_id;
+    uint64_t value;
+  };
+  std::vector<Item> items;
+};
+
+namespace android {
+
+static const int64_t kOneSecondNs = 1000 * 1000 * 1000;
+static const int64_t kDefaultVsyncPeriodNs = kOneSecondNs / 60;
+static const uint32_t kAtomicFlags =
+    DRM_MODE_PAGE_FLIP_EVENT | DRM_MODE_ATOMIC_TEST_ONLY |
+    DRM_MODE_ATOMIC_NONBLOCK | DRM_MODE_ATOMIC_ALLOW_MODESET;
+static const uint32_t kRotateMask = DRM_MODE_ROTATE_0 | DRM_MODE_ROTATE_90 |
+                                    DRM_MODE_ROTATE_180 | DRM_MODE_ROTATE_270;
+
+static int64_t NowNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * kOneSecondNs + ts.tv_nsec;
+}
+
+static int64_t ModePeriodNs(const drmModeModeInfo &mode) {
+  if (mode.clock && mode.htotal && mode.vtotal)
+    return (int64_t)mode.htotal * mode.vtotal * 1000000 / mode.clock;
+  if (mode.vrefresh)
+    return kOneSecondNs / mode.vrefresh;
+  return kDefaultVsyncPeriodNs;
+}
+
+static void SleepUntilNs(int64_t timestamp_ns) {
+  struct timespec ts = {.tv_sec = (time_t)(timestamp_ns / kOneSecondNs),
+                        .tv_nsec = (long)(timestamp_ns % kOneSecondNs)};
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+    ;
+}
+
+static const struct {
+  const char *name;
+  uint32_t type;
+} kConnectorTypes[] = {
+    {"Unknown", DRM_MODE_CONNECTOR_Unknown},
+    {"VGA", DRM_MODE_CONNECTOR_VGA},
+    {"DVI-I", DRM_MODE_CONNECTOR_DVII},
+    {"DVI-D", DRM_MODE_CONNECTOR_DVID},
+    {"LVDS", DRM_MODE_CONNECTOR_LVDS},
+    {"DP", DRM_MODE_CONNECTOR_DisplayPort},
+    {"HDMI-A", DRM_MODE_CONNECTOR_HDMIA},
+    {"HDMI-B", DRM_MODE_CONNECTOR_HDMIB},
+    {"eDP", DRM_MODE_CONNECTOR_eDP},
+    {"Virtual", DRM_MODE_CONNECTOR_VIRTUAL},
+    {"DSI", DRM_MODE_CONNECTOR_DSI},
+    {"DPI", DRM_MODE_CONNECTOR_DPI},
+    {"Writeback", DRM_MODE_CONNECTOR_WRITEBACK},
+};
+
+static bool ParseNumber(const std::string &str, uint32_t *value) {
+  char *end = NULL;
+  errno = 0;
+  unsigned long n = strtoul(str.c_str(), &end, 0);
+  if (str.empty() || *end || errno || n > UINT32_MAX)
+    return false;
+  *value = (uint32_t)n;
+  return true;
+}
+
+static bool ParseSize(const std::string &str, uint32_t *w, uint32_t *h) {
+  char tail;
+  return sscanf(str.c_str(), "%ux%u%c", w, h, &tail) == 2;
+}
+
+static bool ParseFormats(const std::string &str,
+                         std::vector<uint32_t> *formats) {
+  std::istringstream list(str);
+  std::string fourcc;
+  while (std::getline(list, fourcc, ',')) {
+    if (fourcc.size() != 4)
+      return false;
+    formats->push_back(
+        fourcc_code(fourcc[0], fourcc[1], fourcc[2], fourcc[3]));
+  }
+  return !formats->empty();
+}
+
+// Reduced blanking timings, good enough for the vsync period to come out of
+// the clock the way it does on real hardware
+static bool ParseModes(const std::string &str,
+                       std::vector<drmModeModeInfo> *modes) {
+  std::istringstream list(str);
+  std::string spec;
+  while (std::getline(list, spec, ',')) {
+    uint32_t w, h, hz;
+    char tail;
+    if (sscanf(spec.c_str(), "%ux%u@%u%c", &w, &h, &hz, &tail) != 3 || !w ||
+        !h || !hz || w > 16384 || h > 16384)
+      return false;
+
+    drmModeModeInfo mode;
+    memset(&mode, 0, sizeof(mode));
+    mode.hdisplay = w;
+    mode.hsync_start = w + 48;
+    mode.hsync_end = w + 80;
+    mode.htotal = w + 160;
+    mode.vdisplay = h;
+    mode.vsync_start = h + 3;
+    mode.vsync_end = h + 8;
+    mode.vtotal = h + 45;
+    mode.clock = (uint32_t)((uint64_t)mode.htotal * mode.vtotal * hz / 1000);
+    mode.vrefresh = hz;
+    mode.type = DRM_MODE_TYPE_DRIVER;
+    if (modes->empty())
+      mode.type |= DRM_MODE_TYPE_PREFERRED;
+    snprintf(mode.name, sizeof(mode.name), "%ux%u", w, h);
+    modes->push_back(mode);
+  }
+  return !modes->empty();
+}
+
+static void SplitOption(const std::string &arg, std::string *key,
+                        std::string *value) {
+  size_t eq = arg.find('=');
+  *key = arg.substr(0, eq);
+  *value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+}
+
+static int CountBits(uint64_t value) {
+  int bits = 0;
+  for (; value; value &= value - 1)
+    ++bits;
+  return bits;
+}
+
+class FakeKmsDevice {
+ public:
+  explicit FakeKmsDevice(int fd) : fd_(fd) {
+  }
+
+  int Init(const std::string &description);
+  void GetStats(FakeKmsStats *stats);
+
+  int SetClientCap(uint64_t capability, uint64_t value);
+  drmModeResPtr GetResources();
+  drmModeCrtcPtr GetCrtc(uint32_t crtc_id);
+  drmModeEncoderPtr GetEncoder(uint32_t encoder_id);
+  drmModeConnectorPtr GetConnector(uint32_t connector_id);
+  drmModePlaneResPtr GetPlaneResources();
+  drmModePlanePtr GetPlane(uint32_t plane_id);
+  drmModePropertyPtr GetProperty(uint32_t property_id);
+  drmModeObjectPropertiesPtr GetObjectProperties(uint32_t object_id,
+                                                 uint32_t object_type);
+  drmModePropertyBlobPtr GetPropertyBlob(uint32_t blob_id);
+
+  int CreateBlob(const void *data, size_t size, uint32_t *blob_id);
+  int DestroyBlob(uint32_t blob_id);
+  int PrimeFdToHandle(int prime_fd, uint32_t *handle);
+  int CloseHandle(uint32_t handle);
+  int AddFb(uint32_t width, uint32_t height, uint32_t format,
+            const uint32_t handles[4], uint32_t *fb_id);
+  int RmFb(uint32_t fb_id);
+  int ConnectorSetProperty(uint32_t connector_id, uint32_t property_id,
+                           uint64_t value);
+  int AtomicCommit(drmModeAtomicReqPtr req, uint32_t flags, void *user_data);
+
+  int WaitVblank(drmVBlankPtr vbl);
+  int QueueSequence(uint32_t crtc_id, uint32_t flags, uint64_t sequence,
+                    uint64_t *sequence_queued, uint64_t user_data);
+  int HandleEvents(drmEventContextPtr context);
+
+ private:
+  struct Property {
+    std::string name;
+    uint32_t flags;
+    std::vector<uint64_t> values;
+    std::vector<drm_mode_property_enum> enums;
+  };
+
+  struct Object {
+    uint32_t type;
+    std::vector<uint32_t> props;
+    std::vector<uint64_t> values;
+  };
+
+  struct Crtc {
+    uint32_t id;
+    int64_t vblank_base_ns = 0;
+    int64_t period_ns = kDefaultVsyncPeriodNs;
+    int64_t flip_pending_ns = -1;
+    UniqueFd timeline_fd;
+    bool timeline_failed = false;
+    uint32_t fence_point = 0;
+    uint32_t signaled_point = 0;
+  };
+
+  struct Connector {
+    uint32_t id;
+    uint32_t encoder_id;
+    uint32_t type;
+    uint32_t type_id;
+    uint32_t possible_crtcs = 0;
+    bool connected = true;
+    bool lit = false;
+    uint32_t mm_width = 0;
+    uint32_t mm_height = 0;
+    std::vector<drmModeModeInfo> modes;
+    std::vector<uint32_t> formats;  // Writeback only
+  };
+
+  struct Plane {
+    uint32_t id;
+    uint32_t type;
+    uint32_t possible_crtcs = 0;
+    std::vector<uint32_t> formats;
+    uint32_t zpos = 0;
+    uint32_t max_upscale = 0;
+    uint32_t max_downscale = 0;
+    uint32_t rotations = 0;
+    bool alpha = false;
+    bool in_fence = false;
+  };
+
+  struct Framebuffer {
+    uint32_t width;
+    uint32_t height;
+    uint32_t format;
+  };
+
+  struct Blob {
+    std::vector<uint8_t> data;
+    // Destroyed blobs stay around while a MODE_ID might still reference
+    // them, they just can't be used anymore
+    bool destroyed = false;
+  };
+
+  struct Event {
+    enum Kind { kFlip, kVblank, kSequence };
+    Kind kind;
+    int64_t timestamp_ns;
+    uint32_t crtc_id;
+    uint64_t sequence;
+    uint64_t user_data;
+    // Flips are queued without PAGE_FLIP_EVENT too, to signal out fences
+    bool send;
+    uint32_t fence_point;
+  };
+
+  typedef std::map<std::pair<uint32_t, uint32_t>, uint64_t> Changes;
+
+  int ParseCrtc(const std::vector<std::string> &args);
+  int ParseConnector(const std::vector<std::string> &args);
+  int ParsePlane(const std::vector<std::string> &args);
+  void BuildObjects();
+
+  uint32_t AddProperty(const Property &property);
+  uint32_t AddRangeProperty(const char *name, uint32_t flags, uint64_t min,
+                            uint64_t max);
+  uint32_t AddObjectProperty(const char *name, uint32_t object_type);
+  uint32_t AddEnumProperty(
+      const char *name, uint32_t flags,
+      const std::vector<std::pair<uint64_t, const char *>> &enums);
+  void Attach(uint32_t object_id, uint32_t property_id, uint64_t value);
+
+  int FindProperty(const Object &object, const char *name) const;
+  uint64_t Value(uint32_t object_id, const char *name) const;
+  uint64_t Value(uint32_t object_id, const char *name,
+                 const Changes &changes) const;
+  void SetValue(uint32_t object_id, const char *name, uint64_t value);
+  int ValidateValue(const Property &property, uint64_t value) const;
+  int CrtcIndex(uint32_t crtc_id) const;
+  const drmModeModeInfo *BlobMode(uint32_t blob_id) const;
+
+  int CheckCommit(const Changes &changes, uint32_t flags,
+                  uint32_t *touched_crtcs, uint32_t *modeset_crtcs);
+  int CreateFence(Crtc *crtc);
+  uint64_t SequenceAt(const Crtc &crtc, int64_t timestamp_ns) const;
+  int64_t VblankAfter(const Crtc &crtc, int64_t timestamp_ns) const;
+  void ArmTimerLocked();
+
+  const int fd_;
+
+  std::mutex lock_;
+  uint32_t next_id_ = 1;
+  uint32_t min_width_ = 0;
+  uint32_t min_height_ = 0;
+  uint32_t max_width_ = 8192;
+  uint32_t max_height_ = 8192;
+  bool universal_planes_ = false;
+  bool atomic_ = false;
+  bool writeback_ = false;
+
+  std::vector<Crtc> crtcs_;
+  std::vector<Connector> connectors_;
+  std::vector<Plane> planes_;
+  std::map<uint32_t, Property> properties_;
+  std::map<uint32_t, Object> objects_;
+  std::map<uint32_t, Framebuffer> framebuffers_;
+  std::map<uint32_t, Blob> blobs_;
+  std::map<std::pair<dev_t, ino_t>, uint32_t> handles_;
+  uint32_t next_handle_ = 1;
+  std::vector<Event> events_;
+  FakeKmsStats stats_;
+};
+
+int FakeKmsDevice::Init(const std::string &description) {
+  std::istringstream in(description);
+  std::string line;
+  for (int line_no = 1; std::getline(in, line); ++line_no) {
+    size_t comment = line.find('#');
+    if (comment != std::string::npos)
+      line.erase(comment);
+
+    std::istringstream words(line);
+    std::string kind, word;
+    std::vector<std::string> args;
+    if (!(words >> kind))
+      continue;
+    while (words >> word)
+      args.push_back(word);
+
+    int ret = -EINVAL;
+    if (kind == "size") {
+      if (args.size() == 2 &&
+          ParseSize(args[0], &min_width_, &min_height_) &&
+          ParseSize(args[1], &max_width_, &max_height_))
+        ret = 0;
+    } else if (kind == "crtc") {
+      ret = ParseCrtc(args);
+    } else if (kind == "connector") {
+      ret = ParseConnector(args);
+    } else if (kind == "plane") {
+      ret = ParsePlane(args);
+    }
+    if (ret) {
+      ALOGE("Invalid fake KMS description at line %d: %s", line_no,
+            line.c_str());
+      return ret;
+    }
+  }
+
+  if (crtcs_.empty() || crtcs_.size() > 32 || connectors_.empty()) {
+    ALOGE("Fake KMS description needs 1 to 32 crtcs and a connector");
+    return -EINVAL;
+  }
+
+  BuildObjects();
+  memset(&stats_, 0, sizeof(stats_));
+  return 0;
+}
+
+int FakeKmsDevice::ParseCrtc(const std::vector<std::string> &args) {
+  if (!args.empty())
+    return -EINVAL;
+  crtcs_.emplace_back();
+  return 0;
+}
+
+int FakeKmsDevice::ParseConnector(const std::vector<std::string> &args) {
+  if (args.empty())
+    return -EINVAL;
+
+  Connector connector;
+  connector.type = UINT32_MAX;
+  for (const auto &type : kConnectorTypes)
+    if (args[0] == type.name)
+      connector.type = type.type;
+  if (connector.type == UINT32_MAX)
+    return -EINVAL;
+
+  bool writeback = connector.type == DRM_MODE_CONNECTOR_WRITEBACK;
+  connector.type_id = 1;
+  for (const Connector &c : connectors_)
+    if (c.type == connector.type)
+      ++connector.type_id;
+
+  for (size_t i = 1; i < args.size(); ++i) {
+    std::string key, value;
+    SplitOption(args[i], &key, &value);
+    bool valid = false;
+    if (key == "crtcs") {
+      valid = ParseNumber(value, &connector.possible_crtcs);
+    } else if (key == "mm") {
+      valid = ParseSize(value, &connector.mm_width, &connector.mm_height);
+    } else if (key == "modes" && !writeback) {
+      valid = ParseModes(value, &connector.modes);
+    } else if (key == "formats" && writeback) {
+      valid = ParseFormats(value, &connector.formats);
+    } else if (key == "disconnected") {
+      connector.connected = false;
+      valid = value.empty();
+    } else if (key == "lit" && !writeback) {
+      connector.lit = true;
+      valid = value.empty();
+    }
+    if (!valid)
+      return -EINVAL;
+  }
+  if (writeback && connector.formats.empty())
+    connector.formats.push_back(DRM_FORMAT_XRGB8888);
+  if (connector.lit && (!connector.connected || connector.modes.empty()))
+    return -EINVAL;
+
+  connectors_.push_back(connector);
+  return 0;
+}
+
+int FakeKmsDevice::ParsePlane(const std::vector<std::string> &args) {
+  if (args.empty())
+    return -EINVAL;
+
+  Plane plane;
+  if (args[0] == "primary")
+    plane.type = DRM_PLANE_TYPE_PRIMARY;
+  else if (args[0] == "overlay")
+    plane.type = DRM_PLANE_TYPE_OVERLAY;
+  else if (args[0] == "cursor")
+    plane.type = DRM_PLANE_TYPE_CURSOR;
+  else
+    return -EINVAL;
+
+  for (size_t i = 1; i < args.size(); ++i) {
+    std::string key, value;
+    SplitOption(args[i], &key, &value);
+    bool valid = false;
+    if (key == "crtcs") {
+      valid = ParseNumber(value, &plane.possible_crtcs);
+    } else if (key == "formats") {
+      valid = ParseFormats(value, &plane.formats);
+    } else if (key == "zpos") {
+      valid = ParseNumber(value, &plane.zpos);
+    } else if (key == "upscale") {
+      valid = ParseNumber(value, &plane.max_upscale);
+    } else if (key == "downscale") {
+      valid = ParseNumber(value, &plane.max_downscale);
+    } else if (key == "rotation") {
+      valid = ParseNumber(value, &plane.rotations) &&
+              (plane.rotations & DRM_MODE_ROTATE_0) &&
+              !(plane.rotations & ~0x3fu);
+    } else if (key == "alpha") {
+      plane.alpha = true;
+      valid = value.empty();
+    } else if (key == "in_fence") {
+      plane.in_fence = true;
+      valid = value.empty();
+    }
+    if (!valid)
+      return -EINVAL;
+  }
+  if (plane.formats.empty())
+    plane.formats.push_back(DRM_FORMAT_XRGB8888);
+
+  planes_.push_back(plane);
+  return 0;
+}
+
+// Ids are handed out the way the kernel does, from a single pool shared by
+// every mode object, crtcs first
+void FakeKmsDevice::BuildObjects() {
+  uint32_t all_crtcs = (uint32_t)((1ULL << crtcs_.size()) - 1);
+
+  uint32_t active = AddRangeProperty("ACTIVE", 0, 0, 1);
+  uint32_t mode_id = AddProperty({"MODE_ID", DRM_MODE_PROP_BLOB, {}, {}});
+  uint32_t out_fence =
+      AddRangeProperty("OUT_FENCE_PTR", DRM_MODE_PROP_ATOMIC, 0, UINT64_MAX);
+  for (Crtc &crtc : crtcs_) {
+    crtc.id = next_id_++;
+    objects_[crtc.id].type = DRM_MODE_OBJECT_CRTC;
+    Attach(crtc.id, active, 0);
+    Attach(crtc.id, mode_id, 0);
+    Attach(crtc.id, out_fence, 0);
+  }
+
+  uint32_t dpms = AddEnumProperty(
+      "DPMS", 0, {{DRM_MODE_DPMS_ON, "On"},
+                  {DRM_MODE_DPMS_STANDBY, "Standby"},
+                  {DRM_MODE_DPMS_SUSPEND, "Suspend"},
+                  {DRM_MODE_DPMS_OFF, "Off"}});
+  uint32_t crtc_id = AddObjectProperty("CRTC_ID", DRM_MODE_OBJECT_CRTC);
+  for (Connector &connector : connectors_) {
+    if (!connector.possible_crtcs || (connector.possible_crtcs & ~all_crtcs))
+      connector.possible_crtcs = all_crtcs;
+
+    connector.encoder_id = next_id_++;
+    objects_[connector.encoder_id].type = DRM_MODE_OBJECT_ENCODER;
+    connector.id = next_id_++;
+    objects_[connector.id].type = DRM_MODE_OBJECT_CONNECTOR;
+    Attach(connector.id, dpms, DRM_MODE_DPMS_ON);
+    Attach(connector.id, crtc_id, 0);
+    if (connector.type != DRM_MODE_CONNECTOR_WRITEBACK)
+      continue;
+
+    uint32_t formats_blob;
+    CreateBlob(connector.formats.data(),
+               connector.formats.size() * sizeof(uint32_t), &formats_blob);
+    Attach(connector.id,
+           AddProperty({"WRITEBACK_PIXEL_FORMATS",
+                        DRM_MODE_PROP_BLOB | DRM_MODE_PROP_IMMUTABLE,
+                        {},
+                        {}}),
+           formats_blob);
+    Attach(connector.id,
+           AddObjectProperty("WRITEBACK_FB_ID", DRM_MODE_OBJECT_FB), 0);
+    Attach(connector.id,
+           AddRangeProperty("WRITEBACK_OUT_FENCE_PTR", 0, 0, UINT64_MAX), 0);
+  }
+
+  uint32_t type = AddEnumProperty("type", DRM_MODE_PROP_IMMUTABLE,
+                                  {{DRM_PLANE_TYPE_OVERLAY, "Overlay"},
+                                   {DRM_PLANE_TYPE_PRIMARY, "Primary"},
+                                   {DRM_PLANE_TYPE_CURSOR, "Cursor"}});
+  uint32_t fb_id = AddObjectProperty("FB_ID", DRM_MODE_OBJECT_FB);
+  uint32_t crtc_x = AddRangeProperty("CRTC_X", DRM_MODE_PROP_SIGNED_RANGE,
+                                     (uint64_t)INT32_MIN, INT32_MAX);
+  uint32_t crtc_y = AddRangeProperty("CRTC_Y", DRM_MODE_PROP_SIGNED_RANGE,
+                                     (uint64_t)INT32_MIN, INT32_MAX);
+  uint32_t crtc_w = AddRangeProperty("CRTC_W", 0, 0, INT32_MAX);
+  uint32_t crtc_h = AddRangeProperty("CRTC_H", 0, 0, INT32_MAX);
+  uint32_t src_x = AddRangeProperty("SRC_X", 0, 0, UINT32_MAX);
+  uint32_t src_y = AddRangeProperty("SRC_Y", 0, 0, UINT32_MAX);
+  uint32_t src_w = AddRangeProperty("SRC_W", 0, 0, UINT32_MAX);
+  uint32_t src_h = AddRangeProperty("SRC_H", 0, 0, UINT32_MAX);
+  for (Plane &plane : planes_) {
+    if (!plane.possible_crtcs || (plane.possible_crtcs & ~all_crtcs))
+      plane.possible_crtcs = all_crtcs;
+
+    plane.id = next_id_++;
+    objects_[plane.id].type = DRM_MODE_OBJECT_PLANE;
+    Attach(plane.id, type, plane.type);
+    Attach(plane.id, fb_id, 0);
+    Attach(plane.id, crtc_id, 0);
+    for (uint32_t prop : {crtc_x, crtc_y, crtc_w, crtc_h, src_x, src_y, src_w,
+                          src_h})
+      Attach(plane.id, prop, 0);
+    Attach(plane.id,
+           AddRangeProperty("zpos", DRM_MODE_PROP_IMMUTABLE, plane.zpos,
+                            plane.zpos),
+           plane.zpos);
+    if (plane.rotations) {
+      static const char *kRotationNames[] = {"rotate-0",   "rotate-90",
+                                             "rotate-180", "rotate-270",
+                                             "reflect-x",  "reflect-y"};
+      std::vector<std::pair<uint64_t, const char *>> bits;
+      for (uint64_t bit = 0; bit < 6; ++bit)
+        if (plane.rotations & (1u << bit))
+          bits.push_back(std::make_pair(bit, kRotationNames[bit]));
+      Attach(plane.id,
+             AddEnumProperty("rotation", DRM_MODE_PROP_BITMASK, bits),
+             DRM_MODE_ROTATE_0);
+    }
+    if (plane.alpha)
+      Attach(plane.id, AddRangeProperty("alpha", 0, 0, 0xffff), 0xffff);
+    if (plane.in_fence)
+      Attach(plane.id,
+             AddRangeProperty("IN_FENCE_FD", DRM_MODE_PROP_SIGNED_RANGE,
+                              (uint64_t)-1, INT32_MAX),
+             (uint64_t)-1);
+  }
+
+  // Lit connectors start out the way a bootloader leaves them, scanning out
+  // their first mode on the first free CRTC they support
+  uint32_t lit_crtcs = 0;
+  for (Connector &connector : connectors_) {
+    if (!connector.lit)
+      continue;
+    for (size_t i = 0; i < crtcs_.size(); ++i) {
+      if (!(connector.possible_crtcs & ~lit_crtcs & (1u << i)))
+        continue;
+      Crtc &crtc = crtcs_[i];
+      uint32_t blob_id = next_id_++;
+      const uint8_t *mode = (const uint8_t *)&connector.modes[0];
+      blobs_[blob_id].data.assign(mode, mode + sizeof(drmModeModeInfo));
+      SetValue(crtc.id, "ACTIVE", 1);
+      SetValue(crtc.id, "MODE_ID", blob_id);
+      SetValue(connector.id, "CRTC_ID", crtc.id);
+      crtc.vblank_base_ns = NowNs();
+      crtc.period_ns = ModePeriodNs(connector.modes[0]);
+      lit_crtcs |= 1u << i;
+      break;
+    }
+  }
+}
+
+// Identical properties are shared between objects, like the kernel does
+uint32_t FakeKmsDevice::AddProperty(const Property &property) {
+  for (auto &it : properties_) {
+    const Property &p = it.second;
+    if (p.name != property.name || p.flags != property.flags ||
+        p.values != property.values || p.enums.size() != property.enums.size())
+      continue;
+    bool same = true;
+    for (size_t i = 0; i < p.enums.size(); ++i)
+      same = same && p.enums[i].value == property.enums[i].value;
+    if (same)
+      return it.first;
+  }
+
+  uint32_t id = next_id_++;
+  properties_[id] = property;
+  return id;
+}
+
+uint32_t FakeKmsDevice::AddRangeProperty(const char *name, uint32_t flags,
+                                         uint64_t min, uint64_t max) {
+  if (!(flags & DRM_MODE_PROP_EXTENDED_TYPE))
+    flags |= DRM_MODE_PROP_RANGE;
+  return AddProperty({name, flags, {min, max}, {}});
+}
+
+uint32_t FakeKmsDevice::AddObjectProperty(const char *name,
+                                          uint32_t object_type) {
+  return AddProperty({name, DRM_MODE_PROP_OBJECT, {object_type}, {}});
+}
+
+uint32_t FakeKmsDevice::AddEnumProperty(
+    const char *name, uint32_t flags,
+    const std::vector<std::pair<uint64_t, const char *>> &enums) {
+  Property property = {name, flags, {}, {}};
+  if (!(flags & DRM_MODE_PROP_BITMASK))
+    property.flags |= DRM_MODE_PROP_ENUM;
+  for (const auto &e : enums) {
+    drm_mode_property_enum prop_enum;
+    memset(&prop_enum, 0, sizeof(prop_enum));
+    prop_enum.value = e.first;
+    strncpy(prop_enum.name, e.second, sizeof(prop_enum.name) - 1);
+    property.values.push_back(e.first);
+    property.enums.push_back(prop_enum);
+  }
+  return AddProperty(property);
+}
+
+void FakeKmsDevice::Attach(uint32_t object_id, uint32_t property_id,
+                           uint64_t value) {
+  Object &object = objects_[object_id];
+  object.props.push_back(property_id);
+  object.values.push_back(value);
+}
+
+int FakeKmsDevice::FindProperty(const Object &object, const char *name) const {
+  for (size_t i = 0; i < object.props.size(); ++i)
+    if (properties_.at(object.props[i]).name == name)
+      return (int)i;
+  return -1;
+}
+
+uint64_t FakeKmsDevice::Value(uint32_t object_id, const char *name) const {
+  const Object &object = objects_.at(object_id);
+  int index = FindProperty(object, name);
+  return index < 0 ? 0 : object.values[index];
+}
+
+uint64_t FakeKmsDevice::Value(uint32_t object_id, const char *name,
+                              const Changes &changes) const {
+  const Object &object = objects_.at(object_id);
+  int index = FindProperty(object, name);
+  if (index < 0)
+    return 0;
+  auto change = changes.find(std::make_pair(object_id, object.props[index]));
+  return change != changes.end() ? change->second : object.values[index];
+}
+
+void FakeKmsDevice::SetValue(uint32_t object_id, const char *name,
+                             uint64_t value) {
+  Object &object = objects_.at(object_id);
+  int index = FindProperty(object, name);
+  if (index >= 0)
+    object.values[index] = value;
+}
+
+int FakeKmsDevice::ValidateValue(const Property &property,
+                                 uint64_t value) const {
+  uint32_t extended_type = property.flags & DRM_MODE_PROP_EXTENDED_TYPE;
+  if (extended_type == DRM_MODE_PROP_SIGNED_RANGE) {
+    if ((int64_t)value < (int64_t)property.values[0] ||
+        (int64_t)value > (int64_t)property.values[1])
+      return -EINVAL;
+  } else if (extended_type == DRM_MODE_PROP_OBJECT) {
+    if (!value)
+      return 0;
+    if (property.values[0] == DRM_MODE_OBJECT_FB)
+      return framebuffers_.count(value) ? 0 : -ENOENT;
+    auto object = objects_.find(value);
+    if (object == objects_.end() || object->second.type != property.values[0])
+      return -ENOENT;
+  } else if (property.flags & DRM_MODE_PROP_RANGE) {
+    if (value < property.values[0] || value > property.values[1])
+      return -EINVAL;
+  } else if (property.flags & DRM_MODE_PROP_ENUM) {
+    if (std::find(property.values.begin(), property.values.end(), value) ==
+        property.values.end())
+      return -EINVAL;
+  } else if (property.flags & DRM_MODE_PROP_BITMASK) {
+    uint64_t valid = 0;
+    for (uint64_t bit : property.values)
+      valid |= 1ULL << bit;
+    if (value & ~valid)
+      return -EINVAL;
+  } else if (property.flags & DRM_MODE_PROP_BLOB) {
+    if (!value)
+      return 0;
+    auto blob = blobs_.find(value);
+    if (blob == blobs_.end() || blob->second.destroyed)
+      return -EINVAL;
+  }
+  return 0;
+}
+
+int FakeKmsDevice::CrtcIndex(uint32_t crtc_id) const {
+  for (size_t i = 0; i < crtcs_.size(); ++i)
+    if (crtcs_[i].id == crtc_id)
+      return (int)i;
+  return -1;
+}
+
+const drmModeModeInfo *FakeKmsDevice::BlobMode(uint32_t blob_id) const {
+  auto blob = blobs_.find(blob_id);
+  if (blob == blobs_.end() ||
+      blob->second.data.size() != sizeof(drmModeModeInfo))
+    return NULL;
+  return (const drmModeModeInfo *)blob->second.data.data();
+}
+
+void FakeKmsDevice::GetStats(FakeKmsStats *stats) {
+  std::lock_guard<std::mutex> lock(lock_);
+  *stats = stats_;
+  stats->framebuffers = framebuffers_.size();
+}
+
+int FakeKmsDevice::SetClientCap(uint64_t capability, uint64_t value) {
+  std::lock_guard<std::mutex> lock(lock_);
+  stats_.ioctls++;
+  if (value > 1)
+    return -EINVAL;
+  switch (capability) {
+    case DRM_CLIENT_CAP_UNIVERSAL_PLANES:
+      universal_planes_ = value;
+      return 0;
+    case DRM_CLIENT_CAP_ATOMIC:
+      atomic_ = value;
+      universal_planes_ |= atomic_;
+      return 0;
+    case DRM_CLIENT_CAP_WRITEBACK_CONNECTORS:
+      if (!atomic_)
+        return -EINVAL;
+      writeback_ = value;
+      return 0;
+    default:
+      return -EINVAL;
+  }
+}
+
+drmModeResPtr FakeKmsDevice::GetResources() {
+  std::lock_guard<std::mutex> lock(lock_);
+  stats_.ioctls++;
+
+  drmModeResPtr res = (drmModeResPtr)calloc(1, sizeof(*res));
+  res->crtcs = (uint32_t *)calloc(crtcs_.size(), sizeof(uint32_t));
+  for (const Crtc &crtc : crtcs_)
+    res->crtcs[res->count_crtcs++] = crtc.id;
+
+  res->connectors = (uint32_t *)calloc(connectors_.size(), sizeof(uint32_t));
+  res->encoders = (uint32_t *)calloc(connectors_.size(), sizeof(uint32_t));
+  for (const Connector &connector : connectors_) {
+    if (connector.type == DRM_MODE_CONNECTOR_WRITEBACK && !writeback_)
+      continue;
+    res->connectors[res->count_connectors++] = connector.id;
+    res->encoders[res->count_encoders++] = connector.encoder_id;
+  }
+
+  res->fbs = (uint32_t *)calloc(framebuffers_.size() + 1, sizeof(uint32_t));
+  for (const auto &fb : framebuffers_)
+    res->fbs[res->count_fbs++] = fb.first;
+
+  res->min_width = min_width_;
+  res->max_width = max_width_;
+  res->min_height = min_height_;
+  res->max_height = max_height_;
+  return res;
+}
+
+drmModeCrtcPtr FakeKmsDevice::GetCrtc(uint32_t crtc_id) {
+  std::lock_guard<std::mutex> lock(lock_);
+  stats_.ioctls++;
+  if (CrtcIndex(crtc_id) < 0) {
+    errno = ENOENT;
+    return NULL;
+  }
+
+  drmModeCrtcPtr crtc = (drmModeCrtcPtr)calloc(1, sizeof(*crtc));
+  crtc->crtc_id = crtc_id;
+  const drmModeModeInfo *mode = BlobMode(Value(crtc_id, "MODE_ID"));
+  if (mode) {
+    crtc->mode_valid = 1;
+    crtc->mode = *mode;
+    crtc->width = mode->hdisplay;
+    crtc->height = mode->vdisplay;
+  }
+  for (const Plane &plane : planes_)
+    if (plane.type == DRM_PLANE_TYPE_PRIMARY &&
+        Value(plane.id, "CRTC_ID") == crtc_id)
+      crtc->buffer_id = Value(plane.id, "FB_ID");
+  return crtc;
+}
+
+drmModeEncoderPtr FakeKmsDevice::GetEncoder(uint32_t encoder_id) {
+  std::lock_guard<std::mutex> lock(lock_);
+  stats_.ioctls++;
+  for (const Connector &connector : connectors_) {
+    if (connector.encoder_id != encoder_id)
+      continue;
+
+    drmModeEncoderPtr encoder = (drmModeEncoderPtr)calloc(1, sizeof(*encoder));
+    encoder->encoder_id = encoder_id;
+    switch (connector.type) {
+      case DRM_MODE_CONNECTOR_WRITEBACK:
+      case DRM_MODE_CONNECTOR_VIRTUAL:
+        encoder->encoder_type = DRM_MODE_ENCODER_VIRTUAL;
+        break;
+      case DRM_MODE_CONNECTOR_DSI:
+        encoder->encoder_type = DRM_MODE_ENCODER_DSI;
+        break;
+      case DRM_MODE_CONNECTOR_LVDS:
+        encoder->encoder_type = DRM_MODE_ENCODER_LVDS;
+        break;
+      default:
+        encoder->encoder_type = DRM_MODE_ENCODER_TMDS;
+        break;
+    }
+    encoder->crtc_id = Value(connector.id, "CRTC_ID");
+    encoder->possible_crtcs = connector.possible_crtcs;
+    return encoder;
+  }
+  errno = ENOENT;
+  return NULL;
+}
+
+drmModeConnectorPtr FakeKmsDevice::GetConnector(uint32_t connector_id) {
+  std::lock_guard<std::mutex> lock(lock_);
+  stats_.ioctls++;
+  for (const Connector &c : connectors_) {
+    if (c.id != connector_id)
+      continue;
+
+    drmModeConnectorPtr connector =
+        (drmModeConnectorPtr)calloc(1, sizeof(*connector));
+    connector->connector_id = c.id;
+    connector->encoder_id = Value(c.id, "CRTC_ID") ? c.encoder_id : 0;
+    connector->connector_type = c.type;
+    connector->connector_type_id = c.type_id;
+    connector->connection =
+        c.connected ? DRM_MODE_CONNECTED : DRM_MODE_DISCONNECTED;
+    connector->mmWidth = c.mm_width;
+    connector->mmHeight = c.mm_height;
+    connector->subpixel = DRM_MODE_SUBPIXEL_UNKNOWN;
+
+    if (c.connected && !c.modes.empty()) {
+      connector->count_modes = (int)c.modes.size();
+      connector->modes = (drmModeModeInfoPtr)calloc(c.modes.size(),
+                                                    sizeof(drmModeModeInfo));
+      memcpy(connector->modes, c.modes.data(),
+             c.modes.size() * sizeof(drmModeModeInfo));
+    }
+
+    const Object &object = objects_.at(c.id);
+    connector->count_props = (int)object.props.size();
+    connector->props = (uint32_t *)calloc(object.props.size(),
+                                          sizeof(uint32_t));
+    connector->prop_values = (uint64_t *)calloc(object.props.size(),
+                                                sizeof(uint64_t));
+    for (size_t i = 0; i < object.props.size(); ++i) {
+      connector->props[i] = object.props[i];
+      connector->prop_values[i] = object.values[i];
+    }
+
+    connector->count_encoders = 1;
+    connector->encoders = (uint32_t *)calloc(1, sizeof(uint32_t));
+    connector->encoders[0] = c.encoder_id;
+    return connector;
+  }
+  errno = ENOENT;
+  return NULL;
+}
+
+drmModePlaneResPtr FakeKmsDevice::GetPlaneResources() {
+  std::lock_guard<std::mutex> lock(lock_);
+  stats_.ioctls++;
+
+  drmModePlaneResPtr res = (drmModePlaneResPtr)calloc(1, sizeof(*res));
+  res->planes = (uint32_t *)calloc(planes_.size() + 1, sizeof(uint32_t));
+  for (const Plane &plane : planes_)
+    if (universal_planes_ || plane.type == DRM_PLANE_TYPE_OVERLAY)
+      res->planes[res->count_planes++] = plane.id;
+  return res;
+}
+
+drmModePlanePtr FakeKmsDevice::GetPlane(uint32_t plane_id) {
+  std::lock_guard<std::mutex> lock(lock_);
+  stats_.ioctls++;
+  for (const Plane &p : planes_) {
+    if (p.id != plane_id)
+      continue;
+
+    drmModePlanePtr plane = (drmModePlanePtr)calloc(1, sizeof(*plane));
+    plane->plane_id = p.id;
+    plane->count_formats = (uint32_t)p.formats.size();
+    plane->formats = (uint32_t *)calloc(p.formats.size(), sizeof(uint32_t));
+    memcpy(plane->formats, p.formats.data(),
+           p.formats.size() * sizeof(uint32_t));
+    plane->crtc_id = Value(p.id, "CRTC_ID");
+    plane->fb_id = Value(p.id, "FB_ID");
+    plane->possible_crtcs = p.possible_crtcs;
+    return plane;
+  }
+  errno = ENOENT;
+  return NULL;
+}
+
+drmModePropertyPtr FakeKmsDevice::GetProperty(uint32_t property_id) {
+  std::lock_guard<std::mutex> lock(lock_);
+  stats_.ioctls++;
+  auto it = properties_.find(property_id);
+  if (it == properties_.end()) {
+    errno = ENOENT;
+    return NULL;
+  }
+
+  const Property &p = it->second;
+  drmModePropertyPtr property =
+      (drmModePropertyPtr)calloc(1, sizeof(*property));
+  property->prop_id = property_id;
+  property->flags = p.flags;
+  strncpy(property->name, p.name.c_str(), sizeof(property->name) - 1);
+  property->count_values = (int)p.values.size();
+  property->values = (uint64_t *)calloc(p.values.size() + 1, sizeof(uint64_t));
+  std::copy(p.values.begin(), p.values.end(), property->values);
+  property->count_enums = (int)p.enums.size();
+  property->enums = (struct drm_mode_property_enum *)calloc(
+      p.enums.size() + 1, sizeof(struct drm_mode_property_enum));
+  std::copy(p.enums.begin(), p.enums.end(), property->enums);
+  return property;
+}
+
+drmModeObjectPropertiesPtr FakeKmsDevice::GetObjectProperties(
+    uint32_t object_id, uint32_t object_type) {
+  std::lock_guard<std::mutex> lock(lock_);
+  stats_.ioctls++;
+  auto it = objects_.find(object_id);
+  if (it == objects_.end() ||
+      (object_type != DRM_MODE_OBJECT_ANY && it->second.type != object_type)) {
+    errno = ENOENT;
+    return NULL;
+  }
+
+  const Object &object = it->second;
+  drmModeObjectPropertiesPtr props =
+      (drmModeObjectPropertiesPtr)calloc(1, sizeof(*props));
+  props->count_props = (uint32_t)object.props.size();
+  props->props = (uint32_t *)calloc(object.props.size(), sizeof(uint32_t));
+  props->prop_values = (uint64_t *)calloc(object.props.size(),
+                                          sizeof(uint64_t));
+  std::copy(object.props.begin(), object.props.end(), props->props);
+  std::copy(object.values.begin(), object.values.end(), props->prop_values);
+  return props;
+}
+
+drmModePropertyBlobPtr FakeKmsDevice::GetPropertyBlob(uint32_t blob_id) {
+  std::lock_guard<std::mutex> lock(lock_);
+  stats_.ioctls++;
+  auto it = blobs_.find(blob_id);
+  if (it == blobs_.end() || it->second.destroyed) {
+    errno = ENOENT;
+    return NULL;
+  }
+
+  const std::vector<uint8_t> &data = it->second.data;
+  drmModePropertyBlobPtr blob =
+      (drmModePropertyBlobPtr)calloc(1, sizeof(*blob));
+  blob->id = blob_id;
+  blob->length = (uint32_t)data.size();
+  blob->data = malloc(data.size());
+  memcpy(blob->data, data.data(), data.size());
+  return blob;
+}
+
+int FakeKmsDevice::CreateBlob(const void *data, size_t size,
+                              uint32_t *blob_id) {
+  std::lock_guard<std::mutex> lock(lock_);
+  stats_.ioctls++;
+  if (!size || !data)
+    return -EINVAL;
+  *blob_id = next_id_++;
+  const uint8_t *bytes = (const uint8_t *)data;
+  blobs_[*blob_id].data.assign(bytes, bytes + size);
+  return 0;
+}
+
+int FakeKmsDevice::DestroyBlob(uint32_t blob_id) {
+  std::lock_guard<std::mutex> lock(lock_);
+  stats_.ioctls++;
+  auto it = blobs_.find(blob_id);
+  if (it == blobs_.end() || it->second.destroyed)
+    return -ENOENT;
+
+  for (const Crtc &crtc : crtcs_) {
+    if (Value(crtc.id, "MODE_ID") == blob_id) {
+      it->second.destroyed = true;
+      return 0;
+    }
+  }
+  blobs_.erase(it);
+  return 0;
+}
+
+// The same dma-buf always maps to the same handle, like with GEM
+int FakeKmsDevice::PrimeFdToHandle(int prime_fd, uint32_t *handle) {
+  std::lock_guard<std::mutex> lock(lock_);
+  stats_.ioctls++;
+  struct stat st;
+  if (fstat(prime_fd, &st))
+    return -EBADF;
+
+  auto key = std::make_pair(st.st_dev, st.st_ino);
+  auto it = handles_.find(key);
+  if (it == handles_.end())
+    it = handles_.insert(std::make_pair(key, next_handle_++)).first;
+  *handle = it->second;
+  return 0;
+}
+
+int FakeKmsDevice::CloseHandle(uint32_t handle) {
+  std::lock_guard<std::mutex> lock(lock_);
+  stats_.ioctls++;
+  for (auto it = handles_.begin(); it != handles_.end(); ++it) {
+    if (it->second == handle) {
+      handles_.erase(it);
+      return 0;
+    }
+  }
+  return -EINVAL;
+}
+
+int FakeKmsDevice::AddFb(uint32_t width, uint32_t height, uint32_t format,
+                         const uint32_t handles[4], uint32_t *fb_id) {
+  std::lock_guard<std::mutex> lock(lock_);
+  stats_.ioctls++;
+  if (!width || !height || width > max_width_ || height > max_height_)
+    return -EINVAL;
+
+  bool format_supported = false;
+  for (const Plane &plane : planes_)
+    format_supported |= std::find(plane.formats.begin(), plane.formats.end(),
+                                  format) != plane.formats.end();
+  for (const Connector &connector : connectors_)
+    format_supported |=
+        std::find(connector.formats.begin(), connector.formats.end(),
+                  format) != connector.formats.end();
+  if (!format_supported)
+    return -EINVAL;
+
+  if (!handles[0])
+    return -EINVAL;
+  for (int i = 0; i < 4; ++i) {
+    if (!handles[i])
+      continue;
+    bool known = false;
+    for (const auto &it : handles_)
+      known |= it.second == handles[i];
+    if (!known)
+      return -ENOENT;
+  }
+
+  *fb_id = next_id_++;
+  framebuffers_[*fb_id] = {width, height, format};
+  return 0;
+}
+
+// Removing a framebuffer that is scanned out turns its planes off
+int FakeKmsDevice::RmFb(uint32_t fb_id) {
+  std::lock_guard<std::mutex> lock(lock_);
+  stats_.ioctls++;
+  if (!framebuffers_.erase(fb_id))
+    return -ENOENT;
+
+  for (const Plane &plane : planes_) {
+    if (Value(plane.id, "FB_ID") == fb_id) {
+      SetValue(plane.id, "FB_ID", 0);
+      SetValue(plane.id, "CRTC_ID", 0);
+    }
+  }
+  return 0;
+}
+
+int FakeKmsDevice::ConnectorSetProperty(uint32_t connector_id,
+                                        uint32_t property_id, uint64_t value) {
+  std::lock_guard<std::mutex> lock(lock_);
+  stats_.ioctls++;
+  auto it = objects_.find(connector_id);
+  if (it == objects_.end() || it->second.type != DRM_MODE_OBJECT_CONNECTOR)
+    return -ENOENT;
+
+  auto prop = std::find(it->second.props.begin(), it->second.props.end(),
+                        property_id);
+  if (prop == it->second.props.end() ||
+      properties_.at(property_id).name != "DPMS")
+    return -EINVAL;
+
+  int ret = ValidateValue(properties_.at(property_id), value);
+  if (ret)
+    return ret;
+  it->second.values[prop - it->second.props.begin()] = value;
+  return 0;
+}
+
+int FakeKmsDevice::CheckCommit(const Changes &changes, uint32_t flags,
+                               uint32_t *touched_crtcs,
+                               uint32_t *modeset_crtcs) {
+  *touched_crtcs = 0;
+  *modeset_crtcs = 0;
+  for (const auto &change : changes) {
+    uint32_t object_id = change.first.first;
+    switch (objects_.at(object_id).type) {
+      case DRM_MODE_OBJECT_CRTC:
+        *touched_crtcs |= 1u << CrtcIndex(object_id);
+        break;
+      case DRM_MODE_OBJECT_PLANE:
+      case DRM_MODE_OBJECT_CONNECTOR:
+        for (uint64_t crtc_id : {Value(object_id, "CRTC_ID"),
+                                 Value(object_id, "CRTC_ID", changes)})
+          if (crtc_id)
+            *touched_crtcs |= 1u << CrtcIndex(crtc_id);
+        break;
+    }
+  }
+
+  for (size_t i = 0; i < crtcs_.size(); ++i) {
+    uint32_t id = crtcs_[i].id;
+    uint64_t mode_id = Value(id, "MODE_ID", changes);
+    bool active = Value(id, "ACTIVE", changes);
+    bool modeset = mode_id != Value(id, "MODE_ID") ||
+                   active != (bool)Value(id, "ACTIVE");
+
+    bool has_connectors = false;
+    for (const Connector &connector : connectors_) {
+      uint64_t crtc_id = Value(connector.id, "CRTC_ID", changes);
+      uint64_t old_crtc_id = Value(connector.id, "CRTC_ID");
+      has_connectors |= crtc_id == id;
+      // Writeback connectors are attached and detached for every job
+      if (connector.type != DRM_MODE_CONNECTOR_WRITEBACK &&
+          crtc_id != old_crtc_id && (crtc_id == id || old_crtc_id == id))
+        modeset = true;
+    }
+
+    if (modeset && !(flags & DRM_MODE_ATOMIC_ALLOW_MODESET)) {
+      ALOGV("CRTC %u needs a modeset", id);
+      return -EINVAL;
+    }
+    if (active && !mode_id) {
+      ALOGV("CRTC %u active without a mode", id);
+      return -EINVAL;
+    }
+    if ((mode_id != 0) != has_connectors) {
+      ALOGV("CRTC %u enabled/connectors mismatch", id);
+      return -EINVAL;
+    }
+    const drmModeModeInfo *mode = BlobMode(mode_id);
+    if (mode_id && (!mode || !mode->hdisplay || !mode->vdisplay)) {
+      ALOGV("CRTC %u invalid mode blob %" PRIu64, id, mode_id);
+      return -EINVAL;
+    }
+    if (modeset) {
+      *touched_crtcs |= 1u << i;
+      *modeset_crtcs |= 1u << i;
+    }
+  }
+
+  for (const Connector &connector : connectors_) {
+    uint64_t crtc_id = Value(connector.id, "CRTC_ID", changes);
+    if (crtc_id && !(connector.possible_crtcs & (1u << CrtcIndex(crtc_id)))) {
+      ALOGV("Connector %u can't drive CRTC %" PRIu64, connector.id, crtc_id);
+      return -EINVAL;
+    }
+    if (connector.type != DRM_MODE_CONNECTOR_WRITEBACK)
+      continue;
+
+    uint64_t fb_id = Value(connector.id, "WRITEBACK_FB_ID", changes);
+    if (!fb_id)
+      continue;
+    const drmModeModeInfo *mode =
+        crtc_id ? BlobMode(Value(crtc_id, "MODE_ID", changes)) : NULL;
+    const Framebuffer &fb = framebuffers_.at(fb_id);
+    if (!mode || !Value(crtc_id, "ACTIVE", changes) ||
+        fb.width != mode->hdisplay || fb.height != mode->vdisplay ||
+        std::find(connector.formats.begin(), connector.formats.end(),
+                  fb.format) == connector.formats.end()) {
+      ALOGV("Invalid writeback job on connector %u", connector.id);
+      return -EINVAL;
+    }
+  }
+
+  for (const Plane &plane : planes_) {
+    uint64_t fb_id = Value(plane.id, "FB_ID", changes);
+    uint64_t crtc_id = Value(plane.id, "CRTC_ID", changes);
+    if (!fb_id && !crtc_id)
+      continue;
+    if (!fb_id || !crtc_id) {
+      ALOGV("Plane %u needs both FB_ID and CRTC_ID", plane.id);
+      return -EINVAL;
+    }
+    if (!(plane.possible_crtcs & (1u << CrtcIndex(crtc_id)))) {
+      ALOGV("Plane %u can't be used on CRTC %" PRIu64, plane.id, crtc_id);
+      return -EINVAL;
+    }
+    if (!Value(crtc_id, "MODE_ID", changes)) {
+      ALOGV("Plane %u on disabled CRTC %" PRIu64, plane.id, crtc_id);
+      return -EINVAL;
+    }
+
+    const Framebuffer &fb = framebuffers_.at(fb_id);
+    if (std::find(plane.formats.begin(), plane.formats.end(), fb.format) ==
+        plane.formats.end()) {
+      ALOGV("Plane %u doesn't support format %08x", plane.id, fb.format);
+      return -EINVAL;
+    }
+
+    uint64_t src_x = Value(plane.id, "SRC_X", changes);
+    uint64_t src_y = Value(plane.id, "SRC_Y", changes);
+    uint64_t src_w = Value(plane.id, "SRC_W", changes);
+    uint64_t src_h = Value(plane.id, "SRC_H", changes);
+    uint64_t crtc_w = Value(plane.id, "CRTC_W", changes);
+    uint64_t crtc_h = Value(plane.id, "CRTC_H", changes);
+    if (!src_w || !src_h || !crtc_w || !crtc_h) {
+      ALOGV("Plane %u has an empty rectangle", plane.id);
+      return -EINVAL;
+    }
+    if (src_x + src_w > (uint64_t)fb.width << 16 ||
+        src_y + src_h > (uint64_t)fb.height << 16) {
+      ALOGV("Plane %u source outside of fb %" PRIu64, plane.id, fb_id);
+      return -ENOSPC;
+    }
+
+    uint64_t rotation = plane.rotations
+                            ? Value(plane.id, "rotation", changes)
+                            : DRM_MODE_ROTATE_0;
+    if (CountBits(rotation & kRotateMask) != 1) {
+      ALOGV("Plane %u invalid rotation %" PRIx64, plane.id, rotation);
+      return -EINVAL;
+    }
+    if (rotation & (DRM_MODE_ROTATE_90 | DRM_MODE_ROTATE_270))
+      std::swap(src_w, src_h);
+
+    // 16.16 source against integer destination
+    if (plane.max_upscale && ((crtc_w << 16) > src_w * plane.max_upscale ||
+                              (crtc_h << 16) > src_h * plane.max_upscale)) {
+      ALOGV("Plane %u upscaled beyond %ux", plane.id, plane.max_upscale);
+      return -ERANGE;
+    }
+    if (plane.max_downscale &&
+        (src_w > (crtc_w << 16) * plane.max_downscale ||
+         src_h > (crtc_h << 16) * plane.max_downscale)) {
+      ALOGV("Plane %u downscaled beyond %ux", plane.id, plane.max_downscale);
+      return -ERANGE;
+    }
+  }
+
+  if (flags & DRM_MODE_ATOMIC_NONBLOCK) {
+    int64_t now = NowNs();
+    for (size_t i = 0; i < crtcs_.size(); ++i) {
+      if ((*touched_crtcs & (1u << i)) && crtcs_[i].flip_pending_ns > now) {
+        ALOGV("CRTC %u has a flip pending", crtcs_[i].id);
+        return -EBUSY;
+      }
+    }
+  }
+  return 0;
+}
+
+int FakeKmsDevice::AtomicCommit(drmModeAtomicReqPtr req, uint32_t flags,
+                                void *user_data) {
+  std::unique_lock<std::mutex> lock(lock_);
+  stats_.ioctls++;
+  bool test_only = flags & DRM_MODE_ATOMIC_TEST_ONLY;
+  if (test_only)
+    stats_.atomic_tests++;
+  else
+    stats_.atomic_commits++;
+
+  if (!atomic_ || (flags & ~kAtomicFlags) ||
+      (test_only && (flags & DRM_MODE_PAGE_FLIP_EVENT))) {
+    stats_.atomic_rejected++;
+    return -EINVAL;
+  }
+
+  Changes changes;
+  std::map<uint32_t, int32_t *> out_fences;
+  for (const auto &item : req->items) {
+    auto object = objects_.find(item.object_id);
+    if (object == objects_.end()) {
+      ALOGV("Unknown object %u", item.object_id);
+      stats_.atomic_rejected++;
+      return -ENOENT;
+    }
+
+    auto prop = std::find(object->second.props.begin(),
+                          object->second.props.end(), item.property_id);
+    int ret = -EINVAL;
+    if (prop != object->second.props.end()) {
+      const Property &property = properties_.at(item.property_id);
+      ret = (property.flags & DRM_MODE_PROP_IMMUTABLE)
+                ? -EINVAL
+                : ValidateValue(property, item.value);
+      if (!ret && item.value &&
+          (property.name == "OUT_FENCE_PTR" ||
+           property.name == "WRITEBACK_OUT_FENCE_PTR")) {
+        // Written with -1 before anything is checked, like the kernel does
+        int32_t *fence = (int32_t *)(uintptr_t)item.value;
+        *fence = -1;
+        out_fences[item.object_id] = fence;
+        continue;
+      }
+      if (!ret && property.name == "IN_FENCE_FD") {
+        if ((int64_t)item.value >= 0 && fcntl((int)item.value, F_GETFD) < 0)
+          ret = -EINVAL;
+        if (!ret)
+          continue;
+      }
+    }
+    if (ret) {
+      ALOGV("Invalid property %u=%" PRIu64 " on object %u", item.property_id,
+            item.value, item.object_id);
+      stats_.atomic_rejected++;
+      return ret;
+    }
+    changes[std::make_pair(item.object_id, item.property_id)] = item.value;
+  }
+
+  uint32_t touched_crtcs, modeset_crtcs;
+  int ret = CheckCommit(changes, flags, &touched_crtcs, &modeset_crtcs);
+  if (ret) {
+    if (!test_only)
+      ALOGE("Fake KMS rejected commit %d", ret);
+    stats_.atomic_rejected++;
+    return ret;
+  }
+  for (const auto &fence : out_fences) {
+    if (objects_.at(fence.first).type == DRM_MODE_OBJECT_CRTC)
+      touched_crtcs |= 1u << CrtcIndex(fence.first);
+    else if (!Value(fence.first, "WRITEBACK_FB_ID", changes))
+      ret = -EINVAL;
+  }
+  if (ret || test_only) {
+    if (ret)
+      stats_.atomic_rejected++;
+    return ret;
+  }
+
+  for (const auto &change : changes) {
+    Object &object = objects_.at(change.first.first);
+    auto prop = std::find(object.props.begin(), object.props.end(),
+                          change.first.second);
+    object.values[prop - object.props.begin()] = change.second;
+  }
+
+  int64_t now = NowNs();
+  int64_t done_ns = now;
+  for (size_t i = 0; i < crtcs_.size(); ++i) {
+    if (!(touched_crtcs & (1u << i)))
+      continue;
+
+    Crtc &crtc = crtcs_[i];
+    const drmModeModeInfo *mode = BlobMode(Value(crtc.id, "MODE_ID"));
+    bool active = mode && Value(crtc.id, "ACTIVE");
+    if (active && (modeset_crtcs & (1u << i))) {
+      crtc.vblank_base_ns = now;
+      crtc.period_ns = ModePeriodNs(*mode);
+    }
+
+    int64_t flip_ns = now;
+    if (active)
+      flip_ns = VblankAfter(crtc, std::max(now, crtc.flip_pending_ns));
+    crtc.flip_pending_ns = active ? flip_ns : -1;
+    done_ns = std::max(done_ns, flip_ns);
+
+    auto fence = out_fences.find(crtc.id);
+    if (fence != out_fences.end())
+      *fence->second = CreateFence(&crtc);
+    for (const Connector &connector : connectors_) {
+      fence = out_fences.find(connector.id);
+      if (fence != out_fences.end() &&
+          Value(connector.id, "CRTC_ID") == crtc.id)
+        *fence->second = CreateFence(&crtc);
+    }
+
+    events_.push_back({Event::kFlip, flip_ns, crtc.id, 0,
+                       (uint64_t)(uintptr_t)user_data,
+                       (flags & DRM_MODE_PAGE_FLIP_EVENT) != 0,
+                       crtc.fence_point});
+  }
+
+  // Writeback jobs are one shot
+  for (const Connector &connector : connectors_)
+    if (connector.type == DRM_MODE_CONNECTOR_WRITEBACK)
+      SetValue(connector.id, "WRITEBACK_FB_ID", 0);
+
+  ArmTimerLocked();
+  lock.unlock();
+
+  if (!(flags & DRM_MODE_ATOMIC_NONBLOCK))
+    SleepUntilNs(done_ns);
+  return 0;
+}
+
+int FakeKmsDevice::CreateFence(Crtc *crtc) {
+  if (crtc->timeline_fd.get() < 0 && !crtc->timeline_failed) {
+    crtc->timeline_fd.Set(sw_sync_timeline_create());
+    crtc->timeline_failed = crtc->timeline_fd.get() < 0;
+  }
+  if (crtc->timeline_fd.get() < 0)
+    return -1;
+
+  ++crtc->fence_point;
+  return sw_sync_fence_create(crtc->timeline_fd.get(), "fakekms",
+                              crtc->fence_point);
+}
+
+uint64_t FakeKmsDevice::SequenceAt(const Crtc &crtc,
+                                   int64_t timestamp_ns) const {
+  if (timestamp_ns < crtc.vblank_base_ns)
+    return 0;
+  return (uint64_t)((timestamp_ns - crtc.vblank_base_ns) / crtc.period_ns);
+}
+
+int64_t FakeKmsDevice::VblankAfter(const Crtc &crtc,
+                                   int64_t timestamp_ns) const {
+  return crtc.vblank_base_ns +
+         (int64_t)(SequenceAt(crtc, timestamp_ns) + 1) * crtc.period_ns;
+}
+
+void FakeKmsDevice::ArmTimerLocked() {
+  struct itimerspec spec;
+  memset(&spec, 0, sizeof(spec));
+  if (!events_.empty()) {
+    int64_t next_ns = INT64_MAX;
+    for (const Event &event : events_)
+      next_ns = std::min(next_ns, event.timestamp_ns);
+    // A zero it_value would disarm the timer
+    next_ns = std::max<int64_t>(next_ns, 1);
+    spec.it_value.tv_sec = next_ns / kOneSecondNs;
+    spec.it_value.tv_nsec = next_ns % kOneSecondNs;
+  }
+  timerfd_settime(fd_, TFD_TIMER_ABSTIME, &spec, NULL);
+}
+
+int FakeKmsDevice::WaitVblank(drmVBlankPtr vbl) {
+  std::unique_lock<std::mutex> lock(lock_);
+  stats_.ioctls++;
+  uint32_t type = vbl->request.type;
+  size_t pipe = (type & DRM_VBLANK_SECONDARY)
+                    ? 1
+                    : (type & DRM_VBLANK_HIGH_CRTC_MASK) >>
+                          DRM_VBLANK_HIGH_CRTC_SHIFT;
+  if (pipe >= crtcs_.size())
+    return -EINVAL;
+
+  const Crtc &crtc = crtcs_[pipe];
+  if (!Value(crtc.id, "ACTIVE") || !Value(crtc.id, "MODE_ID"))
+    return -EINVAL;
+
+  int64_t now = NowNs();
+  uint64_t current = SequenceAt(crtc, now);
+  uint64_t target = vbl->request.sequence;
+  if (type & DRM_VBLANK_RELATIVE)
+    target += current;
+  if ((type & DRM_VBLANK_NEXTONMISS) && target <= current)
+    target = current + 1;
+  int64_t timestamp_ns =
+      crtc.vblank_base_ns + (int64_t)target * crtc.period_ns;
+
+  if (type & DRM_VBLANK_EVENT) {
+    events_.push_back({Event::kVblank, timestamp_ns, crtc.id, target,
+                       (uint64_t)vbl->request.signal, true, 0});
+    ArmTimerLocked();
+    vbl->reply.sequence = (unsigned int)target;
+    return 0;
+  }
+
+  lock.unlock();
+  SleepUntilNs(timestamp_ns);
+  vbl->reply.sequence = (unsigned int)target;
+  vbl->reply.tval_sec = (long)(timestamp_ns / kOneSecondNs);
+  vbl->reply.tval_usec = (long)(timestamp_ns % kOneSecondNs / 1000);
+  return 0;
+}
+
+int FakeKmsDevice::QueueSequence(uint32_t crtc_id, uint32_t flags,
+                                 uint64_t sequence, uint64_t *sequence_queued,
+                                 uint64_t user_data) {
+  std::lock_guard<std::mutex> lock(lock_);
+  stats_.ioctls++;
+  int index = CrtcIndex(crtc_id);
+  if (index < 0)
+    return -ENOENT;
+
+  const Crtc &crtc = crtcs_[index];
+  if (!Value(crtc.id, "ACTIVE") || !Value(crtc.id, "MODE_ID"))
+    return -EINVAL;
+
+  uint64_t current = SequenceAt(crtc, NowNs());
+  uint64_t target = sequence;
+  if (flags & DRM_CRTC_SEQUENCE_RELATIVE)
+    target += current;
+  if ((flags & DRM_CRTC_SEQUENCE_NEXT_ON_MISS) && target <= current)
+    target = current + 1;
+
+  events_.push_back({Event::kSequence,
+                     crtc.vblank_base_ns + (int64_t)target * crtc.period_ns,
+                     crtc.id, target, user_data, true, 0});
+  ArmTimerLocked();
+  if (sequence_queued)
+    *sequence_queued = target;
+  return 0;
+}
+
+int FakeKmsDevice::HandleEvents(drmEventContextPtr context) {
+  std::vector<Event> due;
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    stats_.ioctls++;
+    uint64_t expirations;
+    if (read(fd_, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+      return -errno;
+
+    int64_t now = NowNs();
+    auto split = std::stable_partition(
+        events_.begin(), events_.end(),
+        [now](const Event &event) { return event.timestamp_ns > now; });
+    due.assign(split, events_.end());
+    events_.erase(split, events_.end());
+    std::stable_sort(due.begin(), due.end(),
+                     [](const Event &a, const Event &b) {
+                       return a.timestamp_ns < b.timestamp_ns;
+                     });
+
+    for (Event &event : due) {
+      if (event.kind != Event::kFlip)
+        continue;
+      Crtc &crtc = crtcs_[CrtcIndex(event.crtc_id)];
+      event.sequence = SequenceAt(crtc, event.timestamp_ns);
+      if (event.fence_point > crtc.signaled_point &&
+          crtc.timeline_fd.get() >= 0) {
+        sw_sync_timeline_inc(crtc.timeline_fd.get(),
+                             event.fence_point - crtc.signaled_point);
+        crtc.signaled_point = event.fence_point;
+      }
+      if (crtc.flip_pending_ns <= event.timestamp_ns)
+        crtc.flip_pending_ns = -1;
+      stats_.page_flips++;
+    }
+    ArmTimerLocked();
+  }
+
+  for (const Event &event : due) {
+    if (!event.send)
+      continue;
+    unsigned int tv_sec = (unsigned int)(event.timestamp_ns / kOneSecondNs);
+    unsigned int tv_usec =
+        (unsigned int)(event.timestamp_ns % kOneSecondNs / 1000);
+    void *user_data = (void *)(uintptr_t)event.user_data;
+    switch (event.kind) {
+      case Event::kFlip:
+        if (context->version >= 3 && context->page_flip_handler2)
+          context->page_flip_handler2(fd_, (unsigned int)event.sequence,
+                                      tv_sec, tv_usec, event.crtc_id,
+                                      user_data);
+        else if (context->page_flip_handler)
+          context->page_flip_handler(fd_, (unsigned int)event.sequence,
+                                     tv_sec, tv_usec, user_data);
+        break;
+      case Event::kVblank:
+        if (context->vblank_handler)
+          context->vblank_handler(fd_, (unsigned int)event.sequence, tv_sec,
+                                  tv_usec, user_data);
+        break;
+      case Event::kSequence:
+        if (context->version >= 4 && context->sequence_handler)
+          context->sequence_handler(fd_, event.sequence,
+                                    (uint64_t)event.timestamp_ns,
+                                    event.user_data);
+        break;
+    }
+  }
+  return 0;
+}
+
+static std::mutex devices_lock;
+static std::map<int, std::shared_ptr<FakeKmsDevice>> devices;
+
+// A regular file handed to any entry point is a device description: it is
+// parsed, and the fd is swapped for the timerfd that signals pending events.
+// Any other fd must be one that was swapped before.
+static std::shared_ptr<FakeKmsDevice> GetDevice(int fd) {
+  std::lock_guard<std::mutex> lock(devices_lock);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st)) {
+    errno = EBADF;
+    return NULL;
+  }
+
+  if (!S_ISREG(st.st_mode)) {
+    auto it = devices.find(fd);
+    if (it == devices.end()) {
+      errno = ENODEV;
+      return NULL;
+    }
+    return it->second;
+  }
+
+  std::string description;
+  char buffer[4096];
+  ssize_t len;
+  for (off_t offset = 0;
+       (len = pread(fd, buffer, sizeof(buffer), offset)) > 0; offset += len)
+    description.append(buffer, len);
+
+  auto device = std::make_shared<FakeKmsDevice>(fd);
+  if (len < 0 || device->Init(description)) {
+    errno = ENODEV;
+    return NULL;
+  }
+
+  UniqueFd timer_fd(timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK));
+  if (timer_fd.get() < 0 || dup2(timer_fd.get(), fd) < 0) {
+    ALOGE("Failed to set up fake KMS events %d", errno);
+    return NULL;
+  }
+  devices[fd] = device;
+  return device;
+}
+
+int FakeKmsGetStats(int fd, FakeKmsStats *stats) {
+  std::shared_ptr<FakeKmsDevice> device = GetDevice(fd);
+  if (!device)
+    return -ENODEV;
+  device->GetStats(stats);
+  return 0;
+}
+
+void FakeKmsGetTotalStats(FakeKmsStats *stats) {
+  std::vector<std::shared_ptr<FakeKmsDevice>> all;
+  {
+    std::lock_guard<std::mutex> lock(devices_lock);
+    for (auto &it : devices)
+      all.push_back(it.second);
+  }
+
+  memset(stats, 0, sizeof(*stats));
+  for (auto &device : all) {
+    FakeKmsStats device_stats;
+    device->GetStats(&device_stats);
+    stats->ioctls += device_stats.ioctls;
+    stats->atomic_commits += device_stats.atomic_commits;
+    stats->atomic_tests += device_stats.atomic_tests;
+    stats->atomic_rejected += device_stats.atomic_rejected;
+    stats->page_flips += device_stats.page_flips;
+    stats->framebuffers += device_stats.framebuffers;
+  }
+}
+
+// drmMode* calls return -errno, the others -1 and set errno
+static int ModeResult(int ret) {
+  if (ret < 0)
+    errno = -ret;
+  return ret;
+}
+
+static int IoctlResult(int ret) {
+  if (ret >= 0)
+    return ret;
+  errno = -ret;
+  return -1;
+}
+}  // namespace android
+
+using android::FakeKmsDevice;
+using android::GetDevice;
+using android::IoctlResult;
+using android::ModeResult;
+
+extern "C" {
+
+int drmIoctl(int fd, unsigned long request, void *arg) {
+  std::shared_ptr<FakeKmsDevice> device = GetDevice(fd);
+  if (!device)
+    return -1;
+
+  if (request == DRM_IOCTL_MODE_CREATEPROPBLOB) {
+    struct drm_mode_create_blob *create = (struct drm_mode_create_blob *)arg;
+    return IoctlResult(device->CreateBlob((void *)(uintptr_t)create->data,
+                                          create->length, &create->blob_id));
+  } else if (request == DRM_IOCTL_MODE_DESTROYPROPBLOB) {
+    struct drm_mode_destroy_blob *destroy =
+        (struct drm_mode_destroy_blob *)arg;
+    return IoctlResult(device->DestroyBlob(destroy->blob_id));
+  } else if (request == DRM_IOCTL_GEM_CLOSE) {
+    struct drm_gem_close *close = (struct drm_gem_close *)arg;
+    return IoctlResult(device->CloseHandle(close->handle));
+  }
+  errno = ENOTTY;
+  return -1;
+}
+
+int drmSetClientCap(int fd, uint64_t capability, uint64_t value) {
+  std::shared_ptr<FakeKmsDevice> device = GetDevice(fd);
+  return device ? IoctlResult(device->SetClientCap(capability, value)) : -1;
+}
+
+int drmGetCap(int fd, uint64_t capability, uint64_t *value) {
+  if (!GetDevice(fd))
+    return -1;
+  switch (capability) {
+    case DRM_CAP_TIMESTAMP_MONOTONIC:
+    case DRM_CAP_CRTC_IN_VBLANK_EVENT:
+      *value = 1;
+      return 0;
+    default:
+      errno = EINVAL;
+      return -1;
+  }
+}
+
+drmModeResPtr drmModeGetResources(int fd) {
+  std::shared_ptr<FakeKmsDevice> device = GetDevice(fd);
+  return device ? device->GetResources() : NULL;
+}
+
+void drmModeFreeResources(drmModeResPtr ptr) {
+  if (!ptr)
+    return;
+  free(ptr->fbs);
+  free(ptr->crtcs);
+  free(ptr->connectors);
+  free(ptr->encoders);
+  free(ptr);
+}
+
+drmModeCrtcPtr drmModeGetCrtc(int fd, uint32_t crtc_id) {
+  std::shared_ptr<FakeKmsDevice> device = GetDevice(fd);
+  return device ? device->GetCrtc(crtc_id) : NULL;
+}
+
+void drmModeFreeCrtc(drmModeCrtcPtr ptr) {
+  free(ptr);
+}
+
+drmModeEncoderPtr drmModeGetEncoder(int fd, uint32_t encoder_id) {
+  std::shared_ptr<FakeKmsDevice> device = GetDevice(fd);
+  return device ? device->GetEncoder(encoder_id) : NULL;
+}
+
+void drmModeFreeEncoder(drmModeEncoderPtr ptr) {
+  free(ptr);
+}
+
+drmModeConnectorPtr drmModeGetConnector(int fd, uint32_t connector_id) {
+  std::shared_ptr<FakeKmsDevice> device = GetDevice(fd);
+  return device ? device->GetConnector(connector_id) : NULL;
+}
+
+drmModeConnectorPtr drmModeGetConnectorCurrent(int fd,
+                                               uint32_t connector_id) {
+  return drmModeGetConnector(fd, connector_id);
+}
+
+void drmModeFreeConnector(drmModeConnectorPtr ptr) {
+  if (!ptr)
+    return;
+  free(ptr->encoders);
+  free(ptr->prop_values);
+  free(ptr->props);
+  free(ptr->modes);
+  free(ptr);
+}
+
+drmModePlaneResPtr drmModeGetPlaneResources(int fd) {
+  std::shared_ptr<FakeKmsDevice> device = GetDevice(fd);
+  return device ? device->GetPlaneResources() : NULL;
+}
+
+void drmModeFreePlaneResources(drmModePlaneResPtr ptr) {
+  if (!ptr)
+    return;
+  free(ptr->planes);
+  free(ptr);
+}
+
+drmModePlanePtr drmModeGetPlane(int fd, uint32_t plane_id) {
+  std::shared_ptr<FakeKmsDevice> device = GetDevice(fd);
+  return device ? device->GetPlane(plane_id) : NULL;
+}
+
+void drmModeFreePlane(drmModePlanePtr ptr) {
+  if (!ptr)
+    return;
+  free(ptr->formats);
+  free(ptr);
+}
+
+drmModePropertyPtr drmModeGetProperty(int fd, uint32_t property_id) {
+  std::shared_ptr<FakeKmsDevice> device = GetDevice(fd);
+  return device ? device->GetProperty(property_id) : NULL;
+}
+
+void drmModeFreeProperty(drmModePropertyPtr ptr) {
+  if (!ptr)
+    return;
+  free(ptr->values);
+  free(ptr->enums);
+  free(ptr->blob_ids);
+  free(ptr);
+}
+
+drmModeObjectPropertiesPtr drmModeObjectGetProperties(int fd,
+                                                      uint32_t object_id,
+                                                      uint32_t object_type) {
+  std::shared_ptr<FakeKmsDevice> device = GetDevice(fd);
+  return device ? device->GetObjectProperties(object_id, object_type) : NULL;
+}
+
+void drmModeFreeObjectProperties(drmModeObjectPropertiesPtr ptr) {
+  if (!ptr)
+    return;
+  free(ptr->props);
+  free(ptr->prop_values);
+  free(ptr);
+}
+
+drmModePropertyBlobPtr drmModeGetPropertyBlob(int fd, uint32_t blob_id) {
+  std::shared_ptr<FakeKmsDevice> device = GetDevice(fd);
+  return device ? device->GetPropertyBlob(blob_id) : NULL;
+}
+
+void drmModeFreePropertyBlob(drmModePropertyBlobPtr ptr) {
+  if (!ptr)
+    return;
+  free(ptr->data);
+  free(ptr);
+}
+
+int drmModeCreatePropertyBlob(int fd, const void *data, size_t size,
+                              uint32_t *id) {
+  struct drm_mode_create_blob create;
+  memset(&create, 0, sizeof(create));
+  create.data = (uint64_t)(uintptr_t)data;
+  create.length = (uint32_t)size;
+  int ret = drmIoctl(fd, DRM_IOCTL_MODE_CREATEPROPBLOB, &create);
+  if (ret)
+    return -errno;
+  *id = create.blob_id;
+  return 0;
+}
+
+int drmModeDestroyPropertyBlob(int fd, uint32_t id) {
+  struct drm_mode_destroy_blob destroy;
+  memset(&destroy, 0, sizeof(destroy));
+  destroy.blob_id = id;
+  return drmIoctl(fd, DRM_IOCTL_MODE_DESTROYPROPBLOB, &destroy) ? -errno : 0;
+}
+
+int drmPrimeFDToHandle(int fd, int prime_fd, uint32_t *handle) {
+  std::shared_ptr<FakeKmsDevice> device = GetDevice(fd);
+  return device ? IoctlResult(device->PrimeFdToHandle(prime_fd, handle)) : -1;
+}
+
+int drmModeAddFB2WithModifiers(int fd, uint32_t width, uint32_t height,
+                               uint32_t pixel_format,
+                               const uint32_t bo_handles[4],
+                               const uint32_t /* pitches */[4],
+                               const uint32_t /* offsets */[4],
+                               const uint64_t /* modifier */[4],
+                               uint32_t *buf_id, uint32_t /* flags */) {
+  std::shared_ptr<FakeKmsDevice> device = GetDevice(fd);
+  if (!device)
+    return -errno;
+  return ModeResult(
+      device->AddFb(width, height, pixel_format, bo_handles, buf_id));
+}
+
+int drmModeAddFB2(int fd, uint32_t width, uint32_t height,
+                  uint32_t pixel_format, const uint32_t bo_handles[4],
+                  const uint32_t pitches[4], const uint32_t offsets[4],
+                  uint32_t *buf_id, uint32_t flags) {
+  return drmModeAddFB2WithModifiers(fd, width, height, pixel_format,
+                                    bo_handles, pitches, offsets, NULL, buf_id,
+                                    flags);
+}
+
+int drmModeRmFB(int fd, uint32_t buffer_id) {
+  std::shared_ptr<FakeKmsDevice> device = GetDevice(fd);
+  return device ? ModeResult(device->RmFb(buffer_id)) : -errno;
+}
+
+int drmModeConnectorSetProperty(int fd, uint32_t connector_id,
+                                uint32_t property_id, uint64_t value) {
+  std::shared_ptr<FakeKmsDevice> device = GetDevice(fd);
+  if (!device)
+    return -errno;
+  return ModeResult(
+      device->ConnectorSetProperty(connector_id, property_id, value));
+}
+
+drmModeAtomicReqPtr drmModeAtomicAlloc(void) {
+  return new _drmModeAtomicReq();
+}
+
+drmModeAtomicReqPtr drmModeAtomicDuplicate(drmModeAtomicReqPtr req) {
+  return req ? new _drmModeAtomicReq(*req) : NULL;
+}
+
+int drmModeAtomicMerge(drmModeAtomicReqPtr base,
+                       drmModeAtomicReqPtr augment) {
+  if (!base)
+    return -EINVAL;
+  if (augment)
+    base->items.insert(base->items.end(), augment->items.begin(),
+                       augment->items.end());
+  return 0;
+}
+
+void drmModeAtomicFree(drmModeAtomicReqPtr req) {
+  delete req;
+}
+
+int drmModeAtomicGetCursor(drmModeAtomicReqPtr req) {
+  return req ? (int)req->items.size() : -EINVAL;
+}
+
+void drmModeAtomicSetCursor(drmModeAtomicReqPtr req, int cursor) {
+  if (req && cursor >= 0 && (size_t)cursor < req->items.size())
+    req->items.resize(cursor);
+}
+
+int drmModeAtomicAddProperty(drmModeAtomicReqPtr req, uint32_t object_id,
+                             uint32_t property_id, uint64_t value) {
+  if (!req)
+    return -EINVAL;
+  req->items.push_back({object_id, property_id, value});
+  return (int)req->items.size();
+}
+
+int drmModeAtomicCommit(int fd, drmModeAtomicReqPtr req, uint32_t flags,
+                        void *user_data) {
+  if (!req)
+    return -EINVAL;
+  if (req->items.empty())
+    return 0;
+  std::shared_ptr<FakeKmsDevice> device = GetDevice(fd);
+  if (!device)
+    return -errno;
+  return ModeResult(device->AtomicCommit(req, flags, user_data));
+}
+
+int drmWaitVBlank(int fd, drmVBlankPtr vbl) {
+  std::shared_ptr<FakeKmsDevice> device = GetDevice(fd);
+  return device ? IoctlResult(device->WaitVblank(vbl)) : -1;
+}
+
+int drmCrtcQueueSequence(int fd, uint32_t crtc_id, uint32_t flags,
+                         uint64_t sequence, uint64_t *sequence_queued,
+                         uint64_t user_data) {
+  std::shared_ptr<FakeKmsDevice> device = GetDevice(fd);
+  if (!device)
+    return -1;
+  return IoctlResult(device->QueueSequence(crtc_id, flags, sequence,
+                                           sequence_queued, user_data));
+}
+
+int drmHandleEvent(int fd, drmEventContextPtr evctx) {
+  std::shared_ptr<FakeKmsDevice> device = GetDevice(fd);
+  return device ? IoctlResult(device->HandleEvents(evctx)) : -1;
+}
+}
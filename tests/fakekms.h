@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_FAKE_KMS_H_
+#define ANDROID_FAKE_KMS_H_
+
+#include <stdint.h>
+
+namespace android {
+
+// libdrmhwc_fakekms implements the libdrm entry points used by the HWC on top
+// of a KMS device that only exists in memory. Linking it instead of libdrm
+// lets the unmodified DrmDevice, compositor and HWC2 code run on machines
+// without display hardware.
+//
+// There is no device node: hwc.drm.device points at a description file
+// instead, which DrmDevice opens like a card. On its first use the fd is
+// parsed and replaced, under the same number, by a timerfd that becomes
+// readable when page flip or vblank events are due, so the event listener's
+// epoll loop works as is. Vblanks are synthesized from the timings of the
+// active mode.
+//
+// The description holds one object per line, '#' starts a comment:
+//
+//   size <min_w>x<min_h> <max_w>x<max_h>
+//   crtc
+//   connector <type> [crtcs=<mask>] [mm=<w>x<h>] [modes=<w>x<h>@<hz>,...]
+//             [disconnected] [lit]
+//   connector Writeback [crtcs=<mask>] [formats=<fourcc>,...]
+//   plane <primary|overlay|cursor> [crtcs=<mask>] [formats=<fourcc>,...]
+//         [zpos=<n>] [upscale=<n>] [downscale=<n>] [rotation=<mask>] [alpha]
+//         [in_fence]
+//
+// Connector types use the kernel names (HDMI-A, DP, eDP, DSI, Virtual, ...).
+// The first mode of a connector is the preferred one. A lit connector starts
+// out driven with it by its first free CRTC, like a bootloader splash screen.
+// crtcs= is a bitmask of CRTC indices in the order of the crtc lines and
+// defaults to all of them.
+// Formats are fourcc strings such as AR24 or NV12. upscale= and downscale=
+// bound the scaling factor of a plane, 0 (the default) is unlimited.
+//
+// Atomic commits are checked roughly the way the DRM core and its helpers
+// do: object and property ids, immutable and range limits, modesets without
+// ALLOW_MODESET, planes on disabled or unsupported CRTCs, unknown
+// framebuffers, unsupported formats, source rectangles outside the
+// framebuffer and scaling limits. Real commits complete on the next vblank,
+// OUT_FENCE_PTR fences come from sw_sync when the kernel has it and are -1
+// otherwise.
+
+// Counters of a fake device, for benchmarks and tests
+struct FakeKmsStats {
+  uint64_t ioctls;
+  uint64_t atomic_commits;
+  uint64_t atomic_tests;
+  uint64_t atomic_rejected;
+  uint64_t page_flips;
+  uint64_t framebuffers;
+};
+
+// Returns -ENODEV if fd isn't a fake device
+int FakeKmsGetStats(int fd, FakeKmsStats *stats);
+// Sum of the counters of all fake devices of the process
+void FakeKmsGetTotalStats(FakeKmsStats *stats);
+}
+
+#endif  // ANDROID_FAKE_KMS_H_
@@ -0,0 +1,270 @@
+#include <gtest/gtest.h>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+
+#include <drm/drm_fourcc.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+#include "fakekms.h"
+
+using android::FakeKmsStats;
+
+static const char kDescription[] =
+    "size 1x1 4096x4096\n"
+    "crtc\n"
+    "crtc\n"
+    "connector HDMI-A crtcs=0x1 modes=1920x1080@60,1280x720@60\n"
+    "connector Writeback formats=XR24\n"
+    "plane primary crtcs=0x1 formats=XR24,AR24\n"
+    "plane overlay crtcs=0x1 formats=XR24,NV12 upscale=2 downscale=2\n"
+    "plane primary crtcs=0x2 formats=XR24  # Unusable, CRTC 1 has no output\n";
+
+struct FakeKmsTest : public testing::Test {
+  int fd = -1;
+  uint32_t crtc_id = 0;
+  uint32_t connector_id = 0;
+  uint32_t primary_id = 0;
+  uint32_t overlay_id = 0;
+  uint32_t other_primary_id = 0;
+
+  virtual void SetUp() {
+    const char *tmp = getenv("TMPDIR");
+    std::string path = std::string(tmp ? tmp : "/data/local/tmp") +
+                       "/fakekms-XXXXXX";
+    fd = mkstemp(&path[0]);
+    ASSERT_GE(fd, 0);
+    unlink(path.c_str());
+    ASSERT_EQ((ssize_t)strlen(kDescription),
+              write(fd, kDescription, strlen(kDescription)));
+
+    ASSERT_EQ(0, drmSetClientCap(fd, DRM_CLIENT_CAP_ATOMIC, 1));
+    drmModeResPtr res = drmModeGetResources(fd);
+    ASSERT_TRUE(res != NULL);
+    crtc_id = res->crtcs[0];
+    connector_id = res->connectors[0];
+    drmModeFreeResources(res);
+
+    drmModePlaneResPtr planes = drmModeGetPlaneResources(fd);
+    ASSERT_TRUE(planes != NULL);
+    ASSERT_EQ(3u, planes->count_planes);
+    primary_id = planes->planes[0];
+    overlay_id = planes->planes[1];
+    other_primary_id = planes->planes[2];
+    drmModeFreePlaneResources(planes);
+  }
+
+  virtual void TearDown() {
+    if (fd >= 0)
+      close(fd);
+  }
+
+  uint32_t prop(uint32_t object_id, const char *name) {
+    uint32_t id = 0;
+    drmModeObjectPropertiesPtr props =
+        drmModeObjectGetProperties(fd, object_id, DRM_MODE_OBJECT_ANY);
+    for (uint32_t i = 0; props && i < props->count_props; ++i) {
+      drmModePropertyPtr p = drmModeGetProperty(fd, props->props[i]);
+      if (!strcmp(p->name, name))
+        id = p->prop_id;
+      drmModeFreeProperty(p);
+    }
+    drmModeFreeObjectProperties(props);
+    return id;
+  }
+
+  int modeset(uint32_t flags) {
+    drmModeConnectorPtr connector = drmModeGetConnector(fd, connector_id);
+    uint32_t mode_blob;
+    int ret = drmModeCreatePropertyBlob(fd, &connector->modes[0],
+                                        sizeof(connector->modes[0]),
+                                        &mode_blob);
+    drmModeFreeConnector(connector);
+    if (ret)
+      return ret;
+
+    drmModeAtomicReqPtr req = drmModeAtomicAlloc();
+    drmModeAtomicAddProperty(req, crtc_id, prop(crtc_id, "MODE_ID"),
+                             mode_blob);
+    drmModeAtomicAddProperty(req, crtc_id, prop(crtc_id, "ACTIVE"), 1);
+    drmModeAtomicAddProperty(req, connector_id, prop(connector_id, "CRTC_ID"),
+                             crtc_id);
+    ret = drmModeAtomicCommit(fd, req, flags, this);
+    drmModeAtomicFree(req);
+    return ret;
+  }
+
+  int show(uint32_t plane_id, uint32_t fb_id, uint32_t src_w, uint32_t src_h,
+           uint32_t crtc_w, uint32_t crtc_h) {
+    drmModeAtomicReqPtr req = drmModeAtomicAlloc();
+    drmModeAtomicAddProperty(req, plane_id, prop(plane_id, "FB_ID"), fb_id);
+    drmModeAtomicAddProperty(req, plane_id, prop(plane_id, "CRTC_ID"),
+                             crtc_id);
+    drmModeAtomicAddProperty(req, plane_id, prop(plane_id, "SRC_W"),
+                             src_w << 16);
+    drmModeAtomicAddProperty(req, plane_id, prop(plane_id, "SRC_H"),
+                             src_h << 16);
+    drmModeAtomicAddProperty(req, plane_id, prop(plane_id, "CRTC_W"), crtc_w);
+    drmModeAtomicAddProperty(req, plane_id, prop(plane_id, "CRTC_H"), crtc_h);
+    int ret = drmModeAtomicCommit(fd, req, DRM_MODE_ATOMIC_TEST_ONLY, NULL);
+    drmModeAtomicFree(req);
+    return ret;
+  }
+
+  uint32_t add_fb(uint32_t width, uint32_t height, uint32_t format) {
+    uint32_t handles[4] = {0}, pitches[4] = {width * 4}, offsets[4] = {0};
+    uint32_t fb_id = 0;
+    // Any fd stands in for a dma-buf
+    int buffer_fd = open("/dev/null", O_RDONLY);
+    int ret = drmPrimeFDToHandle(fd, buffer_fd, &handles[0]);
+    close(buffer_fd);
+    if (ret)
+      return 0;
+    drmModeAddFB2(fd, width, height, format, handles, pitches, offsets,
+                  &fb_id, 0);
+    return fb_id;
+  }
+};
+
+TEST_F(FakeKmsTest, describes_device) {
+  drmModeResPtr res = drmModeGetResources(fd);
+  ASSERT_EQ(2, res->count_crtcs);
+  // Writeback connectors are hidden until the client asks for them
+  ASSERT_EQ(1, res->count_connectors);
+  drmModeFreeResources(res);
+
+  ASSERT_EQ(0, drmSetClientCap(fd, DRM_CLIENT_CAP_WRITEBACK_CONNECTORS, 1));
+  res = drmModeGetResources(fd);
+  ASSERT_EQ(2, res->count_connectors);
+  drmModeConnectorPtr writeback = drmModeGetConnector(fd, res->connectors[1]);
+  ASSERT_EQ((uint32_t)DRM_MODE_CONNECTOR_WRITEBACK, writeback->connector_type);
+  drmModeFreeConnector(writeback);
+  drmModeFreeResources(res);
+
+  drmModeConnectorPtr connector = drmModeGetConnector(fd, connector_id);
+  ASSERT_EQ(DRM_MODE_CONNECTED, connector->connection);
+  ASSERT_EQ(2, connector->count_modes);
+  ASSERT_EQ(1920, connector->modes[0].hdisplay);
+  ASSERT_TRUE(connector->modes[0].type & DRM_MODE_TYPE_PREFERRED);
+  drmModeEncoderPtr encoder = drmModeGetEncoder(fd, connector->encoders[0]);
+  ASSERT_EQ(1u, encoder->possible_crtcs);
+  drmModeFreeEncoder(encoder);
+  drmModeFreeConnector(connector);
+
+  drmModePlanePtr overlay = drmModeGetPlane(fd, overlay_id);
+  ASSERT_EQ(2u, overlay->count_formats);
+  ASSERT_EQ((uint32_t)DRM_FORMAT_NV12, overlay->formats[1]);
+  drmModeFreePlane(overlay);
+
+  drmModeObjectPropertiesPtr props =
+      drmModeObjectGetProperties(fd, overlay_id, DRM_MODE_OBJECT_PLANE);
+  for (uint32_t i = 0; i < props->count_props; ++i)
+    if (props->props[i] == prop(overlay_id, "type"))
+      ASSERT_EQ((uint64_t)DRM_PLANE_TYPE_OVERLAY, props->prop_values[i]);
+  drmModeFreeObjectProperties(props);
+}
+
+TEST_F(FakeKmsTest, checks_commits) {
+  ASSERT_EQ(-EINVAL, modeset(0));
+  ASSERT_EQ(0, modeset(DRM_MODE_ATOMIC_TEST_ONLY |
+                       DRM_MODE_ATOMIC_ALLOW_MODESET));
+  drmModeCrtcPtr crtc = drmModeGetCrtc(fd, crtc_id);
+  ASSERT_EQ(0, crtc->mode_valid);
+  drmModeFreeCrtc(crtc);
+
+  uint32_t fb_id = add_fb(1920, 1080, DRM_FORMAT_XRGB8888);
+  ASSERT_NE(0u, fb_id);
+  // Plane on a disabled CRTC
+  ASSERT_EQ(-EINVAL, show(primary_id, fb_id, 1920, 1080, 1920, 1080));
+
+  ASSERT_EQ(0, modeset(DRM_MODE_ATOMIC_ALLOW_MODESET));
+  crtc = drmModeGetCrtc(fd, crtc_id);
+  ASSERT_EQ(1, crtc->mode_valid);
+  ASSERT_EQ(1080, crtc->mode.vdisplay);
+  drmModeFreeCrtc(crtc);
+
+  ASSERT_EQ(0, show(primary_id, fb_id, 1920, 1080, 1920, 1080));
+  ASSERT_EQ(-ENOSPC, show(primary_id, fb_id, 1920, 1200, 1920, 1080));
+  ASSERT_EQ(-EINVAL, show(other_primary_id, fb_id, 1920, 1080, 1920, 1080));
+  ASSERT_EQ(0, show(overlay_id, fb_id, 960, 540, 1920, 1080));
+  ASSERT_EQ(-ERANGE, show(overlay_id, fb_id, 480, 270, 1920, 1080));
+  ASSERT_EQ(-ERANGE, show(overlay_id, fb_id, 1920, 1080, 480, 270));
+  ASSERT_EQ(0u, add_fb(64, 64, DRM_FORMAT_RGB565));
+
+  drmModeAtomicReqPtr req = drmModeAtomicAlloc();
+  drmModeAtomicAddProperty(req, primary_id, prop(primary_id, "type"),
+                           DRM_PLANE_TYPE_OVERLAY);
+  ASSERT_EQ(-EINVAL,
+            drmModeAtomicCommit(fd, req, DRM_MODE_ATOMIC_TEST_ONLY, NULL));
+  drmModeAtomicFree(req);
+
+  FakeKmsStats stats;
+  ASSERT_EQ(0, android::FakeKmsGetStats(fd, &stats));
+  ASSERT_EQ(2u, stats.atomic_commits);
+  ASSERT_EQ(9u, stats.atomic_tests);
+  ASSERT_EQ(7u, stats.atomic_rejected);
+}
+
+static int flips = 0;
+static unsigned int flip_sec = 0;
+static unsigned int flip_usec = 0;
+
+static void FlipHandler(int, unsigned int, unsigned int tv_sec,
+                        unsigned int tv_usec, void *) {
+  ++flips;
+  flip_sec = tv_sec;
+  flip_usec = tv_usec;
+}
+
+static uint64_t sequence_ns[2];
+
+static void SequenceHandler(int, uint64_t sequence, uint64_t ns,
+                            uint64_t user_data) {
+  sequence_ns[user_data] = ns;
+  (void)sequence;
+}
+
+TEST_F(FakeKmsTest, events_on_vblank) {
+  drmEventContext context;
+  memset(&context, 0, sizeof(context));
+  context.version = 4;
+  context.page_flip_handler = FlipHandler;
+  context.sequence_handler = SequenceHandler;
+
+  // No vblanks while the CRTC is off
+  ASSERT_EQ(-1, drmCrtcQueueSequence(fd, crtc_id, DRM_CRTC_SEQUENCE_RELATIVE,
+                                     1, NULL, 0));
+
+  flips = 0;
+  ASSERT_EQ(0, modeset(DRM_MODE_ATOMIC_ALLOW_MODESET |
+                       DRM_MODE_ATOMIC_NONBLOCK | DRM_MODE_PAGE_FLIP_EVENT));
+  // One flip in flight at a time for non blocking commits
+  ASSERT_EQ(-EBUSY, modeset(DRM_MODE_ATOMIC_ALLOW_MODESET |
+                            DRM_MODE_ATOMIC_NONBLOCK));
+
+  struct pollfd pfd = {.fd = fd, .events = POLLIN, .revents = 0};
+  ASSERT_EQ(1, poll(&pfd, 1, 100));
+  ASSERT_EQ(0, drmHandleEvent(fd, &context));
+  ASSERT_EQ(1, flips);
+  ASSERT_TRUE(flip_sec || flip_usec);
+
+  uint64_t queued[2];
+  ASSERT_EQ(0, drmCrtcQueueSequence(fd, crtc_id, DRM_CRTC_SEQUENCE_RELATIVE,
+                                    1, &queued[0], 0));
+  ASSERT_EQ(0, drmCrtcQueueSequence(fd, crtc_id, DRM_CRTC_SEQUENCE_RELATIVE,
+                                    2, &queued[1], 1));
+  ASSERT_EQ(queued[0] + 1, queued[1]);
+  for (int i = 0; i < 2 && poll(&pfd, 1, 100) == 1; ++i)
+    drmHandleEvent(fd, &context);
+
+  // The period of 1920x1080@60 with the fake's blanking
+  int64_t period = (int64_t)(sequence_ns[1] - sequence_ns[0]);
+  ASSERT_GT(period, 16500000);
+  ASSERT_LT(period, 16800000);
+}
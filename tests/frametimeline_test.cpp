@@ -0,0 +1,59 @@
+#include <gtest/gtest.h>
+
+#include "frametimeline.h"
+
+using android::FrameTimeline;
+
+TEST(FrameTimelineTest, stage_latencies) {
+  FrameTimeline timeline;
+  timeline.Stamp(1, FrameTimeline::kSetLayer, 1000);
+  timeline.Stamp(1, FrameTimeline::kValidate, 3000);
+  // Skipped stages measure from the last stamped one
+  timeline.Stamp(1, FrameTimeline::kCommit, 7000);
+  timeline.Stamp(1, FrameTimeline::kFlip, 20000);
+
+  ASSERT_EQ(3000, timeline.GetStamp(1, FrameTimeline::kValidate));
+  ASSERT_EQ(-1, timeline.GetStamp(1, FrameTimeline::kPlan));
+  ASSERT_EQ(2000,
+            timeline.stage_latency(FrameTimeline::kValidate).Percentile(100));
+  ASSERT_EQ(4000,
+            timeline.stage_latency(FrameTimeline::kCommit).Percentile(100));
+  ASSERT_EQ(0u, timeline.stage_latency(FrameTimeline::kPlan).total_samples());
+}
+
+TEST(FrameTimelineTest, next_flip_releases) {
+  FrameTimeline timeline;
+  timeline.Stamp(1, FrameTimeline::kFlip, 1000);
+  ASSERT_EQ(-1, timeline.GetStamp(1, FrameTimeline::kRelease));
+  timeline.Stamp(2, FrameTimeline::kFlip, 2000);
+  ASSERT_EQ(2000, timeline.GetStamp(1, FrameTimeline::kRelease));
+
+  // Recommitting an older frame doesn't count as a flip
+  timeline.Stamp(0, FrameTimeline::kFlip, 3000);
+  ASSERT_EQ(-1, timeline.GetStamp(2, FrameTimeline::kRelease));
+}
+
+TEST(FrameTimelineTest, ring_wraps) {
+  FrameTimeline timeline;
+  timeline.Stamp(1, FrameTimeline::kCommit, 1000);
+  timeline.Stamp(1 + FrameTimeline::kRingSize, FrameTimeline::kSetLayer, 2000);
+  ASSERT_EQ(-1, timeline.GetStamp(1, FrameTimeline::kCommit));
+  ASSERT_EQ(-1, timeline.GetStamp(1 + FrameTimeline::kRingSize,
+                                  FrameTimeline::kCommit));
+
+  // Stale stamps for the old frame are dropped
+  timeline.Stamp(1, FrameTimeline::kFlip, 3000);
+  ASSERT_EQ(-1, timeline.GetStamp(1, FrameTimeline::kFlip));
+}
+
+TEST(FrameTimelineTest, snapshot_size) {
+  FrameTimeline timeline;
+  std::string snapshot;
+  timeline.AppendSnapshot(&snapshot);
+  size_t histogram = (3 + android::LatencyStats::kNumBuckets) * 8;
+  ASSERT_EQ(sizeof(FrameTimeline::SnapshotHeader) +
+                (FrameTimeline::kNumStages + 1) * histogram +
+                FrameTimeline::kRingSize * (1 + FrameTimeline::kNumStages) * 8,
+            snapshot.size());
+  ASSERT_EQ(0, snapshot.compare(0, 4, "HWCT"));
+}
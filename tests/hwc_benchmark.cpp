@@ -0,0 +1,846 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// End-to-end frame benchmark. Drives the HWC through its HWC2 function table
+// the way SurfaceFlinger does, on the fake KMS device of libdrmhwc_fakekms,
+// and prints the cost of every scene as JSON:
+//
+//   hwc-drm-benchmark [--device=<description>] [--frames=<n>] [--warmup=<n>]
+//                     [--scene=<name>] [--output=<file>]
+//
+// --device sets hwc.drm.device, so the description must be writable like a
+// card would be. Without it the property must already point at one.
+//
+// Per validate and present call it measures the wall time and the CPU time
+// of the calling thread. Per frame it measures the CPU time of the whole
+// process, which includes the compositor and event threads, the ioctls
+// issued to the fake device and the C++ heap allocations of all threads.
+
+#define LOG_TAG "hwc-drm-benchmark"
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <cutils/properties.h>
+#include <hardware/hardware.h>
+#include <hardware/hwcomposer2.h>
+#include <log/log.h>
+#include <sync/sync.h>
+#include <ui/GraphicBuffer.h>
+
+#include "benchmetric.h"
+#include "fakekms.h"
+
+extern hw_module_t HAL_MODULE_INFO_SYM;
+
+// Allocations made through malloc, like the fake's stand-ins for libdrm's
+// structures, aren't counted
+static std::atomic<uint64_t> heap_allocations(0);
+
+void *operator new(size_t size) {
+  heap_allocations.fetch_add(1, std::memory_order_relaxed);
+  void *ptr = malloc(size ? size : 1);
+  if (!ptr)
+    abort();
+  return ptr;
+}
+
+void *operator new[](size_t size) {
+  return operator new(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+  heap_allocations.fetch_add(1, std::memory_order_relaxed);
+  return malloc(size ? size : 1);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &tag) noexcept {
+  return operator new(size, tag);
+}
+
+void operator delete(void *ptr) noexcept {
+  free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept {
+  free(ptr);
+}
+
+namespace android {
+
+static const size_t kBuffersPerLayer = 3;
+static const size_t kMaxLayers = 16;
+static const int kFenceTimeoutMs = 1000;
+
+struct SceneResult {
+  size_t layers = 0;
+  BenchMetric validate_wall_ns;
+  BenchMetric validate_cpu_ns;
+  BenchMetric present_wall_ns;
+  BenchMetric present_cpu_ns;
+  BenchMetric frame_cpu_ns;
+  BenchMetric ioctls;
+  BenchMetric allocations;
+  uint32_t frames = 0;
+  uint32_t client_frames = 0;
+  uint64_t atomic_tests = 0;
+  uint64_t page_flips = 0;
+};
+
+class HwcBenchmark;
+
+struct Scene {
+  const char *name;
+  // Creates the layers and sets their first buffers
+  void (*setup)(HwcBenchmark *bench);
+  // Changes the layers for frame n
+  void (*update)(HwcBenchmark *bench, uint32_t n);
+};
+
+class HwcBenchmark {
+ public:
+  int Init();
+  int RunScene(const Scene &scene, uint32_t warmup, uint32_t frames,
+               SceneResult *result);
+
+  // Scenes describe layers with these. The first failure is kept and turns
+  // the following calls into no-ops, the scene is aborted once it returns.
+  size_t AddLayer(int32_t format, uint32_t width, uint32_t height,
+                  int32_t blend_mode, hwc_rect_t display_frame,
+                  uint32_t z_order);
+  // Queues the next buffer of the layer with full damage
+  void SetLayerBuffer(size_t index);
+  void SetLayerDisplayFrame(size_t index, hwc_rect_t display_frame);
+  void SetLayerPlaneAlpha(size_t index, float alpha);
+  void SetLayerZOrder(size_t index, uint32_t z_order);
+
+  int32_t width() const {
+    return width_;
+  }
+  int32_t height() const {
+    return height_;
+  }
+  int32_t vsync_period() const {
+    return vsync_period_;
+  }
+
+ private:
+  struct Layer {
+    hwc2_layer_t id;
+    std::vector<sp<GraphicBuffer>> buffers;
+    size_t next_buffer;
+  };
+
+  template <typename PFN>
+  int GetFunction(hwc2_function_descriptor_t descriptor, PFN *hook);
+  void SetError(const char *what, size_t index, int32_t error);
+  void DestroyLayers();
+  int PresentFrame(SceneResult *result, bool record);
+
+  static void HotplugCallback(hwc2_callback_data_t data,
+                              hwc2_display_t display, int32_t connected);
+  static void RefreshCallback(hwc2_callback_data_t data,
+                              hwc2_display_t display);
+  static void VsyncCallback(hwc2_callback_data_t data, hwc2_display_t display,
+                            int64_t timestamp);
+
+  hwc2_device_t *device_ = NULL;
+  hwc2_display_t display_ = HWC_DISPLAY_PRIMARY;
+  bool connected_ = false;
+  int32_t width_ = 0;
+  int32_t height_ = 0;
+  int32_t vsync_period_ = 0;
+
+  std::vector<Layer> layers_;
+  int error_ = 0;
+  sp<GraphicBuffer> client_target_;
+  int present_fence_ = -1;
+  // Preallocated so that the frame loop itself doesn't allocate
+  std::vector<hwc2_layer_t> changed_layers_;
+  std::vector<int32_t> changed_types_;
+  std::vector<int32_t> release_fences_;
+
+  HWC2_PFN_ACCEPT_DISPLAY_CHANGES accept_display_changes_;
+  HWC2_PFN_CREATE_LAYER create_layer_;
+  HWC2_PFN_DESTROY_LAYER destroy_layer_;
+  HWC2_PFN_GET_ACTIVE_CONFIG get_active_config_;
+  HWC2_PFN_GET_CHANGED_COMPOSITION_TYPES get_changed_composition_types_;
+  HWC2_PFN_GET_DISPLAY_ATTRIBUTE get_display_attribute_;
+  HWC2_PFN_GET_RELEASE_FENCES get_release_fences_;
+  HWC2_PFN_PRESENT_DISPLAY present_display_;
+  HWC2_PFN_REGISTER_CALLBACK register_callback_;
+  HWC2_PFN_SET_CLIENT_TARGET set_client_target_;
+  HWC2_PFN_SET_LAYER_BLEND_MODE set_layer_blend_mode_;
+  HWC2_PFN_SET_LAYER_BUFFER set_layer_buffer_;
+  HWC2_PFN_SET_LAYER_COMPOSITION_TYPE set_layer_composition_type_;
+  HWC2_PFN_SET_LAYER_DATASPACE set_layer_dataspace_;
+  HWC2_PFN_SET_LAYER_DISPLAY_FRAME set_layer_display_frame_;
+  HWC2_PFN_SET_LAYER_PLANE_ALPHA set_layer_plane_alpha_;
+  HWC2_PFN_SET_LAYER_SOURCE_CROP set_layer_source_crop_;
+  HWC2_PFN_SET_LAYER_SURFACE_DAMAGE set_layer_surface_damage_;
+  HWC2_PFN_SET_LAYER_TRANSFORM set_layer_transform_;
+  HWC2_PFN_SET_LAYER_VISIBLE_REGION set_layer_visible_region_;
+  HWC2_PFN_SET_LAYER_Z_ORDER set_layer_z_order_;
+  HWC2_PFN_SET_POWER_MODE set_power_mode_;
+  HWC2_PFN_VALIDATE_DISPLAY validate_display_;
+};
+
+template <typename PFN>
+int HwcBenchmark::GetFunction(hwc2_function_descriptor_t descriptor,
+                              PFN *hook) {
+  *hook = reinterpret_cast<PFN>(device_->getFunction(device_, descriptor));
+  if (!*hook) {
+    ALOGE("Missing HWC2 function %d", descriptor);
+    return -ENOSYS;
+  }
+  return 0;
+}
+
+void HwcBenchmark::HotplugCallback(hwc2_callback_data_t data,
+                                   hwc2_display_t display, int32_t connected) {
+  HwcBenchmark *bench = static_cast<HwcBenchmark *>(data);
+  if (display == bench->display_)
+    bench->connected_ = connected == HWC2_CONNECTION_CONNECTED;
+}
+
+void HwcBenchmark::RefreshCallback(hwc2_callback_data_t /*data*/,
+                                   hwc2_display_t /*display*/) {
+}
+
+void HwcBenchmark::VsyncCallback(hwc2_callback_data_t /*data*/,
+                                 hwc2_display_t /*display*/,
+                                 int64_t /*timestamp*/) {
+}
+
+int HwcBenchmark::Init() {
+  hw_device_t *device;
+  int ret = HAL_MODULE_INFO_SYM.methods->open(&HAL_MODULE_INFO_SYM,
+                                              HWC_HARDWARE_COMPOSER, &device);
+  if (ret) {
+    ALOGE("Failed to open the HWC %d", ret);
+    return ret;
+  }
+  device_ = reinterpret_cast<hwc2_device_t *>(device);
+
+  if (GetFunction(HWC2_FUNCTION_ACCEPT_DISPLAY_CHANGES,
+                  &accept_display_changes_) ||
+      GetFunction(HWC2_FUNCTION_CREATE_LAYER, &create_layer_) ||
+      GetFunction(HWC2_FUNCTION_DESTROY_LAYER, &destroy_layer_) ||
+      GetFunction(HWC2_FUNCTION_GET_ACTIVE_CONFIG, &get_active_config_) ||
+      GetFunction(HWC2_FUNCTION_GET_CHANGED_COMPOSITION_TYPES,
+                  &get_changed_composition_types_) ||
+      GetFunction(HWC2_FUNCTION_GET_DISPLAY_ATTRIBUTE,
+                  &get_display_attribute_) ||
+      GetFunction(HWC2_FUNCTION_GET_RELEASE_FENCES, &get_release_fences_) ||
+      GetFunction(HWC2_FUNCTION_PRESENT_DISPLAY, &present_display_) ||
+      GetFunction(HWC2_FUNCTION_REGISTER_CALLBACK, &register_callback_) ||
+      GetFunction(HWC2_FUNCTION_SET_CLIENT_TARGET, &set_client_target_) ||
+      GetFunction(HWC2_FUNCTION_SET_LAYER_BLEND_MODE,
+                  &set_layer_blend_mode_) ||
+      GetFunction(HWC2_FUNCTION_SET_LAYER_BUFFER, &set_layer_buffer_) ||
+      GetFunction(HWC2_FUNCTION_SET_LAYER_COMPOSITION_TYPE,
+                  &set_layer_composition_type_) ||
+      GetFunction(HWC2_FUNCTION_SET_LAYER_DATASPACE, &set_layer_dataspace_) ||
+      GetFunction(HWC2_FUNCTION_SET_LAYER_DISPLAY_FRAME,
+                  &set_layer_display_frame_) ||
+      GetFunction(HWC2_FUNCTION_SET_LAYER_PLANE_ALPHA,
+                  &set_layer_plane_alpha_) ||
+      GetFunction(HWC2_FUNCTION_SET_LAYER_SOURCE_CROP,
+                  &set_layer_source_crop_) ||
+      GetFunction(HWC2_FUNCTION_SET_LAYER_SURFACE_DAMAGE,
+                  &set_layer_surface_damage_) ||
+      GetFunction(HWC2_FUNCTION_SET_LAYER_TRANSFORM, &set_layer_transform_) ||
+      GetFunction(HWC2_FUNCTION_SET_LAYER_VISIBLE_REGION,
+                  &set_layer_visible_region_) ||
+      GetFunction(HWC2_FUNCTION_SET_LAYER_Z_ORDER, &set_layer_z_order_) ||
+      GetFunction(HWC2_FUNCTION_SET_POWER_MODE, &set_power_mode_) ||
+      GetFunction(HWC2_FUNCTION_VALIDATE_DISPLAY, &validate_display_))
+    return -ENOSYS;
+
+  if (register_callback_(
+          device_, HWC2_CALLBACK_HOTPLUG, this,
+          reinterpret_cast<hwc2_function_pointer_t>(HotplugCallback)) ||
+      register_callback_(
+          device_, HWC2_CALLBACK_REFRESH, this,
+          reinterpret_cast<hwc2_function_pointer_t>(RefreshCallback)) ||
+      register_callback_(
+          device_, HWC2_CALLBACK_VSYNC, this,
+          reinterpret_cast<hwc2_function_pointer_t>(VsyncCallback))) {
+    ALOGE("Failed to register callbacks %d", ret);
+    return -EINVAL;
+  }
+  if (!connected_) {
+    ALOGE("Primary display isn't connected");
+    return -ENODEV;
+  }
+
+  hwc2_config_t config;
+  ret = get_active_config_(device_, display_, &config);
+  if (ret ||
+      get_display_attribute_(device_, display_, config, HWC2_ATTRIBUTE_WIDTH,
+                             &width_) ||
+      get_display_attribute_(device_, display_, config, HWC2_ATTRIBUTE_HEIGHT,
+                             &height_) ||
+      get_display_attribute_(device_, display_, config,
+                             HWC2_ATTRIBUTE_VSYNC_PERIOD, &vsync_period_) ||
+      set_power_mode_(device_, display_, HWC2_POWER_MODE_ON)) {
+    ALOGE("Failed to set up the display %d", ret);
+    return -EINVAL;
+  }
+
+  client_target_ = new GraphicBuffer(width_, height_, PIXEL_FORMAT_RGBA_8888,
+                                     GRALLOC_USAGE_HW_FB |
+                                         GRALLOC_USAGE_HW_COMPOSER |
+                                         GRALLOC_USAGE_HW_RENDER);
+  if (client_target_->initCheck()) {
+    ALOGE("Failed to allocate the client target");
+    return -ENOMEM;
+  }
+
+  changed_layers_.resize(kMaxLayers);
+  changed_types_.resize(kMaxLayers);
+  release_fences_.resize(kMaxLayers);
+  return 0;
+}
+
+void HwcBenchmark::SetError(const char *what, size_t index, int32_t error) {
+  ALOGE("Failed to %s on layer %zu %d", what, index, error);
+  if (!error_)
+    error_ = -EINVAL;
+}
+
+size_t HwcBenchmark::AddLayer(int32_t format, uint32_t width, uint32_t height,
+                              int32_t blend_mode, hwc_rect_t display_frame,
+                              uint32_t z_order) {
+  size_t index = layers_.size();
+  if (error_)
+    return index;
+  if (index == kMaxLayers) {
+    ALOGE("Too many layers");
+    error_ = -ENOSPC;
+    return index;
+  }
+
+  Layer layer;
+  layer.next_buffer = 0;
+  for (size_t i = 0; i < kBuffersPerLayer; ++i) {
+    sp<GraphicBuffer> buffer =
+        new GraphicBuffer(width, height, format,
+                          GRALLOC_USAGE_HW_COMPOSER | GRALLOC_USAGE_HW_TEXTURE);
+    if (buffer->initCheck()) {
+      ALOGE("Failed to allocate a %ux%u buffer of format %d", width, height,
+            format);
+      error_ = -ENOMEM;
+      return index;
+    }
+    layer.buffers.push_back(buffer);
+  }
+
+  int32_t ret = create_layer_(device_, display_, &layer.id);
+  if (ret) {
+    SetError("create", index, ret);
+    return index;
+  }
+  layers_.push_back(layer);
+
+  hwc_frect_t crop = {0.0f, 0.0f, (float)width, (float)height};
+  hwc_region_t visible = {1, &display_frame};
+  if (set_layer_composition_type_(device_, display_, layer.id,
+                                  HWC2_COMPOSITION_DEVICE) ||
+      set_layer_blend_mode_(device_, display_, layer.id, blend_mode) ||
+      set_layer_dataspace_(device_, display_, layer.id,
+                           HAL_DATASPACE_UNKNOWN) ||
+      set_layer_transform_(device_, display_, layer.id, 0) ||
+      set_layer_source_crop_(device_, display_, layer.id, crop) ||
+      set_layer_visible_region_(device_, display_, layer.id, visible)) {
+    SetError("set up", index, -1);
+    return index;
+  }
+  SetLayerDisplayFrame(index, display_frame);
+  SetLayerZOrder(index, z_order);
+  SetLayerPlaneAlpha(index, 1.0f);
+  SetLayerBuffer(index);
+  return index;
+}
+
+void HwcBenchmark::SetLayerBuffer(size_t index) {
+  if (error_)
+    return;
+  Layer &layer = layers_[index];
+  const sp<GraphicBuffer> &buffer = layer.buffers[layer.next_buffer];
+  layer.next_buffer = (layer.next_buffer + 1) % layer.buffers.size();
+
+  hwc_rect_t rect = {0, 0, (int)buffer->getWidth(), (int)buffer->getHeight()};
+  hwc_region_t damage = {1, &rect};
+  int32_t ret = set_layer_buffer_(device_, display_, layer.id, buffer->handle,
+                                  -1);
+  if (!ret)
+    ret = set_layer_surface_damage_(device_, display_, layer.id, damage);
+  if (ret)
+    SetError("set the buffer", index, ret);
+}
+
+void HwcBenchmark::SetLayerDisplayFrame(size_t index,
+                                        hwc_rect_t display_frame) {
+  if (error_)
+    return;
+  int32_t ret = set_layer_display_frame_(device_, display_, layers_[index].id,
+                                         display_frame);
+  if (ret)
+    SetError("set the display frame", index, ret);
+}
+
+void HwcBenchmark::SetLayerPlaneAlpha(size_t index, float alpha) {
+  if (error_)
+    return;
+  int32_t ret = set_layer_plane_alpha_(device_, display_, layers_[index].id,
+                                       alpha);
+  if (ret)
+    SetError("set the plane alpha", index, ret);
+}
+
+void HwcBenchmark::SetLayerZOrder(size_t index, uint32_t z_order) {
+  if (error_)
+    return;
+  int32_t ret = set_layer_z_order_(device_, display_, layers_[index].id,
+                                   z_order);
+  if (ret)
+    SetError("set the z order", index, ret);
+}
+
+void HwcBenchmark::DestroyLayers() {
+  for (Layer &layer : layers_) {
+    int32_t ret = destroy_layer_(device_, display_, layer.id);
+    if (ret)
+      ALOGW("Failed to destroy a layer %d", ret);
+  }
+  layers_.clear();
+}
+
+// One SurfaceFlinger frame: validate, accept the changes and provide the
+// client target if anything falls back to GPU composition, present, then
+// wait for the previous frame to be on screen
+int HwcBenchmark::PresentFrame(SceneResult *result, bool record) {
+  int64_t validate_wall = BenchNow(CLOCK_MONOTONIC);
+  int64_t validate_cpu = BenchNow(CLOCK_THREAD_CPUTIME_ID);
+  uint32_t num_types, num_requests;
+  int32_t ret = validate_display_(device_, display_, &num_types,
+                                  &num_requests);
+  validate_cpu = BenchNow(CLOCK_THREAD_CPUTIME_ID) - validate_cpu;
+  validate_wall = BenchNow(CLOCK_MONOTONIC) - validate_wall;
+  if (ret && ret != HWC2_ERROR_HAS_CHANGES) {
+    ALOGE("Failed to validate %d", ret);
+    return -EINVAL;
+  }
+
+  bool client = false;
+  if (num_types) {
+    uint32_t num_elements = changed_layers_.size();
+    ret = get_changed_composition_types_(device_, display_, &num_elements,
+                                         changed_layers_.data(),
+                                         changed_types_.data());
+    if (ret || accept_display_changes_(device_, display_)) {
+      ALOGE("Failed to accept display changes %d", ret);
+      return -EINVAL;
+    }
+    for (uint32_t i = 0; i < num_elements; ++i)
+      client |= changed_types_[i] == HWC2_COMPOSITION_CLIENT;
+  }
+  if (client) {
+    hwc_region_t damage = {0, NULL};
+    ret = set_client_target_(device_, display_, client_target_->handle, -1,
+                             HAL_DATASPACE_UNKNOWN, damage);
+    if (ret) {
+      ALOGE("Failed to set the client target %d", ret);
+      return -EINVAL;
+    }
+  }
+
+  int64_t present_wall = BenchNow(CLOCK_MONOTONIC);
+  int64_t present_cpu = BenchNow(CLOCK_THREAD_CPUTIME_ID);
+  int32_t present_fence = -1;
+  ret = present_display_(device_, display_, &present_fence);
+  present_cpu = BenchNow(CLOCK_THREAD_CPUTIME_ID) - present_cpu;
+  present_wall = BenchNow(CLOCK_MONOTONIC) - present_wall;
+  if (ret) {
+    ALOGE("Failed to present %d", ret);
+    return -EINVAL;
+  }
+
+  uint32_t num_fences = release_fences_.size();
+  if (!get_release_fences_(device_, display_, &num_fences,
+                           changed_layers_.data(), release_fences_.data())) {
+    for (uint32_t i = 0; i < num_fences; ++i)
+      if (release_fences_[i] >= 0)
+        close(release_fences_[i]);
+  }
+
+  if (present_fence_ >= 0) {
+    if (sync_wait(present_fence_, kFenceTimeoutMs))
+      ALOGW("Timed out waiting for a present fence");
+    close(present_fence_);
+  }
+  present_fence_ = present_fence;
+
+  if (record) {
+    result->validate_wall_ns.Add(validate_wall);
+    result->validate_cpu_ns.Add(validate_cpu);
+    result->present_wall_ns.Add(present_wall);
+    result->present_cpu_ns.Add(present_cpu);
+    result->client_frames += client;
+  }
+  return 0;
+}
+
+int HwcBenchmark::RunScene(const Scene &scene, uint32_t warmup,
+                           uint32_t frames, SceneResult *result) {
+  error_ = 0;
+  scene.setup(this);
+  result->layers = layers_.size();
+
+  int ret = error_;
+  FakeKmsStats first;
+  for (uint32_t n = 0; n < warmup + frames && !ret; ++n) {
+    bool record = n >= warmup;
+    FakeKmsStats before;
+    FakeKmsGetTotalStats(&before);
+    if (n == warmup)
+      first = before;
+    uint64_t allocations = heap_allocations.load(std::memory_order_relaxed);
+    int64_t frame_cpu = BenchNow(CLOCK_PROCESS_CPUTIME_ID);
+
+    scene.update(this, n);
+    ret = error_;
+    if (!ret)
+      ret = PresentFrame(result, record);
+
+    frame_cpu = BenchNow(CLOCK_PROCESS_CPUTIME_ID) - frame_cpu;
+    allocations = heap_allocations.load(std::memory_order_relaxed) -
+                  allocations;
+    FakeKmsStats after;
+    FakeKmsGetTotalStats(&after);
+    if (record) {
+      result->frame_cpu_ns.Add(frame_cpu);
+      result->ioctls.Add(after.ioctls - before.ioctls);
+      result->allocations.Add(allocations);
+      result->atomic_tests = after.atomic_tests - first.atomic_tests;
+      result->page_flips = after.page_flips - first.page_flips;
+      result->frames++;
+    }
+  }
+  if (ret)
+    ALOGE("Scene %s failed %d", scene.name, ret);
+
+  DestroyLayers();
+  return ret;
+}
+
+// Scenes, for a portrait phone screen of w x h
+
+static hwc_rect_t Rect(int left, int top, int right, int bottom) {
+  hwc_rect_t rect = {left, top, right, bottom};
+  return rect;
+}
+
+// Returns the status bar
+static size_t AddBars(HwcBenchmark *bench, uint32_t z_order) {
+  int w = bench->width(), h = bench->height();
+  size_t status = bench->AddLayer(HAL_PIXEL_FORMAT_RGBA_8888, w, h / 24,
+                                  HWC2_BLEND_MODE_PREMULTIPLIED,
+                                  Rect(0, 0, w, h / 24), z_order);
+  bench->AddLayer(HAL_PIXEL_FORMAT_RGBA_8888, w, h / 16,
+                  HWC2_BLEND_MODE_PREMULTIPLIED, Rect(0, h - h / 16, w, h),
+                  z_order + 1);
+  return status;
+}
+
+// Wallpaper, icons and the system bars, only the clock ever changes
+static size_t launcher_status;
+
+static void SetupStaticLauncher(HwcBenchmark *bench) {
+  int w = bench->width(), h = bench->height();
+  bench->AddLayer(HAL_PIXEL_FORMAT_RGBX_8888, w, h, HWC2_BLEND_MODE_NONE,
+                  Rect(0, 0, w, h), 0);
+  bench->AddLayer(HAL_PIXEL_FORMAT_RGBA_8888, w, h,
+                  HWC2_BLEND_MODE_PREMULTIPLIED, Rect(0, 0, w, h), 1);
+  launcher_status = AddBars(bench, 2);
+}
+
+static void UpdateStaticLauncher(HwcBenchmark *bench, uint32_t n) {
+  if (n % 60 == 0)
+    bench->SetLayerBuffer(launcher_status);
+}
+
+// A full screen app rendering every frame under static system bars
+static size_t scrolling_app;
+
+static void SetupScrollingList(HwcBenchmark *bench) {
+  int w = bench->width(), h = bench->height();
+  scrolling_app = bench->AddLayer(HAL_PIXEL_FORMAT_RGBX_8888, w, h,
+                                  HWC2_BLEND_MODE_NONE, Rect(0, 0, w, h), 0);
+  AddBars(bench, 1);
+}
+
+static void UpdateScrollingList(HwcBenchmark *bench, uint32_t /*n*/) {
+  bench->SetLayerBuffer(scrolling_app);
+}
+
+// 30fps 720p YUV video scaled to the screen width, with translucent
+// controls on top that change twice a second
+static size_t video, video_controls;
+
+static void SetupVideoOverlay(HwcBenchmark *bench) {
+  int w = bench->width(), h = bench->height();
+  int top = (h - w * 9 / 16) / 2;
+  bench->AddLayer(HAL_PIXEL_FORMAT_RGBX_8888, w, h, HWC2_BLEND_MODE_NONE,
+                  Rect(0, 0, w, h), 0);
+  video = bench->AddLayer(HAL_PIXEL_FORMAT_YV12, 1280, 720,
+                          HWC2_BLEND_MODE_NONE,
+                          Rect(0, top, w, top + w * 9 / 16), 1);
+  video_controls =
+      bench->AddLayer(HAL_PIXEL_FORMAT_RGBA_8888, w, h,
+                      HWC2_BLEND_MODE_PREMULTIPLIED, Rect(0, 0, w, h), 2);
+  bench->SetLayerPlaneAlpha(video_controls, 0.8f);
+  AddBars(bench, 3);
+}
+
+static void UpdateVideoOverlay(HwcBenchmark *bench, uint32_t n) {
+  if (n % 2 == 0)
+    bench->SetLayerBuffer(video);
+  if (n % 30 == 0)
+    bench->SetLayerBuffer(video_controls);
+}
+
+// Two apps in split screen plus a picture in picture window and a toast,
+// more layers than the planes of the fake panel
+static size_t split_top, split_bottom, split_pip, split_toast;
+
+static void SetupSplitScreen(HwcBenchmark *bench) {
+  int w = bench->width(), h = bench->height();
+  bench->AddLayer(HAL_PIXEL_FORMAT_RGBX_8888, w, h, HWC2_BLEND_MODE_NONE,
+                  Rect(0, 0, w, h), 0);
+  split_top = bench->AddLayer(HAL_PIXEL_FORMAT_RGBX_8888, w, h / 2 - 8,
+                              HWC2_BLEND_MODE_NONE, Rect(0, 0, w, h / 2 - 8),
+                              1);
+  split_bottom = bench->AddLayer(HAL_PIXEL_FORMAT_RGBX_8888, w, h / 2 - 8,
+                                 HWC2_BLEND_MODE_NONE,
+                                 Rect(0, h / 2 + 8, w, h), 2);
+  bench->AddLayer(HAL_PIXEL_FORMAT_RGBA_8888, w, 16,
+                  HWC2_BLEND_MODE_PREMULTIPLIED,
+                  Rect(0, h / 2 - 8, w, h / 2 + 8), 3);
+  AddBars(bench, 4);
+  split_pip = bench->AddLayer(HAL_PIXEL_FORMAT_RGBX_8888, w / 3, h / 6,
+                              HWC2_BLEND_MODE_NONE,
+                              Rect(w - w / 3 - 16, h / 2 + 32, w - 16,
+                                   h / 2 + 32 + h / 6),
+                              6);
+  split_toast = bench->AddLayer(HAL_PIXEL_FORMAT_RGBA_8888, w / 2, h / 16,
+                                HWC2_BLEND_MODE_PREMULTIPLIED,
+                                Rect(w / 4, h - h / 8, w - w / 4, h - h / 16),
+                                7);
+}
+
+static void UpdateSplitScreen(HwcBenchmark *bench, uint32_t n) {
+  bench->SetLayerBuffer(split_top);
+  bench->SetLayerBuffer(split_bottom);
+  if (n % 2 == 0)
+    bench->SetLayerBuffer(split_pip);
+  if (n % 10 == 0)
+    bench->SetLayerBuffer(split_toast);
+}
+
+// An app opening from its icon while another window slides sideways, and
+// the two trade places in the stack every 10 frames
+static size_t opening_window, sliding_window;
+
+static void SetupGeometryChanges(HwcBenchmark *bench) {
+  int w = bench->width(), h = bench->height();
+  bench->AddLayer(HAL_PIXEL_FORMAT_RGBX_8888, w, h, HWC2_BLEND_MODE_NONE,
+                  Rect(0, 0, w, h), 0);
+  opening_window =
+      bench->AddLayer(HAL_PIXEL_FORMAT_RGBA_8888, w, h,
+                      HWC2_BLEND_MODE_PREMULTIPLIED, Rect(0, 0, w, h), 1);
+  sliding_window = bench->AddLayer(HAL_PIXEL_FORMAT_RGBA_8888, w / 2, h / 2,
+                                   HWC2_BLEND_MODE_PREMULTIPLIED,
+                                   Rect(0, h / 4, w / 2, h / 4 + h / 2), 2);
+  AddBars(bench, 3);
+}
+
+static void UpdateGeometryChanges(HwcBenchmark *bench, uint32_t n) {
+  int w = bench->width(), h = bench->height();
+  // Grows from a quarter of the screen to all of it and back in 60 frames
+  int step = n % 60 < 30 ? n % 30 : 30 - n % 30;
+  int dw = (w * 3 / 8) * (30 - step) / 30;
+  int dh = (h * 3 / 8) * (30 - step) / 30;
+  int x = (n * 16) % (w / 2);
+  bool swap = (n / 10) % 2;
+
+  bench->SetLayerDisplayFrame(opening_window, Rect(dw, dh, w - dw, h - dh));
+  bench->SetLayerPlaneAlpha(opening_window, 0.5f + step / 60.0f);
+  bench->SetLayerBuffer(opening_window);
+  bench->SetLayerDisplayFrame(sliding_window,
+                              Rect(x, h / 4, x + w / 2, h / 4 + h / 2));
+  bench->SetLayerBuffer(sliding_window);
+  bench->SetLayerZOrder(opening_window, swap ? 2 : 1);
+  bench->SetLayerZOrder(sliding_window, swap ? 1 : 2);
+}
+
+static const Scene kScenes[] = {
+    {"static_launcher", SetupStaticLauncher, UpdateStaticLauncher},
+    {"scrolling_list", SetupScrollingList, UpdateScrollingList},
+    {"video_overlay", SetupVideoOverlay, UpdateVideoOverlay},
+    {"split_screen", SetupSplitScreen, UpdateSplitScreen},
+    {"geometry_changes", SetupGeometryChanges, UpdateGeometryChanges},
+};
+
+static void PrintResult(FILE *out, const Scene &scene,
+                        const SceneResult &result, bool last) {
+  fprintf(out,
+          "    {\n"
+          "      \"name\": \"%s\",\n"
+          "      \"layers\": %zu,\n"
+          "      \"frames\": %u,\n"
+          "      \"client_frames\": %u,\n"
+          "      \"atomic_tests\": %llu,\n"
+          "      \"page_flips\": %llu,\n",
+          scene.name, result.layers, result.frames, result.client_frames,
+          (unsigned long long)result.atomic_tests,
+          (unsigned long long)result.page_flips);
+  result.validate_wall_ns.Print(out, "      ", "validate_wall_ns", false);
+  result.validate_cpu_ns.Print(out, "      ", "validate_cpu_ns", false);
+  result.present_wall_ns.Print(out, "      ", "present_wall_ns", false);
+  result.present_cpu_ns.Print(out, "      ", "present_cpu_ns", false);
+  result.frame_cpu_ns.Print(out, "      ", "frame_cpu_ns", false);
+  result.ioctls.Print(out, "      ", "ioctls_per_frame", false);
+  result.allocations.Print(out, "      ", "allocations_per_frame", true);
+  fprintf(out, "    }%s\n", last ? "" : ",");
+}
+
+static void Usage(const char *argv0) {
+  fprintf(stderr,
+          "Usage: %s [--device=<description>] [--frames=<n>] "
+          "[--warmup=<n>] [--scene=<name>] [--output=<file>]\nScenes:",
+          argv0);
+  for (const Scene &scene : kScenes)
+    fprintf(stderr, " %s", scene.name);
+  fprintf(stderr, "\n");
+}
+
+static int BenchmarkMain(int argc, char **argv) {
+  static const struct option options[] = {
+      {"device", required_argument, NULL, 'd'},
+      {"frames", required_argument, NULL, 'f'},
+      {"warmup", required_argument, NULL, 'w'},
+      {"scene", required_argument, NULL, 's'},
+      {"output", required_argument, NULL, 'o'},
+      {NULL, 0, NULL, 0},
+  };
+  const char *device = NULL, *scene_name = NULL, *output = NULL;
+  uint32_t frames = 300, warmup = 30;
+  int opt;
+  while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1) {
+    switch (opt) {
+      case 'd':
+        device = optarg;
+        break;
+      case 'f':
+        frames = strtoul(optarg, NULL, 0);
+        break;
+      case 'w':
+        warmup = strtoul(optarg, NULL, 0);
+        break;
+      case 's':
+        scene_name = optarg;
+        break;
+      case 'o':
+        output = optarg;
+        break;
+      default:
+        Usage(argv[0]);
+        return 1;
+    }
+  }
+
+  if (device && property_set("hwc.drm.device", device)) {
+    fprintf(stderr, "Can't set hwc.drm.device, set it to %s by hand\n",
+            device);
+    return 1;
+  }
+
+  HwcBenchmark bench;
+  int ret = bench.Init();
+  if (ret) {
+    fprintf(stderr, "Failed to start the HWC on the fake device %d\n", ret);
+    return 1;
+  }
+
+  FILE *out = output ? fopen(output, "w") : stdout;
+  if (!out) {
+    fprintf(stderr, "Can't open %s: %s\n", output, strerror(errno));
+    return 1;
+  }
+
+  char device_path[PROPERTY_VALUE_MAX];
+  property_get("hwc.drm.device", device_path, "");
+  fprintf(out,
+          "{\n"
+          "  \"device\": \"%s\",\n"
+          "  \"width\": %d,\n"
+          "  \"height\": %d,\n"
+          "  \"vsync_period_ns\": %d,\n"
+          "  \"warmup\": %u,\n"
+          "  \"scenes\": [\n",
+          device_path, bench.width(), bench.height(), bench.vsync_period(),
+          warmup);
+
+  std::vector<const Scene *> scenes;
+  for (const Scene &scene : kScenes)
+    if (!scene_name || !strcmp(scene_name, scene.name))
+      scenes.push_back(&scene);
+
+  for (size_t i = 0; i < scenes.size() && !ret; ++i) {
+    // Large, keep it off the stack
+    std::unique_ptr<SceneResult> result(new SceneResult());
+    ret = bench.RunScene(*scenes[i], warmup, frames, result.get());
+    if (!ret)
+      PrintResult(out, *scenes[i], *result, i == scenes.size() - 1);
+  }
+
+  fprintf(out, "  ]\n}\n");
+  if (output)
+    fclose(out);
+  if (scenes.empty())
+    fprintf(stderr, "Unknown scene %s\n", scene_name);
+  return ret || scenes.empty() ? 1 : 0;
+}
+}  // namespace android
+
+int main(int argc, char **argv) {
+  return android::BenchmarkMain(argc, argv);
+}
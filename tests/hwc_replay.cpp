@@ -0,0 +1,621 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// Replays a trace recorded with hwc.drm.trace_file (see hwctrace.h) into a
+// freshly opened HWC, to reproduce the planner decisions and the CPU cost
+// of a recorded layer stack on another build or device:
+//
+//   hwc-drm-replay [--module=<name>] [--realtime] <trace>
+//
+// --module picks hwcomposer.<name>.so, e.g. fakekms to run without display
+// hardware. SurfaceFlinger must not be running on a real device.
+//
+// Layer state, composition types, validates and presents are replayed.
+// Buffers are allocated from their recorded size, format and usage but their
+// content is left alone, and fences are dropped. Queries, callbacks and
+// virtual display calls are skipped. The report is JSON on stdout.
+
+#define LOG_TAG "hwc-drm-replay"
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <map>
+#include <memory>
+#include <vector>
+
+#include <drm/drm_fourcc.h>
+#include <hardware/hardware.h>
+#include <hardware/hwcomposer2.h>
+#include <log/log.h>
+#include <ui/GraphicBuffer.h>
+
+#include "benchmetric.h"
+#include "hwctrace.h"
+
+namespace android {
+
+static const size_t kMaxElements = 64;
+
+struct ReplayStats {
+  uint64_t records = 0;
+  uint64_t skipped = 0;
+  uint64_t failed = 0;
+  uint64_t frames = 0;
+  uint64_t validates = 0;
+  // Validates where the number of composition type changes differs from
+  // the recorded one
+  uint64_t mismatched_validates = 0;
+  uint64_t recorded_changes = 0;
+  uint64_t replayed_changes = 0;
+  uint64_t validated_layers = 0;
+  uint64_t client_layers = 0;
+  BenchMetric validate_wall_ns;
+  BenchMetric validate_cpu_ns;
+  BenchMetric present_wall_ns;
+  BenchMetric present_cpu_ns;
+};
+
+class HwcReplay {
+ public:
+  int Init(const char *module_name);
+  int Run(HwcTraceReader *reader, bool realtime, ReplayStats *stats);
+
+ private:
+  struct Display {
+    // Recorded layer id to the one in this run
+    std::map<hwc2_layer_t, hwc2_layer_t> layers;
+    // Composition type requested for each layer of this run
+    std::map<hwc2_layer_t, int32_t> types;
+  };
+
+  template <typename PFN>
+  int GetFunction(hwc2_function_descriptor_t descriptor, PFN *hook);
+  // Returns false if the record was skipped
+  bool Replay(const HwcTraceRecord &record, HwcTraceReader *reader,
+              ReplayStats *stats, int32_t *error);
+  bool ReplayLayer(const HwcTraceRecord &record, hwc2_layer_t layer,
+                   HwcTraceReader *reader, int32_t *error);
+  void AddBuffer(const HwcTraceBuffer &info);
+  buffer_handle_t GetBuffer(uint32_t id);
+  int32_t Validate(hwc2_display_t display, uint32_t recorded_types,
+                   ReplayStats *stats);
+
+  static void HotplugCallback(hwc2_callback_data_t data,
+                              hwc2_display_t display, int32_t connected);
+  static void RefreshCallback(hwc2_callback_data_t data,
+                              hwc2_display_t display);
+  static void VsyncCallback(hwc2_callback_data_t data, hwc2_display_t display,
+                            int64_t timestamp);
+
+  hwc2_device_t *device_ = NULL;
+  std::map<hwc2_display_t, Display> displays_;
+  std::map<uint32_t, sp<GraphicBuffer>> buffers_;
+  hwc2_layer_t elements_[kMaxElements];
+  int32_t values_[kMaxElements];
+  std::vector<hwc_rect_t> rects_;
+
+  HWC2_PFN_ACCEPT_DISPLAY_CHANGES accept_display_changes_;
+  HWC2_PFN_CREATE_LAYER create_layer_;
+  HWC2_PFN_DESTROY_LAYER destroy_layer_;
+  HWC2_PFN_GET_CHANGED_COMPOSITION_TYPES get_changed_composition_types_;
+  HWC2_PFN_GET_RELEASE_FENCES get_release_fences_;
+  HWC2_PFN_PRESENT_DISPLAY present_display_;
+  HWC2_PFN_REGISTER_CALLBACK register_callback_;
+  HWC2_PFN_SET_ACTIVE_CONFIG set_active_config_;
+  HWC2_PFN_SET_CLIENT_TARGET set_client_target_;
+  HWC2_PFN_SET_COLOR_MODE set_color_mode_;
+  HWC2_PFN_SET_COLOR_TRANSFORM set_color_transform_;
+  HWC2_PFN_SET_CURSOR_POSITION set_cursor_position_;
+  HWC2_PFN_SET_LAYER_BLEND_MODE set_layer_blend_mode_;
+  HWC2_PFN_SET_LAYER_BUFFER set_layer_buffer_;
+  HWC2_PFN_SET_LAYER_COLOR set_layer_color_;
+  HWC2_PFN_SET_LAYER_COMPOSITION_TYPE set_layer_composition_type_;
+  HWC2_PFN_SET_LAYER_DATASPACE set_layer_dataspace_;
+  HWC2_PFN_SET_LAYER_DISPLAY_FRAME set_layer_display_frame_;
+  HWC2_PFN_SET_LAYER_PLANE_ALPHA set_layer_plane_alpha_;
+  HWC2_PFN_SET_LAYER_SOURCE_CROP set_layer_source_crop_;
+  HWC2_PFN_SET_LAYER_SURFACE_DAMAGE set_layer_surface_damage_;
+  HWC2_PFN_SET_LAYER_TRANSFORM set_layer_transform_;
+  HWC2_PFN_SET_LAYER_VISIBLE_REGION set_layer_visible_region_;
+  HWC2_PFN_SET_LAYER_Z_ORDER set_layer_z_order_;
+  HWC2_PFN_SET_POWER_MODE set_power_mode_;
+  HWC2_PFN_SET_VSYNC_ENABLED set_vsync_enabled_;
+  HWC2_PFN_VALIDATE_DISPLAY validate_display_;
+};
+
+template <typename PFN>
+int HwcReplay::GetFunction(hwc2_function_descriptor_t descriptor,
+                           PFN *hook) {
+  *hook = reinterpret_cast<PFN>(device_->getFunction(device_, descriptor));
+  if (!*hook) {
+    ALOGE("Missing HWC2 function %d", descriptor);
+    return -ENOSYS;
+  }
+  return 0;
+}
+
+void HwcReplay::HotplugCallback(hwc2_callback_data_t /*data*/,
+                                hwc2_display_t /*display*/,
+                                int32_t /*connected*/) {
+}
+
+void HwcReplay::RefreshCallback(hwc2_callback_data_t /*data*/,
+                                hwc2_display_t /*display*/) {
+}
+
+void HwcReplay::VsyncCallback(hwc2_callback_data_t /*data*/,
+                              hwc2_display_t /*display*/,
+                              int64_t /*timestamp*/) {
+}
+
+int HwcReplay::Init(const char *module_name) {
+  const hw_module_t *module;
+  int ret = module_name ? hw_get_module_by_class(HWC_HARDWARE_MODULE_ID,
+                                                 module_name, &module)
+                        : hw_get_module(HWC_HARDWARE_MODULE_ID, &module);
+  if (ret) {
+    ALOGE("Failed to load the HWC module %d", ret);
+    return ret;
+  }
+
+  hw_device_t *device;
+  ret = module->methods->open(module, HWC_HARDWARE_COMPOSER, &device);
+  if (ret) {
+    ALOGE("Failed to open the HWC %d", ret);
+    return ret;
+  }
+  device_ = reinterpret_cast<hwc2_device_t *>(device);
+
+  if (GetFunction(HWC2_FUNCTION_ACCEPT_DISPLAY_CHANGES,
+                  &accept_display_changes_) ||
+      GetFunction(HWC2_FUNCTION_CREATE_LAYER, &create_layer_) ||
+      GetFunction(HWC2_FUNCTION_DESTROY_LAYER, &destroy_layer_) ||
+      GetFunction(HWC2_FUNCTION_GET_CHANGED_COMPOSITION_TYPES,
+                  &get_changed_composition_types_) ||
+      GetFunction(HWC2_FUNCTION_GET_RELEASE_FENCES, &get_release_fences_) ||
+      GetFunction(HWC2_FUNCTION_PRESENT_DISPLAY, &present_display_) ||
+      GetFunction(HWC2_FUNCTION_REGISTER_CALLBACK, &register_callback_) ||
+      GetFunction(HWC2_FUNCTION_SET_ACTIVE_CONFIG, &set_active_config_) ||
+      GetFunction(HWC2_FUNCTION_SET_CLIENT_TARGET, &set_client_target_) ||
+      GetFunction(HWC2_FUNCTION_SET_COLOR_MODE, &set_color_mode_) ||
+      GetFunction(HWC2_FUNCTION_SET_COLOR_TRANSFORM, &set_color_transform_) ||
+      GetFunction(HWC2_FUNCTION_SET_CURSOR_POSITION, &set_cursor_position_) ||
+      GetFunction(HWC2_FUNCTION_SET_LAYER_BLEND_MODE,
+                  &set_layer_blend_mode_) ||
+      GetFunction(HWC2_FUNCTION_SET_LAYER_BUFFER, &set_layer_buffer_) ||
+      GetFunction(HWC2_FUNCTION_SET_LAYER_COLOR, &set_layer_color_) ||
+      GetFunction(HWC2_FUNCTION_SET_LAYER_COMPOSITION_TYPE,
+                  &set_layer_composition_type_) ||
+      GetFunction(HWC2_FUNCTION_SET_LAYER_DATASPACE, &set_layer_dataspace_) ||
+      GetFunction(HWC2_FUNCTION_SET_LAYER_DISPLAY_FRAME,
+                  &set_layer_display_frame_) ||
+      GetFunction(HWC2_FUNCTION_SET_LAYER_PLANE_ALPHA,
+                  &set_layer_plane_alpha_) ||
+      GetFunction(HWC2_FUNCTION_SET_LAYER_SOURCE_CROP,
+                  &set_layer_source_crop_) ||
+      GetFunction(HWC2_FUNCTION_SET_LAYER_SURFACE_DAMAGE,
+                  &set_layer_surface_damage_) ||
+      GetFunction(HWC2_FUNCTION_SET_LAYER_TRANSFORM, &set_layer_transform_) ||
+      GetFunction(HWC2_FUNCTION_SET_LAYER_VISIBLE_REGION,
+                  &set_layer_visible_region_) ||
+      GetFunction(HWC2_FUNCTION_SET_LAYER_Z_ORDER, &set_layer_z_order_) ||
+      GetFunction(HWC2_FUNCTION_SET_POWER_MODE, &set_power_mode_) ||
+      GetFunction(HWC2_FUNCTION_SET_VSYNC_ENABLED, &set_vsync_enabled_) ||
+      GetFunction(HWC2_FUNCTION_VALIDATE_DISPLAY, &validate_display_))
+    return -ENOSYS;
+
+  if (register_callback_(
+          device_, HWC2_CALLBACK_HOTPLUG, this,
+          reinterpret_cast<hwc2_function_pointer_t>(HotplugCallback)) ||
+      register_callback_(
+          device_, HWC2_CALLBACK_REFRESH, this,
+          reinterpret_cast<hwc2_function_pointer_t>(RefreshCallback)) ||
+      register_callback_(
+          device_, HWC2_CALLBACK_VSYNC, this,
+          reinterpret_cast<hwc2_function_pointer_t>(VsyncCallback))) {
+    ALOGE("Failed to register callbacks");
+    return -EINVAL;
+  }
+  return 0;
+}
+
+static int32_t ConvertDrmFormatToHal(uint32_t drm_format) {
+  switch (drm_format) {
+    case DRM_FORMAT_BGR888:
+      return HAL_PIXEL_FORMAT_RGB_888;
+    case DRM_FORMAT_ARGB8888:
+      return HAL_PIXEL_FORMAT_BGRA_8888;
+    case DRM_FORMAT_XBGR8888:
+      return HAL_PIXEL_FORMAT_RGBX_8888;
+    case DRM_FORMAT_ABGR8888:
+      return HAL_PIXEL_FORMAT_RGBA_8888;
+    case DRM_FORMAT_BGR565:
+      return HAL_PIXEL_FORMAT_RGB_565;
+    case DRM_FORMAT_YVU420:
+      return HAL_PIXEL_FORMAT_YV12;
+    default:
+      return -EINVAL;
+  }
+}
+
+void HwcReplay::AddBuffer(const HwcTraceBuffer &info) {
+  int32_t format = ConvertDrmFormatToHal(info.format);
+  if (format < 0 || !info.width || !info.height) {
+    ALOGW("Can't allocate buffer %u: %ux%u format 0x%x", info.id, info.width,
+          info.height, info.format);
+    return;
+  }
+
+  sp<GraphicBuffer> buffer =
+      new GraphicBuffer(info.width, info.height, format, info.usage);
+  if (buffer->initCheck()) {
+    ALOGW("Failed to allocate buffer %u", info.id);
+    return;
+  }
+  buffers_[info.id] = buffer;
+}
+
+buffer_handle_t HwcReplay::GetBuffer(uint32_t id) {
+  auto it = buffers_.find(id);
+  return it != buffers_.end() ? it->second->handle : NULL;
+}
+
+int32_t HwcReplay::Validate(hwc2_display_t display, uint32_t recorded_types,
+                            ReplayStats *stats) {
+  uint32_t num_types = 0, num_requests = 0;
+  int64_t wall = BenchNow(CLOCK_MONOTONIC);
+  int64_t cpu = BenchNow(CLOCK_THREAD_CPUTIME_ID);
+  int32_t ret = validate_display_(device_, display, &num_types,
+                                  &num_requests);
+  stats->validate_cpu_ns.Add(BenchNow(CLOCK_THREAD_CPUTIME_ID) - cpu);
+  stats->validate_wall_ns.Add(BenchNow(CLOCK_MONOTONIC) - wall);
+
+  stats->validates++;
+  stats->recorded_changes += recorded_types;
+  stats->replayed_changes += num_types;
+  stats->mismatched_validates += num_types != recorded_types;
+
+  // Final composition types, what was asked unless validate changed it
+  Display &d = displays_[display];
+  std::map<hwc2_layer_t, int32_t> types = d.types;
+  uint32_t num_elements = kMaxElements;
+  if (num_types &&
+      !get_changed_composition_types_(device_, display, &num_elements,
+                                      elements_, values_)) {
+    for (uint32_t i = 0; i < std::min<uint32_t>(num_elements, kMaxElements);
+         ++i)
+      types[elements_[i]] = values_[i];
+  }
+  stats->validated_layers += types.size();
+  for (std::pair<const hwc2_layer_t, int32_t> &t : types)
+    stats->client_layers += t.second == HWC2_COMPOSITION_CLIENT;
+  return ret;
+}
+
+bool HwcReplay::Replay(const HwcTraceRecord &record, HwcTraceReader *reader,
+                       ReplayStats *stats, int32_t *error) {
+  hwc2_display_t display = record.display;
+  Display &d = displays_[display];
+  switch (record.function) {
+    case kBufferFunction:
+      AddBuffer(reader->Get<HwcTraceBuffer>());
+      return true;
+
+    case HWC2_FUNCTION_ACCEPT_DISPLAY_CHANGES:
+      *error = accept_display_changes_(device_, display);
+      return true;
+    case HWC2_FUNCTION_CREATE_LAYER: {
+      hwc2_layer_t recorded, layer;
+      if (!reader->GetOutput(&recorded) || record.error)
+        return false;
+      *error = create_layer_(device_, display, &layer);
+      if (!*error) {
+        d.layers[recorded] = layer;
+        d.types[layer] = HWC2_COMPOSITION_INVALID;
+      }
+      return true;
+    }
+    case HWC2_FUNCTION_DESTROY_LAYER: {
+      auto it = d.layers.find(reader->Get<hwc2_layer_t>());
+      if (it == d.layers.end())
+        return false;
+      *error = destroy_layer_(device_, display, it->second);
+      d.types.erase(it->second);
+      d.layers.erase(it);
+      return true;
+    }
+    case HWC2_FUNCTION_GET_RELEASE_FENCES: {
+      hwc2_layer_t layer;
+      uint32_t num_elements;
+      reader->GetOutput(&num_elements);
+      if (!reader->GetOutput(&layer))
+        return false;
+      num_elements = kMaxElements;
+      *error = get_release_fences_(device_, display, &num_elements, elements_,
+                                   values_);
+      for (uint32_t i = 0;
+           !*error && i < std::min<uint32_t>(num_elements, kMaxElements); ++i)
+        if (values_[i] >= 0)
+          close(values_[i]);
+      return true;
+    }
+    case HWC2_FUNCTION_PRESENT_DISPLAY: {
+      int32_t fence = -1;
+      int64_t wall = BenchNow(CLOCK_MONOTONIC);
+      int64_t cpu = BenchNow(CLOCK_THREAD_CPUTIME_ID);
+      *error = present_display_(device_, display, &fence);
+      stats->present_cpu_ns.Add(BenchNow(CLOCK_THREAD_CPUTIME_ID) - cpu);
+      stats->present_wall_ns.Add(BenchNow(CLOCK_MONOTONIC) - wall);
+      stats->frames++;
+      if (fence >= 0)
+        close(fence);
+      return true;
+    }
+    case HWC2_FUNCTION_SET_ACTIVE_CONFIG:
+      *error = set_active_config_(device_, display,
+                                  reader->Get<hwc2_config_t>());
+      return true;
+    case HWC2_FUNCTION_SET_CLIENT_TARGET: {
+      buffer_handle_t target = GetBuffer(reader->Get<uint32_t>());
+      reader->Get<int32_t>();  // acquire fence
+      int32_t dataspace = reader->Get<int32_t>();
+      reader->GetRegion(&rects_);
+      hwc_region_t damage = {rects_.size(), rects_.data()};
+      *error = set_client_target_(device_, display, target, -1, dataspace,
+                                  damage);
+      return true;
+    }
+    case HWC2_FUNCTION_SET_COLOR_MODE:
+      *error = set_color_mode_(device_, display, reader->Get<int32_t>());
+      return true;
+    case HWC2_FUNCTION_SET_COLOR_TRANSFORM: {
+      float matrix[16];
+      bool has_matrix = reader->GetMatrix(matrix);
+      int32_t hint = reader->Get<int32_t>();
+      *error = set_color_transform_(device_, display,
+                                    has_matrix ? matrix : NULL, hint);
+      return true;
+    }
+    case HWC2_FUNCTION_SET_POWER_MODE:
+      *error = set_power_mode_(device_, display, reader->Get<int32_t>());
+      return true;
+    case HWC2_FUNCTION_SET_VSYNC_ENABLED:
+      *error = set_vsync_enabled_(device_, display, reader->Get<int32_t>());
+      return true;
+    case HWC2_FUNCTION_VALIDATE_DISPLAY: {
+      uint32_t recorded_types = 0;
+      reader->GetOutput(&recorded_types);
+      *error = Validate(display, recorded_types, stats);
+      return true;
+    }
+
+    case HWC2_FUNCTION_SET_CURSOR_POSITION:
+    case HWC2_FUNCTION_SET_LAYER_BLEND_MODE:
+    case HWC2_FUNCTION_SET_LAYER_BUFFER:
+    case HWC2_FUNCTION_SET_LAYER_COLOR:
+    case HWC2_FUNCTION_SET_LAYER_COMPOSITION_TYPE:
+    case HWC2_FUNCTION_SET_LAYER_DATASPACE:
+    case HWC2_FUNCTION_SET_LAYER_DISPLAY_FRAME:
+    case HWC2_FUNCTION_SET_LAYER_PLANE_ALPHA:
+    case HWC2_FUNCTION_SET_LAYER_SOURCE_CROP:
+    case HWC2_FUNCTION_SET_LAYER_SURFACE_DAMAGE:
+    case HWC2_FUNCTION_SET_LAYER_TRANSFORM:
+    case HWC2_FUNCTION_SET_LAYER_VISIBLE_REGION:
+    case HWC2_FUNCTION_SET_LAYER_Z_ORDER: {
+      auto it = d.layers.find(record.layer);
+      if (it == d.layers.end())
+        return false;
+      return ReplayLayer(record, it->second, reader, error);
+    }
+
+    default:
+      return false;
+  }
+}
+
+bool HwcReplay::ReplayLayer(const HwcTraceRecord &record, hwc2_layer_t layer,
+                            HwcTraceReader *reader, int32_t *error) {
+  hwc2_display_t display = record.display;
+  switch (record.function) {
+    case HWC2_FUNCTION_SET_CURSOR_POSITION: {
+      int32_t x = reader->Get<int32_t>();
+      int32_t y = reader->Get<int32_t>();
+      *error = set_cursor_position_(device_, display, layer, x, y);
+      break;
+    }
+    case HWC2_FUNCTION_SET_LAYER_BLEND_MODE:
+      *error = set_layer_blend_mode_(device_, display, layer,
+                                     reader->Get<int32_t>());
+      break;
+    case HWC2_FUNCTION_SET_LAYER_BUFFER:
+      *error = set_layer_buffer_(device_, display, layer,
+                                 GetBuffer(reader->Get<uint32_t>()), -1);
+      break;
+    case HWC2_FUNCTION_SET_LAYER_COLOR:
+      *error = set_layer_color_(device_, display, layer,
+                                reader->Get<hwc_color_t>());
+      break;
+    case HWC2_FUNCTION_SET_LAYER_COMPOSITION_TYPE: {
+      int32_t type = reader->Get<int32_t>();
+      *error = set_layer_composition_type_(device_, display, layer, type);
+      displays_[display].types[layer] = type;
+      break;
+    }
+    case HWC2_FUNCTION_SET_LAYER_DATASPACE:
+      *error = set_layer_dataspace_(device_, display, layer,
+                                    reader->Get<int32_t>());
+      break;
+    case HWC2_FUNCTION_SET_LAYER_DISPLAY_FRAME:
+      *error = set_layer_display_frame_(device_, display, layer,
+                                        reader->Get<hwc_rect_t>());
+      break;
+    case HWC2_FUNCTION_SET_LAYER_PLANE_ALPHA:
+      *error = set_layer_plane_alpha_(device_, display, layer,
+                                      reader->Get<float>());
+      break;
+    case HWC2_FUNCTION_SET_LAYER_SOURCE_CROP:
+      *error = set_layer_source_crop_(device_, display, layer,
+                                      reader->Get<hwc_frect_t>());
+      break;
+    case HWC2_FUNCTION_SET_LAYER_SURFACE_DAMAGE:
+    case HWC2_FUNCTION_SET_LAYER_VISIBLE_REGION: {
+      reader->GetRegion(&rects_);
+      hwc_region_t region = {rects_.size(), rects_.data()};
+      if (record.function == HWC2_FUNCTION_SET_LAYER_SURFACE_DAMAGE)
+        *error = set_layer_surface_damage_(device_, display, layer, region);
+      else
+        *error = set_layer_visible_region_(device_, display, layer, region);
+      break;
+    }
+    case HWC2_FUNCTION_SET_LAYER_TRANSFORM:
+      *error = set_layer_transform_(device_, display, layer,
+                                    reader->Get<int32_t>());
+      break;
+    case HWC2_FUNCTION_SET_LAYER_Z_ORDER:
+      *error = set_layer_z_order_(device_, display, layer,
+                                  reader->Get<uint32_t>());
+      break;
+    default:
+      return false;
+  }
+  return true;
+}
+
+int HwcReplay::Run(HwcTraceReader *reader, bool realtime, ReplayStats *stats) {
+  int64_t start_ns = BenchNow(CLOCK_MONOTONIC);
+  HwcTraceRecord record;
+  while (reader->Next(&record)) {
+    stats->records++;
+    if (realtime) {
+      int64_t delay_ns = start_ns + record.timestamp_ns -
+                         BenchNow(CLOCK_MONOTONIC);
+      if (delay_ns > 0) {
+        struct timespec ts = {(time_t)(delay_ns / 1000000000),
+                              (long)(delay_ns % 1000000000)};
+        nanosleep(&ts, NULL);
+      }
+    }
+
+    int32_t error = 0;
+    if (!Replay(record, reader, stats, &error) || reader->error()) {
+      stats->skipped++;
+      continue;
+    }
+    // Didn't return what it did when recorded
+    if (error != record.error)
+      stats->failed++;
+  }
+  return 0;
+}
+
+static int ReplayMain(int argc, char **argv) {
+  static const struct option options[] = {
+      {"module", required_argument, NULL, 'm'},
+      {"realtime", no_argument, NULL, 'r'},
+      {NULL, 0, NULL, 0},
+  };
+  const char *module_name = NULL;
+  bool realtime = false;
+  int opt;
+  while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1) {
+    switch (opt) {
+      case 'm':
+        module_name = optarg;
+        break;
+      case 'r':
+        realtime = true;
+        break;
+      default:
+        optind = argc + 1;
+        break;
+    }
+  }
+  if (optind != argc - 1) {
+    fprintf(stderr, "Usage: %s [--module=<name>] [--realtime] <trace>\n",
+            argv[0]);
+    return 1;
+  }
+
+  HwcTraceReader reader;
+  int ret = reader.Open(argv[optind]);
+  if (ret) {
+    fprintf(stderr, "Can't read trace %s: %s\n", argv[optind],
+            strerror(-ret));
+    return 1;
+  }
+
+  HwcReplay replay;
+  ret = replay.Init(module_name);
+  if (ret) {
+    fprintf(stderr, "Failed to open the HWC %d\n", ret);
+    return 1;
+  }
+
+  // Large, keep it off the stack
+  std::unique_ptr<ReplayStats> stats(new ReplayStats());
+  int64_t wall = BenchNow(CLOCK_MONOTONIC);
+  int64_t cpu = BenchNow(CLOCK_PROCESS_CPUTIME_ID);
+  replay.Run(&reader, realtime, stats.get());
+  cpu = BenchNow(CLOCK_PROCESS_CPUTIME_ID) - cpu;
+  wall = BenchNow(CLOCK_MONOTONIC) - wall;
+
+  printf(
+      "{\n"
+      "  \"trace\": \"%s\",\n"
+      "  \"records\": %llu,\n"
+      "  \"skipped\": %llu,\n"
+      "  \"failed\": %llu,\n"
+      "  \"frames\": %llu,\n"
+      "  \"validates\": %llu,\n"
+      "  \"recorded_changes\": %llu,\n"
+      "  \"replayed_changes\": %llu,\n"
+      "  \"mismatched_validates\": %llu,\n"
+      "  \"validated_layers\": %llu,\n"
+      "  \"client_layers\": %llu,\n"
+      "  \"gpu_offload_pct\": %.2f,\n"
+      "  \"process_cpu_ns\": %lld,\n"
+      "  \"wall_ns\": %lld,\n",
+      argv[optind], (unsigned long long)stats->records,
+      (unsigned long long)stats->skipped, (unsigned long long)stats->failed,
+      (unsigned long long)stats->frames, (unsigned long long)stats->validates,
+      (unsigned long long)stats->recorded_changes,
+      (unsigned long long)stats->replayed_changes,
+      (unsigned long long)stats->mismatched_validates,
+      (unsigned long long)stats->validated_layers,
+      (unsigned long long)stats->client_layers,
+      stats->validated_layers
+          ? 100.0 * stats->client_layers / stats->validated_layers
+          : 0.0,
+      (long long)cpu, (long long)wall);
+  stats->validate_wall_ns.Print(stdout, "  ", "validate_wall_ns", false);
+  stats->validate_cpu_ns.Print(stdout, "  ", "validate_cpu_ns", false);
+  stats->present_wall_ns.Print(stdout, "  ", "present_wall_ns", false);
+  stats->present_cpu_ns.Print(stdout, "  ", "present_cpu_ns", true);
+  printf("}\n");
+  return 0;
+}
+}  // namespace android
+
+int main(int argc, char **argv) {
+  return android::ReplayMain(argc, argv);
+}
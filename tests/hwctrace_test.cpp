@@ -0,0 +1,114 @@
+#include <gtest/gtest.h>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "frametimeline.h"
+#include "hwctrace.h"
+#include "taskqueueworker.h"
+
+using android::FrameTimeline;
+using android::HwcTraceBuffer;
+using android::HwcTraceReader;
+using android::HwcTraceRecord;
+using android::HwcTraceWriter;
+using android::TaskQueueWorker;
+
+TEST(HwcTraceTest, round_trip) {
+  const char *tmp = getenv("TMPDIR");
+  std::string path = std::string(tmp ? tmp : "/data/local/tmp") +
+                     "/hwctrace-XXXXXX";
+  int fd = mkstemp(&path[0]);
+  ASSERT_GE(fd, 0);
+  close(fd);
+
+  native_handle_t handle;
+  buffer_handle_t buffer = &handle;
+  hwc_rect_t rects[2] = {{0, 0, 10, 10}, {5, 5, 20, 20}};
+  hwc_region_t damage = {2, rects};
+  hwc2_layer_t layer = 7;
+  {
+    TaskQueueWorker worker("hwctrace-test", 0);
+    ASSERT_EQ(0, worker.Init());
+    HwcTraceWriter writer;
+    ASSERT_FALSE(writer.enabled());
+    ASSERT_EQ(0, writer.Open(path.c_str(), &worker,
+                             [](buffer_handle_t, HwcTraceBuffer *info) {
+                               info->width = 64;
+                               info->height = 32;
+                               info->format = 0x34325241;
+                               return 0;
+                             }));
+    ASSERT_TRUE(writer.enabled());
+    writer.Record(2, 0, 0, 0, &layer);
+    writer.Record(28, 0, 7, 0, buffer, (int32_t)-1);
+    writer.Record(28, 0, 7, 0, buffer, (int32_t)-1);
+    writer.Record(35, 0, 7, 0, damage);
+    writer.Record(19, 0, 0, 0, (uint32_t *)NULL, (hwc2_layer_t *)NULL,
+                  (int32_t *)NULL);
+  }
+
+  HwcTraceReader reader;
+  ASSERT_EQ(0, reader.Open(path.c_str()));
+  unlink(path.c_str());
+
+  HwcTraceRecord record;
+  ASSERT_TRUE(reader.Next(&record));
+  ASSERT_EQ(2, record.function);
+  hwc2_layer_t recorded_layer = 0;
+  ASSERT_TRUE(reader.GetOutput(&recorded_layer));
+  ASSERT_EQ(7u, recorded_layer);
+
+  // The buffer is described once, before its first use
+  ASSERT_TRUE(reader.Next(&record));
+  ASSERT_EQ(android::kBufferFunction, record.function);
+  HwcTraceBuffer info = reader.Get<HwcTraceBuffer>();
+  ASSERT_EQ(1u, info.id);
+  ASSERT_EQ(64u, info.width);
+  ASSERT_EQ(32u, info.height);
+  for (int i = 0; i < 2; ++i) {
+    ASSERT_TRUE(reader.Next(&record));
+    ASSERT_EQ(28, record.function);
+    ASSERT_EQ(7u, record.layer);
+    ASSERT_EQ(1u, reader.Get<uint32_t>());
+    ASSERT_EQ(-1, reader.Get<int32_t>());
+  }
+
+  ASSERT_TRUE(reader.Next(&record));
+  std::vector<hwc_rect_t> region;
+  reader.GetRegion(&region);
+  ASSERT_EQ(2u, region.size());
+  ASSERT_EQ(20, region[1].bottom);
+
+  ASSERT_TRUE(reader.Next(&record));
+  uint32_t num_elements;
+  ASSERT_FALSE(reader.GetOutput(&num_elements));
+  ASSERT_FALSE(reader.error());
+  reader.Get<uint64_t>();
+  ASSERT_TRUE(reader.error());
+
+  ASSERT_FALSE(reader.Next(&record));
+}
+
+TEST(HwcTraceTest, rejects_timeline_snapshot) {
+  const char *tmp = getenv("TMPDIR");
+  std::string path = std::string(tmp ? tmp : "/data/local/tmp") +
+                     "/hwctrace-XXXXXX";
+  int fd = mkstemp(&path[0]);
+  ASSERT_GE(fd, 0);
+
+  FrameTimeline timeline;
+  std::string snapshot;
+  timeline.AppendSnapshot(&snapshot);
+  ASSERT_EQ((ssize_t)snapshot.size(),
+            write(fd, snapshot.data(), snapshot.size()));
+  close(fd);
+
+  HwcTraceReader reader;
+  ASSERT_EQ(-EINVAL, reader.Open(path.c_str()));
+  unlink(path.c_str());
+}
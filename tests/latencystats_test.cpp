@@ -0,0 +1,49 @@
+#include <gtest/gtest.h>
+
+#include <thread>
+#include <vector>
+
+#include "latencystats.h"
+
+using android::LatencyStats;
+
+TEST(LatencyStatsTest, empty) {
+  LatencyStats stats;
+  ASSERT_EQ(-1, stats.Percentile(50));
+  ASSERT_EQ(0u, stats.total_samples());
+}
+
+TEST(LatencyStatsTest, percentiles) {
+  LatencyStats stats;
+  for (int i = 100; i >= 1; --i)
+    stats.AddSample(i);
+  ASSERT_EQ(1, stats.Percentile(0));
+  ASSERT_EQ(51, stats.Percentile(50));
+  ASSERT_EQ(99, stats.Percentile(99));
+  ASSERT_EQ(100, stats.Percentile(100));
+}
+
+TEST(LatencyStatsTest, bucket_error_is_bounded) {
+  for (int64_t value = 1; value < (1ll << LatencyStats::kMaxValueBits);
+       value = value * 3 / 2 + 1) {
+    size_t index = LatencyStats::BucketIndex(value);
+    ASSERT_LT(index, LatencyStats::kNumBuckets);
+    int64_t highest = LatencyStats::BucketHighestValue(index);
+    ASSERT_GE(highest, value);
+    ASSERT_LE(highest - value, value / LatencyStats::kSubBuckets);
+  }
+}
+
+TEST(LatencyStatsTest, concurrent_samples) {
+  LatencyStats stats;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t)
+    threads.emplace_back([&] {
+      for (int i = 0; i < 10000; ++i)
+        stats.AddSample(1000 * 1000);
+    });
+  for (std::thread &thread : threads)
+    thread.join();
+  ASSERT_EQ(40000u, stats.total_samples());
+  ASSERT_EQ(1000 * 1000, stats.Percentile(100));
+}
@@ -0,0 +1,918 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// Microbenchmark of the planner and its stages against the plane inventory
+// of a fake KMS device (see fakekms.h), on randomized or recorded layer
+// stacks, reporting both their cost and how much they offload:
+//
+//   hwc-drm-planner-benchmark --device=<description> [--display=<n>]
+//                             [--max-planes=<n>] [--stages=<a,b,...>]
+//                             [--trace=<trace>] [--frames=<n>] [--seed=<n>]
+//                             [--max-layers=<n>] [--output=<file>]
+//
+// Random stacks start from a wallpaper and a status bar and then change a
+// little every frame: windows come and go, move and switch formats, and
+// some are scaled, rotated, translucent or protected. --trace replays the
+// stacks SurfaceFlinger validated in a trace recorded with
+// hwc.drm.trace_file instead, see hwctrace.h.
+//
+// Every frame is split between device and client composition like
+// ValidateDisplay() does and planned with the given stages, which are timed
+// one by one as well as through Planner::ProvisionPlanes(). The plan is then
+// checked with TEST_ONLY commits. While the device rejects it, the lowest
+// device layer is moved to client composition and the plan is tried again,
+// which is what the HWC would need to do instead of giving up. The report
+// has the fraction of the pixels scanned out from planes, the TEST_ONLY
+// commits needed per frame and how often layers moved between planes.
+//
+// New stages are compared by adding them to kStages.
+
+#define LOG_TAG "hwc-drm-planner-benchmark"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <drm/drm_fourcc.h>
+#include <hardware/gralloc.h>
+#include <hardware/hwcomposer2.h>
+#include <log/log.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+#include "autofd.h"
+#include "benchmetric.h"
+#include "drmdevice.h"
+#include "hwctrace.h"
+#include "platform.h"
+
+namespace android {
+
+// What SurfaceFlinger set on a layer for one frame
+struct BenchLayer {
+  uint64_t id = 0;
+  uint32_t z = 0;
+  // Asked for anything but device composition
+  bool client = false;
+  bool is_protected = false;
+  uint32_t width = 0;
+  uint32_t height = 0;
+  uint32_t format = 0;
+  hwc_frect_t crop = {0, 0, 0, 0};
+  hwc_rect_t frame = {0, 0, 0, 0};
+  int32_t transform = 0;
+  int32_t blend = HWC2_BLEND_MODE_NONE;
+  float alpha = 1.0f;
+};
+
+// Ordered by z
+typedef std::vector<BenchLayer> LayerStack;
+
+template <typename T>
+static Planner::PlanStage *CreateStage() {
+  return new T();
+}
+
+template <typename T>
+static void AddStage(Planner *planner) {
+  planner->AddStage<T>();
+}
+
+struct StageInfo {
+  const char *name;
+  Planner::PlanStage *(*create)();
+  void (*add)(Planner *planner);
+};
+
+static const StageInfo kStages[] = {
+    {"protected", CreateStage<PlanStageProtected>,
+     AddStage<PlanStageProtected>},
+    {"greedy", CreateStage<PlanStageGreedy>, AddStage<PlanStageGreedy>},
+};
+
+static int64_t FrameArea(const hwc_rect_t &frame, uint32_t width,
+                         uint32_t height) {
+  int64_t w = std::min<int64_t>(frame.right, width) -
+              std::max<int64_t>(frame.left, 0);
+  int64_t h = std::min<int64_t>(frame.bottom, height) -
+              std::max<int64_t>(frame.top, 0);
+  return w > 0 && h > 0 ? w * h : 0;
+}
+
+class StackGenerator {
+ public:
+  StackGenerator(uint32_t seed, uint32_t width, uint32_t height,
+                 size_t max_layers)
+      : random_(seed), width_(width), height_(height), max_layers_(max_layers) {
+  }
+
+  void Next(LayerStack *stack);
+
+ private:
+  bool Chance(double probability) {
+    return std::uniform_real_distribution<double>(0, 1)(random_) <
+           probability;
+  }
+  uint32_t Uniform(uint32_t min, uint32_t max) {
+    return std::uniform_int_distribution<uint32_t>(min, max)(random_);
+  }
+  template <typename T, size_t N>
+  T Pick(const T (&values)[N]) {
+    return values[Uniform(0, N - 1)];
+  }
+
+  BenchLayer Fullscreen(uint32_t height, uint32_t format);
+  void Randomize(BenchLayer *layer);
+  void Move(BenchLayer *layer);
+
+  std::mt19937 random_;
+  uint32_t width_;
+  uint32_t height_;
+  size_t max_layers_;
+  uint64_t next_id_ = 1;
+};
+
+BenchLayer StackGenerator::Fullscreen(uint32_t height, uint32_t format) {
+  BenchLayer layer;
+  layer.id = next_id_++;
+  layer.width = width_;
+  layer.height = height;
+  layer.format = format;
+  layer.crop = {0, 0, (float)width_, (float)height};
+  layer.frame = {0, 0, (int)width_, (int)height};
+  return layer;
+}
+
+void StackGenerator::Randomize(BenchLayer *layer) {
+  static const uint32_t kFormats[] = {
+      DRM_FORMAT_ABGR8888, DRM_FORMAT_ABGR8888, DRM_FORMAT_XBGR8888,
+      DRM_FORMAT_ARGB8888, DRM_FORMAT_BGR565,   DRM_FORMAT_NV12,
+      DRM_FORMAT_YVU420,
+  };
+  // Most windows are 1:1, the others stress the scaling limits of planes
+  static const float kScales[] = {1, 1, 1, 1, 0.5f, 2, 0.25f, 6, 0.1f};
+
+  layer->format = Pick(kFormats);
+  float scale = Pick(kScales);
+  layer->transform = Chance(0.1) ? HWC_TRANSFORM_ROT_90 : 0;
+  layer->blend = Chance(0.5) ? HWC2_BLEND_MODE_PREMULTIPLIED
+                             : HWC2_BLEND_MODE_NONE;
+  layer->alpha = Chance(0.1) ? 0.5f : 1.0f;
+  layer->is_protected = Chance(0.03);
+  layer->client = Chance(0.05);
+
+  uint32_t w = Uniform(width_ / 8, width_);
+  uint32_t h = Uniform(height_ / 8, height_);
+  layer->frame.left = Uniform(0, width_ - w);
+  layer->frame.top = Uniform(0, height_ - h);
+  layer->frame.right = layer->frame.left + w;
+  layer->frame.bottom = layer->frame.top + h;
+  if (layer->transform == HWC_TRANSFORM_ROT_90)
+    std::swap(w, h);
+  layer->width = std::max<uint32_t>(w * scale, 2) & ~1;
+  layer->height = std::max<uint32_t>(h * scale, 2) & ~1;
+  layer->crop = {0, 0, (float)layer->width, (float)layer->height};
+}
+
+void StackGenerator::Move(BenchLayer *layer) {
+  int w = layer->frame.right - layer->frame.left;
+  int h = layer->frame.bottom - layer->frame.top;
+  layer->frame.left = Uniform(0, width_ - w);
+  layer->frame.top = Uniform(0, height_ - h);
+  layer->frame.right = layer->frame.left + w;
+  layer->frame.bottom = layer->frame.top + h;
+}
+
+void StackGenerator::Next(LayerStack *stack) {
+  if (stack->empty()) {
+    stack->push_back(Fullscreen(height_, DRM_FORMAT_XBGR8888));
+    BenchLayer status_bar = Fullscreen(height_ / 24, DRM_FORMAT_ABGR8888);
+    status_bar.z = UINT32_MAX;
+    status_bar.blend = HWC2_BLEND_MODE_PREMULTIPLIED;
+    stack->push_back(status_bar);
+    return;
+  }
+
+  // The wallpaper and the status bar stay, windows live in between
+  if (stack->size() > 2 && Chance(0.1))
+    stack->erase(stack->begin() + Uniform(1, stack->size() - 2));
+  if (stack->size() < max_layers_ && Chance(0.1)) {
+    BenchLayer layer;
+    layer.id = next_id_++;
+    layer.z = stack->end()[-2].z + 1;
+    Randomize(&layer);
+    stack->insert(stack->end() - 1, layer);
+  }
+  for (size_t i = 1; i + 1 < stack->size(); ++i) {
+    BenchLayer &layer = (*stack)[i];
+    if (Chance(0.05))
+      Randomize(&layer);
+    else if (Chance(0.3))
+      Move(&layer);
+  }
+}
+
+// Collects the layer stacks of display as they were when validated
+static int LoadTrace(const char *path, uint64_t display,
+                     std::vector<LayerStack> *stacks) {
+  HwcTraceReader reader;
+  int ret = reader.Open(path);
+  if (ret)
+    return ret;
+
+  std::map<uint32_t, HwcTraceBuffer> buffers;
+  std::map<uint64_t, BenchLayer> layers;
+  std::map<uint64_t, uint32_t> layer_buffers;
+  HwcTraceRecord record;
+  while (reader.Next(&record)) {
+    if (record.function == kBufferFunction) {
+      HwcTraceBuffer buffer = reader.Get<HwcTraceBuffer>();
+      buffers[buffer.id] = buffer;
+      continue;
+    }
+    if (record.display != display || record.error)
+      continue;
+
+    if (record.function == HWC2_FUNCTION_CREATE_LAYER) {
+      uint64_t id;
+      if (reader.GetOutput(&id))
+        layers[id].id = id;
+      continue;
+    }
+    if (record.function == HWC2_FUNCTION_DESTROY_LAYER) {
+      uint64_t id = reader.Get<uint64_t>();
+      layers.erase(id);
+      layer_buffers.erase(id);
+      continue;
+    }
+    if (record.function == HWC2_FUNCTION_VALIDATE_DISPLAY) {
+      LayerStack stack;
+      for (std::pair<const uint64_t, BenchLayer> &l : layers) {
+        auto buffer = buffers.find(layer_buffers[l.first]);
+        if (buffer == buffers.end() && !l.second.client)
+          continue;
+        BenchLayer layer = l.second;
+        if (buffer != buffers.end()) {
+          layer.width = buffer->second.width;
+          layer.height = buffer->second.height;
+          layer.format = buffer->second.format;
+          layer.is_protected = (buffer->second.usage &
+                                GRALLOC_USAGE_PROTECTED) ==
+                               GRALLOC_USAGE_PROTECTED;
+        }
+        stack.push_back(layer);
+      }
+      std::stable_sort(stack.begin(), stack.end(),
+                       [](const BenchLayer &a, const BenchLayer &b) {
+                         return a.z < b.z;
+                       });
+      if (!stack.empty())
+        stacks->push_back(stack);
+      continue;
+    }
+
+    auto it = layers.find(record.layer);
+    if (it == layers.end())
+      continue;
+    BenchLayer &layer = it->second;
+    switch (record.function) {
+      case HWC2_FUNCTION_SET_LAYER_BLEND_MODE:
+        layer.blend = reader.Get<int32_t>();
+        break;
+      case HWC2_FUNCTION_SET_LAYER_BUFFER:
+        layer_buffers[record.layer] = reader.Get<uint32_t>();
+        break;
+      case HWC2_FUNCTION_SET_LAYER_COMPOSITION_TYPE:
+        layer.client = reader.Get<int32_t>() != HWC2_COMPOSITION_DEVICE;
+        break;
+      case HWC2_FUNCTION_SET_LAYER_DISPLAY_FRAME:
+        layer.frame = reader.Get<hwc_rect_t>();
+        break;
+      case HWC2_FUNCTION_SET_LAYER_PLANE_ALPHA:
+        layer.alpha = reader.Get<float>();
+        break;
+      case HWC2_FUNCTION_SET_LAYER_SOURCE_CROP:
+        layer.crop = reader.Get<hwc_frect_t>();
+        break;
+      case HWC2_FUNCTION_SET_LAYER_TRANSFORM:
+        layer.transform = reader.Get<int32_t>();
+        break;
+      case HWC2_FUNCTION_SET_LAYER_Z_ORDER:
+        layer.z = reader.Get<uint32_t>();
+        break;
+      default:
+        break;
+    }
+  }
+  return 0;
+}
+
+// The framebuffers belong to the benchmark, which only lends them to layers
+class BenchImporter : public Importer {
+ public:
+  int ImportBuffer(buffer_handle_t /*handle*/, hwc_drm_bo_t * /*bo*/) override {
+    return -ENOTSUP;
+  }
+  int ReleaseBuffer(hwc_drm_bo_t * /*bo*/) override {
+    return 0;
+  }
+};
+
+struct PlannerResult {
+  uint64_t frames = 0;
+  uint64_t layers = 0;
+  uint64_t device_layers = 0;
+  uint64_t pixels = 0;
+  uint64_t device_pixels = 0;
+  // What the HWC gets today, which composites everything on the client when
+  // its only TEST_ONLY commit fails
+  uint64_t first_test_device_pixels = 0;
+  uint64_t first_test_passed = 0;
+  uint64_t all_client_frames = 0;
+  // Layers the stages left without a plane although there were enough
+  uint64_t dropped_layers = 0;
+  // Layers on screen in consecutive frames, and how many of them changed
+  // planes or moved between client and device composition
+  uint64_t kept_layers = 0;
+  uint64_t reassigned_layers = 0;
+  BenchMetric tests;
+  BenchMetric provision_ns;
+  std::vector<std::unique_ptr<BenchMetric>> stage_ns;
+};
+
+class PlannerBenchmark {
+ public:
+  int Init(const char *device, int display, size_t max_planes,
+           const std::vector<const StageInfo *> &stages);
+  void Run(const LayerStack &stack, PlannerResult *result);
+
+  uint32_t width() const {
+    return width_;
+  }
+  uint32_t height() const {
+    return height_;
+  }
+  size_t num_planes() const {
+    return primary_planes_.size() + overlay_planes_.size();
+  }
+
+ private:
+  uint32_t GetFramebuffer(uint32_t width, uint32_t height, uint32_t format);
+  // Layers for the composition and the index in stack of each, -1 for the
+  // client target
+  void BuildLayers(const LayerStack &stack, const std::vector<bool> &device,
+                   std::vector<DrmHwcLayer> *layers, std::vector<int> *sources);
+  void TimeStages(std::vector<DrmHwcLayer> *layers, PlannerResult *result);
+  int Test(std::vector<DrmHwcLayer> &layers,
+           const std::vector<DrmCompositionPlane> &composition);
+
+  DrmDevice drm_;
+  DrmCrtc *crtc_ = NULL;
+  DrmConnector *connector_ = NULL;
+  std::vector<DrmPlane *> primary_planes_;
+  std::vector<DrmPlane *> overlay_planes_;
+  uint32_t width_ = 0;
+  uint32_t height_ = 0;
+  uint32_t mode_blob_ = 0;
+  uint32_t gem_handle_ = 0;
+  BenchImporter importer_;
+  std::map<std::tuple<uint32_t, uint32_t, uint32_t>, uint32_t> framebuffers_;
+  std::vector<std::unique_ptr<Planner::PlanStage>> stages_;
+  std::unique_ptr<Planner> planner_;
+  // Plane of every layer in the last frame, 0 for client composition
+  std::map<uint64_t, uint32_t> last_planes_;
+};
+
+int PlannerBenchmark::Init(const char *device, int display, size_t max_planes,
+                           const std::vector<const StageInfo *> &stages) {
+  int ret, num_displays;
+  std::tie(ret, num_displays) = drm_.Init(device, 0);
+  if (ret)
+    return ret;
+
+  connector_ = drm_.GetConnectorForDisplay(display);
+  crtc_ = drm_.GetCrtcForDisplay(display);
+  if (!connector_ || !crtc_) {
+    ALOGE("No display %d among the %d of %s", display, num_displays, device);
+    return -ENODEV;
+  }
+  ret = connector_->UpdateModes();
+  if (ret || connector_->modes().empty()) {
+    ALOGE("Display %d has no modes", display);
+    return -ENODEV;
+  }
+
+  // Drivers list the preferred mode first
+  const DrmMode &mode = connector_->modes().front();
+  width_ = mode.h_display();
+  height_ = mode.v_display();
+  struct drm_mode_modeinfo drm_mode;
+  memset(&drm_mode, 0, sizeof(drm_mode));
+  mode.ToDrmModeModeInfo(&drm_mode);
+  ret = drm_.CreatePropertyBlob(&drm_mode, sizeof(drm_mode), &mode_blob_);
+  if (ret)
+    return ret;
+
+  // Same split as the HWC, minus the overlays beyond max_planes
+  for (const std::unique_ptr<DrmPlane> &plane : drm_.planes()) {
+    if (!plane->GetCrtcSupported(*crtc_))
+      continue;
+    if (plane->type() == DRM_PLANE_TYPE_PRIMARY)
+      primary_planes_.push_back(plane.get());
+    else if (plane->type() == DRM_PLANE_TYPE_OVERLAY)
+      overlay_planes_.push_back(plane.get());
+  }
+  while (!overlay_planes_.empty() && num_planes() > max_planes)
+    overlay_planes_.pop_back();
+
+  // A stand-in for a dma-buf, all framebuffers share its handle
+  UniqueFd buffer_fd(open("/dev/zero", O_RDONLY));
+  ret = drmPrimeFDToHandle(drm_.fd(), buffer_fd.get(), &gem_handle_);
+  if (ret)
+    return ret;
+
+  planner_.reset(new Planner());
+  for (const StageInfo *stage : stages) {
+    stages_.emplace_back(stage->create());
+    stage->add(planner_.get());
+  }
+  return 0;
+}
+
+uint32_t PlannerBenchmark::GetFramebuffer(uint32_t width, uint32_t height,
+                                          uint32_t format) {
+  auto key = std::make_tuple(width, height, format);
+  auto it = framebuffers_.find(key);
+  if (it != framebuffers_.end())
+    return it->second;
+
+  // 0 for formats no plane supports, which the TEST_ONLY commit rejects
+  uint32_t handles[4] = {gem_handle_, 0, 0, 0};
+  uint32_t pitches[4] = {width * 4, 0, 0, 0};
+  uint32_t offsets[4] = {0, 0, 0, 0};
+  uint32_t fb_id = 0;
+  if (drmModeAddFB2(drm_.fd(), width, height, format, handles, pitches,
+                    offsets, &fb_id, 0))
+    fb_id = 0;
+  framebuffers_[key] = fb_id;
+  return fb_id;
+}
+
+void PlannerBenchmark::BuildLayers(const LayerStack &stack,
+                                   const std::vector<bool> &device,
+                                   std::vector<DrmHwcLayer> *layers,
+                                   std::vector<int> *sources) {
+  layers->clear();
+  sources->clear();
+  bool client_target = false;
+  for (size_t i = 0; i < stack.size(); ++i) {
+    const BenchLayer &l = stack[i];
+    hwc_drm_bo_t bo;
+    memset(&bo, 0, sizeof(bo));
+    DrmHwcLayer layer;
+    if (device[i]) {
+      bo.width = l.width;
+      bo.height = l.height;
+      bo.format = l.format;
+      layer.SetSourceCrop(l.crop);
+      layer.SetDisplayFrame(l.frame);
+      layer.SetTransform(l.transform);
+      layer.alpha = static_cast<uint16_t>(65535.0f * l.alpha + 0.5f);
+      if (l.blend == HWC2_BLEND_MODE_PREMULTIPLIED)
+        layer.blending = DrmHwcBlending::kPreMult;
+      else if (l.blend == HWC2_BLEND_MODE_COVERAGE)
+        layer.blending = DrmHwcBlending::kCoverage;
+      if (l.is_protected)
+        layer.gralloc_buffer_usage = GRALLOC_USAGE_PROTECTED;
+      sources->push_back(i);
+    } else if (!client_target) {
+      // At the z of the lowest client layer, like the HWC does
+      client_target = true;
+      bo.width = width_;
+      bo.height = height_;
+      bo.format = DRM_FORMAT_ABGR8888;
+      layer.SetSourceCrop({0, 0, (float)width_, (float)height_});
+      layer.SetDisplayFrame({0, 0, (int)width_, (int)height_});
+      layer.SetTransform(0);
+      layer.blending = DrmHwcBlending::kPreMult;
+      sources->push_back(-1);
+    } else {
+      continue;
+    }
+    bo.fb_id = GetFramebuffer(bo.width, bo.height, bo.format);
+    layer.buffer = DrmHwcBuffer(bo, &importer_);
+    layers->emplace_back(std::move(layer));
+  }
+}
+
+void PlannerBenchmark::TimeStages(std::vector<DrmHwcLayer> *layers,
+                                  PlannerResult *result) {
+  std::map<size_t, DrmHwcLayer *> to_composite;
+  for (size_t i = 0; i < layers->size(); ++i)
+    to_composite.emplace(i, &(*layers)[i]);
+
+  std::vector<DrmPlane *> planes(primary_planes_);
+  planes.insert(planes.end(), overlay_planes_.begin(), overlay_planes_.end());
+  std::vector<DrmCompositionPlane> composition;
+  for (size_t i = 0; i < stages_.size(); ++i) {
+    int64_t start_ns = BenchNow(CLOCK_MONOTONIC);
+    stages_[i]->ProvisionPlanes(&composition, to_composite, crtc_, &planes);
+    result->stage_ns[i]->Add(BenchNow(CLOCK_MONOTONIC) - start_ns);
+  }
+}
+
+int PlannerBenchmark::Test(
+    std::vector<DrmHwcLayer> &layers,
+    const std::vector<DrmCompositionPlane> &composition) {
+  drmModeAtomicReqPtr pset = drmModeAtomicAlloc();
+  if (!pset)
+    return -ENOMEM;
+
+  // The CRTC is off, so every test carries the modeset
+  int ret = drmModeAtomicAddProperty(pset, crtc_->id(),
+                                     crtc_->active_property().id(), 1) < 0 ||
+            drmModeAtomicAddProperty(pset, crtc_->id(),
+                                     crtc_->mode_property().id(),
+                                     mode_blob_) < 0 ||
+            drmModeAtomicAddProperty(pset, connector_->id(),
+                                     connector_->crtc_id_property().id(),
+                                     crtc_->id()) < 0;
+
+  std::vector<DrmPlane *> unused(primary_planes_);
+  unused.insert(unused.end(), overlay_planes_.begin(), overlay_planes_.end());
+  for (const DrmCompositionPlane &comp_plane : composition) {
+    DrmPlane *plane = comp_plane.plane();
+    unused.erase(std::remove(unused.begin(), unused.end(), plane),
+                 unused.end());
+    if (ret || comp_plane.type() != DrmCompositionPlane::Type::kLayer)
+      continue;
+
+    // Same properties as DrmDisplayCompositor::CommitFrame()
+    const DrmHwcLayer &layer = layers[comp_plane.source_layers().front()];
+    const hwc_rect_t &frame = layer.display_frame;
+    const hwc_frect_t &crop = layer.source_crop;
+    uint64_t rotation = DRM_MODE_ROTATE_0;
+    if (layer.transform & DrmHwcTransform::kRotate90)
+      rotation = DRM_MODE_ROTATE_90;
+    else if (layer.transform & DrmHwcTransform::kRotate180)
+      rotation = DRM_MODE_ROTATE_180;
+    else if (layer.transform & DrmHwcTransform::kRotate270)
+      rotation = DRM_MODE_ROTATE_270;
+    if (layer.transform & DrmHwcTransform::kFlipH)
+      rotation |= DRM_MODE_REFLECT_X;
+    if (layer.transform & DrmHwcTransform::kFlipV)
+      rotation |= DRM_MODE_REFLECT_Y;
+    uint64_t alpha = 0xFFFF;
+    if (layer.blending == DrmHwcBlending::kPreMult)
+      alpha = layer.alpha;
+
+    // Rejected by the compositor before reaching the kernel
+    if ((rotation != DRM_MODE_ROTATE_0 &&
+         plane->rotation_property().id() == 0) ||
+        (alpha != 0xFFFF && plane->alpha_property().id() == 0)) {
+      ret = -EINVAL;
+      continue;
+    }
+
+    uint32_t id = plane->id();
+    ret = drmModeAtomicAddProperty(pset, id, plane->crtc_property().id(),
+                                   crtc_->id()) < 0 ||
+          drmModeAtomicAddProperty(pset, id, plane->fb_property().id(),
+                                   layer.buffer->fb_id) < 0 ||
+          drmModeAtomicAddProperty(pset, id, plane->crtc_x_property().id(),
+                                   frame.left) < 0 ||
+          drmModeAtomicAddProperty(pset, id, plane->crtc_y_property().id(),
+                                   frame.top) < 0 ||
+          drmModeAtomicAddProperty(pset, id, plane->crtc_w_property().id(),
+                                   frame.right - frame.left) < 0 ||
+          drmModeAtomicAddProperty(pset, id, plane->crtc_h_property().id(),
+                                   frame.bottom - frame.top) < 0 ||
+          drmModeAtomicAddProperty(pset, id, plane->src_x_property().id(),
+                                   (int)crop.left << 16) < 0 ||
+          drmModeAtomicAddProperty(pset, id, plane->src_y_property().id(),
+                                   (int)crop.top << 16) < 0 ||
+          drmModeAtomicAddProperty(pset, id, plane->src_w_property().id(),
+                                   (int)(crop.right - crop.left) << 16) < 0 ||
+          drmModeAtomicAddProperty(pset, id, plane->src_h_property().id(),
+                                   (int)(crop.bottom - crop.top) << 16) < 0;
+    if (!ret && plane->rotation_property().id())
+      ret = drmModeAtomicAddProperty(pset, id,
+                                     plane->rotation_property().id(),
+                                     rotation) < 0;
+    if (!ret && plane->alpha_property().id())
+      ret = drmModeAtomicAddProperty(pset, id, plane->alpha_property().id(),
+                                     alpha) < 0;
+  }
+  for (DrmPlane *plane : unused) {
+    if (!ret)
+      ret = drmModeAtomicAddProperty(pset, plane->id(),
+                                     plane->crtc_property().id(), 0) < 0 ||
+            drmModeAtomicAddProperty(pset, plane->id(),
+                                     plane->fb_property().id(), 0) < 0;
+  }
+
+  if (!ret)
+    ret = drmModeAtomicCommit(drm_.fd(), pset,
+                              DRM_MODE_ATOMIC_TEST_ONLY |
+                                  DRM_MODE_ATOMIC_ALLOW_MODESET,
+                              NULL);
+  drmModeAtomicFree(pset);
+  return ret;
+}
+
+void PlannerBenchmark::Run(const LayerStack &stack, PlannerResult *result) {
+  // ValidateDisplay(): device layers from the top down while there are
+  // planes, keeping one for the client target if not everything fits
+  size_t avail_planes = num_planes();
+  if (avail_planes < stack.size())
+    avail_planes--;
+  std::vector<bool> device(stack.size(), false);
+  for (size_t i = stack.size(); i > 0 && avail_planes; --i) {
+    if (!stack[i - 1].client) {
+      device[i - 1] = true;
+      avail_planes--;
+    }
+  }
+
+  std::vector<DrmHwcLayer> layers;
+  std::vector<int> sources;
+  std::vector<DrmCompositionPlane> composition;
+  uint32_t tests = 0;
+  for (;;) {
+    BuildLayers(stack, device, &layers, &sources);
+    if (!tests)
+      TimeStages(&layers, result);
+
+    std::map<size_t, DrmHwcLayer *> to_composite;
+    for (size_t i = 0; i < layers.size(); ++i)
+      to_composite.emplace(i, &layers[i]);
+    std::vector<DrmPlane *> primary_planes(primary_planes_);
+    std::vector<DrmPlane *> overlay_planes(overlay_planes_);
+    int64_t start_ns = BenchNow(CLOCK_MONOTONIC);
+    int ret;
+    std::tie(ret, composition) = planner_->ProvisionPlanes(
+        to_composite, crtc_, &primary_planes, &overlay_planes);
+    result->provision_ns.Add(BenchNow(CLOCK_MONOTONIC) - start_ns);
+
+    if (!ret) {
+      ret = Test(layers, composition);
+      tests++;
+    }
+    if (!ret || std::find(device.begin(), device.end(), true) == device.end())
+      break;
+    // Fold the lowest device layer into the client target and retry
+    *std::find(device.begin(), device.end(), true) = false;
+  }
+  result->tests.Add(tests);
+
+  std::map<uint64_t, uint32_t> planes;
+  for (const BenchLayer &layer : stack)
+    planes[layer.id] = 0;
+  uint64_t device_pixels = 0;
+  size_t device_layers = 0;
+  for (const DrmCompositionPlane &comp_plane : composition) {
+    if (comp_plane.type() != DrmCompositionPlane::Type::kLayer)
+      continue;
+    int source = sources[comp_plane.source_layers().front()];
+    if (source < 0)
+      continue;
+    const BenchLayer &layer = stack[source];
+    planes[layer.id] = comp_plane.plane()->id();
+    device_pixels += FrameArea(layer.frame, width_, height_);
+    device_layers++;
+  }
+  result->dropped_layers +=
+      std::count(device.begin(), device.end(), true) - device_layers;
+
+  uint64_t pixels = 0;
+  for (const BenchLayer &layer : stack)
+    pixels += FrameArea(layer.frame, width_, height_);
+
+  result->frames++;
+  result->layers += stack.size();
+  result->device_layers += device_layers;
+  result->pixels += pixels;
+  result->device_pixels += device_pixels;
+  if (tests == 1) {
+    result->first_test_passed++;
+    result->first_test_device_pixels += device_pixels;
+  }
+  if (!device_layers)
+    result->all_client_frames++;
+
+  for (std::pair<const uint64_t, uint32_t> &p : planes) {
+    auto last = last_planes_.find(p.first);
+    if (last == last_planes_.end())
+      continue;
+    result->kept_layers++;
+    result->reassigned_layers += last->second != p.second;
+  }
+  last_planes_.swap(planes);
+}
+
+static double Percent(uint64_t part, uint64_t total) {
+  return total ? 100.0 * part / total : 0.0;
+}
+
+static void Usage(const char *argv0) {
+  fprintf(stderr,
+          "Usage: %s --device=<description> [--display=<n>] "
+          "[--max-planes=<n>] [--stages=<a,b,...>] [--trace=<trace>] "
+          "[--frames=<n>] [--seed=<n>] [--max-layers=<n>] "
+          "[--output=<file>]\nStages:",
+          argv0);
+  for (const StageInfo &stage : kStages)
+    fprintf(stderr, " %s", stage.name);
+  fprintf(stderr, "\n");
+}
+
+static int PlannerBenchmarkMain(int argc, char **argv) {
+  static const struct option options[] = {
+      {"device", required_argument, NULL, 'd'},
+      {"display", required_argument, NULL, 'D'},
+      {"max-planes", required_argument, NULL, 'p'},
+      {"stages", required_argument, NULL, 's'},
+      {"trace", required_argument, NULL, 't'},
+      {"frames", required_argument, NULL, 'f'},
+      {"seed", required_argument, NULL, 'S'},
+      {"max-layers", required_argument, NULL, 'l'},
+      {"output", required_argument, NULL, 'o'},
+      {NULL, 0, NULL, 0},
+  };
+  const char *device = NULL, *trace = NULL, *output = NULL;
+  std::string stage_names = "protected,greedy";
+  int display = 0;
+  size_t max_planes = SIZE_MAX, max_layers = 8;
+  uint32_t frames = 1000, seed = 1;
+  int opt;
+  while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1) {
+    switch (opt) {
+      case 'd':
+        device = optarg;
+        break;
+      case 'D':
+        display = atoi(optarg);
+        break;
+      case 'p':
+        max_planes = strtoul(optarg, NULL, 0);
+        break;
+      case 's':
+        stage_names = optarg;
+        break;
+      case 't':
+        trace = optarg;
+        break;
+      case 'f':
+        frames = strtoul(optarg, NULL, 0);
+        break;
+      case 'S':
+        seed = strtoul(optarg, NULL, 0);
+        break;
+      case 'l':
+        max_layers = std::max<size_t>(strtoul(optarg, NULL, 0), 2);
+        break;
+      case 'o':
+        output = optarg;
+        break;
+      default:
+        Usage(argv[0]);
+        return 1;
+    }
+  }
+  if (!device || optind != argc) {
+    Usage(argv[0]);
+    return 1;
+  }
+
+  std::vector<const StageInfo *> stages;
+  std::string stages_json;
+  size_t start = 0;
+  while (start <= stage_names.size()) {
+    size_t end = std::min(stage_names.find(',', start), stage_names.size());
+    std::string name = stage_names.substr(start, end - start);
+    start = end + 1;
+    const StageInfo *stage = NULL;
+    for (const StageInfo &s : kStages)
+      if (name == s.name)
+        stage = &s;
+    if (!stage) {
+      fprintf(stderr, "Unknown stage %s\n", name.c_str());
+      Usage(argv[0]);
+      return 1;
+    }
+    stages.push_back(stage);
+    stages_json += (stages_json.empty() ? "\"" : ", \"") + name + "\"";
+  }
+
+  PlannerBenchmark bench;
+  int ret = bench.Init(device, display, max_planes, stages);
+  if (ret) {
+    fprintf(stderr, "Failed to open display %d of %s: %d\n", display, device,
+            ret);
+    return 1;
+  }
+
+  std::vector<LayerStack> recorded;
+  if (trace) {
+    ret = LoadTrace(trace, display, &recorded);
+    if (ret || recorded.empty()) {
+      fprintf(stderr, "No layer stacks for display %d in %s\n", display,
+              trace);
+      return 1;
+    }
+    frames = recorded.size();
+  }
+
+  // Large, keep it off the stack
+  std::unique_ptr<PlannerResult> result(new PlannerResult());
+  for (size_t i = 0; i < stages.size(); ++i)
+    result->stage_ns.emplace_back(new BenchMetric());
+
+  StackGenerator generator(seed, bench.width(), bench.height(), max_layers);
+  LayerStack stack;
+  for (uint32_t i = 0; i < frames; ++i) {
+    if (trace) {
+      bench.Run(recorded[i], result.get());
+    } else {
+      generator.Next(&stack);
+      bench.Run(stack, result.get());
+    }
+  }
+
+  FILE *out = output ? fopen(output, "w") : stdout;
+  if (!out) {
+    fprintf(stderr, "Can't open %s: %s\n", output, strerror(errno));
+    return 1;
+  }
+  fprintf(out,
+          "{\n"
+          "  \"device\": \"%s\",\n"
+          "  \"display\": %d,\n"
+          "  \"width\": %u,\n"
+          "  \"height\": %u,\n"
+          "  \"planes\": %zu,\n"
+          "  \"stacks\": \"%s\",\n"
+          "  \"seed\": %u,\n"
+          "  \"stages\": [%s],\n"
+          "  \"frames\": %llu,\n"
+          "  \"layers_per_frame\": %.2f,\n"
+          "  \"device_layers_pct\": %.2f,\n"
+          "  \"plane_pixels_pct\": %.2f,\n"
+          "  \"first_test_plane_pixels_pct\": %.2f,\n"
+          "  \"first_test_passed_pct\": %.2f,\n"
+          "  \"all_client_frames\": %llu,\n"
+          "  \"dropped_layers\": %llu,\n"
+          "  \"reassigned_layers_pct\": %.2f,\n",
+          device, display, bench.width(), bench.height(), bench.num_planes(),
+          trace ? trace : "random", seed, stages_json.c_str(),
+          (unsigned long long)result->frames,
+          result->frames ? (double)result->layers / result->frames : 0.0,
+          Percent(result->device_layers, result->layers),
+          Percent(result->device_pixels, result->pixels),
+          Percent(result->first_test_device_pixels, result->pixels),
+          Percent(result->first_test_passed, result->frames),
+          (unsigned long long)result->all_client_frames,
+          (unsigned long long)result->dropped_layers,
+          Percent(result->reassigned_layers, result->kept_layers));
+  result->tests.Print(out, "  ", "tests_per_frame", false);
+  result->provision_ns.Print(out, "  ", "provision_ns", false);
+  fprintf(out, "  \"stage_ns\": {\n");
+  for (size_t i = 0; i < stages.size(); ++i)
+    result->stage_ns[i]->Print(out, "    ", stages[i]->name,
+                               i == stages.size() - 1);
+  fprintf(out, "  }\n}\n");
+  if (output)
+    fclose(out);
+  return 0;
+}
+}  // namespace android
+
+int main(int argc, char **argv) {
+  return android::PlannerBenchmarkMain(argc, argv);
+}
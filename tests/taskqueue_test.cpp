@@ -0,0 +1,155 @@
+#include <gtest/gtest.h>
+#include <hardware/hardware.h>
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "taskqueueworker.h"
+
+using android::TaskQueueWorker;
+
+static const int64_t kMsNs = 1000 * 1000;
+
+struct TaskQueueTest : public testing::Test {
+  TaskQueueWorker worker;
+
+  TaskQueueTest() : worker("test-task-queue", HAL_PRIORITY_URGENT_DISPLAY) {
+  }
+
+  virtual void SetUp() {
+    ASSERT_EQ(0, worker.Init());
+  }
+
+  void wait_idle() {
+    for (int i = 0; i < 100 && worker.pending_tasks(); ++i)
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  }
+};
+
+TEST_F(TaskQueueTest, runs_in_deadline_order) {
+  std::mutex lock;
+  std::vector<int> order;
+  auto record = [&](int n) {
+    return [&, n] {
+      std::lock_guard<std::mutex> lk(lock);
+      order.push_back(n);
+    };
+  };
+
+  int64_t now = TaskQueueWorker::Now();
+  worker.PostAt(now + 30 * kMsNs, record(3));
+  worker.PostAt(now + 10 * kMsNs, record(1));
+  worker.PostAt(now + 20 * kMsNs, record(2));
+  worker.Post(record(0));
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(60));
+  wait_idle();
+
+  std::lock_guard<std::mutex> lk(lock);
+  ASSERT_EQ(4u, order.size());
+  for (int i = 0; i < 4; ++i)
+    ASSERT_EQ(i, order[i]);
+}
+
+TEST_F(TaskQueueTest, waits_for_deadline) {
+  std::atomic<int64_t> ran_at(0);
+  int64_t posted = TaskQueueWorker::Now();
+  worker.PostDelayed(20 * kMsNs, [&] { ran_at = TaskQueueWorker::Now(); });
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  ASSERT_EQ(0, ran_at);
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(40));
+  wait_idle();
+  ASSERT_GE(ran_at - posted, 20 * kMsNs);
+}
+
+TEST_F(TaskQueueTest, cancel) {
+  std::atomic<int> runs(0);
+  TaskQueueWorker::TaskId id =
+      worker.PostDelayed(10 * kMsNs, [&] { runs++; });
+  ASSERT_TRUE(worker.Cancel(id));
+  ASSERT_FALSE(worker.Cancel(id));
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(30));
+  ASSERT_EQ(0, runs);
+  ASSERT_EQ(0u, worker.pending_tasks());
+}
+
+TEST_F(TaskQueueTest, cancel_waits_for_running_task) {
+  std::atomic<bool> started(false), finished(false);
+  TaskQueueWorker::TaskId id = worker.Post([&] {
+    started = true;
+    std::this_thread::sleep_for(std::chrono::milliseconds(30));
+    finished = true;
+  });
+
+  while (!started)
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  ASSERT_FALSE(worker.Cancel(id));
+  ASSERT_TRUE(finished);
+}
+
+TEST_F(TaskQueueTest, wait) {
+  std::atomic<bool> finished(false);
+  TaskQueueWorker::TaskId id = worker.PostDelayed(10 * kMsNs, [&] {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    finished = true;
+  });
+  worker.Wait(id);
+  ASSERT_TRUE(finished);
+
+  // Cancelled tasks release their waiters too
+  id = worker.PostDelayed(1000 * kMsNs, [] {});
+  std::thread canceller([&] {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    worker.Cancel(id);
+  });
+  worker.Wait(id);
+  canceller.join();
+  ASSERT_EQ(0u, worker.pending_tasks());
+}
+
+TEST_F(TaskQueueTest, coalesce) {
+  std::atomic<int> runs(0), last(0);
+  int64_t now = TaskQueueWorker::Now();
+  for (int i = 1; i <= 5; ++i)
+    worker.PostCoalesced("job", now + (10 + i) * kMsNs, [&, i] {
+      runs++;
+      last = i;
+    });
+  ASSERT_EQ(1u, worker.pending_tasks());
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(40));
+  wait_idle();
+  ASSERT_EQ(1, runs);
+  ASSERT_EQ(5, last);
+
+  worker.PostCoalesced("job", now + 100 * kMsNs, [&] { runs++; });
+  ASSERT_TRUE(worker.Cancel(std::string("job")));
+  ASSERT_EQ(0u, worker.pending_tasks());
+}
+
+TEST_F(TaskQueueTest, task_posts_task) {
+  std::atomic<int> runs(0);
+  worker.Post([&] {
+    runs++;
+    worker.PostDelayed(5 * kMsNs, [&] { runs++; });
+  });
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  wait_idle();
+  ASSERT_EQ(2, runs);
+}
+
+TEST_F(TaskQueueTest, exit_with_pending_tasks) {
+  std::atomic<int> runs(0);
+  worker.PostDelayed(1000 * kMsNs, [&] { runs++; });
+  worker.Exit();
+  ASSERT_FALSE(worker.initialized());
+  ASSERT_EQ(0, runs);
+}
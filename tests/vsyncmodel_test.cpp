@@ -0,0 +1,118 @@
+#include <gtest/gtest.h>
+
+#include <stdlib.h>
+
+#include "vsyncmodel.h"
+
+using android::VSyncModel;
+
+static const int64_t kPeriodNs = 16666667;
+static const int64_t kStartNs = 1000 * 1000 * 1000;
+
+TEST(VSyncModelTest, no_samples) {
+  VSyncModel model;
+  model.SetNominalPeriod(kPeriodNs);
+  ASSERT_FALSE(model.confident());
+  ASSERT_EQ(kPeriodNs, model.period());
+  ASSERT_EQ(-1, model.PredictNext(kStartNs));
+}
+
+TEST(VSyncModelTest, steady_timeline) {
+  VSyncModel model;
+  model.SetNominalPeriod(kPeriodNs);
+  for (int i = 0; i < 10; ++i)
+    model.AddSample(kStartNs + i * kPeriodNs);
+  ASSERT_TRUE(model.confident());
+  ASSERT_LE(llabs(model.period() - kPeriodNs), 1);
+
+  int64_t last = kStartNs + 9 * kPeriodNs;
+  ASSERT_LE(llabs(model.PredictNext(last + kPeriodNs / 2) -
+                  (last + kPeriodNs)),
+            10);
+  ASSERT_LE(llabs(model.PredictNext(last) - (last + kPeriodNs)), 10);
+}
+
+TEST(VSyncModelTest, duplicated_samples_are_ignored) {
+  VSyncModel model;
+  model.SetNominalPeriod(kPeriodNs);
+  for (int i = 0; i < 10; ++i) {
+    model.AddSample(kStartNs + i * kPeriodNs);
+    model.AddSample(kStartNs + i * kPeriodNs + 1000);
+  }
+  ASSERT_EQ(10u, model.num_samples());
+  ASSERT_TRUE(model.confident());
+}
+
+TEST(VSyncModelTest, missed_vblanks_leave_the_period_alone) {
+  VSyncModel model;
+  model.SetNominalPeriod(kPeriodNs);
+  const int vsyncs[] = {0, 1, 3, 4, 7, 8, 9, 12, 13, 15};
+  for (int n : vsyncs)
+    model.AddSample(kStartNs + n * kPeriodNs);
+  ASSERT_TRUE(model.confident());
+  ASSERT_LE(llabs(model.period() - kPeriodNs), 1);
+  ASSERT_LE(llabs(model.PredictNext(kStartNs + 15 * kPeriodNs) -
+                  (kStartNs + 16 * kPeriodNs)),
+            10);
+}
+
+TEST(VSyncModelTest, follows_drift_from_the_nominal_period) {
+  // Panels commonly run a bit off their advertised refresh rate
+  const int64_t actual_period_ns = kPeriodNs + kPeriodNs / 100;
+  VSyncModel model;
+  model.SetNominalPeriod(kPeriodNs);
+  for (int i = 0; i < 20; ++i)
+    model.AddSample(kStartNs + i * actual_period_ns);
+  ASSERT_TRUE(model.confident());
+  ASSERT_LE(llabs(model.period() - actual_period_ns), 1);
+
+  // The nominal period would be off by several milliseconds here
+  int64_t last = kStartNs + 19 * actual_period_ns;
+  ASSERT_LE(llabs(model.PredictNext(last + 10 * actual_period_ns) -
+                  (last + 11 * actual_period_ns)),
+            100);
+  ASSERT_LE(llabs(model.PredictionError(last + 5 * actual_period_ns)), 100);
+}
+
+TEST(VSyncModelTest, too_much_drift_is_not_trusted) {
+  const int64_t actual_period_ns = kPeriodNs + kPeriodNs / 10;
+  VSyncModel model;
+  model.SetNominalPeriod(kPeriodNs);
+  for (int i = 0; i < 20; ++i)
+    model.AddSample(kStartNs + i * actual_period_ns);
+  ASSERT_FALSE(model.confident());
+  ASSERT_EQ(kPeriodNs, model.period());
+}
+
+TEST(VSyncModelTest, resets_on_outlier) {
+  VSyncModel model;
+  model.SetNominalPeriod(kPeriodNs);
+  for (int i = 0; i < 10; ++i)
+    model.AddSample(kStartNs + i * kPeriodNs);
+  ASSERT_TRUE(model.confident());
+
+  // Half a period off the grid, e.g. after the CRTC was reprogrammed
+  int64_t outlier = kStartNs + 10 * kPeriodNs + kPeriodNs / 2;
+  model.AddSample(outlier);
+  ASSERT_FALSE(model.confident());
+  ASSERT_EQ(1u, model.num_samples());
+
+  // And picks up the new phase from there
+  for (int i = 1; i < 10; ++i)
+    model.AddSample(outlier + i * kPeriodNs);
+  ASSERT_TRUE(model.confident());
+  ASSERT_LE(llabs(model.PredictionError(outlier + 20 * kPeriodNs)), 10);
+}
+
+TEST(VSyncModelTest, resets_on_nominal_period_change) {
+  VSyncModel model;
+  model.SetNominalPeriod(kPeriodNs);
+  for (int i = 0; i < 10; ++i)
+    model.AddSample(kStartNs + i * kPeriodNs);
+  ASSERT_TRUE(model.confident());
+
+  model.SetNominalPeriod(kPeriodNs / 2);
+  ASSERT_FALSE(model.confident());
+  ASSERT_EQ(0u, model.num_samples());
+  ASSERT_EQ(kPeriodNs / 2, model.period());
+}
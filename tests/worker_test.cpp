@@ -5,6 +5,8 @@
 
 #include "worker.h"
 
+using android::ParseSchedPolicy;
+using android::SchedPolicy;
 using android::Worker;
 
 struct TestWorker : public Worker {
@@ -108,3 +110,27 @@ TEST_F(WorkerTest, exit_while_running) {
   std::this_thread::sleep_for(std::chrono::milliseconds(50));
   worker.Exit();
 }
+
+TEST(SchedPolicyTest, parse) {
+  SchedPolicy policy;
+  ASSERT_EQ(0, ParseSchedPolicy("fifo:2,cpus:f0,uclamp:512-1024", &policy));
+  ASSERT_TRUE(policy.type == SchedPolicy::Type::kFifo);
+  ASSERT_EQ(2, policy.fifo_priority);
+  ASSERT_EQ(0xf0u, policy.cpu_mask);
+  ASSERT_EQ(512, policy.uclamp_min);
+  ASSERT_EQ(1024, policy.uclamp_max);
+
+  ASSERT_EQ(0, ParseSchedPolicy("deadline:2000/8000/16666", &policy));
+  ASSERT_TRUE(policy.type == SchedPolicy::Type::kDeadline);
+  ASSERT_EQ(2000000u, policy.runtime_ns);
+  ASSERT_EQ(8000000u, policy.deadline_ns);
+  ASSERT_EQ(16666000u, policy.period_ns);
+  ASSERT_EQ(0u, policy.cpu_mask);
+
+  // Malformed specs leave the policy untouched
+  ASSERT_EQ(-EINVAL, ParseSchedPolicy("fifo:0", &policy));
+  ASSERT_EQ(-EINVAL, ParseSchedPolicy("deadline:8000/2000/16666", &policy));
+  ASSERT_EQ(-EINVAL, ParseSchedPolicy("uclamp:512", &policy));
+  ASSERT_EQ(-EINVAL, ParseSchedPolicy("rr:2", &policy));
+  ASSERT_TRUE(policy.type == SchedPolicy::Type::kDeadline);
+}
@@ -0,0 +1,159 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#define LOG_TAG "hwc-vsync-model"
+
+#include "vsyncmodel.h"
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdlib.h>
+
+#include <log/log.h>
+
+namespace android {
+
+// Kernel vblank timestamps are accurate to a few microseconds, a fit worse
+// than this means the samples don't come from a steady timeline.
+static const double kMaxRmsErrorNs = 200 * 1000;
+// A single sample this far off the fitted grid invalidates the model.
+static const int64_t kMaxSampleErrorNs = 1000 * 1000;
+// The fitted period may not stray further than this from the nominal one.
+static const double kMaxPeriodDeviation = 0.05;
+static const int64_t kDefaultPeriodNs = 1000 * 1000 * 1000 / 60;
+
+VSyncModel::VSyncModel()
+    : nominal_period_(kDefaultPeriodNs),
+      first_sample_(0),
+      num_samples_(0),
+      confident_(false),
+      period_(kDefaultPeriodNs),
+      anchor_(-1),
+      rms_error_ns_(0) {
+}
+
+void VSyncModel::SetNominalPeriod(int64_t period_ns) {
+  if (period_ns <= 0 || period_ns == nominal_period_)
+    return;
+
+  nominal_period_ = period_ns;
+  Reset();
+}
+
+void VSyncModel::Reset() {
+  first_sample_ = 0;
+  num_samples_ = 0;
+  confident_ = false;
+  period_ = nominal_period_;
+  anchor_ = -1;
+  rms_error_ns_ = 0;
+}
+
+int64_t VSyncModel::period() const {
+  return confident_ ? llround(period_) : nominal_period_;
+}
+
+int64_t VSyncModel::PredictNext(int64_t timestamp_ns) const {
+  if (anchor_ < 0)
+    return -1;
+
+  double period = confident_ ? period_ : nominal_period_;
+  double elapsed = timestamp_ns - anchor_;
+  int64_t n = (int64_t)floor(elapsed / period) + 1;
+  return anchor_ + llround(n * period);
+}
+
+int64_t VSyncModel::PredictionError(int64_t timestamp_ns) const {
+  if (anchor_ < 0)
+    return 0;
+
+  double period = confident_ ? period_ : nominal_period_;
+  double elapsed = timestamp_ns - anchor_;
+  int64_t n = llround(elapsed / period);
+  return timestamp_ns - (anchor_ + llround(n * period));
+}
+
+void VSyncModel::AddSample(int64_t timestamp_ns) {
+  if (num_samples_) {
+    size_t last = (first_sample_ + num_samples_ - 1) % kMaxSamples;
+    int64_t since_last = timestamp_ns - samples_[last];
+    // Duplicated or out of order events carry no information
+    if (since_last < nominal_period_ / 2)
+      return;
+  }
+
+  if (confident_ && llabs(PredictionError(timestamp_ns)) > kMaxSampleErrorNs) {
+    ALOGV("Vsync off the model by %" PRId64 "ns, resetting",
+          PredictionError(timestamp_ns));
+    Reset();
+  }
+
+  if (num_samples_ == kMaxSamples) {
+    first_sample_ = (first_sample_ + 1) % kMaxSamples;
+    num_samples_--;
+  }
+  samples_[(first_sample_ + num_samples_) % kMaxSamples] = timestamp_ns;
+  num_samples_++;
+
+  Fit();
+}
+
+void VSyncModel::Fit() {
+  int64_t base = samples_[first_sample_];
+  double guess = confident_ ? period_ : nominal_period_;
+
+  // Number each sample by the vsync it belongs to, so missed vblanks leave a
+  // gap in x instead of skewing the period, then fit y = anchor + x * period.
+  double sum_x = 0, sum_y = 0, sum_xx = 0, sum_xy = 0;
+  for (size_t i = 0; i < num_samples_; ++i) {
+    double y = samples_[(first_sample_ + i) % kMaxSamples] - base;
+    double x = llround(y / guess);
+    sum_x += x;
+    sum_y += y;
+    sum_xx += x * x;
+    sum_xy += x * y;
+  }
+
+  double n = num_samples_;
+  double denom = n * sum_xx - sum_x * sum_x;
+  if (num_samples_ < 2 || denom == 0) {
+    anchor_ = base;
+    confident_ = false;
+    return;
+  }
+
+  double period = (n * sum_xy - sum_x * sum_y) / denom;
+  double intercept = (sum_y - period * sum_x) / n;
+
+  double sum_err = 0;
+  for (size_t i = 0; i < num_samples_; ++i) {
+    double y = samples_[(first_sample_ + i) % kMaxSamples] - base;
+    double x = llround(y / guess);
+    double err = y - (intercept + x * period);
+    sum_err += err * err;
+  }
+
+  period_ = period;
+  anchor_ = base + llround(intercept);
+  rms_error_ns_ = sqrt(sum_err / n);
+  confident_ = num_samples_ >= kMinSamples && rms_error_ns_ < kMaxRmsErrorNs &&
+               fabs(period - nominal_period_) <
+                   nominal_period_ * kMaxPeriodDeviation;
+  if (!confident_)
+    period_ = nominal_period_;
+}
+}
@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef ANDROID_VSYNC_MODEL_H_
+#define ANDROID_VSYNC_MODEL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace android {
+
+// Fits the vsync timeline (phase and period) to recent hardware vblank
+// timestamps with a least squares line fit, so that future vsyncs can be
+// predicted without waiting on the vblank interrupt. Samples which don't land
+// on the fitted grid reset the model. Not thread safe.
+class VSyncModel {
+ public:
+  VSyncModel();
+
+  // Resets the model whenever the nominal (mode) period changes.
+  void SetNominalPeriod(int64_t period_ns);
+  void AddSample(int64_t timestamp_ns);
+  void Reset();
+
+  // True once there are enough samples and they fit the line well.
+  bool confident() const {
+    return confident_;
+  }
+  size_t num_samples() const {
+    return num_samples_;
+  }
+  // Fitted period if confident, nominal period otherwise.
+  int64_t period() const;
+  int64_t nominal_period() const {
+    return nominal_period_;
+  }
+  double rms_error_ns() const {
+    return rms_error_ns_;
+  }
+
+  // Returns the first vsync strictly after timestamp_ns, or -1 if there isn't
+  // any sample to phase the prediction off.
+  int64_t PredictNext(int64_t timestamp_ns) const;
+  // Signed distance between timestamp_ns and the closest predicted vsync.
+  int64_t PredictionError(int64_t timestamp_ns) const;
+
+ private:
+  static const size_t kMaxSamples = 32;
+  static const size_t kMinSamples = 6;
+
+  void Fit();
+
+  int64_t nominal_period_;
+  int64_t samples_[kMaxSamples];
+  size_t first_sample_;
+  size_t num_samples_;
+
+  bool confident_;
+  double period_;
+  int64_t anchor_;
+  double rms_error_ns_;
+};
+}
+
+#endif  // ANDROID_VSYNC_MODEL_H_
@@ -18,158 +18,76 @@
 
 #include "drmdevice.h"
 #include "vsyncworker.h"
-#include "worker.h"
-
-#include <map>
-#include <stdlib.h>
-#include <time.h>
-#include <xf86drm.h>
-#include <xf86drmMode.h>
 
 #include <log/log.h>
 #include <hardware/hardware.h>
 
 namespace android {
 
-VSyncWorker::VSyncWorker()
-    : Worker("vsync", HAL_PRIORITY_URGENT_DISPLAY),
-      drm_(NULL),
-      display_(-1),
-      enabled_(false),
-      last_timestamp_(-1) {
+VSyncWorker::VSyncWorker() : drm_(NULL), display_(-1), enabled_(false) {
 }
 
 VSyncWorker::~VSyncWorker() {
+  Exit();
 }
 
 int VSyncWorker::Init(DrmDevice *drm, int display) {
   drm_ = drm;
   display_ = display;
 
-  return InitWorker();
+  return drm_->event_listener()->RegisterVblankHandler(display_, this);
+}
+
+void VSyncWorker::Exit() {
+  if (!drm_)
+    return;
+
+  drm_->event_listener()->UnregisterVblankHandler(display_, this);
+  drm_ = NULL;
 }
 
 void VSyncWorker::RegisterCallback(std::shared_ptr<VsyncCallback> callback) {
-  Lock();
+  std::lock_guard<std::mutex> lk(mutex_);
   callback_ = callback;
-  Unlock();
 }
 
 void VSyncWorker::VSyncControl(bool enabled) {
-  Lock();
-  enabled_ = enabled;
-  last_timestamp_ = -1;
-  Unlock();
+  {
+    std::lock_guard<std::mutex> lk(mutex_);
+    enabled_ = enabled;
+  }
 
-  Signal();
+  if (enabled && drm_)
+    drm_->event_listener()->RequestVblank(display_);
 }
 
-/*
- * Returns the timestamp of the next vsync in phase with last_timestamp_.
- * For example:
- *  last_timestamp_ = 137
- *  frame_ns = 50
- *  current = 683
- *
- *  ret = (50 * ((683 - 137)/50 + 1)) + 137
- *  ret = 687
- *
- *  Thus, we must sleep until timestamp 687 to maintain phase with the last
- *  timestamp.
- */
-int64_t VSyncWorker::GetPhasedVSync(int64_t frame_ns, int64_t current) {
-  if (last_timestamp_ < 0)
-    return current + frame_ns;
-
-  return frame_ns * ((current - last_timestamp_) / frame_ns + 1) +
-         last_timestamp_;
+int64_t VSyncWorker::GetVsyncPeriodNs() const {
+  if (!drm_)
+    return -1;
+  return drm_->event_listener()->GetVsyncPeriodNs(display_);
 }
 
-static const int64_t kOneSecondNs = 1 * 1000 * 1000 * 1000;
-
-int VSyncWorker::SyntheticWaitVBlank(int64_t *timestamp) {
-  struct timespec vsync;
-  int ret = clock_gettime(CLOCK_MONOTONIC, &vsync);
-
-  float refresh = 60.0f;  // Default to 60Hz refresh rate
-  DrmConnector *conn = drm_->GetConnectorForDisplay(display_);
-  if (conn && conn->active_mode().v_refresh() != 0.0f)
-    refresh = conn->active_mode().v_refresh();
-  else
-    ALOGW("Vsync worker active with conn=%p refresh=%f\n", conn,
-          conn ? conn->active_mode().v_refresh() : 0.0f);
-
-  int64_t phased_timestamp = GetPhasedVSync(
-      kOneSecondNs / refresh, vsync.tv_sec * kOneSecondNs + vsync.tv_nsec);
-  vsync.tv_sec = phased_timestamp / kOneSecondNs;
-  vsync.tv_nsec = phased_timestamp - (vsync.tv_sec * kOneSecondNs);
-  do {
-    ret = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &vsync, NULL);
-  } while (ret == -1 && errno == EINTR);
-  if (ret)
-    return ret;
-
-  *timestamp = (int64_t)vsync.tv_sec * kOneSecondNs + (int64_t)vsync.tv_nsec;
-  return 0;
+int64_t VSyncWorker::GetNextVsyncNs(int64_t timestamp_ns) const {
+  if (!drm_)
+    return -1;
+  return drm_->event_listener()->GetNextVsyncNs(display_, timestamp_ns);
 }
 
-void VSyncWorker::Routine() {
-  int ret;
-
-  Lock();
-  if (!enabled_) {
-    ret = WaitForSignalOrExitLocked();
-    if (ret == -EINTR) {
-      Unlock();
-      return;
-    }
-  }
-
-  bool enabled = enabled_;
-  int display = display_;
-  std::shared_ptr<VsyncCallback> callback(callback_);
-  Unlock();
-
-  if (!enabled)
-    return;
-
-  DrmCrtc *crtc = drm_->GetCrtcForDisplay(display);
-  if (!crtc) {
-    ALOGE("Failed to get crtc for display");
-    return;
-  }
-  uint32_t high_crtc = (crtc->pipe() << DRM_VBLANK_HIGH_CRTC_SHIFT);
-
-  drmVBlank vblank;
-  memset(&vblank, 0, sizeof(vblank));
-  vblank.request.type = (drmVBlankSeqType)(
-      DRM_VBLANK_RELATIVE | (high_crtc & DRM_VBLANK_HIGH_CRTC_MASK));
-  vblank.request.sequence = 1;
+bool VSyncWorker::vblank_enabled() {
+  std::lock_guard<std::mutex> lk(mutex_);
+  return enabled_;
+}
 
-  int64_t timestamp;
-  ret = drmWaitVBlank(drm_->fd(), &vblank);
-  if (ret == -EINTR) {
-    return;
-  } else if (ret) {
-    ret = SyntheticWaitVBlank(&timestamp);
-    if (ret)
+void VSyncWorker::HandleVblank(int64_t timestamp_ns) {
+  std::shared_ptr<VsyncCallback> callback;
+  {
+    std::lock_guard<std::mutex> lk(mutex_);
+    if (!enabled_)
       return;
-  } else {
-    timestamp = (int64_t)vblank.reply.tval_sec * kOneSecondNs +
-                (int64_t)vblank.reply.tval_usec * 1000;
+    callback = callback_;
   }
 
-  /*
-   * There's a race here where a change in callback_ will not take effect until
-   * the next subsequent requested vsync. This is unavoidable since we can't
-   * call the vsync hook while holding the thread lock.
-   *
-   * We could shorten the race window by caching callback_ right before calling
-   * the hook. However, in practice, callback_ is only updated once, so it's not
-   * worth the overhead.
-   */
   if (callback)
-    callback->Callback(display, timestamp);
-  last_timestamp_ = timestamp;
+    callback->Callback(display_, timestamp_ns);
 }
 }
@@ -18,9 +18,11 @@
 #define ANDROID_EVENT_WORKER_H_
 
 #include "drmdevice.h"
-#include "worker.h"
+#include "drmeventlistener.h"
 
 #include <map>
+#include <memory>
+#include <mutex>
 #include <stdint.h>
 
 #include <hardware/hardware.h>
@@ -35,7 +37,10 @@ class VsyncCallback {
   virtual void Callback(int display, int64_t timestamp) = 0;
 };
 
-class VSyncWorker : public Worker {
+// Per-display vsync subscriber. It doesn't own a thread, vblanks are delivered
+// by the DrmDevice's event loop which fans them out to all subscribers of a
+// display.
+class VSyncWorker : public DrmVblankHandler {
  public:
   VSyncWorker();
   ~VSyncWorker() override;
@@ -44,24 +49,27 @@ class VSyncWorker : public Worker {
   void RegisterCallback(std::shared_ptr<VsyncCallback> callback);
 
   void VSyncControl(bool enabled);
+  void Exit();
 
- protected:
-  void Routine() override;
+  // See DrmEventListener::GetVsyncPeriodNs()/GetNextVsyncNs()
+  int64_t GetVsyncPeriodNs() const;
+  int64_t GetNextVsyncNs(int64_t timestamp_ns) const;
 
- private:
-  int64_t GetPhasedVSync(int64_t frame_ns, int64_t current);
-  int SyntheticWaitVBlank(int64_t *timestamp);
+  // DrmVblankHandler
+  void HandleVblank(int64_t timestamp_ns) override;
+  bool vblank_enabled() override;
 
+ private:
   DrmDevice *drm_;
 
-  // shared_ptr since we need to use this outside of the thread lock (to
-  // actually call the hook) and we don't want the memory freed until we're
-  // done
+  std::mutex mutex_;
+
+  // shared_ptr since we need to use this outside of the lock (to actually call
+  // the hook) and we don't want the memory freed until we're done
   std::shared_ptr<VsyncCallback> callback_ = NULL;
 
   int display_;
   bool enabled_;
-  int64_t last_timestamp_;
 };
 }
 
@@ -14,13 +14,102 @@
  * limitations under the License.
  */
 
+#define LOG_TAG "hwc-drm-worker"
+
 #include "worker.h"
 
+#include <errno.h>
+#include <inttypes.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
 #include <sys/prctl.h>
 #include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cutils/properties.h>
+#include <log/log.h>
+
+#ifndef SCHED_DEADLINE
+#define SCHED_DEADLINE 6
+#endif
+#ifndef SCHED_FLAG_RESET_ON_FORK
+#define SCHED_FLAG_RESET_ON_FORK 0x01
+#endif
+#ifndef SCHED_FLAG_KEEP_POLICY
+#define SCHED_FLAG_KEEP_POLICY 0x08
+#endif
+#ifndef SCHED_FLAG_KEEP_PARAMS
+#define SCHED_FLAG_KEEP_PARAMS 0x10
+#endif
+#ifndef SCHED_FLAG_UTIL_CLAMP_MIN
+#define SCHED_FLAG_UTIL_CLAMP_MIN 0x20
+#endif
+#ifndef SCHED_FLAG_UTIL_CLAMP_MAX
+#define SCHED_FLAG_UTIL_CLAMP_MAX 0x40
+#endif
 
 namespace android {
 
+// Not exposed by libc, see include/uapi/linux/sched/types.h
+struct SchedAttr {
+  uint32_t size;
+  uint32_t sched_policy;
+  uint64_t sched_flags;
+  int32_t sched_nice;
+  uint32_t sched_priority;
+  uint64_t sched_runtime;
+  uint64_t sched_deadline;
+  uint64_t sched_period;
+  uint32_t sched_util_min;
+  uint32_t sched_util_max;
+};
+
+static int SchedSetAttr(SchedAttr *attr) {
+  return syscall(__NR_sched_setattr, 0, attr, 0) ? -errno : 0;
+}
+
+int ParseSchedPolicy(const char *spec, SchedPolicy *policy) {
+  SchedPolicy result;
+  std::string tokens(spec);
+  size_t start = 0;
+  while (start < tokens.size()) {
+    size_t end = tokens.find(',', start);
+    if (end == std::string::npos)
+      end = tokens.size();
+    std::string token = tokens.substr(start, end - start);
+    start = end + 1;
+    if (token.empty())
+      continue;
+
+    unsigned long long a, b, c;
+    int n;
+    const char *t = token.c_str();
+    if (sscanf(t, "fifo:%llu%n", &a, &n) == 1 && !t[n] && a >= 1 && a <= 99) {
+      result.type = SchedPolicy::Type::kFifo;
+      result.fifo_priority = a;
+    } else if (sscanf(t, "deadline:%llu/%llu/%llu%n", &a, &b, &c, &n) == 3 &&
+               !t[n] && a && a <= b && b <= c) {
+      result.type = SchedPolicy::Type::kDeadline;
+      result.runtime_ns = a * 1000;
+      result.deadline_ns = b * 1000;
+      result.period_ns = c * 1000;
+    } else if (sscanf(t, "cpus:%llx%n", &a, &n) == 1 && !t[n] && a) {
+      result.cpu_mask = a;
+    } else if (sscanf(t, "uclamp:%llu-%llu%n", &a, &b, &n) == 2 && !t[n] &&
+               a <= b && b <= 1024) {
+      result.uclamp_min = a;
+      result.uclamp_max = b;
+    } else {
+      return -EINVAL;
+    }
+  }
+
+  *policy = result;
+  return 0;
+}
+
 Worker::Worker(const char *name, int priority)
     : name_(name), priority_(priority), exit_(false), initialized_(false) {
 }
@@ -34,6 +123,15 @@ int Worker::InitWorker() {
   if (initialized())
     return -EALREADY;
 
+  if (!sched_policy_set_) {
+    char prop_name[PROPERTY_KEY_MAX + 64];
+    char spec[PROPERTY_VALUE_MAX];
+    snprintf(prop_name, sizeof(prop_name), "hwc.drm.sched.%s", name_.c_str());
+    if (property_get(prop_name, spec, "") > 0 &&
+        ParseSchedPolicy(spec, &sched_policy_))
+      ALOGE("Ignoring malformed %s=\"%s\"", prop_name, spec);
+  }
+
   thread_ = std::unique_ptr<std::thread>(
       new std::thread(&Worker::InternalRoutine, this));
   initialized_ = true;
@@ -47,7 +145,7 @@ void Worker::Exit() {
   exit_ = true;
   if (initialized()) {
     lk.unlock();
-    cond_.notify_all();
+    Signal();
     thread_->join();
     initialized_ = false;
   }
@@ -76,9 +174,58 @@ int Worker::WaitForSignalOrExitLocked(int64_t max_nanoseconds) {
   return ret;
 }
 
+void Worker::ApplySchedPolicy() {
+  const SchedPolicy &policy = sched_policy_;
+  int ret;
+
+  if (policy.cpu_mask) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    for (int cpu = 0; cpu < 64 && cpu < CPU_SETSIZE; ++cpu)
+      if (policy.cpu_mask & (1ULL << cpu))
+        CPU_SET(cpu, &cpus);
+    if (sched_setaffinity(0, sizeof(cpus), &cpus))
+      ALOGW("Failed to set affinity %" PRIx64 " for %s %d", policy.cpu_mask,
+            name_.c_str(), -errno);
+  }
+
+  SchedAttr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.sched_flags = SCHED_FLAG_RESET_ON_FORK;
+  switch (policy.type) {
+    case SchedPolicy::Type::kFifo:
+      attr.sched_policy = SCHED_FIFO;
+      attr.sched_priority = policy.fifo_priority;
+      break;
+    case SchedPolicy::Type::kDeadline:
+      attr.sched_policy = SCHED_DEADLINE;
+      attr.sched_runtime = policy.runtime_ns;
+      attr.sched_deadline = policy.deadline_ns;
+      attr.sched_period = policy.period_ns;
+      break;
+    case SchedPolicy::Type::kDefault:
+      attr.sched_flags |= SCHED_FLAG_KEEP_POLICY | SCHED_FLAG_KEEP_PARAMS;
+      break;
+  }
+  if (policy.uclamp_min >= 0) {
+    attr.sched_flags |= SCHED_FLAG_UTIL_CLAMP_MIN | SCHED_FLAG_UTIL_CLAMP_MAX;
+    attr.sched_util_min = policy.uclamp_min;
+    attr.sched_util_max = policy.uclamp_max;
+  }
+
+  if (policy.type == SchedPolicy::Type::kDefault && policy.uclamp_min < 0)
+    return;
+
+  ret = SchedSetAttr(&attr);
+  if (ret)
+    ALOGW("Failed to set scheduling policy for %s %d", name_.c_str(), ret);
+}
+
 void Worker::InternalRoutine() {
   setpriority(PRIO_PROCESS, 0, priority_);
   prctl(PR_SET_NAME, name_.c_str());
+  ApplySchedPolicy();
 
   std::unique_lock<std::mutex> lk(mutex_, std::defer_lock);
 
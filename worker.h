@@ -27,6 +27,36 @@
 
 namespace android {
 
+// Scheduling hints applied to a worker thread when it starts. Anything left
+// at its default is not touched.
+struct SchedPolicy {
+  enum class Type {
+    kDefault,
+    kFifo,
+    kDeadline,
+  };
+
+  Type type = Type::kDefault;
+  // SCHED_FIFO
+  int fifo_priority = 0;
+  // SCHED_DEADLINE
+  uint64_t runtime_ns = 0;
+  uint64_t deadline_ns = 0;
+  uint64_t period_ns = 0;
+  // Bit n allows cpu n, 0 keeps the inherited affinity
+  uint64_t cpu_mask = 0;
+  // Utilization clamps in [0, 1024], -1 to leave unset
+  int uclamp_min = -1;
+  int uclamp_max = -1;
+};
+
+/*
+ * Parses a comma separated policy such as "fifo:2,cpus:f0,uclamp:512-1024" or
+ * "deadline:2000/8000/16666" (runtime/deadline/period in microseconds).
+ * Returns -EINVAL if the spec is malformed.
+ */
+int ParseSchedPolicy(const char *spec, SchedPolicy *policy);
+
 class Worker {
  public:
   void Lock() {
@@ -36,7 +66,7 @@ class Worker {
     mutex_.unlock();
   }
 
-  void Signal() {
+  virtual void Signal() {
     cond_.notify_all();
   }
   void Exit();
@@ -45,6 +75,13 @@ class Worker {
     return initialized_;
   }
 
+  // Takes effect the next time the thread is started. Overrides the policy
+  // read from the hwc.drm.sched.<name> property.
+  void set_sched_policy(const SchedPolicy &policy) {
+    sched_policy_ = policy;
+    sched_policy_set_ = true;
+  }
+
  protected:
   Worker(const char *name, int priority);
   virtual ~Worker();
@@ -69,9 +106,12 @@ class Worker {
 
  private:
   void InternalRoutine();
+  void ApplySchedPolicy();
 
   std::string name_;
   int priority_;
+  SchedPolicy sched_policy_;
+  bool sched_policy_set_ = false;
 
   std::unique_ptr<std::thread> thread_;
   bool exit_;